@@ -0,0 +1,15 @@
+//
+//  GSFEasing.h
+//  Headset Sensors
+//
+//  Created by Mick Bennett on 10/17/26.
+//  Copyright (c) 2026 Mick. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <RBBTweenAnimation.h>                       // RBBEasingFunction
+
+// Same curve as RBBCubicBezier used to give, solved by cubic_bezier from a sample
+// table instead of bisecting every value. Linear when the control points are on
+// the diagonal. RBBCubicBezier itself calls this, see Patches/RBBCubicBezier.patch
+extern RBBEasingFunction GSFCubicBezier(CGFloat x1, CGFloat y1, CGFloat x2, CGFloat y2);
@@ -0,0 +1,22 @@
+//
+//  GSFEasing.m
+//  Headset Sensors
+//
+//  Created by Mick Bennett on 10/17/26.
+//  Copyright (c) 2026 Mick. All rights reserved.
+//
+
+#import "GSFEasing.h"
+#import "cubic_bezier.h"
+
+RBBEasingFunction GSFCubicBezier(CGFloat x1, CGFloat y1, CGFloat x2, CGFloat y2) {
+    if (x1 == y1 && x2 == y2) return RBBEasingFunctionLinear;
+    
+    // The block keeps its own copy of the table
+    CubicBezier curve;
+    cubic_bezier_init(&curve, x1, y1, x2, y2);
+    
+    return ^(CGFloat x) {
+        return (CGFloat)cubic_bezier_value(&curve, x);
+    };
+}
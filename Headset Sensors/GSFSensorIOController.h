@@ -39,6 +39,8 @@
 - (void) monitorSensors: (BOOL) enable;     // Starts the power and communication with micro
 - (void) checkAudioStatus;                  // Checks for changes in audio conditions that could disturb collection process.
 - (NSMutableArray*) collectSensorData;      // Returns an array of sensor readings
+- (NSMutableArray*) currentSensorData;      // Same summary as collectSensorData without stopping collection
+- (NSArray*) sensorHistoryFrom: (NSDate *) from to: (NSDate *) to points: (int) maxPoints;  // Stored readings across sessions, for plotting
 
 // Delegate to limit number of sensor packets collected
 @property (nonatomic, weak) id collectionDelegate;
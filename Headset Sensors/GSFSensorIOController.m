@@ -7,74 +7,72 @@
 //
 
 #import "GSFSensorIOController.h"
+#import "sensor_io.h"
+#import "capture_file.h"
+#import "capture_codec.h"
+#import "reading_store.h"
 
-// Comment out to remove DEBUG prints
-//#define DEBUG_AVG         //  Prints average sample reading
-//#define DEBUG_SUM         //  Prints sumation of average sample reading
-#define DEBUG_PACKETS     //  Prints the packets recieved
+// Debug builds only, comment out to remove DEBUG prints
+#ifdef DEBUG
 #define DEBUG_WRITE       //  Creates new file that will contain raw input form mic
 //#define DEBUG_REMOVE      //  Removes last file containing raw input from mic
+#define DEBUG_IO_STATS    //  Logs render callback timing and decode counts after each collection
+#define DEBUG_TRACE       //  Writes what the decoder decides to a binary trace, print it with trace_dump
+#endif
+//#define LINK_TRAINING     //  Negotiates a faster bit rate, needs sensor firmware that follows the rate messages
+//#define SELECTIVE_REPEAT  //  NAKs failed frames of a burst instead of waitACycle, needs firmware that keeps recent bursts
 
 // Code Macros
 #define OUTPUTBUS          0
 #define INPUTBUS           1
 #define SAMPLERATE         44100
 
-#define MAX_BUF                 1000000
-#define HIGH_MIN_AVG            175000
-#define LOW_STATE               0
-#define HIGH_STATE              1
-#define UNKNOWN_STATE           -1
-#define HALF_PERIOD_TC          216     // Tested working for multi bytes/packet
-#define NUM_SAMPLES_PER_PERIOD  8       // Tested working for multi bytes/packet
-#define SAMPLES_PER_CHECK       HALF_PERIOD_TC / NUM_SAMPLES_PER_PERIOD
+#define RAW_INPUT_CAPACITY      (1 << 18)   // ~6 s of mic input between capture drains
+#define CAPTURE_DRAIN_MS        50
+#define CAPTURE_CHUNK           4096
+#define TRACE_CAPACITY          (1 << 14)   // Records between trace drains, ~1 s of half period records
+#define READING_DRAIN_MS        1000        // Well inside the SENSOR_MAX_READINGS the decoder keeps
 
 #define UNSET_STATE         -1
 #define SENSOR_CONNECTED    0
 #define SENSOR_DISCONNECTED 1
 #define APP_CHANGE          2
 
+// RemoteIO backend state handed to the render callback, see sensor_io.h
+typedef struct {
+    AudioUnit ioUnit;
+    SensorIO io;
+    TraceLog trace;
+} SensorIOState;
+
 // Private interface
 @interface GSFSensorIOController () {
     AUGraph auGraph;
     AUNode ioNode;
     AUNode highPassNode;
+    SensorIOState *ioState;
+    CaptureCodecWriter capture;
+    TraceWriter traceWriter;
+    ReadingStore readingStore;      // Only touched on readingQueue
+    BOOL readingStoreOpen;
+    int storedReadings;             // Decoder readings already in readingStore
+    int64_t collectionStartMs;      // Wall clock at the decoder's sample 0
 }
 @property (assign) AudioUnit ioUnit;            // Audio unit handles in IO
 @property AVAudioSession *sensorAudioSession;   // Pointer to sensor required audio session
 @property double sampleRate;                    // Sample rate
 @property double bufferDuration;
-@property double sinPhase;                      // Latest point of sine wave for power tone
 @property int routeStatus;
 
-@property NSMutableArray *inputDataDecoded;     // Decoded input
-@property NSMutableArray *sensorData;           // Final sensor data
-@property NSMutableArray *rawInputData;         // Raw input data for DEBUG printing
-@property NSMutableArray *temperatureReadings;      // All temperature readings
-@property NSMutableArray *humidityReadings;         // All humidity readings
-@property BOOL reqNewData;                      // Flag for new communication to micro
 @property BOOL audioSetup;
-@property BOOL waitACycle;
-
-@property BOOL startEdge;                       // First rise of input signal signifies start edge
-@property BOOL firstHalfPeriod;                 // First half period for start edge
-@property int curState;                         // Current input state value (HIGH or LOW)
-@property int lastState;                        // Last input state to compare with current state
-@property int lastSampleEdge;
-@property int curWindowState;
-@property int lastWindowState;
-@property int secondLastWindowState;
-@property int doubleState;                      // Marks last double state (HIGH-HIGH or LOW-LOW)
-@property int halfPeriodCount;                  // Count for half of the expected input period
-@property int halfPeriodSum;
-@property int bit_num;
-@property int checkSum;
-@property int crc_index;
-@property int first_sample;
 
-@property UIView *associatedView;               // *** View for ONE view alert system ***
+@property (strong) dispatch_queue_t captureQueue;   // Drains rawInput off the audio thread
+@property (strong) dispatch_source_t captureTimer;
 
-- (void) processIO: (AudioBufferList*) bufferList;
+@property (strong) dispatch_queue_t readingQueue;   // Moves decoded readings into the history store
+@property (strong) dispatch_source_t readingTimer;
+
+@property UIView *associatedView;               // *** View for ONE view alert system ***
 
 @end
 
@@ -84,58 +82,32 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
                                    UInt32 						inBusNumber,
                                    UInt32 						inNumberFrames,
                                    AudioBufferList              *ioData) {
-    // Scope reference to GSFSensorIOController class
-    GSFSensorIOController *sensorIO = (__bridge GSFSensorIOController *) inRefCon;
+    // Render thread state owned by the GSFSensorIOController
+    SensorIOState *state = (SensorIOState *) inRefCon;
+    uint64_t startNs = io_stats_now_ns();
+    IoStatsCycle cycle = { .frames = inNumberFrames };
     
     // Grab the samples and place them in the buffer list
-    AudioUnit ioUnit = sensorIO.ioUnit;
-    
-    OSStatus result = AudioUnitRender(ioUnit,
+    OSStatus result = AudioUnitRender(state->ioUnit,
                                       ioActionFlags,
                                       inTimeStamp,
                                       INPUTBUS,
                                       inNumberFrames,
                                       ioData);
     
+    // Decode the mic line and put the tones in its place. Stream format is
+    // interleaved so everything is in the first buffer
+    AudioBuffer sourceBuffer = ioData->mBuffers[0];
+    UInt32 channels = sourceBuffer.mNumberChannels ? sourceBuffer.mNumberChannels : 1;
+    UInt32 numFrames = sourceBuffer.mDataByteSize / (channels * sizeof(SInt16));
+    sensor_io_render(&state->io, (SInt16 *) sourceBuffer.mData, numFrames, channels, &cycle);
     
-    // Process input data
-    [sensorIO processIO:ioData];
-    
-    // Set up power tone attributes
-    float freq = 20000.00f;
-    float sampleRate = sensorIO.sampleRate;
-    float phase = sensorIO.sinPhase;
-    float sinSignal;
-    
-    double phaseInc = 2 * M_PI * freq / sampleRate;
-    
-    // Write to output buffers
-    for(size_t i = 0; i < ioData->mNumberBuffers; ++i) {
-        AudioBuffer buffer = ioData->mBuffers[i];
-        for(size_t sampleIdx = 0; sampleIdx < inNumberFrames; ++sampleIdx) {
-            // Grab sample buffer
-            SInt16 *sampleBuffer = buffer.mData;
-            
-            // Generate power tone on left channel
-            sinSignal = sin(phase);
-            //sampleBuffer[2 * sampleIdx] = (SInt16)((sinSignal * 60534.0f) /2);
-            sampleBuffer[2 * sampleIdx] = 0;
-            
-            // Write to commands to Atmel on right channel as necessary
-            if(sensorIO.reqNewData)
-                sampleBuffer[2*sampleIdx + 1] = (SInt16)((sinSignal * 32767.0f) /2);     // (SInt16)((sinSignal * 32767.0f) /2);
-            else
-                sampleBuffer[2*sampleIdx + 1] = 0;
-            
-            phase += phaseInc;
-            if (phase >= 2 * M_PI * freq) {
-                phase -= (2 * M_PI * freq);
-            }
-        }
+    // Anything else AudioUnitRender filled would play the mic back out
+    for (UInt32 i = 1; i < ioData->mNumberBuffers; ++i) {
+        memset(ioData->mBuffers[i].mData, 0, ioData->mBuffers[i].mDataByteSize);
     }
     
-    // Store sine wave phase for next callback
-    sensorIO.sinPhase = phase;
+    io_stats_record(&state->io.stats, startNs, io_stats_now_ns(), &cycle);
     
     return result;
 }
@@ -158,6 +130,26 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
         return nil;
     }
     
+    // Render thread state is allocated once, the callback only ever sees this pointer
+    ioState = calloc(1, sizeof(SensorIOState));
+#ifdef DEBUG_WRITE
+    uint32_t rawInputCapacity = RAW_INPUT_CAPACITY;
+#else
+    uint32_t rawInputCapacity = 0;
+#endif
+    if (ioState == NULL || !sensor_io_init(&ioState->io, rawInputCapacity)) {
+        NSLog(@"ERROR init: GSFSensorIOController failed to allocate IO state");
+        free(ioState);
+        ioState = NULL;
+        return nil;
+    }
+#ifdef DEBUG_TRACE
+    if (trace_log_init(&ioState->trace, TRACE_CAPACITY, TRACE_DEFAULT_MASK))
+        ioState->io.trace = &ioState->trace;
+    else
+        NSLog(@"WARNING init: GSFSensorIOController couldn't allocate the trace, tracing is off");
+#endif
+    
     // Set up AVAudioSession
     self.sensorAudioSession = [AVAudioSession sharedInstance];
     BOOL success;
@@ -182,10 +174,17 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
     
     // Grab actual sample rate and buffer duration
     self.sampleRate = [self.sensorAudioSession sampleRate];
-    if(self.sampleRate != 44100.00) NSLog(@"WARNING init: Actual sample rate is: %f", self.sampleRate);
+    if(self.sampleRate != SAMPLERATE) NSLog(@"WARNING init: Actual sample rate is: %f, the mic line is resampled to %d", self.sampleRate, MAN_LINE_SAMPLE_RATE);
     self.bufferDuration = [self.sensorAudioSession IOBufferDuration];
     if(self.bufferDuration != 0.005) NSLog(@"WARNING init: Actual buffer duration is: %f", self.bufferDuration);
     
+    // Reading history carries over from earlier sessions
+    self.readingQueue = dispatch_queue_create("GSFSensorIOController.readings", DISPATCH_QUEUE_SERIAL);
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+    NSString *storePath = [NSString stringWithFormat:@"%@/HeadsetSensor_readings%s", [paths objectAtIndex:0], READING_STORE_EXTENSION];
+    readingStoreOpen = reading_store_open(&readingStore, [storePath UTF8String]);
+    if (!readingStoreOpen) NSLog(@"ERROR init: Couldn't open reading history %@", storePath);
+    
     // Add pointer to associated UIView controlerr for alerts
     self.associatedView = view;
     
@@ -216,6 +215,32 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
 }
 
 
+/**
+ *  Stops the audio graph before releasing the render thread state it points at.
+ */
+- (void) dealloc {
+    if (auGraph) {
+        AUGraphStop(auGraph);
+        AUGraphUninitialize(auGraph);
+    }
+#ifdef DEBUG_WRITE
+    [self stopCapture];
+#endif
+#ifdef DEBUG_TRACE
+    [self stopTrace];
+#endif
+    [self stopStoringReadings];
+    if (readingStoreOpen && !reading_store_close(&readingStore))
+        NSLog(@"ERROR dealloc: Couldn't finish reading history");
+    
+    if (ioState) {
+        sensor_io_free(&ioState->io);
+        trace_log_free(&ioState->trace);
+        free(ioState);
+    }
+}
+
+
 /**
  *  Auto adjuct iOS devices master volume when the sensor is attached.
  *
@@ -227,38 +252,29 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
 
 
 - (void) setUpSensorIO {
-    // Initialize input data buffer/states
-    self.reqNewData = true;
-    self.startEdge = false;
-    self.firstHalfPeriod = false;
-    self.doubleState = LOW_STATE;
-    self.curState = LOW_STATE;
-    self.lastState = UNKNOWN_STATE;
-    self.lastSampleEdge = 0;
-    self.curWindowState = UNKNOWN_STATE;
-    self.lastWindowState = UNKNOWN_STATE;
-    self.secondLastWindowState = UNKNOWN_STATE;
-    self.halfPeriodCount = 0;
-    self.halfPeriodSum = 0;
-    self.bit_num = 0;
-    self.checkSum = 0;
-    self.crc_index = 0;
-    self.first_sample = 0;
-    self.waitACycle = false;
-    
-    
-    // Free array's
-    self.sensorData = nil;
-    self.temperatureReadings = nil;
-    self.humidityReadings = nil;
-    self.inputDataDecoded = nil;
-    self.rawInputData = nil;
-    
-    self.sensorData = [[NSMutableArray alloc] init];
-    self.temperatureReadings = [[NSMutableArray alloc] init];
-    self.humidityReadings = [[NSMutableArray alloc] init];
-    self.inputDataDecoded = [[NSMutableArray alloc] init];
-    self.rawInputData = [[NSMutableArray alloc] init];
+    // Initialize input data buffer/states. The graph is stopped so nothing else touches ioState
+#ifdef LINK_TRAINING
+    ioState->io.linkTraining = true;
+#endif
+#ifdef SELECTIVE_REPEAT
+    ioState->io.selectiveRepeat = true;
+#endif
+    // The route may have changed the hardware rate, the stream runs at whatever it is now
+    self.sampleRate = [self.sensorAudioSession sampleRate];
+    [self stopStoringReadings];
+    sensor_io_reset(&ioState->io, self.sampleRate);
+    [self startStoringReadings];
+    
+#ifdef DEBUG_WRITE
+    [self stopCapture];
+    sample_ring_reset(&ioState->io.rawInput);
+    [self startCapture];
+#endif
+#ifdef DEBUG_TRACE
+    [self stopTrace];
+    trace_log_reset(&ioState->trace);
+    [self startTrace];
+#endif
     
     // RemoteIO component description
     AudioComponentDescription ioUnitdesc;
@@ -272,7 +288,7 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
     // Stereo ASBD
     AudioStreamBasicDescription stereoStreamFormat;
     bzero(&stereoStreamFormat, sizeof(AudioStreamBasicDescription));
-    stereoStreamFormat.mSampleRate          = SAMPLERATE;
+    stereoStreamFormat.mSampleRate          = self.sampleRate;
     stereoStreamFormat.mFormatID            = kAudioFormatLinearPCM;
     stereoStreamFormat.mFormatFlags         = kAudioFormatFlagsCanonical;
     stereoStreamFormat.mBytesPerPacket      = 4;
@@ -309,6 +325,7 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
                               NULL,
                               &_ioUnit);
         NSAssert1(err == noErr, @"ERROR setUpSensorIO: failed to add node info: %hd", err);
+        ioState->ioUnit = _ioUnit;
         
         // Enable input, which is disabled by default.
         UInt32 enabled = 1;
@@ -341,7 +358,7 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
         // Set hardware IO callback
         AURenderCallbackStruct callbackStruct;
         callbackStruct.inputProc = hardwareIOCallback;
-        callbackStruct.inputProcRefCon = (__bridge void *)(self);
+        callbackStruct.inputProcRefCon = ioState;
         err = AUGraphSetNodeInputCallback(auGraph,
                                           ioNode,
                                           OUTPUTBUS,
@@ -652,280 +669,258 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
 
 
 /**
- *  Process Input readinga and fills right channel output buffer with any response
- *
- *  @param bufferList sensorIO is list of buffers containing the input from the mic line
+ *  Delegate message to end collection process
+ */
+- (void) collectionCompleteDelegate {
+    [self.collectionDelegate endCollection:self];
+}
+
+#ifdef DEBUG_WRITE
+/**
+ *  Opens the raw input capture file and starts draining rawInput into it off the audio thread.
+ *  Blocks are compressed as they fill, on the capture queue.
  */
-- (void) processIO: (AudioBufferList*) bufferList {
+- (void) startCapture {
+    // Grabs Document directory path and file name
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+    NSString *path = [NSString stringWithFormat:@"%@/HeadsetSensor_in_25Hz_15kHzOne_SensorReading_ObjC_RT_44kSR_i5s%s", [paths objectAtIndex:0], CAPTURE_CODEC_EXTENSION];
+    
+    // Only the mic channel goes into rawInput
+    UIDevice *device = [UIDevice currentDevice];
+    NSString *deviceInfo = [NSString stringWithFormat:@"%@ iOS %@", [device model], [device systemVersion]];
+    CaptureHeader header;
+    capture_header_init(&header, (uint32_t)ioState->io.sampleRate, 1, [deviceInfo UTF8String]);
+    
+    // Open new file
+    if (!capture_codec_writer_open(&capture, [path UTF8String], &header)) {
+        NSLog(@"ERROR startCapture: Couldn't open file %@", path);
+        return;
+    }
     
-    if (self.waitACycle) {
-        self.waitACycle = false;
-        self.reqNewData = true;
-    } else {
-        // Realtime decode
-        int j = 0;
-        int last_sample = 0;
-        
-        for (int j = 0 ; j < bufferList->mNumberBuffers ; j++) {
-            AudioBuffer sourceBuffer = bufferList->mBuffers[j];
-            SInt16 *buffer = (SInt16 *) bufferList->mBuffers[j].mData;
-            
-            for (int i = 0; i < (sourceBuffer.mDataByteSize / sizeof(sourceBuffer)); i++) {
-                // Array of raw data points for debug
-                [self.rawInputData addObject:[NSNumber numberWithInt:buffer[i]]];
-            }
+    if (!self.captureQueue)
+        self.captureQueue = dispatch_queue_create("GSFSensorIOController.capture", DISPATCH_QUEUE_SERIAL);
+    
+    // Periodically move samples from the ring to the file
+    __weak __typeof(self)weakSelf = self;
+    self.captureTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.captureQueue);
+    dispatch_source_set_timer(self.captureTimer,
+                              dispatch_time(DISPATCH_TIME_NOW, CAPTURE_DRAIN_MS * NSEC_PER_MSEC),
+                              CAPTURE_DRAIN_MS * NSEC_PER_MSEC,
+                              CAPTURE_DRAIN_MS * NSEC_PER_MSEC / 10);
+    dispatch_source_set_event_handler(self.captureTimer, ^{
+        [weakSelf drainCapture];
+    });
+    dispatch_resume(self.captureTimer);
+}
+
+
+/**
+ *  Writes every sample waiting in rawInput to the capture file. Only runs on captureQueue.
+ */
+- (void) drainCapture {
+    int16_t chunk[CAPTURE_CHUNK];
+    uint32_t n;
+    
+    if (capture.file == NULL) return;
+    
+    while ((n = sample_ring_read(&ioState->io.rawInput, chunk, CAPTURE_CHUNK)) > 0) {
+        capture_codec_writer_write(&capture, chunk, n);
+    }
+}
+
+
+/**
+ *  Stops the capture timer, writes the remaining samples and closes the capture file.
+ */
+- (void) stopCapture {
+    if (!self.captureTimer) return;
+    
+    dispatch_source_cancel(self.captureTimer);
+    self.captureTimer = nil;
+    
+    // Serialized behind any drain that is already running
+    dispatch_sync(self.captureQueue, ^{
+        [self drainCapture];
+        if (capture.file != NULL && !capture_codec_writer_close(&capture))
+            NSLog(@"ERROR stopCapture: Couldn't finish capture file");
+    });
+    
+    if (ioState->io.rawInput.dropped)
+        NSLog(@"WARNING stopCapture: %u samples dropped from capture", ioState->io.rawInput.dropped);
+}
+#endif
+
+#ifdef DEBUG_TRACE
+/**
+ *  Opens the trace file, its writer thread drains the ring into it until stopTrace.
+ */
+- (void) startTrace {
+    if (ioState->io.trace == NULL) return;
+    
+    NSArray *paths = NSSearchPathForDirectoriesInDomains(NSDocumentDirectory, NSUserDomainMask, YES);
+    NSString *path = [NSString stringWithFormat:@"%@/HeadsetSensor_trace%s", [paths objectAtIndex:0], TRACE_EXTENSION];
+    
+    // Records count decoder samples
+    if (!trace_writer_start(&traceWriter, ioState->io.trace, [path UTF8String], MAN_LINE_SAMPLE_RATE))
+        NSLog(@"ERROR startTrace: Couldn't open file %@", path);
+}
+
+
+/**
+ *  Writes the remaining records and closes the trace file.
+ */
+- (void) stopTrace {
+    if (traceWriter.file == NULL) return;
+    
+    if (!trace_writer_stop(&traceWriter))
+        NSLog(@"ERROR stopTrace: Couldn't finish trace file");
+    if (traceWriter.header.dropped)
+        NSLog(@"WARNING stopTrace: %u records dropped from trace", traceWriter.header.dropped);
+}
+#endif
+
+
+/**
+ *  Starts moving the decoder's readings into the history store, timed from now.
+ *  Call with the decoder just reset.
+ */
+- (void) startStoringReadings {
+    if (!readingStoreOpen) return;
+    
+    dispatch_sync(self.readingQueue, ^{
+        storedReadings = 0;
+        collectionStartMs = (int64_t)([[NSDate date] timeIntervalSince1970] * 1000);
+    });
+    
+    __weak __typeof(self)weakSelf = self;
+    self.readingTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.readingQueue);
+    dispatch_source_set_timer(self.readingTimer,
+                              dispatch_time(DISPATCH_TIME_NOW, READING_DRAIN_MS * NSEC_PER_MSEC),
+                              READING_DRAIN_MS * NSEC_PER_MSEC,
+                              READING_DRAIN_MS * NSEC_PER_MSEC / 10);
+    dispatch_source_set_event_handler(self.readingTimer, ^{
+        [weakSelf drainReadings];
+    });
+    dispatch_resume(self.readingTimer);
+}
+
+
+/**
+ *  Adds the readings decoded since the last drain to the store, stamped by
+ *  the decoder sample they were decoded at. Only runs on readingQueue. The
+ *  render thread keeps decoding meanwhile, so each reading is copied out
+ *  with sensor_decoder_copy_reading, which tells when the render thread
+ *  has come round the ring and reused the slot.
+ */
+- (void) drainReadings {
+    const SensorDecoder *dec = &ioState->io.decoder;
+    int count = sensor_decoder_reading_count(dec);
+    int overwritten = 0;
+    
+    if (count - storedReadings > SENSOR_MAX_READINGS) {
+        overwritten = count - storedReadings - SENSOR_MAX_READINGS;
+        storedReadings = count - SENSOR_MAX_READINGS;
+    }
+    for (; storedReadings < count; storedReadings++) {
+        SensorReading reading;
+        if (!sensor_decoder_copy_reading(dec, storedReadings, &reading)) {
+            overwritten++;
+            continue;
         }
+        int64_t timeMs = collectionStartMs + reading.sample * 1000 / MAN_LINE_SAMPLE_RATE;
         
-        last_sample = (int)[self.rawInputData count];
-        
-        for (int i = self.first_sample; i < last_sample; i += SAMPLES_PER_CHECK) {
-            int avgSampleNext = 0;
-            int nextSamples = 0;
-            
-            // Find average value for the prev and next set of point around the expected edge
-            for (j = 0; j < SAMPLES_PER_CHECK && i+j < last_sample && i+j > 0; j++) {
-                nextSamples += abs((int)self.rawInputData[i+j]);
-            }
-            avgSampleNext = nextSamples / j;
-            
-            // Associate current bit value based on min/max values and check if it's the start bit
-            if ( avgSampleNext >= HIGH_MIN_AVG ) {
-                self.curState = HIGH_STATE;
-                // Only enters this statement for the rising edge of the start signal
-                if (!self.startEdge) {
-                    
-    #ifdef DEBUG_AVG
-                    printf("    !!!!! Start between samples %d to %d\n\n\n",i ,i+j);
-    #endif
-                    
-                    self.startEdge = true;
-                    self.firstHalfPeriod = true;
-                    self.halfPeriodCount = SAMPLES_PER_CHECK;
-                    self.halfPeriodSum = 0;
-                    self.doubleState = LOW_STATE;
-                }
-            } else {
-                self.curState = LOW_STATE;
-            }
-            
-            self.halfPeriodSum += avgSampleNext;
-            
-            
-    #ifdef DEBUG_AVG
-            printf("Avg for samples %d to %d: %d\n",i ,i+j , avgSampleNext);
-    #endif
-            
-            // When start flag is set check for data
-            if (self.startEdge) {
-                // Grab edge
-                if (self.curState != self.lastState) {
-                    self.lastState = self.curState;
-                    self.lastSampleEdge = i;
-                }
-                
-                // Increment and check if half period is finished
-                self.halfPeriodCount += j;
-                if (self.halfPeriodCount >= HALF_PERIOD_TC) {
-                    // Assign window state and adjust off set from last edge
-                    if ((self.halfPeriodSum / NUM_SAMPLES_PER_PERIOD) > HIGH_MIN_AVG) {
-                        self.curWindowState = HIGH_STATE;
-                    } else {
-                        self.curWindowState = LOW_STATE;
-                    }
-                    
-    #ifdef DEBUG_AVG
-                    printf("Half Period Start- curState: %d doubleState: %d curWindowState:%d lastWindowState:%d secondLastWindowState:%d\n", self.curState, self.doubleState, self.curWindowState, self.lastWindowState, self.secondLastWindowState);
-    #endif
-                    
-                    if (self.curWindowState != self.curState){
-    #ifdef DEBUG_AVG
-                        printf("Last sample starting point: %d\n", i);
-    #endif
-                        
-                        i = self.lastSampleEdge - SAMPLES_PER_CHECK;
-                        
-    #ifdef DEBUG_AVG
-                        printf("Next sample starting point: %d\n", i);
-    #endif
-                    }
-                    
-    #ifdef DEBUG_SUM
-                    printf("Half period sum: %d\n", self.halfPeriodSum);
-                    printf("Number of samples per period: %d\n", NUM_SAMPLES_PER_PERIOD);
-                    printf("Half period Average: %d && Cutoff: %d\n", (self.halfPeriodSum / NUM_SAMPLES_PER_PERIOD), HIGH_MIN_AVG);
-                    printf("Half period State: %d\n", (self.halfPeriodSum / NUM_SAMPLES_PER_PERIOD) > HIGH_MIN_AVG);
-                    printf("Half Period Count: %d\n", self.halfPeriodCount);
-    #endif
-                    
-                    // Reset half period count and sumation
-                    self.halfPeriodSum = 0;
-                    self.halfPeriodCount = 0;
-                    
-                    // Check if this is the first pass after the start edge
-                    if (self.firstHalfPeriod) {
-                        //if (curState == HIGH_STATE) doubleState = HIGH_STATE;
-                        self.firstHalfPeriod = false;
-                        
-    #ifdef DEBUG_AVG
-                        printf("    First Half Period- doubleState:%d curWindowState:%d lastWindowState:%d secondLastWindowState:%d\n", self.doubleState, self.curState, self.lastWindowState, self.secondLastWindowState);
-    #endif
-                        
-                    }
-                    // Check for bit flip
-                    else if (self.curWindowState != self.lastWindowState &&
-                             self.doubleState != self.curWindowState) {
-                        
-    #ifdef DEBUG_AVG
-                        printf("            ***** %d detected between samples %d to %d\n", self.curWindowState, i, i+j);
-    #endif
-                        
-                        [self.inputDataDecoded addObject:[NSNumber numberWithInt:self.curWindowState]];
-                        self.bit_num++;
-                    }
-                    // Check for non bit flip
-                    else if (self.curWindowState == self.lastWindowState &&
-                             self.lastWindowState != self.secondLastWindowState) {
-                        self.doubleState = self.curWindowState;
-                        
-    #ifdef DEBUG_AVG
-                        printf("    NonFlip- doubleState: %d curWindowState:%d lastWindowState:%d secondLastWindowState:%d\n", self.doubleState, self.curWindowState, self.lastWindowState, self.secondLastWindowState);
-    #endif
-                        
-                    }
-                    // Reset input stream last three states are equivalent
-                    else if (self.curWindowState == self.lastWindowState &&
-                             self.lastWindowState == self.secondLastWindowState) {
-                        self.startEdge = false;
-                        
-    #ifdef DEBUG_AVG
-                        printf("    !!!!! End of transmission detected between samples %d to %d\n", i, i+j);
-                        printf("    !!!!! curWindowState:%d lastWindowState:%d secondLastWindowState:%d\n", self.curWindowState, self.lastWindowState, self.secondLastWindowState);
-                        printf("\n\n");
-    #endif
-                        
-                        // Convert resulting "bits" to bytes. data is Little Endian
-    #ifdef DEBUG_PACKETS
-                        printf("\nDecoded Bytes:\n");
-    #endif
-                        int byte_val = 0;
-                        int power = 7;
-                        int check_it = 0;
-                        
-                        for (int byte_itor = self.bit_num-1; byte_itor >= 0; byte_itor--) {
-                            NSNumber *cur_bit = self.inputDataDecoded[byte_itor];
-                            byte_val += (int)pow(2,power) * cur_bit.intValue;
-                            if (check_it)
-                                self.checkSum += cur_bit.intValue;
-                            power--;
-                            if (power < 0) {
-                                if (byte_itor == self.bit_num - 8) {
-    #ifdef DEBUG_PACKETS
-                                    printf("Recieved Check Sum: ");
-    #endif
-                                    check_it = 1;
-                                }
-    #ifdef DEBUG_PACKETS
-                                printf("0x%x\n",byte_val);
-    #endif
-                                [self.sensorData addObject:[NSNumber numberWithInt:byte_val]];
-                                power = 7;
-                                byte_val = 0;
-                            }
-                        }
-    #ifdef DEBUG_PACKETS
-                        printf("Actual Check Sum: 0x%x\n\n", self.checkSum);
-                        printf("    Little Endian Binary Input:\n");
-                        for(int bit_itor = 0; bit_itor < self.bit_num; bit_itor++) {
-                            NSNumber *cur_bit = self.inputDataDecoded[bit_itor];
-                            printf("%d", cur_bit.intValue);
-                            if (bit_itor%8 == 7) printf(" ");
-                        }
-                        printf("\n");
-    #endif
-                        
-                        // Clear binary input array
-                        [self.inputDataDecoded removeAllObjects];
-                        
-                        // Verify checksum
-                        NSNumber *calc_check_sum = self.sensorData[self.crc_index];
-                        if (calc_check_sum.intValue != self.checkSum) {
-#ifdef DEBUG_PACKETS
-                            printf("Bad CRC - Discarding Packet\n");
-#endif
-                            self.reqNewData = false;
-                            self.waitACycle = true;
-                            self.bit_num = 0;
-                            self.checkSum = 0;
-                            
-                            for (int k = (int)[self.sensorData count]; k != self.crc_index; k--) {
-                                [self.sensorData removeLastObject];
-                            }
-                        } else {
-                            // Convert chipcap bytes into sensor reading values
-                            int chipcapData[4];
-                            int rawHumidData[2];
-                            int rawTempData[2];
-                            float humidData = 0.0;
-                            float tempData = 0.0;
-                            
-                            for (int k = self.crc_index+1, i = 0; k < self.crc_index+5; k++, i++) {
-                                NSNumber *cur_byte = self.sensorData[k];
-                                chipcapData[i] = cur_byte.intValue;
-                            }
-                            
-                            // Get raw data from chipcapData array
-                            rawHumidData[0] = chipcapData[0];
-                            rawHumidData[1] = chipcapData[1];
-                            
-                            rawTempData[0] = chipcapData[2];
-                            rawTempData[1] = chipcapData[3];
-                            
-                            // Conversion equations from ChipCap2 data sheet
-                            humidData = (((rawHumidData[0] >> 2)*256 + rawHumidData[1])/pow(2,14)) * 100;
-                            tempData = ((rawTempData[0]*64 + (rawTempData[1] >> 2))/pow(2,14)) * 165 - 40;
-                            
-                            // Add the converted data to reading arrays
-                            [self.humidityReadings addObject:[NSNumber numberWithFloat:humidData]];
-                            [self.temperatureReadings addObject:[NSNumber numberWithFloat:tempData]];
-                            
-                            self.crc_index += 5;
-                            self.bit_num = 0;
-                            self.checkSum = 0;
-                        }
-                    }
-                    
-                    // Push state down the line
-                    self.secondLastWindowState = self.lastWindowState;
-                    self.lastWindowState = self.curWindowState;
-                    
-    #ifdef DEBUG_AVG
-                    printf("Half Period count: %d\n",self.halfPeriodCount);
-                    printf("Half Period sum: %d\n", self.halfPeriodSum);
-                    printf("Half Period End- doubleState: %d curWindowState:%d lastWindowState:%d secondLastWindowState:%d\n\n\n", self.doubleState, self.curWindowState, self.lastWindowState, self.secondLastWindowState);
-    #endif
-                }
-                // When four packets have been successfully collected stop collecting
-                /*if (self.crc_index == 20) {
-                    [self collectionCompleteDelegate];
-                }*/
-            }
+        if (!reading_store_add(&readingStore, timeMs, reading.humidity, reading.temperature)) {
+            NSLog(@"ERROR drainReadings: Couldn't append to reading history");
+            break;
         }
-        self.first_sample = last_sample;
     }
+    if (overwritten > 0) NSLog(@"WARNING drainReadings: %d readings overwritten before they were stored", overwritten);
+    reading_store_flush(&readingStore);
 }
 
 
 /**
- *  Delegate message to end collection process
+ *  Stops the drain timer and stores the readings it had not reached yet.
  */
-- (void) collectionCompleteDelegate {
-    [self.collectionDelegate endCollection:self];
+- (void) stopStoringReadings {
+    if (!self.readingTimer) return;
+    
+    dispatch_source_cancel(self.readingTimer);
+    self.readingTimer = nil;
+    
+    // Serialized behind any drain that is already running
+    dispatch_sync(self.readingQueue, ^{
+        [self drainReadings];
+    });
 }
 
+
 /**
- *  Averages sample readings from micro and returns an NSMutableArray of the results.
+ *  Reading history over a time range, at the finest level that gives at most
+ *  maxPoints entries. Safe to call while collecting.
  *
- *  @return An NSMutableArray containing the decoded sensor data.
+ *  @return One NSArray per second, minute or hour the range covers, or per
+ *          reading at the finest level: start time as an NSDate, then the mean,
+ *          min and max humidity and the mean, min and max temperature. Empty
+ *          if the history couldn't be opened.
+ */
+- (NSArray*) sensorHistoryFrom:(NSDate *)from to:(NSDate *)to points:(int)maxPoints {
+    NSMutableArray *history = [[NSMutableArray alloc] init];
+    if (!readingStoreOpen || maxPoints <= 0) return history;
+    
+    ReadingBucket *buckets = malloc(maxPoints * sizeof(ReadingBucket));
+    if (buckets == NULL) return history;
+    
+    int64_t fromMs = (int64_t)([from timeIntervalSince1970] * 1000);
+    int64_t toMs = (int64_t)([to timeIntervalSince1970] * 1000);
+    __block int n = 0;
+    dispatch_sync(self.readingQueue, ^{
+        if (self.readingTimer) [self drainReadings];
+        int level = reading_store_level_for(&readingStore, fromMs, toMs, maxPoints);
+        n = reading_store_query(&readingStore, level, fromMs, toMs, buckets, maxPoints);
+    });
+    
+    for (int i = 0; i < n; i++) {
+        const ReadingBucket *b = &buckets[i];
+        [history addObject:@[[NSDate dateWithTimeIntervalSince1970:b->timeMs / 1000.0],
+                             @(b->sum[READING_HUMIDITY] / 65536.0 / b->count),
+                             @(b->min[READING_HUMIDITY] / 65536.0), @(b->max[READING_HUMIDITY] / 65536.0),
+                             @(b->sum[READING_TEMPERATURE] / 65536.0 / b->count),
+                             @(b->min[READING_TEMPERATURE] / 65536.0), @(b->max[READING_TEMPERATURE] / 65536.0)]];
+    }
+    free(buckets);
+    return history;
+}
+
+
+/**
+ *  Logs a snapshot of the render callback stats. Safe while the graph is running.
+ */
+- (void) logIOStats {
+    IoStatsCounters stats;
+    io_stats_snapshot(&ioState->io.stats, &stats);
+    
+    if (stats.callbacks == 0) return;
+    
+    NSLog(@"IO stats: %llu callbacks, %.1f us mean, p50 %.1f us, p99 %.1f us, max %.1f us",
+          stats.callbacks, stats.durationSumNs / 1e3 / stats.callbacks,
+          io_stats_percentile_ns(&stats, 50) / 1e3, io_stats_percentile_ns(&stats, 99) / 1e3,
+          stats.durationMaxNs / 1e3);
+    NSLog(@"IO stats: %llu deadline misses, %llu overruns, %llu samples, %llu bits, %llu packets, %llu corrected, %llu bad CRC, %llu retries, %llu NAKs",
+          stats.deadlineMisses, stats.overruns, stats.samples, stats.bits, stats.packets, stats.corrected, stats.badPackets,
+          stats.retries, stats.naks);
+    if (ioState->io.linkTraining) {
+        int rate = __atomic_load_n(&ioState->io.link.rate, __ATOMIC_RELAXED);
+        NSLog(@"IO stats: link at %.0f bps after %u rate changes",
+              link_rate_bits_per_second(rate, self.sampleRate), __atomic_load_n(&ioState->io.link.changes, __ATOMIC_RELAXED));
+    }
+}
+
+
+/**
+ *  Stops collection and returns the summary of the readings from micro.
+ *
+ *  @return An NSMutableArray containing the decoded sensor data, see currentSensorData.
  */
 - (NSMutableArray*) collectSensorData {
     
@@ -947,49 +942,51 @@ static OSStatus hardwareIOCallback(void                         *inRefCon,
     }
 #endif
 #ifdef DEBUG_WRITE
-    // New file to add
-    NSString *path = [NSString stringWithFormat:@"%@/HeadsetSensor_in_25Hz_15kHzOne_SensorReading_ObjC_RT_44kSR_i5s.txt",docs_dir];
-    const char *file = [path UTF8String];
-
-    // Open and write to new file
-    FILE *fp;
-    fp = fopen(file, "w+");
-    if (fp == NULL) {
-        printf("ERROR processIO: Couldn't open file \"inputData.txt\"\n");
-        exit(0);
-    }
-    int buf_indx = 0;
-    for (buf_indx = 0; buf_indx < [self.rawInputData count]; buf_indx++) {
-        fprintf(fp, "%d\n", (int)self.rawInputData[buf_indx]);
-    }
-    fclose(fp);
+    // Write out whatever the capture timer has not drained yet
+    [self stopCapture];
+#endif
+#ifdef DEBUG_TRACE
+    [self stopTrace];
 #endif
     /***************************************************************************
      **** DEBUG: Prints contents of input buffer to file. Doing this in     ****
      ***************************************************************************/
     
-    self.reqNewData = false;
+    ioState->io.reqNewData = false;
     [self monitorSensors: NO];
+    [self stopStoringReadings];
     
-    float humAvg = 0.0;
-    float tempAvg = 0.0;
-    int count = (int)[self.humidityReadings count];
+#ifdef DEBUG_IO_STATS
+    [self logIOStats];
+#endif
     
-    // Get avarage humidity and temperature readings
-    for (int k = 0; k < count; k++){
-        NSNumber *hum = self.humidityReadings[k];
-        humAvg += hum.floatValue;
-        
-        NSNumber *tem = self.temperatureReadings[k];
-        tempAvg += tem.floatValue;
-    }
+    return [self currentSensorData];
+}
+
+/**
+ *  Summary of the readings decoded so far. Safe to call while collecting,
+ *  the render thread keeps adding readings while this copies them.
+ *
+ *  @return Mean humidity and temperature, the number of readings, the
+ *          standard deviation of each, median of each and how many readings
+ *          were rejected as outliers. Empty before the first reading.
+ */
+- (NSMutableArray*) currentSensorData {
+    ReadingStatsCounters stats;
+    reading_stats_snapshot(&ioState->io.decoder.readingStats, &stats);
     
     NSMutableArray *readings = [[NSMutableArray alloc] init];
-    [readings addObject:[NSNumber numberWithFloat:(humAvg/count)]];
-    [readings addObject:[NSNumber numberWithFloat:(tempAvg/count)]];
-    [readings addObject:[NSNumber numberWithInt:count]];
+    if (stats.count == 0) return readings;
+    
+    [readings addObject:[NSNumber numberWithFloat:reading_stats_mean(&stats, READING_HUMIDITY)]];
+    [readings addObject:[NSNumber numberWithFloat:reading_stats_mean(&stats, READING_TEMPERATURE)]];
+    [readings addObject:[NSNumber numberWithInt:(int)stats.count]];
+    [readings addObject:[NSNumber numberWithFloat:sqrt(reading_stats_variance(&stats, READING_HUMIDITY))]];
+    [readings addObject:[NSNumber numberWithFloat:sqrt(reading_stats_variance(&stats, READING_TEMPERATURE))]];
+    [readings addObject:[NSNumber numberWithFloat:reading_stats_quantile(&stats, READING_HUMIDITY, 0.5)]];
+    [readings addObject:[NSNumber numberWithFloat:reading_stats_quantile(&stats, READING_TEMPERATURE, 0.5)]];
+    [readings addObject:[NSNumber numberWithInt:(int)stats.rejected]];
     
-    // Return average of readings 
     return readings;
 }
 
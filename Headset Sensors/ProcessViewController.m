@@ -65,7 +65,7 @@
     
     // Display data
     if ([data count] != 0) {
-        self.decodedDataLabel.text = [NSString stringWithFormat:@"Avg Humidiy: %@ RH\n Avg Temperature: %@ C\n Number of Samples: %@", data[0], data[1], data[2]];
+        self.decodedDataLabel.text = [NSString stringWithFormat:@"Avg Humidiy: %@ RH (sd %@)\n Avg Temperature: %@ C (sd %@)\n Number of Samples: %@ (%@ rejected)", data[0], data[3], data[1], data[4], data[2], data[7]];
     } else {
         self.decodedDataLabel.text = [NSString stringWithFormat:@"No Data"];
     }
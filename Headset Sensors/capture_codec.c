@@ -0,0 +1,771 @@
+/* *********************************************************************
+ * File: capture_codec.c
+ * Author: Michael Bennett
+ * Purpose: Compressed capture writer and block decoder. The coder picks
+ *          the predictor with the smallest sum of absolute residuals, as
+ *          FLAC does, from the fixed ones and LPC fitted by Levinson-
+ *          Durbin, and the partitioning and Rice parameters from an
+ *          estimate of the bits they cost that is never under the real
+ *          count, so a block that would grow is stored verbatim instead.
+ * ********************************************************************/
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture_codec.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #error "capture frames are stored and mapped as little endian int16"
+#endif
+
+typedef struct {
+    uint8_t *bytes;
+    size_t pos;
+    uint64_t acc;
+    int count;                      // Bits in acc not yet written out, under 8 between puts
+} BitWriter;
+
+typedef struct {
+    const uint8_t *bytes;
+    size_t length;
+    size_t pos;                     // Next byte to load, past length once reading the zero padding
+    uint64_t bits;                  // MSB first, everything below the top count bits is 0
+    int count;
+} BitReader;
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static uint32_t block_checksum(const int16_t *samples, size_t numSamples) {
+    uint64_t a = 0, b = 0;
+    size_t i;
+
+    for (i = 0; i < numSamples; i++) {
+        a += (uint16_t)samples[i];
+        b += a;
+    }
+    return (uint32_t)(a % 65535) | (uint32_t)(b % 65535) << 16;
+}
+
+static inline uint32_t zigzag(int32_t r) {
+    return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+    return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+static inline int bit_width(uint32_t v) {
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+static inline void bw_put(BitWriter *bw, uint32_t value, int bits) {
+    if (bits == 0) return;
+    bw->acc = (bw->acc << bits) | (bits == 32 ? value : value & ((1u << bits) - 1));
+    bw->count += bits;
+    while (bw->count >= 8) {
+        bw->count -= 8;
+        bw->bytes[bw->pos++] = (uint8_t)(bw->acc >> bw->count);
+    }
+}
+
+static inline void bw_put_unary(BitWriter *bw, uint32_t q) {
+    for (; q >= 32; q -= 32) bw_put(bw, 0, 32);
+    bw_put(bw, 1, (int)q + 1);
+}
+
+static void bw_flush(BitWriter *bw) {
+    if (bw->count > 0) bw_put(bw, 0, 8 - bw->count);
+}
+
+/**
+ *  Tops bits up to at least 57. Past the end of the payload it loads zeros,
+ *  so a damaged stream is caught by the position check after the block.
+ */
+static inline void br_refill(BitReader *br) {
+    if (br->pos + 8 <= br->length) {
+        uint64_t v;
+        memcpy(&v, br->bytes + br->pos, sizeof(v));
+        v = __builtin_bswap64(v);
+        br->bits |= v >> br->count;
+        br->pos += (63 - br->count) >> 3;
+        br->count |= 56;
+        br->bits &= ~0ull << (64 - br->count);
+        return;
+    }
+    while (br->count <= 56) {
+        uint64_t byte = br->pos < br->length ? br->bytes[br->pos] : 0;
+        br->bits |= byte << (56 - br->count);
+        br->pos++;
+        br->count += 8;
+    }
+}
+
+// bits from 1 to 32
+static inline uint32_t br_get(BitReader *br, int bits) {
+    uint32_t v;
+
+    if (br->count < bits) br_refill(br);
+    v = (uint32_t)(br->bits >> (64 - bits));
+    br->bits <<= bits;
+    br->count -= bits;
+    return v;
+}
+
+static inline bool br_get_unary(BitReader *br, uint32_t *q) {
+    uint32_t zeros = 0;
+    int z;
+
+    while (br->bits == 0) {
+        zeros += br->count;
+        br->count = 0;
+        if (br->pos > br->length + 8) return false;
+        br_refill(br);
+    }
+    z = __builtin_clzll(br->bits);
+    br->bits <<= z;
+    br->bits <<= 1;
+    br->count -= z + 1;
+    *q = zeros + z;
+    return true;
+}
+
+
+/**
+ *  Cost of Rice coding m residuals that sum to sum and reach max, counting
+ *  the parameter. An estimate: quotients are taken as sum >> k, never less
+ *  than the real total.
+ */
+static uint64_t partition_bits(int m, uint64_t sum, uint32_t max, int *k) {
+    uint64_t escape = 5 + (uint64_t)m * bit_width(max);
+    uint64_t best = UINT64_MAX, bits;
+    int p = 0, t;
+
+    while (p < 30 && ((uint64_t)m << p) < sum) p++;
+    for (t = p > 0 ? p - 1 : 0; t <= p; t++) {
+        bits = (uint64_t)m * (t + 1) + (sum >> t);
+        if (bits < best) {
+            best = bits;
+            *k = t;
+        }
+    }
+    if (escape <= best) {
+        *k = CAPTURE_CODEC_ESCAPE;
+        return 5 + escape;
+    }
+    return 5 + best;
+}
+
+static void put_partition(BitWriter *bw, const uint32_t *u, int m, uint64_t sum, uint32_t max) {
+    int k, i, w;
+
+    partition_bits(m, sum, max, &k);
+    bw_put(bw, (uint32_t)k, 5);
+    if (k == CAPTURE_CODEC_ESCAPE) {
+        w = bit_width(max);
+        bw_put(bw, (uint32_t)w, 5);
+        for (i = 0; i < m; i++) bw_put(bw, u[i], w);
+        return;
+    }
+    for (i = 0; i < m; i++) {
+        bw_put_unary(bw, u[i] >> k);
+        bw_put(bw, u[i], k);
+    }
+}
+
+/**
+ *  Fits predictors of every order up to maxOrder to x by Levinson-Durbin on
+ *  its autocorrelation. lpc[m - 1] gets order m's coefficients, x[i] is
+ *  predicted as the sum of lpc[m - 1][j] * x[i - 1 - j]. Returns the
+ *  highest order fitted, 0 for a line with nothing to predict.
+ */
+static int lpc_fit(const int32_t *x, int n, int maxOrder, double lpc[][CAPTURE_CODEC_MAX_LPC]) {
+    double r[CAPTURE_CODEC_MAX_LPC + 1], a[CAPTURE_CODEC_MAX_LPC], tmp[CAPTURE_CODEC_MAX_LPC];
+    double err;
+    int lag, i, j, m;
+
+    for (lag = 0; lag <= maxOrder; lag++) {
+        double sum = 0;
+        for (i = lag; i < n; i++) sum += (double)x[i] * x[i - lag];
+        r[lag] = sum;
+    }
+    if (r[0] == 0) return 0;
+
+    err = r[0];
+    for (m = 0; m < maxOrder; m++) {
+        double k = r[m + 1];
+        for (j = 0; j < m; j++) k -= a[j] * r[m - j];
+        k /= err;
+
+        for (j = 0; j < m; j++) tmp[j] = a[j] - k * a[m - 1 - j];
+        for (j = 0; j < m; j++) a[j] = tmp[j];
+        a[m] = k;
+        err *= 1 - k * k;
+        for (j = 0; j <= m; j++) lpc[m][j] = a[j];
+        if (err <= 0) return m + 1;
+    }
+    return maxOrder;
+}
+
+/**
+ *  Quantizes order coefficients to CAPTURE_CODEC_LPC_PRECISION bits, or
+ *  fewer fraction bits than that if maxShift says so, carrying each one's
+ *  rounding error into the next. False when they are too big.
+ */
+static bool lpc_quantize(const double *lpc, int order, int maxShift, int32_t *q, int *shift) {
+    int limit = (1 << (CAPTURE_CODEC_LPC_PRECISION - 1)) - 1;
+    double cmax = 0, error = 0;
+    int exponent, j;
+
+    for (j = 0; j < order; j++) {
+        if (fabs(lpc[j]) > cmax) cmax = fabs(lpc[j]);
+    }
+    if (cmax <= 0) return false;
+
+    frexp(cmax, &exponent);
+    *shift = CAPTURE_CODEC_LPC_PRECISION - 1 - exponent;
+    if (*shift > maxShift) *shift = maxShift;
+    if (*shift < 0) return false;
+
+    for (j = 0; j < order; j++) {
+        double v = lpc[j] * (1 << *shift) + error;
+        long c = lround(v);
+        if (c > limit) c = limit;
+        if (c < -limit) c = -limit;
+        error = v - c;
+        q[j] = (int32_t)c;
+    }
+    return true;
+}
+
+// Quantized coefficients and the samples both fit, so the sum stays in 32 bits
+static inline int32_t lpc_predict(const int32_t *q, int order, int shift, const int32_t *history) {
+    int32_t sum = 0;
+    int j;
+
+    for (j = 0; j < order; j++) sum += q[j] * history[-1 - j];
+    return sum >> shift;
+}
+
+static uint64_t lpc_residuals(const int32_t *x, int n, const int32_t *q, int order, int shift, uint32_t *u) {
+    uint64_t sum = 0;
+    int i;
+
+    for (i = order; i < n; i++) {
+        int32_t r = x[i] - lpc_predict(q, order, shift, x + i);
+        sum += (uint32_t)abs(r);
+        if (u != NULL) u[i - order] = zigzag(r);
+    }
+    return sum;
+}
+
+/**
+ *  Codes one channel of n samples. x is the channel, u room for n residuals.
+ */
+static void code_channel(BitWriter *bw, const int32_t *x, int n, uint32_t *u) {
+    uint64_t errors[CAPTURE_CODEC_MAX_ORDER + 1] = { 0 };
+    uint64_t sums[1 << CAPTURE_CODEC_MAX_PARTITION];
+    uint32_t maxes[1 << CAPTURE_CODEC_MAX_PARTITION];
+    double lpc[CAPTURE_CODEC_MAX_LPC][CAPTURE_CODEC_MAX_LPC];
+    int32_t q[CAPTURE_CODEC_MAX_LPC], bestQ[CAPTURE_CODEC_MAX_LPC];
+    uint64_t bits, bestBits = UINT64_MAX, bestError;
+    int order = 0, maxOrder = n - 1 < CAPTURE_CODEC_MAX_ORDER ? n - 1 : CAPTURE_CODEC_MAX_ORDER;
+    int lpcOrder = 0, lpcShift = 0, shift, fitted;
+    int i, p, maxP = 0, bestP = 0, numU, k;
+
+    for (i = 1; i < n && x[i] == x[0]; i++) {}
+    if (i == n) {
+        bw_put(bw, CAPTURE_CODEC_CONSTANT, 4);
+        bw_put(bw, (uint32_t)x[0], 16);
+        return;
+    }
+
+    // Each order's residual is the difference of the one below it
+    for (i = CAPTURE_CODEC_MAX_ORDER; i < n; i++) {
+        int32_t e0 = x[i], e1 = e0 - x[i-1], e2 = e1 - (x[i-1] - x[i-2]);
+        int32_t e3 = e2 - (x[i-1] - 2 * x[i-2] + x[i-3]);
+        int32_t e4 = e3 - (x[i-1] - 3 * x[i-2] + 3 * x[i-3] - x[i-4]);
+        errors[0] += (uint32_t)abs(e0);
+        errors[1] += (uint32_t)abs(e1);
+        errors[2] += (uint32_t)abs(e2);
+        errors[3] += (uint32_t)abs(e3);
+        errors[4] += (uint32_t)abs(e4);
+    }
+    for (i = 1; i <= maxOrder; i++) {
+        if (errors[i] < errors[order]) order = i;
+    }
+    bestError = errors[order];
+
+    // LPC where it leaves less than the fixed predictors. The least squares
+    // fit shies away from the transitions, rounded to a few fraction bits
+    // it often lands on the exact -1 at the square wave's half cycle
+    fitted = lpc_fit(x, n, n - 1 < CAPTURE_CODEC_MAX_LPC ? n - 1 : CAPTURE_CODEC_MAX_LPC, lpc);
+    for (i = 1; i <= fitted; i++) {
+        for (int s = 0; s <= CAPTURE_CODEC_COARSE_SHIFTS; s++) {
+            uint64_t error;
+            int maxShift = s < CAPTURE_CODEC_COARSE_SHIFTS ? s : CAPTURE_CODEC_MAX_SHIFT;
+            if (!lpc_quantize(lpc[i - 1], i, maxShift, q, &shift)) continue;
+            error = lpc_residuals(x, n, q, i, shift, NULL);
+            if (error < bestError) {
+                bestError = error;
+                lpcOrder = i;
+                lpcShift = shift;
+                memcpy(bestQ, q, sizeof(q));
+            }
+        }
+    }
+    if (lpcOrder > 0) {
+        order = lpcOrder;
+        lpc_residuals(x, n, bestQ, order, lpcShift, u);
+    }
+
+    for (i = order; lpcOrder == 0 && i < n; i++) {
+        int32_t r;
+        switch (order) {
+            case 0:  r = x[i]; break;
+            case 1:  r = x[i] - x[i-1]; break;
+            case 2:  r = x[i] - 2 * x[i-1] + x[i-2]; break;
+            case 3:  r = x[i] - 3 * x[i-1] + 3 * x[i-2] - x[i-3]; break;
+            default: r = x[i] - 4 * x[i-1] + 6 * x[i-2] - 4 * x[i-3] + x[i-4]; break;
+        }
+        u[i - order] = zigzag(r);
+    }
+
+    // Finest partitioning first, then each coarser one by merging pairs
+    while (maxP < CAPTURE_CODEC_MAX_PARTITION && n % (2 << maxP) == 0 && (n >> (maxP + 1)) > order) maxP++;
+    for (p = 0, numU = 0; p < (1 << maxP); p++) {
+        int m = (n >> maxP) - (p == 0 ? order : 0);
+        sums[p] = 0;
+        maxes[p] = 0;
+        for (i = 0; i < m; i++, numU++) {
+            sums[p] += u[numU];
+            if (u[numU] > maxes[p]) maxes[p] = u[numU];
+        }
+    }
+    for (p = maxP; ; p--) {
+        bits = 4;
+        for (i = 0; i < (1 << p); i++)
+            bits += partition_bits((n >> p) - (i == 0 ? order : 0), sums[i], maxes[i], &k);
+        if (bits < bestBits) {
+            bestBits = bits;
+            bestP = p;
+        }
+        if (p == 0) break;
+        for (i = 0; i < (1 << (p - 1)); i++) {
+            sums[i] = sums[2 * i] + sums[2 * i + 1];
+            maxes[i] = maxes[2 * i] > maxes[2 * i + 1] ? maxes[2 * i] : maxes[2 * i + 1];
+        }
+    }
+
+    bits = 16 * (uint64_t)order + (lpcOrder ? 7 + CAPTURE_CODEC_LPC_PRECISION * (uint64_t)order : 0);
+    if (bits + bestBits >= 16 * (uint64_t)n) {
+        bw_put(bw, CAPTURE_CODEC_VERBATIM, 4);
+        for (i = 0; i < n; i++) bw_put(bw, (uint32_t)x[i], 16);
+        return;
+    }
+
+    if (lpcOrder) {
+        bw_put(bw, CAPTURE_CODEC_LPC, 4);
+        bw_put(bw, (uint32_t)(order - 1), 3);
+        bw_put(bw, (uint32_t)lpcShift, 4);
+        for (i = 0; i < order; i++) bw_put(bw, (uint32_t)bestQ[i], CAPTURE_CODEC_LPC_PRECISION);
+    } else {
+        bw_put(bw, (uint32_t)order, 4);
+    }
+    for (i = 0; i < order; i++) bw_put(bw, (uint32_t)x[i], 16);
+    bw_put(bw, (uint32_t)bestP, 4);
+    for (p = 0, numU = 0; p < (1 << bestP); p++) {
+        int m = (n >> bestP) - (p == 0 ? order : 0);
+        uint64_t sum = 0;
+        uint32_t max = 0;
+        for (i = 0; i < m; i++) {
+            sum += u[numU + i];
+            if (u[numU + i] > max) max = u[numU + i];
+        }
+        put_partition(bw, u + numU, m, sum, max);
+        numU += m;
+    }
+}
+
+/**
+ *  Codes numFrames frames of pending into one block and writes it.
+ */
+static bool write_block(CaptureCodecWriter *writer, uint32_t numFrames) {
+    uint32_t channels = writer->header.channels;
+    int32_t *x = writer->residuals;
+    uint32_t *u = (uint32_t *)writer->residuals + writer->blockFrames;
+    BitWriter bw = { writer->block + CAPTURE_CODEC_BLOCK_BYTES, 0, 0, 0 };
+    uint32_t c, i;
+    size_t blockBytes;
+
+    for (c = 0; c < channels; c++) {
+        for (i = 0; i < numFrames; i++) x[i] = writer->pending[i * channels + c];
+        code_channel(&bw, x, (int)numFrames, u);
+    }
+    bw_flush(&bw);
+
+    put_u32(writer->block, (uint32_t)bw.pos);
+    put_u32(writer->block + 4, numFrames);
+    put_u32(writer->block + 8, block_checksum(writer->pending, (size_t)numFrames * channels));
+    blockBytes = CAPTURE_CODEC_BLOCK_BYTES + bw.pos;
+    if (fwrite(writer->block, 1, blockBytes, writer->file) != blockBytes) return false;
+
+    if (writer->numBlocks == writer->maxBlocks) {
+        uint32_t maxBlocks = writer->maxBlocks ? 2 * writer->maxBlocks : 256;
+        uint64_t *offsets = realloc(writer->offsets, maxBlocks * sizeof(uint64_t));
+        if (offsets == NULL) return false;
+        writer->offsets = offsets;
+        writer->maxBlocks = maxBlocks;
+    }
+    writer->offsets[writer->numBlocks++] = writer->offset;
+    writer->offset += blockBytes;
+    writer->header.numFrames += numFrames;
+    return true;
+}
+
+static void pack_header(const CaptureCodecWriter *writer, uint64_t indexOffset, uint8_t *bytes) {
+    capture_header_pack(&writer->header, CAPTURE_CODEC_MAGIC, bytes);
+    put_u32(bytes + 28, writer->blockFrames);
+    put_u64(bytes + 112, indexOffset);
+    put_u32(bytes + 120, indexOffset ? writer->numBlocks : 0);
+}
+
+static void free_writer(CaptureCodecWriter *writer) {
+    free(writer->pending);
+    free(writer->block);
+    free(writer->residuals);
+    free(writer->offsets);
+    writer->pending = NULL;
+    writer->block = NULL;
+    writer->residuals = NULL;
+    writer->offsets = NULL;
+}
+
+
+bool capture_codec_read_header(const char *path, CaptureHeader *header) {
+    uint8_t bytes[CAPTURE_HEADER_BYTES];
+    int fd = open(path, O_RDONLY);
+    ssize_t n;
+
+    if (fd < 0) return false;
+    n = read(fd, bytes, sizeof(bytes));
+    close(fd);
+
+    return n == (ssize_t)sizeof(bytes) && capture_header_unpack(bytes, CAPTURE_CODEC_MAGIC, header) != 0;
+}
+
+
+bool capture_codec_writer_open(CaptureCodecWriter *writer, const char *path, const CaptureHeader *header) {
+    uint8_t bytes[CAPTURE_HEADER_BYTES];
+    uint32_t channels = header->channels;
+
+    memset(writer, 0, sizeof(*writer));
+    writer->header = *header;
+    writer->header.numFrames = 0;
+    writer->blockFrames = CAPTURE_CODEC_BLOCK_FRAMES;
+    writer->offset = CAPTURE_HEADER_BYTES;
+    if (channels == 0) return false;
+
+    // A verbatim channel is 4 bits over its samples, and the stream is padded to a byte
+    writer->pending = malloc((size_t)writer->blockFrames * channels * sizeof(int16_t));
+    writer->block = malloc(CAPTURE_CODEC_BLOCK_BYTES + (size_t)channels * (2 * writer->blockFrames + 1) + 1);
+    writer->residuals = malloc(2 * (size_t)writer->blockFrames * sizeof(int32_t));
+    if (writer->pending == NULL || writer->block == NULL || writer->residuals == NULL) {
+        free_writer(writer);
+        return false;
+    }
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) {
+        free_writer(writer);
+        return false;
+    }
+
+    // The index stays 0 until close so a crashed capture is read by walking its blocks
+    pack_header(writer, 0, bytes);
+    if (fwrite(bytes, 1, sizeof(bytes), writer->file) != sizeof(bytes)) {
+        fclose(writer->file);
+        writer->file = NULL;
+        free_writer(writer);
+        return false;
+    }
+
+    return true;
+}
+
+
+bool capture_codec_writer_write(CaptureCodecWriter *writer, const int16_t *frames, uint32_t numFrames) {
+    uint32_t channels = writer->header.channels;
+    uint32_t n;
+
+    if (writer->file == NULL) return false;
+
+    while (numFrames > 0) {
+        n = writer->blockFrames - writer->numPending;
+        if (n > numFrames) n = numFrames;
+        memcpy(writer->pending + (size_t)writer->numPending * channels, frames, (size_t)n * channels * sizeof(int16_t));
+        writer->numPending += n;
+        frames += (size_t)n * channels;
+        numFrames -= n;
+
+        if (writer->numPending == writer->blockFrames) {
+            writer->numPending = 0;
+            if (!write_block(writer, writer->blockFrames)) return false;
+        }
+    }
+    return true;
+}
+
+
+bool capture_codec_writer_close(CaptureCodecWriter *writer) {
+    uint8_t bytes[CAPTURE_HEADER_BYTES];
+    uint64_t indexOffset;
+    uint32_t b;
+    bool ok = true;
+
+    if (writer->file == NULL) return false;
+
+    if (writer->numPending > 0) ok = write_block(writer, writer->numPending);
+    writer->numPending = 0;
+
+    indexOffset = writer->offset;
+    for (b = 0; ok && b < writer->numBlocks; b++) {
+        put_u64(bytes, writer->offsets[b]);
+        ok = fwrite(bytes, 1, 8, writer->file) == 8;
+    }
+
+    pack_header(writer, ok ? indexOffset : 0, bytes);
+    ok = ok && fseek(writer->file, 0, SEEK_SET) == 0 &&
+         fwrite(bytes, 1, sizeof(bytes), writer->file) == sizeof(bytes);
+    ok = (fclose(writer->file) == 0) && ok;
+    writer->file = NULL;
+    free_writer(writer);
+
+    return ok;
+}
+
+
+bool capture_codec_reader_open(CaptureCodecReader *reader, const char *path) {
+    struct stat st;
+    uint32_t headerBytes, numBlocks, maxBlocks, b;
+    uint64_t indexOffset, offset;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    if (fstat(fd, &st) != 0 || st.st_size < CAPTURE_HEADER_BYTES) {
+        close(fd);
+        return false;
+    }
+
+    reader->mapBytes = (size_t)st.st_size;
+    void *map = mmap(NULL, reader->mapBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+    reader->map = map;
+
+    headerBytes = capture_header_unpack(reader->map, CAPTURE_CODEC_MAGIC, &reader->header);
+    reader->blockFrames = get_u32(reader->map + 28);
+    indexOffset = get_u64(reader->map + 112);
+    numBlocks = get_u32(reader->map + 120);
+    if (headerBytes == 0 || headerBytes > reader->mapBytes ||
+        reader->blockFrames == 0 || reader->blockFrames > CAPTURE_CODEC_MAX_FRAMES) {
+        capture_codec_reader_close(reader);
+        return false;
+    }
+
+    // Without an index the blocks are found one after another by their sizes
+    if (indexOffset == 0 || indexOffset > reader->mapBytes || numBlocks > (reader->mapBytes - indexOffset) / 8) {
+        indexOffset = 0;
+        numBlocks = 0;
+        for (offset = headerBytes; reader->mapBytes - offset >= CAPTURE_CODEC_BLOCK_BYTES; numBlocks++) {
+            uint32_t payloadBytes = get_u32(reader->map + offset);
+            if (payloadBytes > reader->mapBytes - offset - CAPTURE_CODEC_BLOCK_BYTES) break;
+            offset += CAPTURE_CODEC_BLOCK_BYTES + payloadBytes;
+        }
+    }
+    maxBlocks = numBlocks;
+    reader->offsets = malloc((maxBlocks ? maxBlocks : 1) * sizeof(uint64_t));
+    if (reader->offsets == NULL) {
+        capture_codec_reader_close(reader);
+        return false;
+    }
+
+    // Stop at the first block that is cut off or does not fit the capture
+    reader->header.numFrames = 0;
+    for (b = 0, offset = headerBytes; b < maxBlocks; b++) {
+        if (indexOffset) offset = get_u64(reader->map + indexOffset + 8 * b);
+        if (offset > reader->mapBytes || reader->mapBytes - offset < CAPTURE_CODEC_BLOCK_BYTES) break;
+
+        uint32_t payloadBytes = get_u32(reader->map + offset);
+        uint32_t numFrames = get_u32(reader->map + offset + 4);
+        if (payloadBytes > reader->mapBytes - offset - CAPTURE_CODEC_BLOCK_BYTES ||
+            numFrames == 0 || numFrames > reader->blockFrames)
+            break;
+
+        reader->offsets[b] = offset;
+        reader->header.numFrames += numFrames;
+        offset += CAPTURE_CODEC_BLOCK_BYTES + payloadBytes;
+        // Only the last block may be short
+        if (numFrames < reader->blockFrames) {
+            b++;
+            break;
+        }
+    }
+    reader->numBlocks = b;
+
+    madvise(map, reader->mapBytes, MADV_SEQUENTIAL);
+    return true;
+}
+
+
+void capture_codec_reader_close(CaptureCodecReader *reader) {
+    if (reader->map != NULL)
+        munmap((void *)reader->map, reader->mapBytes);
+    free(reader->offsets);
+    memset(reader, 0, sizeof(*reader));
+}
+
+
+uint64_t capture_codec_block_start(const CaptureCodecReader *reader, uint32_t block) {
+    return (uint64_t)block * reader->blockFrames;
+}
+
+/**
+ *  Decodes one channel's Rice partitions, rebuilding samples as it goes with
+ *  the fixed predictor of order, or the LPC in q when it is set.
+ */
+static bool decode_residuals(BitReader *br, int order, const int32_t *q, int shift, int n, int16_t *out, uint32_t stride) {
+    int32_t history[CAPTURE_CODEC_MAX_LPC + 1];
+    int32_t s1 = 0, s2 = 0, s3 = 0, s4 = 0;
+    int p, partitions, i, j, k, w;
+    int done = order;
+
+    // Warm up samples are already in out, history holds the newest last
+    for (j = 0; j < order; j++) history[CAPTURE_CODEC_MAX_LPC - order + j] = out[(size_t)j * stride];
+    if (order >= 1) s1 = out[(order - 1) * stride];
+    if (order >= 2) s2 = out[(order - 2) * stride];
+    if (order >= 3) s3 = out[(order - 3) * stride];
+    if (order >= 4) s4 = out[(order - 4) * stride];
+
+    p = (int)br_get(br, 4);
+    if (p > CAPTURE_CODEC_MAX_PARTITION || n % (1 << p) != 0 || (n >> p) < order) return false;
+    partitions = 1 << p;
+
+    for (int part = 0; part < partitions; part++) {
+        int m = (n >> p) - (part == 0 ? order : 0);
+
+        k = (int)br_get(br, 5);
+        w = k == CAPTURE_CODEC_ESCAPE ? (int)br_get(br, 5) : 0;
+        for (i = 0; i < m; i++) {
+            uint32_t u, quotient;
+            int32_t x;
+
+            if (k == CAPTURE_CODEC_ESCAPE) {
+                u = w ? br_get(br, w) : 0;
+            } else {
+                if (!br_get_unary(br, &quotient)) return false;
+                u = k ? (quotient << k) | br_get(br, k) : quotient;
+            }
+            if (q != NULL) {
+                x = unzigzag(u) + lpc_predict(q, order, shift, history + CAPTURE_CODEC_MAX_LPC);
+                if (x > INT16_MAX || x < INT16_MIN) return false;
+                memmove(history, history + 1, (CAPTURE_CODEC_MAX_LPC - 1) * sizeof(int32_t));
+                history[CAPTURE_CODEC_MAX_LPC - 1] = x;
+                out[(size_t)done++ * stride] = (int16_t)x;
+                continue;
+            }
+            switch (order) {
+                case 0:  x = unzigzag(u); break;
+                case 1:  x = unzigzag(u) + s1; break;
+                case 2:  x = unzigzag(u) + 2 * s1 - s2; break;
+                case 3:  x = unzigzag(u) + 3 * s1 - 3 * s2 + s3; break;
+                default: x = unzigzag(u) + 4 * s1 - 6 * s2 + 4 * s3 - s4; break;
+            }
+            if (x > INT16_MAX || x < INT16_MIN) return false;
+            out[(size_t)done++ * stride] = (int16_t)x;
+            s4 = s3;
+            s3 = s2;
+            s2 = s1;
+            s1 = x;
+        }
+    }
+    return true;
+}
+
+
+int capture_codec_decode_block(const CaptureCodecReader *reader, uint32_t block, int16_t *frames) {
+    const uint8_t *bytes;
+    uint32_t channels = reader->header.channels;
+    uint32_t payloadBytes, numFrames, c;
+    BitReader br;
+    int i;
+
+    if (block >= reader->numBlocks) return -1;
+    bytes = reader->map + reader->offsets[block];
+    payloadBytes = get_u32(bytes);
+    numFrames = get_u32(bytes + 4);
+
+    memset(&br, 0, sizeof(br));
+    br.bytes = bytes + CAPTURE_CODEC_BLOCK_BYTES;
+    br.length = payloadBytes;
+
+    for (c = 0; c < channels; c++) {
+        int16_t *out = frames + c;
+        int kind = (int)br_get(&br, 4);
+
+        if (kind == CAPTURE_CODEC_CONSTANT) {
+            int16_t v = (int16_t)br_get(&br, 16);
+            for (i = 0; i < (int)numFrames; i++) out[(size_t)i * channels] = v;
+        } else if (kind == CAPTURE_CODEC_VERBATIM) {
+            for (i = 0; i < (int)numFrames; i++) out[(size_t)i * channels] = (int16_t)br_get(&br, 16);
+        } else if (kind == CAPTURE_CODEC_LPC) {
+            int32_t q[CAPTURE_CODEC_MAX_LPC];
+            int order = (int)br_get(&br, 3) + 1;
+            int shift = (int)br_get(&br, 4);
+            if (order >= (int)numFrames) return -1;
+            for (i = 0; i < order; i++) {
+                // Sign extend from CAPTURE_CODEC_LPC_PRECISION bits
+                uint32_t v = br_get(&br, CAPTURE_CODEC_LPC_PRECISION) << (32 - CAPTURE_CODEC_LPC_PRECISION);
+                q[i] = (int32_t)v >> (32 - CAPTURE_CODEC_LPC_PRECISION);
+            }
+            for (i = 0; i < order; i++) out[(size_t)i * channels] = (int16_t)br_get(&br, 16);
+            if (!decode_residuals(&br, order, q, shift, (int)numFrames, out, channels)) return -1;
+        } else if (kind <= CAPTURE_CODEC_MAX_ORDER && kind < (int)numFrames) {
+            for (i = 0; i < kind; i++) out[(size_t)i * channels] = (int16_t)br_get(&br, 16);
+            if (!decode_residuals(&br, kind, NULL, 0, (int)numFrames, out, channels)) return -1;
+        } else {
+            return -1;
+        }
+    }
+
+    // Read no further than the payload, and get back what was written
+    if (br.pos * 8 - br.count > (size_t)payloadBytes * 8 ||
+        block_checksum(frames, (size_t)numFrames * channels) != get_u32(bytes + 8))
+        return -1;
+
+    return (int)numFrames;
+}
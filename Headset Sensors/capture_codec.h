@@ -0,0 +1,117 @@
+/* *********************************************************************
+ * File: capture_codec.h
+ * Author: Michael Bennett
+ * Purpose: Lossless compressed captures, coded the way FLAC codes audio.
+ *          Frames are cut into blocks that need nothing before them.
+ *          Each channel of a block is predicted by whichever fixed
+ *          polynomial predictor (order 0 to 4) or quantized LPC (order 1
+ *          to 8, which follows the HIGH square wave) leaves the least,
+ *          and the residuals are Rice coded in partitions with a
+ *          parameter each.
+ *          The quiet line between transmissions takes a few bits a
+ *          sample or less. Blocks decode one after another as a stream
+ *          for the decoders, or on as many threads as there are blocks.
+ *
+ *          Layout, all fields little endian:
+ *            0  the capture_file.h header with magic "GSFZ", and
+ *               28  u32 blockFrames
+ *              112  u64 indexOffset (0 until closed)
+ *              120  u32 numBlocks (0 until closed)
+ *          128  blocks, each
+ *                 0  u32 payloadBytes
+ *                 4  u32 numFrames
+ *                 8  u32 checksum, Fletcher-32 of the decoded samples
+ *                12  payload, one bit stream, MSB first, every channel
+ *                    in turn:
+ *                      4 bits CAPTURE_CODEC_* kind
+ *                      CONSTANT: 16 bit sample
+ *                      VERBATIM: numFrames 16 bit samples
+ *                      LPC: 3 bits order - 1, 4 bits shift, order signed
+ *                        CAPTURE_CODEC_LPC_PRECISION bit coefficients,
+ *                        then as a fixed order, predicting the sum of
+ *                        coefficient j times sample i - 1 - j, >> shift
+ *                      order 0-4: order 16 bit warm up samples, 4 bits
+ *                        partition order p, then 2^p partitions of
+ *                        numFrames >> p residuals (the first order
+ *                        fewer), each a 5 bit Rice parameter k and its
+ *                        residuals zigzagged to unsigned, quotient in
+ *                        unary (0s then a 1) and k bits of remainder.
+ *                        k of CAPTURE_CODEC_ESCAPE is followed by 5 bits
+ *                        of width and the residuals in that many bits.
+ *          indexOffset  u64 offset of every block
+ * ********************************************************************/
+#ifndef CAPTURE_CODEC_H
+#define CAPTURE_CODEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "capture_file.h"
+
+#define CAPTURE_CODEC_MAGIC         "GSFZ"
+#define CAPTURE_CODEC_EXTENSION     ".gsfz"
+#define CAPTURE_CODEC_BLOCK_FRAMES  4096    // ~93 ms at 44.1 kHz
+#define CAPTURE_CODEC_MAX_FRAMES    65536   // Most frames a block may hold
+#define CAPTURE_CODEC_MAX_ORDER     4       // Fixed predictors
+#define CAPTURE_CODEC_MAX_LPC       8
+#define CAPTURE_CODEC_LPC_PRECISION 12      // Bits per coefficient, sign included
+#define CAPTURE_CODEC_MAX_SHIFT     15
+#define CAPTURE_CODEC_COARSE_SHIFTS 3       // LPC is also tried rounded to 0 to 2 fraction bits
+#define CAPTURE_CODEC_MAX_PARTITION 6       // 2^6 partitions, 64 residuals each in a full block
+#define CAPTURE_CODEC_BLOCK_BYTES   12      // Block header ahead of the payload
+#define CAPTURE_CODEC_ESCAPE        31
+
+// Kinds of coded channel, orders 0 to CAPTURE_CODEC_MAX_ORDER are themselves
+#define CAPTURE_CODEC_LPC           8
+#define CAPTURE_CODEC_CONSTANT      14
+#define CAPTURE_CODEC_VERBATIM      15
+
+typedef struct {
+    FILE *file;
+    CaptureHeader header;           // numFrames counts frames written so far
+    uint32_t blockFrames;
+    int16_t *pending;               // Frames waiting for a whole block
+    uint32_t numPending;
+    uint8_t *block;                 // Header and payload of the block being coded
+    int32_t *residuals;
+    uint64_t *offsets;              // Of every block written, for the index
+    uint32_t numBlocks;
+    uint32_t maxBlocks;
+    uint64_t offset;                // Where the next block goes
+} CaptureCodecWriter;
+
+typedef struct {
+    CaptureHeader header;           // numFrames is what the blocks really hold
+    uint32_t blockFrames;
+    uint32_t numBlocks;
+    uint64_t *offsets;              // From the index, or found by walking a capture never closed
+    const uint8_t *map;
+    size_t mapBytes;
+} CaptureCodecReader;
+
+// Reads just the header. False when path is not a compressed capture
+bool capture_codec_read_header(const char *path, CaptureHeader *header);
+
+bool capture_codec_writer_open(CaptureCodecWriter *writer, const char *path, const CaptureHeader *header);
+
+// Codes each block as it fills, the rest wait for the next write or close
+bool capture_codec_writer_write(CaptureCodecWriter *writer, const int16_t *frames, uint32_t numFrames);
+
+// Codes the last part block, writes the index and the final header and closes the file
+bool capture_codec_writer_close(CaptureCodecWriter *writer);
+
+// Maps a compressed capture. One that was never closed is read up to its
+// last whole block
+bool capture_codec_reader_open(CaptureCodecReader *reader, const char *path);
+void capture_codec_reader_close(CaptureCodecReader *reader);
+
+// First frame of block
+uint64_t capture_codec_block_start(const CaptureCodecReader *reader, uint32_t block);
+
+// Decodes block into frames, which holds blockFrames frames. Returns the
+// frames decoded, or -1 for a damaged block. Any number of threads may
+// decode blocks of one reader at once
+int capture_codec_decode_block(const CaptureCodecReader *reader, uint32_t block, int16_t *frames);
+
+#endif
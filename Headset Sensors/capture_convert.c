@@ -0,0 +1,342 @@
+/* *********************************************************************
+ * File: capture_convert.c
+ * Author: Michael Bennett
+ * Purpose: Convert one sample per line text captures into the binary
+ *          capture format, or dump a binary capture back out as text.
+ *          Dumps taken before the collector moved to plain C hold the
+ *          NSNumber pointers of the samples rather than the samples,
+ *          which is the sample shifted up 8 bits plus a tag. These are
+ *          detected by their range (or forced with -l) and shifted back.
+ *          Binary captures can also be compressed losslessly (-z) and
+ *          decompressed again (-u).
+ * Build:   cc -O2 -o capture_convert capture_convert.c capture_file.c capture_codec.c -lm
+ * Usage:   capture_convert [-r sample_rate] [-d device] [-l | -n] capture.txt capture.gsfc
+ *          capture_convert -x capture.gsfc|capture.gsfz [capture.txt]
+ *          capture_convert -z capture.gsfc capture.gsfz
+ *          capture_convert -u capture.gsfz capture.gsfc
+ * ********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+#include "capture_codec.h"
+
+#define CONVERT_READ_BYTES      (1 << 16)
+#define CONVERT_SAMPLES         4096
+#define CONVERT_SAMPLE_RATE     44100
+#define LEGACY_SHIFT            8       // NSNumber tagged pointer payload starts at bit 8
+
+enum { SCALE_AUTO, SCALE_LEGACY, SCALE_NONE };
+
+typedef void (*ConvertSink)(const int *samples, int numSamples, void *userData);
+
+typedef struct {
+    CaptureWriter writer;
+    int shift;
+    long long clipped;
+} ConvertState;
+
+
+/**
+ *  Runs every sample of a text capture through sink. Returns 0 on success.
+ */
+static int read_text(FILE *file_in, ConvertSink sink, void *userData) {
+    static char text[CONVERT_READ_BYTES];
+    int samples[CONVERT_SAMPLES];
+    CaptureTextParser parser = {0};
+    size_t length, offset, used;
+    int n;
+
+    rewind(file_in);
+    while ((length = fread(text, 1, sizeof(text), file_in)) > 0) {
+        for (offset = 0; offset < length; offset += used) {
+            n = capture_text_parse(&parser, text + offset, length - offset, &used, samples, CONVERT_SAMPLES);
+            if (n > 0) sink(samples, n, userData);
+        }
+    }
+    if (capture_text_finish(&parser, &samples[0]))
+        sink(samples, 1, userData);
+
+    return ferror(file_in) ? -1 : 0;
+}
+
+static void find_range(const int *samples, int numSamples, void *userData) {
+    int *maxAbs = userData;
+    int k;
+
+    for (k = 0; k < numSamples; k++) {
+        int v = abs(samples[k]);
+        if (v > *maxAbs) *maxAbs = v;
+    }
+}
+
+static void write_samples(const int *samples, int numSamples, void *userData) {
+    ConvertState *state = userData;
+    int16_t frames[CONVERT_SAMPLES];
+    int k;
+
+    for (k = 0; k < numSamples; k++) {
+        int v = samples[k] >> state->shift;
+
+        if (v > INT16_MAX || v < INT16_MIN) {
+            v = v > 0 ? INT16_MAX : INT16_MIN;
+            state->clipped++;
+        }
+        frames[k] = (int16_t)v;
+    }
+    capture_writer_write(&state->writer, frames, numSamples);
+}
+
+
+static int to_binary(const char *in, const char *out, uint32_t sampleRate, const char *device, int scale) {
+    CaptureHeader header;
+    ConvertState state;
+    int maxAbs = 0;
+
+    FILE *file_in = fopen(in, "rb");
+    if (file_in == NULL) {
+        perror("ERROR to_binary: failed to open the input file.\n");
+        return 1;
+    }
+
+    // Old dumps are far outside the int16 range, real samples never are
+    state.shift = scale == SCALE_LEGACY ? LEGACY_SHIFT : 0;
+    if (scale == SCALE_AUTO) {
+        if (read_text(file_in, find_range, &maxAbs) != 0) {
+            perror("ERROR to_binary: failed to read the input file.\n");
+            fclose(file_in);
+            return 1;
+        }
+        if (maxAbs > INT16_MAX + 1) state.shift = LEGACY_SHIFT;
+    }
+    state.clipped = 0;
+
+    capture_header_init(&header, sampleRate, 1, device);
+    if (!capture_writer_open(&state.writer, out, &header)) {
+        perror("ERROR to_binary: failed to open the output file.\n");
+        fclose(file_in);
+        return 1;
+    }
+
+    if (read_text(file_in, write_samples, &state) != 0 || !capture_writer_close(&state.writer)) {
+        perror("ERROR to_binary: failed to convert the capture.\n");
+        fclose(file_in);
+        return 1;
+    }
+    fclose(file_in);
+
+    printf("%s: %llu samples%s\n", out, (unsigned long long)state.writer.header.numFrames,
+           state.shift ? ", converted from NSNumber dump" : "");
+    if (state.clipped)
+        printf("WARNING to_binary: %lld samples clipped to 16 bits\n", state.clipped);
+
+    return 0;
+}
+
+/**
+ *  Decodes every block of a compressed capture in turn through sink, which
+ *  gets whole frames. Returns 0 on success.
+ */
+static int read_compressed(const CaptureCodecReader *reader, void (*sink)(const int16_t *frames, int numFrames, void *userData), void *userData) {
+    int16_t *frames = malloc((size_t)reader->blockFrames * reader->header.channels * sizeof(int16_t));
+    uint32_t block;
+    int n = 0;
+
+    if (frames == NULL) return -1;
+    for (block = 0; block < reader->numBlocks; block++) {
+        n = capture_codec_decode_block(reader, block, frames);
+        if (n < 0) {
+            fprintf(stderr, "ERROR read_compressed: block %u is damaged\n", block);
+            break;
+        }
+        sink(frames, n, userData);
+    }
+    free(frames);
+    return n < 0 ? -1 : 0;
+}
+
+typedef struct {
+    FILE *file;
+    uint32_t channels;
+} TextSink;
+
+static void print_frames(const int16_t *frames, int numFrames, void *userData) {
+    TextSink *text = userData;
+    int k;
+
+    for (k = 0; k < numFrames; k++) {
+        fprintf(text->file, "%d\n", frames[(size_t)k * text->channels]);
+    }
+}
+
+static int to_text(const char *in, const char *out) {
+    CaptureReader reader;
+    CaptureCodecReader compressed;
+    CaptureHeader header;
+    int16_t samples[CONVERT_SAMPLES];
+    bool isCompressed = capture_codec_read_header(in, &header);
+    uint64_t frame;
+    uint32_t n, k;
+    int result = 0;
+
+    if (isCompressed ? !capture_codec_reader_open(&compressed, in) : !capture_reader_open(&reader, in)) {
+        perror("ERROR to_text: failed to open the binary capture.\n");
+        return 1;
+    }
+
+    FILE *file_out = stdout;
+    if (out != NULL && strcmp(out, "-") != 0) {
+        file_out = fopen(out, "w");
+        if (file_out == NULL) {
+            perror("ERROR to_text: failed to open the output file.\n");
+            if (isCompressed) capture_codec_reader_close(&compressed);
+            else capture_reader_close(&reader);
+            return 1;
+        }
+    }
+
+    if (isCompressed) {
+        TextSink text = { file_out, compressed.header.channels };
+        result = read_compressed(&compressed, print_frames, &text) != 0;
+        capture_codec_reader_close(&compressed);
+    } else {
+        for (frame = 0; frame < reader.header.numFrames; frame += n) {
+            n = reader.header.numFrames - frame < CONVERT_SAMPLES ? (uint32_t)(reader.header.numFrames - frame) : CONVERT_SAMPLES;
+            capture_read_channel(&reader, frame, n, 0, samples);
+            for (k = 0; k < n; k++) {
+                fprintf(file_out, "%d\n", samples[k]);
+            }
+        }
+        capture_reader_close(&reader);
+    }
+
+    if (file_out != stdout) fclose(file_out);
+
+    return result;
+}
+
+static int compress(const char *in, const char *out) {
+    CaptureReader reader;
+    CaptureCodecWriter writer;
+    struct stat st;
+    uint64_t frame, inBytes;
+    uint32_t n;
+    bool complete;
+
+    if (!capture_reader_open(&reader, in)) {
+        perror("ERROR compress: failed to open the binary capture.\n");
+        return 1;
+    }
+    if (!capture_codec_writer_open(&writer, out, &reader.header)) {
+        perror("ERROR compress: failed to open the output file.\n");
+        capture_reader_close(&reader);
+        return 1;
+    }
+
+    for (frame = 0; frame < reader.header.numFrames; frame += n) {
+        n = reader.header.numFrames - frame < CAPTURE_CODEC_BLOCK_FRAMES ? (uint32_t)(reader.header.numFrames - frame) : CAPTURE_CODEC_BLOCK_FRAMES;
+        if (!capture_codec_writer_write(&writer, reader.frames + frame * reader.header.channels, n)) break;
+    }
+    complete = frame >= reader.header.numFrames;
+    inBytes = CAPTURE_HEADER_BYTES + reader.header.numFrames * reader.header.channels * sizeof(int16_t);
+    capture_reader_close(&reader);
+
+    if (!capture_codec_writer_close(&writer) || !complete || stat(out, &st) != 0) {
+        perror("ERROR compress: failed to write the compressed capture.\n");
+        return 1;
+    }
+
+    printf("%s: %llu frames, %lld bytes from %llu, %.2fx\n", out, (unsigned long long)writer.header.numFrames,
+           (long long)st.st_size, (unsigned long long)inBytes, (double)inBytes / st.st_size);
+    return 0;
+}
+
+static void write_frames(const int16_t *frames, int numFrames, void *userData) {
+    capture_writer_write(userData, frames, numFrames);
+}
+
+static int decompress(const char *in, const char *out) {
+    CaptureCodecReader reader;
+    CaptureWriter writer;
+    int result;
+
+    if (!capture_codec_reader_open(&reader, in)) {
+        perror("ERROR decompress: failed to open the compressed capture.\n");
+        return 1;
+    }
+    if (!capture_writer_open(&writer, out, &reader.header)) {
+        perror("ERROR decompress: failed to open the output file.\n");
+        capture_codec_reader_close(&reader);
+        return 1;
+    }
+
+    result = read_compressed(&reader, write_frames, &writer);
+    capture_codec_reader_close(&reader);
+    if (!capture_writer_close(&writer) || result != 0) {
+        perror("ERROR decompress: failed to write the capture.\n");
+        return 1;
+    }
+
+    printf("%s: %llu frames\n", out, (unsigned long long)writer.header.numFrames);
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    uint32_t sampleRate = CONVERT_SAMPLE_RATE;
+    const char *device = "converted text capture";
+    int scale = SCALE_AUTO;
+    int extract = 0;
+    int pack = 0;
+    int unpack = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:d:lnxzu")) != -1) {
+        switch (opt) {
+            case 'r':
+                sampleRate = (uint32_t)atoi(optarg);
+                break;
+            case 'd':
+                device = optarg;
+                break;
+            case 'l':
+                scale = SCALE_LEGACY;
+                break;
+            case 'n':
+                scale = SCALE_NONE;
+                break;
+            case 'x':
+                extract = 1;
+                break;
+            case 'z':
+                pack = 1;
+                break;
+            case 'u':
+                unpack = 1;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+
+    if (extract + pack + unpack > 1) optind = argc + 1;
+
+    if (extract && optind < argc)
+        return to_text(argv[optind], optind + 1 < argc ? argv[optind + 1] : NULL);
+    if (pack && optind + 2 == argc)
+        return compress(argv[optind], argv[optind + 1]);
+    if (unpack && optind + 2 == argc)
+        return decompress(argv[optind], argv[optind + 1]);
+    if (!extract && !pack && !unpack && optind + 2 == argc)
+        return to_binary(argv[optind], argv[optind + 1], sampleRate, device, scale);
+
+    fprintf(stderr, "Usage: %s [-r sample_rate] [-d device] [-l | -n] capture.txt capture.gsfc\n"
+                    "       %s -x capture.gsfc|capture.gsfz [capture.txt]\n"
+                    "       %s -z capture.gsfc capture.gsfz\n"
+                    "       %s -u capture.gsfz capture.gsfc\n", argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+}
@@ -0,0 +1,263 @@
+/* *********************************************************************
+ * File: capture_file.c
+ * Author: Michael Bennett
+ * Purpose: Binary raw input capture writer and memory mapped reader.
+ *          The header is packed byte by byte so it does not depend on
+ *          struct layout; frames are written and mapped as they are in
+ *          memory, which is little endian on every target we build for.
+ * ********************************************************************/
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture_file.h"
+#include "sensor_decoder.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #error "capture frames are stored and mapped as little endian int16"
+#endif
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+
+void capture_header_pack(const CaptureHeader *header, const char *magic, uint8_t *bytes) {
+    memset(bytes, 0, CAPTURE_HEADER_BYTES);
+    memcpy(bytes, magic, 4);
+    put_u16(bytes + 4, CAPTURE_VERSION);
+    put_u16(bytes + 6, CAPTURE_HEADER_BYTES);
+    put_u32(bytes + 8, header->sampleRate);
+    put_u16(bytes + 12, header->channels);
+    put_u16(bytes + 14, header->bitsPerSample);
+    put_u32(bytes + 16, header->halfPeriodTC);
+    put_u32(bytes + 20, header->samplesPerCheck);
+    put_u32(bytes + 24, (uint32_t)header->highMinAvg);
+    put_u64(bytes + 32, header->numFrames);
+    put_u64(bytes + 40, (uint64_t)header->startTime);
+    memcpy(bytes + 48, header->device, CAPTURE_DEVICE_CHARS);
+}
+
+
+uint32_t capture_header_unpack(const uint8_t *bytes, const char *magic, CaptureHeader *header) {
+    uint32_t headerBytes = get_u16(bytes + 6);
+
+    if (memcmp(bytes, magic, 4) != 0 || get_u16(bytes + 4) != CAPTURE_VERSION ||
+        headerBytes < CAPTURE_HEADER_BYTES || (headerBytes & 1))
+        return 0;
+
+    header->sampleRate = get_u32(bytes + 8);
+    header->channels = get_u16(bytes + 12);
+    header->bitsPerSample = get_u16(bytes + 14);
+    header->halfPeriodTC = get_u32(bytes + 16);
+    header->samplesPerCheck = get_u32(bytes + 20);
+    header->highMinAvg = (int32_t)get_u32(bytes + 24);
+    header->numFrames = get_u64(bytes + 32);
+    header->startTime = (int64_t)get_u64(bytes + 40);
+    memcpy(header->device, bytes + 48, CAPTURE_DEVICE_CHARS);
+    header->device[CAPTURE_DEVICE_CHARS - 1] = '\0';
+
+    if (header->channels == 0 || header->bitsPerSample != 16) return 0;
+
+    return headerBytes;
+}
+
+
+void capture_header_init(CaptureHeader *header, uint32_t sampleRate, uint16_t channels, const char *device) {
+    memset(header, 0, sizeof(*header));
+
+    header->sampleRate = sampleRate;
+    header->channels = channels;
+    header->bitsPerSample = 16;
+    header->halfPeriodTC = HALF_PERIOD_TC;
+    header->samplesPerCheck = SAMPLES_PER_CHECK;
+    header->highMinAvg = SAMPLE_HIGH_MIN_AVG;
+    header->startTime = (int64_t)time(NULL);
+    if (device != NULL)
+        strncpy(header->device, device, CAPTURE_DEVICE_CHARS - 1);
+}
+
+
+bool capture_read_header(const char *path, CaptureHeader *header) {
+    uint8_t bytes[CAPTURE_HEADER_BYTES];
+    int fd = open(path, O_RDONLY);
+    ssize_t n;
+
+    if (fd < 0) return false;
+    n = read(fd, bytes, sizeof(bytes));
+    close(fd);
+
+    return n == (ssize_t)sizeof(bytes) && capture_header_unpack(bytes, CAPTURE_MAGIC, header) != 0;
+}
+
+
+bool capture_writer_open(CaptureWriter *writer, const char *path, const CaptureHeader *header) {
+    uint8_t bytes[CAPTURE_HEADER_BYTES];
+
+    writer->header = *header;
+    writer->header.numFrames = 0;
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) return false;
+
+    // numFrames stays 0 until close so a crashed capture is read by its size
+    capture_header_pack(&writer->header, CAPTURE_MAGIC, bytes);
+    if (fwrite(bytes, 1, sizeof(bytes), writer->file) != sizeof(bytes)) {
+        fclose(writer->file);
+        writer->file = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+
+bool capture_writer_write(CaptureWriter *writer, const int16_t *frames, uint32_t numFrames) {
+    size_t n;
+
+    if (writer->file == NULL) return false;
+
+    n = fwrite(frames, (size_t)writer->header.channels * sizeof(int16_t), numFrames, writer->file);
+    writer->header.numFrames += n;
+
+    return n == numFrames;
+}
+
+
+bool capture_writer_close(CaptureWriter *writer) {
+    uint8_t bytes[CAPTURE_HEADER_BYTES];
+    bool ok;
+
+    if (writer->file == NULL) return false;
+
+    capture_header_pack(&writer->header, CAPTURE_MAGIC, bytes);
+    ok = fseek(writer->file, 0, SEEK_SET) == 0 &&
+         fwrite(bytes, 1, sizeof(bytes), writer->file) == sizeof(bytes);
+    ok = (fclose(writer->file) == 0) && ok;
+    writer->file = NULL;
+
+    return ok;
+}
+
+
+bool capture_reader_open(CaptureReader *reader, const char *path) {
+    struct stat st;
+    uint32_t headerBytes;
+    uint64_t available;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    if (fstat(fd, &st) != 0 || st.st_size < CAPTURE_HEADER_BYTES) {
+        close(fd);
+        return false;
+    }
+
+    reader->mapBytes = (size_t)st.st_size;
+    reader->map = mmap(NULL, reader->mapBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (reader->map == MAP_FAILED) {
+        reader->map = NULL;
+        return false;
+    }
+
+    headerBytes = capture_header_unpack(reader->map, CAPTURE_MAGIC, &reader->header);
+    if (headerBytes == 0 || headerBytes > reader->mapBytes) {
+        capture_reader_close(reader);
+        return false;
+    }
+
+    // Trust the file size over a frame count that was never filled in
+    available = (reader->mapBytes - headerBytes) / (reader->header.channels * sizeof(int16_t));
+    if (reader->header.numFrames == 0 || reader->header.numFrames > available)
+        reader->header.numFrames = available;
+
+    reader->frames = (const int16_t *)((const uint8_t *)reader->map + headerBytes);
+    madvise(reader->map, reader->mapBytes, MADV_SEQUENTIAL);
+
+    return true;
+}
+
+
+void capture_reader_close(CaptureReader *reader) {
+    if (reader->map != NULL)
+        munmap(reader->map, reader->mapBytes);
+    memset(reader, 0, sizeof(*reader));
+}
+
+
+void capture_read_channel(const CaptureReader *reader, uint64_t firstFrame, uint32_t numFrames,
+                          int channel, int16_t *samples) {
+    const int16_t *p = reader->frames + firstFrame * reader->header.channels + channel;
+    uint32_t k;
+
+    for (k = 0; k < numFrames; k++) {
+        samples[k] = p[(size_t)k * reader->header.channels];
+    }
+}
+
+
+int capture_text_parse(CaptureTextParser *parser, const char *text, size_t length, size_t *used,
+                       int *samples, int maxSamples) {
+    int numSamples = 0;
+    size_t i;
+
+    for (i = 0; i < length && numSamples < maxSamples; i++) {
+        char c = text[i];
+
+        if (c >= '0' && c <= '9') {
+            parser->value = parser->value * 10 + (c - '0');
+            parser->inNumber = true;
+        } else if (c == '-' && !parser->inNumber) {
+            parser->negative = true;
+        } else {
+            if (parser->inNumber)
+                samples[numSamples++] = (int)(parser->negative ? -parser->value : parser->value);
+            parser->value = 0;
+            parser->negative = false;
+            parser->inNumber = false;
+        }
+    }
+    *used = i;
+
+    return numSamples;
+}
+
+
+bool capture_text_finish(CaptureTextParser *parser, int *sample) {
+    bool pending = parser->inNumber;
+
+    if (pending)
+        *sample = (int)(parser->negative ? -parser->value : parser->value);
+    memset(parser, 0, sizeof(*parser));
+
+    return pending;
+}
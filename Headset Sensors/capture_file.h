@@ -0,0 +1,100 @@
+/* *********************************************************************
+ * File: capture_file.h
+ * Author: Michael Bennett
+ * Purpose: Binary raw input capture. A fixed 128 byte header describing
+ *          how the capture was taken, followed by little endian int16
+ *          frames exactly as they came off the mic. Captures are read
+ *          back by mapping the file, so decoding one costs no parsing.
+ *
+ *          Header layout, all fields little endian:
+ *            0  magic "GSFC"        28  reserved
+ *            4  u16 version         32  u64 numFrames (0 until closed)
+ *            6  u16 headerBytes     40  i64 startTime, Unix seconds
+ *            8  u32 sampleRate      48  char device[64], NUL padded
+ *           12  u16 channels       112  reserved to headerBytes
+ *           14  u16 bitsPerSample
+ *           16  u32 halfPeriodTC
+ *           20  u32 samplesPerCheck
+ *           24  i32 highMinAvg
+ * ********************************************************************/
+#ifndef CAPTURE_FILE_H
+#define CAPTURE_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CAPTURE_MAGIC           "GSFC"
+#define CAPTURE_VERSION         1
+#define CAPTURE_HEADER_BYTES    128
+#define CAPTURE_DEVICE_CHARS    64
+#define CAPTURE_EXTENSION       ".gsfc"
+
+typedef struct {
+    uint32_t sampleRate;
+    uint16_t channels;              // Interleaved, the mic line is channel 0
+    uint16_t bitsPerSample;         // Always 16
+    uint32_t halfPeriodTC;          // Decoder timing the capture was taken with
+    uint32_t samplesPerCheck;
+    int32_t highMinAvg;             // Decode threshold in the units of the stored samples
+    uint64_t numFrames;
+    int64_t startTime;
+    char device[CAPTURE_DEVICE_CHARS];
+} CaptureHeader;
+
+typedef struct {
+    FILE *file;
+    CaptureHeader header;           // numFrames counts frames written so far
+} CaptureWriter;
+
+typedef struct {
+    CaptureHeader header;           // numFrames is what the file really holds
+    const int16_t *frames;          // Mapped, header.channels samples per frame
+    void *map;
+    size_t mapBytes;
+} CaptureReader;
+
+// Fills in this build's decoder timing, the current time and 16 bit samples
+void capture_header_init(CaptureHeader *header, uint32_t sampleRate, uint16_t channels, const char *device);
+
+// Packs header into CAPTURE_HEADER_BYTES bytes starting with magic. Formats
+// built on this one keep their own fields in the reserved bytes
+void capture_header_pack(const CaptureHeader *header, const char *magic, uint8_t *bytes);
+
+// Returns the offset of the first frame, or 0 when bytes is not a header
+// starting with magic that this version understands
+uint32_t capture_header_unpack(const uint8_t *bytes, const char *magic, CaptureHeader *header);
+
+// Reads just the header. False when path is not a binary capture
+bool capture_read_header(const char *path, CaptureHeader *header);
+
+bool capture_writer_open(CaptureWriter *writer, const char *path, const CaptureHeader *header);
+bool capture_writer_write(CaptureWriter *writer, const int16_t *frames, uint32_t numFrames);
+
+// Fills in the final frame count and closes the file
+bool capture_writer_close(CaptureWriter *writer);
+
+// Maps a capture. A capture that was never closed is read up to its last whole frame
+bool capture_reader_open(CaptureReader *reader, const char *path);
+void capture_reader_close(CaptureReader *reader);
+
+// Copies one channel of numFrames frames from firstFrame on into samples
+void capture_read_channel(const CaptureReader *reader, uint64_t firstFrame, uint32_t numFrames,
+                          int channel, int16_t *samples);
+
+// Incremental parser for the older one sample per line text captures
+typedef struct {
+    long long value;
+    bool negative;
+    bool inNumber;
+} CaptureTextParser;
+
+// Parses text until maxSamples are found. used is set to the bytes consumed,
+// a number cut off at the end of text is carried over to the next call
+int capture_text_parse(CaptureTextParser *parser, const char *text, size_t length, size_t *used,
+                       int *samples, int maxSamples);
+
+// Returns the number the text ended in, if it did not end in a newline
+bool capture_text_finish(CaptureTextParser *parser, int *sample);
+
+#endif
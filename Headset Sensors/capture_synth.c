@@ -0,0 +1,134 @@
+/* *********************************************************************
+ * File: capture_synth.c
+ * Author: Michael Bennett
+ * Purpose: Write a synthetic binary capture of ChipCap2 packets for
+ *          trying man_decode, man_batch and the app's decoder on a line
+ *          of known quality. What was sent is printed one packet per
+ *          line so decoder output can be checked against it. With -F,
+ *          each transmission is a burst of framed readings instead, and
+ *          -E adds FEC parity to its frames. -r samples the line at
+ *          another rate, as hardware that would not run at 44.1 kHz does.
+ * Build:   cc -O2 -o capture_synth capture_synth.c signal_gen.c capture_file.c chipcap.c \
+ *             sensor_frame.c sensor_fec.c -lm
+ * Usage:   capture_synth [-n packets] [-a peak] [-s snr_db] [-c clock_offset]
+ *                        [-D clock_drift_per_s] [-o dc_offset] [-d dropouts_per_s]
+ *                        [-b bit_rate] [-e bit_error_rate] [-F sensors_per_burst] [-E]
+ *                        [-r sample_rate] [-S seed] capture.gsfc
+ * ********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "signal_gen.h"
+#include "capture_file.h"
+
+#define SYNTH_PACKETS           100
+#define SYNTH_DROPOUT_SAMPLES   441     // 10 ms, a lost IO buffer or two
+
+int main(int argc, char **argv) {
+    SignalGenConfig config;
+    SignalGenPacket *packets;
+    CaptureWriter writer;
+    CaptureHeader header;
+    int16_t *samples;
+    long long numSamples;
+    int numPackets = SYNTH_PACKETS;
+    double snrDb = -1;
+    double sampleRate = 0;
+    int opt, p;
+
+    signal_gen_default(&config);
+    config.dropoutSamples = SYNTH_DROPOUT_SAMPLES;
+
+    while ((opt = getopt(argc, argv, "n:a:s:c:D:o:d:b:e:F:Er:S:")) != -1) {
+        switch (opt) {
+            case 'n':
+                numPackets = atoi(optarg);
+                break;
+            case 'a':
+                config.amplitude = atof(optarg);
+                break;
+            case 's':
+                snrDb = atof(optarg);
+                break;
+            case 'c':
+                config.clockOffset = atof(optarg);
+                break;
+            case 'D':
+                config.clockDrift = atof(optarg);
+                break;
+            case 'o':
+                config.dcOffset = atof(optarg);
+                break;
+            case 'd':
+                config.dropoutRate = atof(optarg);
+                break;
+            case 'b':
+                config.bitRate = atof(optarg);
+                break;
+            case 'e':
+                config.bitErrorRate = atof(optarg);
+                break;
+            case 'F':
+                config.framedSensors = atoi(optarg);
+                break;
+            case 'E':
+                config.codedBursts = true;
+                break;
+            case 'r':
+                sampleRate = atof(optarg);
+                break;
+            case 'S':
+                config.seed = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+
+    if (optind + 1 != argc || numPackets <= 0) {
+        fprintf(stderr, "Usage: %s [-n packets] [-a peak] [-s snr_db] [-c clock_offset]\n"
+                        "       [-D clock_drift_per_s] [-o dc_offset] [-d dropouts_per_s]\n"
+                        "       [-b bit_rate] [-e bit_error_rate] [-F sensors_per_burst] [-E]\n"
+                        "       [-r sample_rate] [-S seed] capture.gsfc\n", argv[0]);
+        return 1;
+    }
+    if (snrDb >= 0) signal_gen_set_snr(&config, snrDb);
+    if (sampleRate > 0) {
+        // Gaps and dropouts last as long as they would at 44.1 kHz
+        double scale = sampleRate / config.sampleRate;
+        config.gapSamples = (int)(config.gapSamples * scale);
+        config.gapJitter = (int)(config.gapJitter * scale);
+        config.dropoutSamples = (int)(config.dropoutSamples * scale);
+        config.sampleRate = sampleRate;
+    }
+
+    packets = malloc(numPackets * sizeof(SignalGenPacket));
+    if (packets == NULL || (numSamples = signal_gen_render(&config, numPackets, &samples, packets)) < 0) {
+        perror("ERROR main: failed to generate the capture.\n");
+        return 1;
+    }
+
+    // SAMPLE_HIGH_MIN_AVG suits the real line's level, not every synthesized one
+    capture_header_init(&header, (uint32_t)config.sampleRate, 1, "capture_synth");
+    header.highMinAvg = signal_gen_high_min_avg(&config);
+    if (!capture_writer_open(&writer, argv[optind], &header) ||
+        !capture_writer_write(&writer, samples, (uint32_t)numSamples) ||
+        !capture_writer_close(&writer)) {
+        perror("ERROR main: failed to write the capture.\n");
+        return 1;
+    }
+
+    for (p = 0; p < numPackets; p++) {
+        const uint8_t *bytes = packets[p].bytes;
+        printf("%lld %lld 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x %.2f %.2f\n",
+               packets[p].startSample, packets[p].endSample,
+               bytes[0], bytes[1], bytes[2], bytes[3], bytes[4],
+               packets[p].humidity, packets[p].temperature);
+    }
+
+    free(samples);
+    free(packets);
+    return 0;
+}
@@ -0,0 +1,43 @@
+/* *********************************************************************
+ * File: chipcap.c
+ * Author: Michael Bennett
+ * Purpose: ChipCap2 packet check sum and reading conversion.
+ * ********************************************************************/
+#include "chipcap.h"
+
+int chipcap_checksum(const uint8_t *bytes, int numBytes) {
+    int checkSum = 0;
+    int i;
+
+    for (i = 1; i < numBytes; i++) {
+        checkSum += __builtin_popcount(bytes[i]);
+    }
+
+    return checkSum;
+}
+
+
+bool chipcap_valid(const uint8_t *bytes, int numBytes) {
+    return numBytes >= CHIPCAP_PACKET_BYTES && bytes[0] == chipcap_checksum(bytes, numBytes);
+}
+
+
+void chipcap_convert_q16(const uint8_t *bytes, int32_t *humidity, int32_t *temperature) {
+    // Get raw data from chipcap bytes
+    int32_t rawHumid = (bytes[1] >> 2) << 8 | bytes[2];
+    int32_t rawTemp = bytes[3] << 6 | bytes[4] >> 2;
+
+    // Conversion equations from ChipCap2 data sheet, raw / 2^14 in Q16.16 is raw << 2
+    *humidity = rawHumid * 100 << (FIXED_Q16_SHIFT - CHIPCAP_FULL_SCALE_BITS);
+    *temperature = (rawTemp * 165 << (FIXED_Q16_SHIFT - CHIPCAP_FULL_SCALE_BITS)) - 40 * FIXED_Q16_ONE;
+}
+
+
+void chipcap_convert(const uint8_t *bytes, float *humidity, float *temperature) {
+    int32_t humidityQ, temperatureQ;
+
+    // Both fit in a float's 24 bits, so nothing is rounded
+    chipcap_convert_q16(bytes, &humidityQ, &temperatureQ);
+    *humidity = fixed_q16_to_float(humidityQ);
+    *temperature = fixed_q16_to_float(temperatureQ);
+}
@@ -0,0 +1,32 @@
+/* *********************************************************************
+ * File: chipcap.h
+ * Author: Michael Bennett
+ * Purpose: ChipCap2 packet check sum and reading conversion shared by
+ *          the real-time decoder and the host side tools. Readings are
+ *          converted in Q16.16, which holds every ChipCap2 step exactly,
+ *          and only made floats for whoever wants them.
+ * ********************************************************************/
+#ifndef CHIPCAP_H
+#define CHIPCAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fixed_point.h"
+
+#define CHIPCAP_PACKET_BYTES    5       // Check sum followed by 4 ChipCap2 data bytes
+#define CHIPCAP_FULL_SCALE_BITS 14      // Readings are 14 bit fractions of full scale
+
+// Number of set bits in every byte after the check sum byte
+int chipcap_checksum(const uint8_t *bytes, int numBytes);
+
+// True when bytes hold a whole packet whose check sum byte matches
+bool chipcap_valid(const uint8_t *bytes, int numBytes);
+
+// Converts the 4 data bytes after the check sum into %RH and degrees C
+void chipcap_convert(const uint8_t *bytes, float *humidity, float *temperature);
+
+// Same in Q16.16, with no floating point. chipcap_convert's floats are these exactly
+void chipcap_convert_q16(const uint8_t *bytes, int32_t *humidity, int32_t *temperature);
+
+#endif
@@ -0,0 +1,75 @@
+/* *********************************************************************
+ * File: cubic_bezier.c
+ * Author: Michael Bennett
+ * Purpose: Cubic-bezier easing solved from a table of x. Convergence is
+ *          judged in t rather than x, so flat parts of the curve come
+ *          out as close as steep ones.
+ * ********************************************************************/
+#include <math.h>
+
+#include "cubic_bezier.h"
+
+static double cubic_bezier_slope_x(const CubicBezier *curve, double t) {
+    return (3.0 * curve->ax * t + 2.0 * curve->bx) * t + curve->cx;
+}
+
+
+void cubic_bezier_init(CubicBezier *curve, double x1, double y1, double x2, double y2) {
+    int i;
+
+    curve->cx = 3.0 * x1;
+    curve->bx = 3.0 * x2 - 6.0 * x1;
+    curve->ax = 1.0 - 3.0 * x2 + 3.0 * x1;
+    curve->cy = 3.0 * y1;
+    curve->by = 3.0 * y2 - 6.0 * y1;
+    curve->ay = 1.0 - 3.0 * y2 + 3.0 * y1;
+
+    for (i = 0; i < CUBIC_BEZIER_SAMPLES; i++) {
+        curve->samples[i] = cubic_bezier_x(curve, i * CUBIC_BEZIER_STEP);
+    }
+}
+
+
+double cubic_bezier_solve(const CubicBezier *curve, double x) {
+    int i = 0, n;
+
+    // x is monotonic in t, so the table brackets the answer
+    while (i < CUBIC_BEZIER_SAMPLES - 2 && curve->samples[i + 1] <= x) i++;
+
+    double start = i * CUBIC_BEZIER_STEP;
+    double end = start + CUBIC_BEZIER_STEP;
+    double width = curve->samples[i + 1] - curve->samples[i];
+    double t = width > 0 ? start + (x - curve->samples[i]) / width * CUBIC_BEZIER_STEP : start;
+
+    for (n = 0; n < CUBIC_BEZIER_NEWTON_STEPS; n++) {
+        double slope = cubic_bezier_slope_x(curve, t);
+        if (slope < CUBIC_BEZIER_MIN_SLOPE) break;
+
+        double step = (cubic_bezier_x(curve, t) - x) / slope;
+        t -= step;
+        if (t < start || t > end) break;
+        if (fabs(step) < CUBIC_BEZIER_EPSILON) return t;
+    }
+
+    // Too flat, or Newton left the interval
+    for (n = 0; n < CUBIC_BEZIER_BISECT_STEPS; n++) {
+        t = start + (end - start) / 2;
+        double error = cubic_bezier_x(curve, t) - x;
+        if (error == 0) break;
+
+        if (error > 0) {
+            end = t;
+        } else {
+            start = t;
+        }
+    }
+    return t;
+}
+
+
+double cubic_bezier_value(const CubicBezier *curve, double x) {
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+
+    return cubic_bezier_y(curve, cubic_bezier_solve(curve, x));
+}
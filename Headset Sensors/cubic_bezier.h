@@ -0,0 +1,44 @@
+/* *********************************************************************
+ * File: cubic_bezier.h
+ * Author: Michael Bennett
+ * Purpose: CSS style cubic-bezier easing, from (0, 0) to (1, 1) through
+ *          control points (x1, y1) and (x2, y2). x is sampled once when
+ *          the curve is set up; each value starts Newton-Raphson from
+ *          that table and only bisects inside one sample interval where
+ *          the slope is too flat for Newton to be trusted. Plain C so it
+ *          also builds off iOS, GSFEasing hands it to RBBAnimation.
+ * ********************************************************************/
+#ifndef CUBIC_BEZIER_H
+#define CUBIC_BEZIER_H
+
+#define CUBIC_BEZIER_SAMPLES        11
+#define CUBIC_BEZIER_STEP           (1.0 / (CUBIC_BEZIER_SAMPLES - 1))
+#define CUBIC_BEZIER_EPSILON        1e-9    // In t, so the eased value is as close where x is flat
+#define CUBIC_BEZIER_NEWTON_STEPS   4
+#define CUBIC_BEZIER_MIN_SLOPE      1e-3
+#define CUBIC_BEZIER_BISECT_STEPS   27      // Halves a sample interval past the epsilon
+
+typedef struct {
+    double ax, bx, cx;              // x(t) = ((ax t + bx) t + cx) t
+    double ay, by, cy;              // and y(t) the same
+    double samples[CUBIC_BEZIER_SAMPLES];   // x at every CUBIC_BEZIER_STEP of t
+} CubicBezier;
+
+// x1 and x2 must be in [0, 1] so x is monotonic in t
+void cubic_bezier_init(CubicBezier *curve, double x1, double y1, double x2, double y2);
+
+// t where the curve reaches x, for x in [0, 1]
+double cubic_bezier_solve(const CubicBezier *curve, double x);
+
+// Eased value at x, x clamped to [0, 1]
+double cubic_bezier_value(const CubicBezier *curve, double x);
+
+static inline double cubic_bezier_x(const CubicBezier *curve, double t) {
+    return ((curve->ax * t + curve->bx) * t + curve->cx) * t;
+}
+
+static inline double cubic_bezier_y(const CubicBezier *curve, double t) {
+    return ((curve->ay * t + curve->by) * t + curve->cy) * t;
+}
+
+#endif
@@ -0,0 +1,147 @@
+/* *********************************************************************
+ * File: cubic_bezier_test.c
+ * Author: Michael Bennett
+ * Purpose: Host test and benchmark of cubic_bezier against the easing
+ *          RBBCubicBezier computed before Patches/RBBCubicBezier.patch,
+ *          ten rounds of bisection over the whole of t for every value.
+ *          Checks how far each is from the curve bisected to the last
+ *          bit of t on the CSS curves and two flat sloped ones, then
+ *          times a whole animation's worth of values per curve, the way
+ *          RBBAnimation asks for them.
+ * Build:   cc -O2 -o cubic_bezier_test cubic_bezier_test.c cubic_bezier.c -lm
+ * Usage:   cubic_bezier_test [frames_per_animation]
+ * ********************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cubic_bezier.h"
+
+#define EASING_FRAMES           600     // RBBAnimation values for a 10 s animation at 60 fps
+#define EASING_ACCURACY_POINTS  100001
+#define EASING_MAX_ERROR        1e-6    // Eased value may be this far from the exact one where x has a slope
+#define EASING_MIN_SECONDS      0.2     // Each timing runs at least this long
+
+static const struct {
+    const char *name;
+    double x1, y1, x2, y2;
+    double maxError;
+} easingCurves[] = {
+    { "ease", 0.25, 0.1, 0.25, 1.0, EASING_MAX_ERROR },
+    { "ease-in", 0.42, 0.0, 1.0, 1.0, EASING_MAX_ERROR },
+    { "ease-out", 0.0, 0.0, 0.58, 1.0, EASING_MAX_ERROR },
+    { "ease-in-out", 0.42, 0.0, 0.58, 1.0, EASING_MAX_ERROR },
+    { "flat middle", 0.0, 0.8, 1.0, 0.2, EASING_MAX_ERROR },
+    // x goes flat as a cube at t = 0.5, where rounding x alone moves t ~1e-5
+    { "flat ends", 1.0, 0.0, 0.0, 1.0, 1e-4 },
+};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ *  RBBCubicBezier's easing unpatched: up to ten rounds of bisection over
+ *  the whole of t.
+ */
+static double easing_bisect(double x, double x1, double y1, double x2, double y2) {
+    CubicBezier curve;
+    double start = 0, end = 1, t, error;
+    int i = 0;
+
+    curve.ax = 1.0 - 3.0 * x2 + 3.0 * x1, curve.bx = 3.0 * x2 - 6.0 * x1, curve.cx = 3.0 * x1;
+    curve.ay = 1.0 - 3.0 * y2 + 3.0 * y1, curve.by = 3.0 * y2 - 6.0 * y1, curve.cy = 3.0 * y1;
+    do {
+        t = start + (end - start) / 2;
+        error = cubic_bezier_x(&curve, t) - x;
+        if (error > 0) end = t;
+        else start = t;
+    } while (fabs(error) > 0.0000001 && ++i < 10);
+
+    return cubic_bezier_y(&curve, t);
+}
+
+/**
+ *  Eased value bisected to the last bit of t.
+ */
+static double easing_exact(const CubicBezier *curve, double x) {
+    double start = 0, end = 1;
+    int i;
+
+    for (i = 0; i < 64; i++) {
+        double t = start + (end - start) / 2;
+        if (cubic_bezier_x(curve, t) > x) end = t;
+        else start = t;
+    }
+    return cubic_bezier_y(curve, start + (end - start) / 2);
+}
+
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : EASING_FRAMES;
+    volatile double sink = 0;
+    int failed = 0, c;
+
+    if (frames < 2) frames = EASING_FRAMES;
+
+    printf("easing: %d frames per animation, errors over %d points\n", frames, EASING_ACCURACY_POINTS);
+    printf("  %-12s %12s %12s %12s %12s %10s\n", "curve", "old error", "new error", "old ns", "new ns", "init ns");
+    for (c = 0; c < (int)(sizeof(easingCurves) / sizeof(easingCurves[0])); c++) {
+        double x1 = easingCurves[c].x1, y1 = easingCurves[c].y1, x2 = easingCurves[c].x2, y2 = easingCurves[c].y2;
+        CubicBezier curve;
+        double oldError = 0, newError = 0, start, oldSeconds, newSeconds, initSeconds;
+        long long runs;
+        int k;
+
+        cubic_bezier_init(&curve, x1, y1, x2, y2);
+        for (k = 0; k < EASING_ACCURACY_POINTS; k++) {
+            double x = (double)k / (EASING_ACCURACY_POINTS - 1);
+            double exact = easing_exact(&curve, x);
+            double e = fabs(easing_bisect(x, x1, y1, x2, y2) - exact);
+            if (e > oldError) oldError = e;
+            e = fabs(cubic_bezier_value(&curve, x) - exact);
+            if (e > newError) newError = e;
+        }
+
+        // The values for one animation, as RBBAnimation asks for them
+        runs = 0;
+        start = now_seconds();
+        do {
+            for (k = 0; k < frames; k++) sink += easing_bisect((double)k / (frames - 1), x1, y1, x2, y2);
+            runs++;
+        } while ((oldSeconds = now_seconds() - start) < EASING_MIN_SECONDS);
+        oldSeconds /= runs * frames;
+
+        // A new curve each run, so its setup is counted as an animation would pay it
+        runs = 0;
+        start = now_seconds();
+        do {
+            cubic_bezier_init(&curve, x1, y1 + runs * 1e-12, x2, y2);
+            for (k = 0; k < frames; k++) sink += cubic_bezier_value(&curve, (double)k / (frames - 1));
+            runs++;
+        } while ((newSeconds = now_seconds() - start) < EASING_MIN_SECONDS);
+        newSeconds /= runs * frames;
+
+        runs = 0;
+        start = now_seconds();
+        do {
+            cubic_bezier_init(&curve, x1, y1 + runs * 1e-12, x2, y2);
+            sink += curve.samples[runs % CUBIC_BEZIER_SAMPLES];
+            runs++;
+        } while ((initSeconds = now_seconds() - start) < EASING_MIN_SECONDS);
+        initSeconds /= runs;
+
+        printf("  %-12s %12.2e %12.2e %12.1f %12.1f %10.1f\n", easingCurves[c].name, oldError, newError,
+               oldSeconds * 1e9, newSeconds * 1e9, initSeconds * 1e9);
+
+        if (newError > easingCurves[c].maxError || newError > oldError) {
+            printf("ERROR main: %s is %.2e off the exact value\n", easingCurves[c].name, newError);
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+/* *********************************************************************
+ * File: fixed_point.h
+ * Author: Michael Bennett
+ * Purpose: Integer helpers for the decode core, so it runs the same on
+ *          a part without an FPU or a fast divider. A divisor known only
+ *          at run time is turned into a multiply and a shift once
+ *          (Granlund and Montgomery's round-up method), and gives the
+ *          same quotient as / for every numerator from 0 to INT32_MAX.
+ *          Readings are Q16.16, 16 fraction bits.
+ * ********************************************************************/
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <stdint.h>
+
+#define FIXED_Q16_SHIFT     16
+#define FIXED_Q16_ONE       (1 << FIXED_Q16_SHIFT)
+
+typedef struct {
+    uint32_t multiplier;            // ceil(2^shift / divisor), always under 2^32
+    int shift;                      // 31 + ceil(log2(divisor))
+} FixedRecip;
+
+// divisor must be from 1 to INT32_MAX. Not for the inner loop, it divides
+static inline FixedRecip fixed_recip(uint32_t divisor) {
+    FixedRecip recip;
+    int bits = 0;
+
+    while (bits < 31 && (1u << bits) < divisor) bits++;
+    recip.shift = 31 + bits;
+    recip.multiplier = (uint32_t)(((1ull << recip.shift) + divisor - 1) / divisor);
+    return recip;
+}
+
+// numerator / divisor for numerator from 0 to INT32_MAX
+static inline int32_t fixed_div(int32_t numerator, FixedRecip recip) {
+    return (int32_t)(((uint64_t)(uint32_t)numerator * recip.multiplier) >> recip.shift);
+}
+
+static inline float fixed_q16_to_float(int32_t q) {
+    return (float)q / FIXED_Q16_ONE;
+}
+
+#endif
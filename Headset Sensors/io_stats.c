@@ -0,0 +1,140 @@
+/* *********************************************************************
+ * File: io_stats.c
+ * Author: Michael Bennett
+ * Purpose: Render callback instrumentation published through a sequence
+ *          count. The writer makes the count odd, updates the counters
+ *          and makes it even again; a reader copies the counters between
+ *          two reads of an even, unchanged count.
+ * ********************************************************************/
+#include <string.h>
+#include <time.h>
+
+#if defined(__APPLE__)
+    #include <mach/mach_time.h>
+#endif
+
+#include "io_stats.h"
+
+#define NS_PER_US   1000
+
+void io_stats_init(IoStats *stats, double sampleRate) {
+    memset(stats, 0, sizeof(*stats));
+    stats->sampleRate = sampleRate;
+}
+
+
+uint64_t io_stats_now_ns(void) {
+#if defined(__APPLE__)
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) mach_timebase_info(&timebase);
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+int io_stats_bucket(uint64_t durationNs) {
+    uint64_t us = durationNs / NS_PER_US;
+    int msb, bucket;
+
+    if (us < 4) return (int)us;
+
+    // Octave from the top bit, quarter octave from the two below it
+    msb = 63 - __builtin_clzll(us);
+    bucket = (msb - 1) * 4 + (int)((us >> (msb - 2)) & 3);
+
+    return bucket < IO_STATS_BUCKETS ? bucket : IO_STATS_BUCKETS - 1;
+}
+
+
+uint64_t io_stats_bucket_floor_ns(int bucket) {
+    if (bucket < 4) return (uint64_t)bucket * NS_PER_US;
+    return ((uint64_t)(4 + bucket % 4) << (bucket / 4 - 1)) * NS_PER_US;
+}
+
+
+void io_stats_record(IoStats *stats, uint64_t startNs, uint64_t endNs, const IoStatsCycle *cycle) {
+    IoStatsCounters *c = &stats->counters;
+    uint64_t duration = endNs > startNs ? endNs - startNs : 0;
+    uint64_t periodNs = stats->sampleRate > 0 ? (uint64_t)(cycle->frames * 1e9 / stats->sampleRate) : 0;
+    uint32_t sequence = stats->sequence;
+
+    __atomic_store_n(&stats->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    c->callbacks++;
+    if (periodNs && duration > periodNs) c->deadlineMisses++;
+    if (periodNs && stats->lastStartNs && startNs - stats->lastStartNs >= IO_STATS_OVERRUN_FACTOR * periodNs)
+        c->overruns++;
+    c->frames += cycle->frames;
+    c->samples += cycle->samples;
+    c->bits += cycle->bits;
+    c->packets += cycle->packets;
+    c->badPackets += cycle->badPackets;
+    c->corrected += cycle->corrected;
+    c->retries += cycle->retries;
+    c->naks += cycle->naks;
+    c->durationSumNs += duration;
+    if (duration > c->durationMaxNs) c->durationMaxNs = duration;
+    c->histogram[io_stats_bucket(duration)]++;
+    stats->lastStartNs = startNs;
+
+    __atomic_store_n(&stats->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+void io_stats_snapshot(const IoStats *stats, IoStatsCounters *out) {
+    uint32_t before, after;
+
+    do {
+        before = __atomic_load_n(&stats->sequence, __ATOMIC_ACQUIRE);
+        memcpy(out, &stats->counters, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&stats->sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+
+void io_stats_merge(IoStatsCounters *total, const IoStatsCounters *counters) {
+    int b;
+
+    total->callbacks += counters->callbacks;
+    total->deadlineMisses += counters->deadlineMisses;
+    total->overruns += counters->overruns;
+    total->frames += counters->frames;
+    total->samples += counters->samples;
+    total->bits += counters->bits;
+    total->packets += counters->packets;
+    total->badPackets += counters->badPackets;
+    total->corrected += counters->corrected;
+    total->retries += counters->retries;
+    total->naks += counters->naks;
+    total->durationSumNs += counters->durationSumNs;
+    if (counters->durationMaxNs > total->durationMaxNs) total->durationMaxNs = counters->durationMaxNs;
+    for (b = 0; b < IO_STATS_BUCKETS; b++) {
+        total->histogram[b] += counters->histogram[b];
+    }
+}
+
+
+uint64_t io_stats_percentile_ns(const IoStatsCounters *counters, double p) {
+    uint64_t rank = (uint64_t)(counters->callbacks * p / 100.0);
+    uint64_t seen = 0;
+    int b;
+
+    if (counters->callbacks == 0) return 0;
+    if (rank >= counters->callbacks) rank = counters->callbacks - 1;
+
+    for (b = 0; b < IO_STATS_BUCKETS - 1; b++) {
+        seen += counters->histogram[b];
+        if (seen > rank) break;
+    }
+    if (b == IO_STATS_BUCKETS - 1) return counters->durationMaxNs;
+
+    // Upper edge of the bucket, but never past the longest callback seen
+    uint64_t edge = io_stats_bucket_floor_ns(b + 1);
+    return edge < counters->durationMaxNs ? edge : counters->durationMaxNs;
+}
@@ -0,0 +1,76 @@
+/* *********************************************************************
+ * File: io_stats.h
+ * Author: Michael Bennett
+ * Purpose: Lock free instrumentation for the audio render callback. Each
+ *          writing thread owns one IoStats and records one cycle at a
+ *          time without locking or allocating. Any other thread can take
+ *          a consistent snapshot, retrying if a cycle was being recorded
+ *          while it copied.
+ * ********************************************************************/
+#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IO_STATS_BUCKETS        64      // Callback duration histogram, 4 buckets per octave of us up to ~65 ms
+#define IO_STATS_OVERRUN_FACTOR 2       // A callback this many periods after the last means a buffer was lost
+
+// What one callback did, besides taking time
+typedef struct {
+    uint32_t frames;                // Frames in the buffer
+    uint32_t samples;               // Samples run through the decoder
+    uint32_t bits;                  // Bits decoded
+    uint32_t packets;               // Packets with a good check sum
+    uint32_t badPackets;            // Packets that failed their check sum
+    uint32_t corrected;             // Good packets the FEC had to put right
+    uint32_t retries;               // Cycles skipped by waitACycle before asking again
+    uint32_t naks;                  // Failed frames asked for again instead
+} IoStatsCycle;
+
+typedef struct {
+    uint64_t callbacks;
+    uint64_t deadlineMisses;        // Callbacks that took longer than their buffer lasts
+    uint64_t overruns;              // Callbacks that started a whole buffer late
+    uint64_t frames;
+    uint64_t samples;
+    uint64_t bits;
+    uint64_t packets;
+    uint64_t badPackets;
+    uint64_t corrected;
+    uint64_t retries;
+    uint64_t naks;
+    uint64_t durationSumNs;
+    uint64_t durationMaxNs;
+    uint32_t histogram[IO_STATS_BUCKETS];
+} IoStatsCounters;
+
+typedef struct {
+    uint32_t sequence;              // Odd while a cycle is being recorded
+    IoStatsCounters counters;
+    double sampleRate;
+    uint64_t lastStartNs;           // Only read by the writer
+} IoStats;
+
+void io_stats_init(IoStats *stats, double sampleRate);
+
+// Monotonic clock the callback is timed with
+uint64_t io_stats_now_ns(void);
+
+// Writer: records one callback that ran from startNs to endNs
+void io_stats_record(IoStats *stats, uint64_t startNs, uint64_t endNs, const IoStatsCycle *cycle);
+
+// Reader: copies a consistent set of counters, never blocks the writer
+void io_stats_snapshot(const IoStats *stats, IoStatsCounters *out);
+
+// Adds the counters of another thread or another snapshot into total
+void io_stats_merge(IoStatsCounters *total, const IoStatsCounters *counters);
+
+// Histogram bucket for a duration, and the shortest duration in each bucket
+int io_stats_bucket(uint64_t durationNs);
+uint64_t io_stats_bucket_floor_ns(int bucket);
+
+// Callback duration at percentile p (0-100), the upper edge of its bucket
+uint64_t io_stats_percentile_ns(const IoStatsCounters *counters, double p);
+
+#endif
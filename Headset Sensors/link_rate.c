@@ -0,0 +1,248 @@
+/* *********************************************************************
+ * File: link_rate.c
+ * Author: Michael Bennett
+ * Purpose: Bit rate training and the command tone messages. A
+ *          rate is judged LINK_EVAL_PACKETS packets at a time; passing
+ *          a judging clears the rate's hold, failing one backs off a
+ *          step. Holds count good packets at any rate, so a flaky rate
+ *          is retried sooner when readings are coming in quickly.
+ * ********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "link_rate.h"
+
+#define RATE_HALF(half, windows)    half,
+static const int linkHalfPeriods[LINK_RATES] = { MAN_LINE_RATES(RATE_HALF) };
+
+void link_rate_init(LinkRate *link, double sampleRate) {
+    int r;
+
+    memset(link, 0, sizeof(*link));
+    link->maxSilentFrames = (uint64_t)(LINK_SILENT_SECONDS * sampleRate);
+    for (r = 0; r < LINK_RATES; r++) link->holdLength[r] = LINK_HOLD_PACKETS;
+}
+
+
+int link_rate_half_period(int rate) {
+    if (rate < 0) rate = 0;
+    if (rate >= LINK_RATES) rate = LINK_RATES - 1;
+    return linkHalfPeriods[rate];
+}
+
+
+double link_rate_bits_per_second(int rate, double sampleRate) {
+    return sampleRate / (2 * link_rate_half_period(rate));
+}
+
+static void link_rate_set(LinkRate *link, int rate) {
+    link->rate = rate;
+    link->goodRun = 0;
+    link->evalGood = 0;
+    link->evalBad = 0;
+    link->silentFrames = 0;
+    link->changes++;
+}
+
+/**
+ *  Drops a step and keeps the failed rate off for its hold, doubling the next one.
+ */
+static void link_rate_back_off(LinkRate *link) {
+    int failed = link->rate;
+
+    link->hold[failed] = link->holdLength[failed];
+    if (link->holdLength[failed] < LINK_MAX_HOLD_PACKETS) link->holdLength[failed] *= 2;
+    link_rate_set(link, failed - 1);
+}
+
+
+bool link_rate_update(LinkRate *link, int good, int bad, uint32_t frames) {
+    int r;
+
+    if (good == 0 && bad == 0) {
+        link->silentFrames += frames;
+        if (link->rate > 0 && link->silentFrames > link->maxSilentFrames) {
+            link_rate_back_off(link);
+            return true;
+        }
+        return false;
+    }
+    link->silentFrames = 0;
+
+    for (r = 0; r < LINK_RATES; r++) {
+        link->hold[r] = link->hold[r] > good ? link->hold[r] - good : 0;
+    }
+    link->goodRun = bad ? good : link->goodRun + good;
+    link->evalGood += good;
+    link->evalBad += bad;
+
+    if (link->rate > 0 && link->evalBad > LINK_MAX_BAD) {
+        link_rate_back_off(link);
+        return true;
+    }
+    if (link->evalGood + link->evalBad >= LINK_EVAL_PACKETS) {
+        link->holdLength[link->rate] = LINK_HOLD_PACKETS;
+        link->evalGood = 0;
+        link->evalBad = 0;
+    }
+
+    if (link->goodRun >= LINK_UP_PACKETS && link->rate + 1 < LINK_RATES && link->hold[link->rate + 1] == 0) {
+        link_rate_set(link, link->rate + 1);
+        return true;
+    }
+    return false;
+}
+
+
+void link_command_init(LinkCommand *command, double sampleRate) {
+    memset(command, 0, sizeof(*command));
+    command->chipFrames = (uint32_t)(LINK_CHIP_SECONDS * sampleRate);
+    if (command->chipFrames == 0) command->chipFrames = 1;
+}
+
+
+bool link_command_send(LinkCommand *command, int message) {
+    if (command->queueCount == LINK_COMMAND_QUEUE) {
+        command->dropped++;
+        return false;
+    }
+    command->queue[(command->queueHead + command->queueCount) % LINK_COMMAND_QUEUE] = (uint8_t)message;
+    command->queueCount++;
+    return true;
+}
+
+
+bool link_command_active(const LinkCommand *command) {
+    return command->frame < command->length || command->queueCount > 0;
+}
+
+/**
+ *  Off through the gap, on for the start chip, then each bit as a chip pair.
+ */
+static bool link_command_chip_on(const LinkCommand *command, uint32_t chip) {
+    if (chip < LINK_GAP_CHIPS) return false;
+    if (chip == LINK_GAP_CHIPS) return true;
+
+    uint32_t data = chip - LINK_GAP_CHIPS - 1;
+    int bit = (command->message >> (LINK_MESSAGE_BITS - 1 - data / 2)) & 1;
+    return data % 2 == 0 ? bit : !bit;
+}
+
+
+uint32_t link_command_render(LinkCommand *command, ToneGen *tone, int16_t *out, uint32_t numFrames, uint32_t stride) {
+    uint32_t done = 0;
+
+    while (done < numFrames && link_command_active(command)) {
+        if (command->frame >= command->length) {
+            command->message = command->queue[command->queueHead];
+            command->queueHead = (command->queueHead + 1) % LINK_COMMAND_QUEUE;
+            command->queueCount--;
+            command->frame = 0;
+            command->length = LINK_MESSAGE_CHIPS * command->chipFrames;
+        }
+
+        uint32_t chip = command->frame / command->chipFrames;
+        uint32_t n = (chip + 1) * command->chipFrames - command->frame;
+        if (n > numFrames - done) n = numFrames - done;
+
+        if (link_command_chip_on(command, chip))
+            tone_gen_render_s16(tone, out + done * stride, n, stride);
+        else
+            tone_gen_render_silent(tone, out + done * stride, n, stride);
+        command->frame += n;
+        done += n;
+    }
+
+    return done;
+}
+
+
+void link_listener_init(LinkListener *listener, double sampleRate, int threshold) {
+    memset(listener, 0, sizeof(*listener));
+    listener->chipFrames = (uint32_t)(LINK_CHIP_SECONDS * sampleRate);
+    listener->threshold = threshold;
+}
+
+/**
+ *  Decides each data chip by the majority of its blocks. A pair that isn't
+ *  on-off or off-on was no message.
+ */
+static int link_listener_message(const LinkListener *listener) {
+    int message = 0, b;
+
+    for (b = 0; b < LINK_MESSAGE_BITS; b++) {
+        bool first = 2 * listener->chipOn[2 * b] > listener->chipBlocks[2 * b];
+        bool second = 2 * listener->chipOn[2 * b + 1] > listener->chipBlocks[2 * b + 1];
+        if (first == second) return -1;
+        message = message << 1 | first;
+    }
+    return message;
+}
+
+/**
+ *  One block decided. Tone back after at least most of a gap starts a
+ *  message, after less it was the host asking again. Chips are timed from
+ *  the start chip's edge.
+ */
+static int link_listener_block(LinkListener *listener, bool on) {
+    uint32_t gap = LINK_GAP_CHIPS * listener->chipFrames - listener->chipFrames / 2;
+    int message = -1;
+
+    if (on != listener->on) {
+        if (on && listener->run >= gap) {
+            listener->inMessage = true;
+            listener->at = 0;
+            memset(listener->chipOn, 0, sizeof(listener->chipOn));
+            memset(listener->chipBlocks, 0, sizeof(listener->chipBlocks));
+        } else if (on && !listener->inMessage && listener->wasRequested) {
+            listener->retries++;
+        }
+        if (!on) listener->wasRequested = listener->requested;
+        listener->on = on;
+        listener->run = 0;
+    }
+    listener->run += LINK_LISTEN_BLOCK;
+
+    if (!on) {
+        listener->requested = false;
+    } else if (listener->run >= LINK_REQUEST_CHIPS * listener->chipFrames) {
+        // Messages never hold the tone this long
+        listener->requested = true;
+        listener->inMessage = false;
+    }
+
+    if (listener->inMessage) {
+        uint32_t chip = listener->at / listener->chipFrames;
+        if (chip >= 1 && chip <= 2 * LINK_MESSAGE_BITS) {
+            listener->chipOn[chip - 1] += on;
+            listener->chipBlocks[chip - 1]++;
+        }
+        listener->at += LINK_LISTEN_BLOCK;
+
+        if (listener->at >= (2 * LINK_MESSAGE_BITS + 1) * listener->chipFrames) {
+            listener->inMessage = false;
+            message = link_listener_message(listener);
+            if (message >= 0 && !(message & LINK_MSG_NAK)) listener->rate = message;
+        }
+    }
+    return message;
+}
+
+
+int link_listener_feed(LinkListener *listener, const int16_t *samples, uint32_t numFrames, uint32_t stride) {
+    int heard = -1;
+    uint32_t k;
+
+    for (k = 0; k < numFrames; k++) {
+        int mag = abs(samples[k * stride]);
+        if (mag > listener->blockPeak) listener->blockPeak = mag;
+
+        if (++listener->blockFill == LINK_LISTEN_BLOCK) {
+            int message = link_listener_block(listener, listener->blockPeak > listener->threshold);
+            if (message >= 0) heard = message;
+            listener->blockFill = 0;
+            listener->blockPeak = 0;
+        }
+    }
+    return heard;
+}
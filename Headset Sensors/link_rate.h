@@ -0,0 +1,122 @@
+/* *********************************************************************
+ * File: link_rate.h
+ * Author: Michael Bennett
+ * Purpose: Link training for the sensor's bit rate, and the messages
+ *          the host keys onto the command tone. The rates are the
+ *          MAN_LINE_RATES timings, slowest first. LinkRate steps the
+ *          rate up after a run of good packets and backs it off when
+ *          check sums start failing or nothing decodes at all, holding
+ *          a rate that failed off for longer each time it fails again.
+ *          A message is a gap in the request tone, a start chip, then 8
+ *          Manchester coded chip pairs, MSB first: on-off for a 1,
+ *          off-on for a 0. The tone never stays on for LINK_REQUEST_CHIPS
+ *          inside a message, so the sensor can tell the steady request
+ *          from it. A sensor that ignores messages keeps sending at the
+ *          base rate and the host backs off to it. All of it runs on the
+ *          render thread.
+ * ********************************************************************/
+#ifndef LINK_RATE_H
+#define LINK_RATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "man_line.h"
+#include "tone_gen.h"
+
+#define LINK_RATES              4       // Entries in MAN_LINE_RATES
+#define LINK_CHIP_SECONDS       0.005   // One on or off chip of a message
+#define LINK_GAP_CHIPS          3       // Silence before each message's start chip
+#define LINK_MESSAGE_BITS       8
+#define LINK_MESSAGE_CHIPS      (LINK_GAP_CHIPS + 1 + 2 * LINK_MESSAGE_BITS)
+#define LINK_REQUEST_CHIPS      3       // Tone on this long is the request to send
+#define LINK_COMMAND_QUEUE      8       // Messages waiting to be keyed
+#define LINK_UP_PACKETS         10      // Good packets in a row before trying the next rate up
+#define LINK_EVAL_PACKETS       8       // Packets a rate is judged over
+#define LINK_MAX_BAD            2       // More bad check sums than this in one judging backs off
+#define LINK_SILENT_SECONDS     2.0     // and so does a raised rate that decodes nothing for this long
+#define LINK_HOLD_PACKETS       50      // Good packets before a rate that failed is tried again
+#define LINK_MAX_HOLD_PACKETS   3200    // Hold doubles each time the rate fails, up to this
+#define LINK_LISTEN_BLOCK       8       // Frames the listener decides tone or silence over
+
+// Messages. A rate change is the rate's index; a NAK asks the sensor to send
+// one frame of a recent burst again, by the low bits of the burst's sequence
+#define LINK_MSG_RATE(rate)         (rate)
+#define LINK_MSG_NAK                0x80
+#define LINK_MSG_NAK_OF(seq, frame) (LINK_MSG_NAK | ((seq) & 0xf) << 3 | ((frame) & 0x7))
+#define LINK_NAK_SEQUENCE(msg)      (((msg) >> 3) & 0xf)
+#define LINK_NAK_FRAME(msg)         ((msg) & 0x7)
+#define LINK_NAK_FRAMES             8       // Frames of a burst a NAK can name
+#define LINK_SEQUENCE_WINDOW        8       // Bursts the sensor keeps for resending, under the 16 a NAK tells apart
+
+typedef struct {
+    int rate;                       // Index of the current rate, 0 is HALF_PERIOD_TC
+    int goodRun;                    // Good packets in a row at this rate
+    int evalGood;                   // Packets in the current judging
+    int evalBad;
+    uint64_t silentFrames;          // Frames since the last packet, good or bad
+    uint64_t maxSilentFrames;
+    int hold[LINK_RATES];           // Good packets left before the rate may be tried again
+    int holdLength[LINK_RATES];     // Hold the rate gets the next time it fails
+    uint32_t changes;
+} LinkRate;
+
+// Keys the command tone through queued messages
+typedef struct {
+    uint32_t chipFrames;
+    uint32_t frame;                 // Next frame of the message playing
+    uint32_t length;                // Frames in it, 0 when none is playing
+    int message;
+    uint8_t queue[LINK_COMMAND_QUEUE];
+    int queueHead;
+    int queueCount;
+    uint32_t dropped;               // Messages sent with the queue full
+} LinkCommand;
+
+// Reference for the sensor side: finds messages and the request tone in
+// the command channel
+typedef struct {
+    uint32_t chipFrames;
+    int threshold;                  // A block peaking over this has the tone in it
+    uint32_t blockFill;             // Frames in the block being measured
+    int blockPeak;
+    bool on;
+    uint32_t run;                   // Frames the line has been on or off
+    bool inMessage;
+    uint32_t at;                    // Frames since the start chip began
+    int chipOn[2 * LINK_MESSAGE_BITS];      // Blocks with the tone in each data chip
+    int chipBlocks[2 * LINK_MESSAGE_BITS];
+    int rate;                       // Last rate announced
+    bool requested;                 // Steady request tone playing
+    bool wasRequested;              // and it was before the line went quiet
+    uint32_t retries;               // Short drops of the request tone, the host's waitACycle
+} LinkListener;
+
+void link_rate_init(LinkRate *link, double sampleRate);
+
+// Counts one callback's packets. True when the rate changed; the decoder
+// must follow it and the new rate be sent
+bool link_rate_update(LinkRate *link, int good, int bad, uint32_t frames);
+
+// Samples per half period at a rate
+int link_rate_half_period(int rate);
+double link_rate_bits_per_second(int rate, double sampleRate);
+
+void link_command_init(LinkCommand *command, double sampleRate);
+
+// Queues a message, false when the queue is full
+bool link_command_send(LinkCommand *command, int message);
+
+bool link_command_active(const LinkCommand *command);
+
+// Renders up to numFrames of queued messages into every stride'th entry of
+// out. Returns the frames rendered, fewer once the queue is empty
+uint32_t link_command_render(LinkCommand *command, ToneGen *tone, int16_t *out, uint32_t numFrames, uint32_t stride);
+
+void link_listener_init(LinkListener *listener, double sampleRate, int threshold);
+
+// Follows the command channel. Returns the message when one just finished
+// in these samples, otherwise -1
+int link_listener_feed(LinkListener *listener, const int16_t *samples, uint32_t numFrames, uint32_t stride);
+
+#endif
@@ -0,0 +1,600 @@
+/* *********************************************************************
+ * File: man_batch.c
+ * Author: Michael Bennett
+ * Purpose: Decode a whole archive of captures on every core and print a
+ *          summary per capture: transmissions, check sum failures and
+ *          the average humidity and temperature of the good packets.
+ *          Captures bigger than the split size are cut into segments
+ *          that decode in parallel. Segment edges are resolved at quiet
+ *          gaps so the summary does not depend on how a file was split.
+ *          Compressed captures split at blocks, and are sized by what
+ *          they hold uncompressed. Binary and compressed captures at
+ *          another rate than MAN_LINE_SAMPLE_RATE are resampled to it in
+ *          one segment, and count samples at that rate.
+ * Build:   cc -O2 -pthread -o man_batch man_batch.c man_decoder.c window_avg.c chipcap.c work_pool.c \
+ *             capture_file.c capture_codec.c resampler.c -lm
+ * Usage:   man_batch [-j threads] [-t high_min_avg] [-s split_mb] capture_or_dir ...
+ *          Directories are searched (not recursively) for binary *.gsfc
+ *          captures, compressed *.gsfz captures and *.txt captures with
+ *          one sample per line.
+ * ********************************************************************/
+#include <dirent.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "man_decoder.h"
+#include "chipcap.h"
+#include "work_pool.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "resampler.h"
+
+// Uncomment, or build with -DDEBUG, for the total decode time
+//#define DEBUG
+
+#define BATCH_READ_BYTES        (1 << 16)
+#define BATCH_FEED_SAMPLES      4096
+#define BATCH_SPLIT_MB          64      // Default segment size for big captures
+#define BATCH_MAX_SEGMENTS      1024    // Per capture
+
+// A start edge after this many LOW windows cannot be inside a transmission:
+// any three LOW half periods in a row end one, so the decoder is idle no
+// matter where decoding began. Segments hand off to each other at these edges.
+#define BATCH_SYNC_WINDOWS      (4 * NUM_SAMPLES_PER_PERIOD)
+#define BATCH_SYNC_SAMPLES      (BATCH_SYNC_WINDOWS * SAMPLES_PER_CHECK)
+
+typedef struct {
+    char *path;
+    long long size;
+    bool binary;
+    bool compressed;
+    CaptureHeader header;           // Binary and compressed captures only
+    int numSegments;
+    long long beginByte[BATCH_MAX_SEGMENTS];    // Line aligned, text captures only
+    long long beginSample[BATCH_MAX_SEGMENTS];  // Multiple of SAMPLES_PER_CHECK
+    int error;
+} BatchFile;
+
+typedef struct {
+    BatchFile *file;
+    int highMinAvg;
+    long long beginByte;
+    long long beginSample;
+    long long claimSample;          // Own packets from the first sync edge at or after this
+    long long endSample;            // Stop at the first sync edge at or after this
+
+    bool claiming;
+    bool done;
+
+    // Results
+    long long samples;
+    int packets;
+    int badPackets;
+    int goodPackets;
+    int64_t humiditySum;            // Q16.16, exact whatever order segments finish in
+    int64_t temperatureSum;
+    int error;
+} BatchSegment;
+
+static BatchFile *files;
+static int numFiles;
+static int maxFiles;
+
+
+#ifdef DEBUG
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
+static void add_file(const char *path, long long size) {
+    if (numFiles == maxFiles) {
+        maxFiles = maxFiles ? maxFiles * 2 : 64;
+        files = realloc(files, maxFiles * sizeof(BatchFile));
+        if (files == NULL) {
+            perror("ERROR add_file: failed to grow the file list.\n");
+            exit(1);
+        }
+    }
+    memset(&files[numFiles], 0, sizeof(BatchFile));
+    files[numFiles].path = strdup(path);
+    files[numFiles].size = size;
+    files[numFiles].numSegments = 1;
+    files[numFiles].binary = capture_read_header(path, &files[numFiles].header);
+    if (!files[numFiles].binary) files[numFiles].compressed = capture_codec_read_header(path, &files[numFiles].header);
+    numFiles++;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static void add_path(const char *path) {
+    struct stat st;
+    struct dirent *entry;
+    char **names = NULL;
+    int numNames = 0, maxNames = 0;
+    char full[PATH_MAX];
+    DIR *dir;
+    int i;
+
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "ERROR add_path: cannot stat %s\n", path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        add_file(path, st.st_size);
+        return;
+    }
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "ERROR add_path: cannot open directory %s\n", path);
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        size_t ext = strlen(CAPTURE_EXTENSION);
+        size_t zext = strlen(CAPTURE_CODEC_EXTENSION);
+        if ((len < 4 || strcmp(entry->d_name + len - 4, ".txt") != 0) &&
+            (len < ext || strcmp(entry->d_name + len - ext, CAPTURE_EXTENSION) != 0) &&
+            (len < zext || strcmp(entry->d_name + len - zext, CAPTURE_CODEC_EXTENSION) != 0)) continue;
+
+        if (numNames == maxNames) {
+            maxNames = maxNames ? maxNames * 2 : 64;
+            names = realloc(names, maxNames * sizeof(char *));
+            if (names == NULL) {
+                perror("ERROR add_path: failed to grow the name list.\n");
+                exit(1);
+            }
+        }
+        names[numNames++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+
+    // readdir order is arbitrary, keep the summary stable
+    qsort(names, numNames, sizeof(char *), compare_names);
+    for (i = 0; i < numNames; i++) {
+        snprintf(full, sizeof(full), "%s/%s", path, names[i]);
+        if (stat(full, &st) == 0 && S_ISREG(st.st_mode))
+            add_file(full, st.st_size);
+        free(names[i]);
+    }
+    free(names);
+}
+
+
+/**
+ *  Binary captures split at even frame counts rounded down to a window.
+ */
+static void plan_binary(BatchFile *file, int wanted) {
+    long long numFrames = (long long)file->header.numFrames;
+    int k;
+
+    for (k = 1; k < wanted; k++) {
+        file->beginSample[k] = numFrames / wanted * k / SAMPLES_PER_CHECK * SAMPLES_PER_CHECK;
+    }
+    file->numSegments = wanted;
+}
+
+/**
+ *  Picks the segment starts for a big text capture: the first line at or after
+ *  each even split of the file whose sample index falls on a window
+ *  boundary, so every segment sees the same windows a single pass would.
+ */
+static void plan_file(void *arg, int worker) {
+    BatchFile *file = arg;
+    char *buf = malloc(BATCH_READ_BYTES);
+    long long target, pos = 0, lines = 0;
+    int wanted = file->numSegments;
+    int k = 1;
+    size_t n, i;
+    FILE *f;
+
+    (void)worker;
+    file->numSegments = 1;
+
+    f = fopen(file->path, "rb");
+    if (f == NULL || buf == NULL) {
+        file->error = 1;
+        if (f != NULL) fclose(f);
+        free(buf);
+        return;
+    }
+
+    target = file->size / wanted;
+    while (k < wanted && (n = fread(buf, 1, BATCH_READ_BYTES, f)) > 0) {
+        for (i = 0; i < n && k < wanted; i++) {
+            if (buf[i] != '\n') continue;
+
+            // Next line starts at pos + i + 1 and holds sample number lines
+            lines++;
+            if (pos + (long long)i + 1 >= target && lines % SAMPLES_PER_CHECK == 0) {
+                file->beginByte[k] = pos + i + 1;
+                file->beginSample[k] = lines;
+                k++;
+                target = file->size / wanted * k;
+            }
+        }
+        pos += n;
+    }
+
+    // Drop a last segment that would start at the very end of the file
+    if (k > 1 && file->beginByte[k-1] >= file->size) k--;
+    file->numSegments = k;
+
+    fclose(f);
+    free(buf);
+}
+
+
+static void count_packet(const ManPacket *packet, void *userData) {
+    BatchSegment *seg = userData;
+    unsigned char bytes[MAN_MAX_PACKET_BITS / 8];
+    bool sync = packet->quietBefore >= BATCH_SYNC_WINDOWS;
+    int32_t humidity, temperature;
+    int num_bytes;
+
+    if (seg->done) return;
+
+    // Packets before the hand off belong to the previous segment
+    if (!seg->claiming) {
+        if (!sync || packet->startSample < seg->claimSample) return;
+        seg->claiming = true;
+    }
+    // and packets after the next hand off to the next one
+    if (sync && packet->startSample >= seg->endSample) {
+        seg->done = true;
+        return;
+    }
+
+    // Empty transmissions are noise that tripped the start edge
+    if (packet->numBits == 0) return;
+
+    seg->packets++;
+    num_bytes = man_packet_bytes(packet, bytes, (int)sizeof(bytes));
+    if (!chipcap_valid(bytes, num_bytes)) {
+        seg->badPackets++;
+        return;
+    }
+
+    chipcap_convert_q16(bytes, &humidity, &temperature);
+    seg->goodPackets++;
+    seg->humiditySum += humidity;
+    seg->temperatureSum += temperature;
+}
+
+/**
+ *  Marks the segment done once the next segment's first packet has started.
+ */
+static void check_handoff(BatchSegment *seg, const ManDecoder *dec) {
+    if (dec->startEdge && dec->packet.quietBefore >= BATCH_SYNC_WINDOWS &&
+        dec->packet.startSample >= seg->endSample)
+        seg->done = true;
+}
+
+static int decode_text(BatchSegment *seg, ManDecoder *dec) {
+    char *text = malloc(BATCH_READ_BYTES);
+    int samples[BATCH_FEED_SAMPLES];
+    CaptureTextParser parser = {0};
+    size_t length, offset, used;
+    int n;
+    FILE *f;
+
+    f = fopen(seg->file->path, "rb");
+    if (f == NULL || text == NULL || fseeko(f, seg->beginByte, SEEK_SET) != 0) {
+        if (f != NULL) fclose(f);
+        free(text);
+        return -1;
+    }
+
+    while (!seg->done && (length = fread(text, 1, BATCH_READ_BYTES, f)) > 0) {
+        for (offset = 0; offset < length; offset += used) {
+            n = capture_text_parse(&parser, text + offset, length - offset, &used, samples, BATCH_FEED_SAMPLES);
+            man_decoder_feed(dec, samples, n);
+        }
+        check_handoff(seg, dec);
+    }
+    if (capture_text_finish(&parser, &samples[0]))
+        man_decoder_feed(dec, samples, 1);
+
+    fclose(f);
+    free(text);
+    return 0;
+}
+
+/**
+ *  A resampler from sampleRate to the decoder's rate, or NULL if none can
+ *  be made.
+ */
+static Resampler *new_resampler(uint32_t sampleRate) {
+    Resampler *rs = malloc(sizeof(Resampler));
+
+    if (rs == NULL || !resampler_init(rs, sampleRate, MAN_LINE_SAMPLE_RATE)) {
+        free(rs);
+        return NULL;
+    }
+    return rs;
+}
+
+static void feed_resampled(ManDecoder *dec, Resampler *rs, const int16_t *samples, int numSamples) {
+    int16_t out[RESAMPLER_MAX_RATIO * BATCH_FEED_SAMPLES];
+    int offset, used, numOut;
+
+    for (offset = 0; offset < numSamples; offset += used) {
+        int n = numSamples - offset < BATCH_FEED_SAMPLES ? numSamples - offset : BATCH_FEED_SAMPLES;
+        numOut = resampler_process(rs, samples + offset, n, 1, out, (int)(sizeof(out) / sizeof(out[0])), &used);
+        man_decoder_feed_s16(dec, out, numOut);
+    }
+}
+
+/**
+ *  Decodes a whole capture that is not at the decoder's rate. Segment
+ *  edges are decoder samples, so these are never split.
+ */
+static int decode_resampled(ManDecoder *dec, const CaptureReader *reader) {
+    Resampler *rs = new_resampler(reader->header.sampleRate);
+    int16_t samples[BATCH_FEED_SAMPLES];
+    uint64_t frame;
+    uint32_t n;
+
+    if (rs == NULL) return -1;
+
+    for (frame = 0; frame < reader->header.numFrames; frame += n) {
+        n = reader->header.numFrames - frame < BATCH_FEED_SAMPLES ? (uint32_t)(reader->header.numFrames - frame) : BATCH_FEED_SAMPLES;
+        capture_read_channel(reader, frame, n, 0, samples);
+        feed_resampled(dec, rs, samples, n);
+    }
+
+    free(rs);
+    return 0;
+}
+
+static int decode_binary(BatchSegment *seg, ManDecoder *dec) {
+    CaptureReader reader;
+    int16_t samples[BATCH_FEED_SAMPLES];
+    uint64_t frame;
+    uint32_t n;
+    int result;
+
+    if (!capture_reader_open(&reader, seg->file->path)) return -1;
+
+    if (reader.header.sampleRate != MAN_LINE_SAMPLE_RATE) {
+        result = decode_resampled(dec, &reader);
+        capture_reader_close(&reader);
+        return result;
+    }
+
+    for (frame = (uint64_t)seg->beginSample; !seg->done && frame < reader.header.numFrames; frame += n) {
+        n = reader.header.numFrames - frame < BATCH_FEED_SAMPLES ? (uint32_t)(reader.header.numFrames - frame) : BATCH_FEED_SAMPLES;
+        if (reader.header.channels == 1) {
+            man_decoder_feed_s16(dec, reader.frames + frame, n);
+        } else {
+            capture_read_channel(&reader, frame, n, 0, samples);
+            man_decoder_feed_s16(dec, samples, n);
+        }
+        check_handoff(seg, dec);
+    }
+
+    capture_reader_close(&reader);
+    return 0;
+}
+
+/**
+ *  Decompresses from the block holding the segment's first sample, one
+ *  block at a time. A damaged block ends the capture there.
+ */
+static int decode_compressed(BatchSegment *seg, ManDecoder *dec) {
+    CaptureCodecReader reader;
+    Resampler *rs = NULL;
+    int16_t *frames;
+    uint32_t block, channels, skip;
+    int n, k;
+
+    if (!capture_codec_reader_open(&reader, seg->file->path)) return -1;
+    channels = reader.header.channels;
+    frames = malloc((size_t)reader.blockFrames * channels * sizeof(int16_t));
+    if (reader.header.sampleRate != MAN_LINE_SAMPLE_RATE) rs = new_resampler(reader.header.sampleRate);
+    if (frames == NULL || (rs == NULL && reader.header.sampleRate != MAN_LINE_SAMPLE_RATE)) {
+        free(frames);
+        capture_codec_reader_close(&reader);
+        return -1;
+    }
+
+    block = (uint32_t)(seg->beginSample / reader.blockFrames);
+    skip = (uint32_t)(seg->beginSample % reader.blockFrames);
+    for (; !seg->done && block < reader.numBlocks; block++, skip = 0) {
+        n = capture_codec_decode_block(&reader, block, frames);
+        if (n < 0) {
+            fprintf(stderr, "ERROR decode_compressed: %s block %u is damaged, stopping there\n", seg->file->path, block);
+            break;
+        }
+        if ((int)skip >= n) continue;
+        for (k = 0; k < n - (int)skip; k++) frames[k] = frames[(size_t)(k + skip) * channels];
+        if (rs != NULL) {
+            feed_resampled(dec, rs, frames, n - skip);
+        } else {
+            man_decoder_feed_s16(dec, frames, n - skip);
+        }
+        check_handoff(seg, dec);
+    }
+
+    free(rs);
+    free(frames);
+    capture_codec_reader_close(&reader);
+    return 0;
+}
+
+static void decode_segment(void *arg, int worker) {
+    BatchSegment *seg = arg;
+    long long stopSample;
+    ManDecoder dec;
+
+    (void)worker;
+
+    man_decoder_init(&dec, seg->highMinAvg, count_packet, seg);
+    man_decoder_seek(&dec, seg->beginSample);
+
+    if ((seg->file->binary ? decode_binary(seg, &dec) :
+         seg->file->compressed ? decode_compressed(seg, &dec) : decode_text(seg, &dec)) != 0) {
+        seg->error = 1;
+        return;
+    }
+    if (!seg->done) man_decoder_flush(&dec);
+
+    // Samples past the next segment's start are counted there
+    stopSample = seg->endSample == LLONG_MAX ? LLONG_MAX : seg->endSample - BATCH_SYNC_SAMPLES;
+    seg->samples = (dec.sampleCount < stopSample ? dec.sampleCount : stopSample) - seg->beginSample;
+}
+
+
+int main(int argc, char **argv) {
+    BatchSegment *segments;
+    WorkPool *pool;
+    long long splitBytes = (long long)BATCH_SPLIT_MB << 20;
+    int highMinAvg = 0;
+    int numThreads = 0;
+    int numSegments = 0;
+    int opt, i, k, s;
+    #ifdef DEBUG
+        double start = now_seconds();
+    #endif
+
+    while ((opt = getopt(argc, argv, "j:t:s:")) != -1) {
+        switch (opt) {
+            case 'j':
+                numThreads = atoi(optarg);
+                break;
+            case 't':
+                highMinAvg = atoi(optarg);
+                break;
+            case 's':
+                splitBytes = (long long)(atof(optarg) * (1 << 20));
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-j threads] [-t high_min_avg] [-s split_mb] capture_or_dir ...\n", argv[0]);
+                exit(1);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-j threads] [-t high_min_avg] [-s split_mb] capture_or_dir ...\n", argv[0]);
+        exit(1);
+    }
+    if (splitBytes < BATCH_READ_BYTES) splitBytes = BATCH_READ_BYTES;
+
+    for (i = optind; i < argc; i++) {
+        add_path(argv[i]);
+    }
+    if (numFiles == 0) return 0;
+
+    pool = work_pool_create(numThreads, numFiles * BATCH_MAX_SEGMENTS);
+    if (pool == NULL) {
+        perror("ERROR main: failed to create the worker pool.\n");
+        exit(1);
+    }
+
+    // Find the split points of the big captures, all of them at once
+    for (i = 0; i < numFiles; i++) {
+        long long size = files[i].compressed ? (long long)files[i].header.numFrames * files[i].header.channels * 2 : files[i].size;
+        long long wanted = (size + splitBytes - 1) / splitBytes;
+        if (wanted <= 1) continue;
+        if ((files[i].binary || files[i].compressed) && files[i].header.sampleRate != MAN_LINE_SAMPLE_RATE) continue;
+
+        if (wanted > BATCH_MAX_SEGMENTS) wanted = BATCH_MAX_SEGMENTS;
+        if (files[i].binary || files[i].compressed) {
+            plan_binary(&files[i], (int)wanted);
+        } else {
+            files[i].numSegments = (int)wanted;
+            work_pool_add(pool, plan_file, &files[i]);
+        }
+    }
+    work_pool_run(pool);
+
+    for (i = 0; i < numFiles; i++) {
+        numSegments += files[i].numSegments;
+    }
+    segments = calloc(numSegments, sizeof(BatchSegment));
+    if (segments == NULL) {
+        perror("ERROR main: failed to allocate segments.\n");
+        exit(1);
+    }
+
+    for (i = 0, s = 0; i < numFiles; i++) {
+        for (k = 0; k < files[i].numSegments; k++, s++) {
+            BatchSegment *seg = &segments[s];
+
+            seg->file = &files[i];
+            // Binary captures know their threshold, text dumps are NSNumber scaled
+            seg->highMinAvg = highMinAvg ? highMinAvg : files[i].binary || files[i].compressed ? files[i].header.highMinAvg : HIGH_MIN_AVG;
+            seg->beginByte = files[i].beginByte[k];
+            seg->beginSample = files[i].beginSample[k];
+            seg->claiming = k == 0;
+            seg->claimSample = files[i].beginSample[k] + BATCH_SYNC_SAMPLES;
+            seg->endSample = k + 1 < files[i].numSegments ? files[i].beginSample[k+1] + BATCH_SYNC_SAMPLES : LLONG_MAX;
+        }
+    }
+
+    // Biggest segments first so the last ones to finish are short. Dealing
+    // in reverse puts them at the back of each deque where owners start
+    for (s = numSegments - 1; s >= 0; s--) {
+        work_pool_add(pool, decode_segment, &segments[s]);
+    }
+    work_pool_run(pool);
+
+    // Summaries come out in the order the captures were given
+    long long totalSamples = 0;
+    int totalPackets = 0;
+    for (i = 0, s = 0; i < numFiles; i++) {
+        long long samples = 0;
+        int packets = 0, bad = 0, good = 0, error = files[i].error;
+        int64_t humiditySum = 0, temperatureSum = 0;
+
+        for (k = 0; k < files[i].numSegments; k++, s++) {
+            samples += segments[s].samples;
+            packets += segments[s].packets;
+            bad += segments[s].badPackets;
+            good += segments[s].goodPackets;
+            humiditySum += segments[s].humiditySum;
+            temperatureSum += segments[s].temperatureSum;
+            error |= segments[s].error;
+        }
+        totalSamples += samples;
+        totalPackets += packets;
+
+        if (error) {
+            printf("%s: ERROR failed to read capture\n", files[i].path);
+        } else if (good == 0) {
+            printf("%s: %lld samples, %d packets, %d bad CRC, no good readings\n",
+                   files[i].path, samples, packets, bad);
+        } else {
+            printf("%s: %lld samples, %d packets, %d bad CRC, humidity %.2f %%RH, temperature %.2f C\n",
+                   files[i].path, samples, packets, bad, (double)humiditySum / good / FIXED_Q16_ONE,
+                   (double)temperatureSum / good / FIXED_Q16_ONE);
+        }
+    }
+
+    #ifdef DEBUG
+        double elapsed = now_seconds() - start;
+        printf("Total: %d files in %d segments, %lld samples, %d packets\n",
+               numFiles, numSegments, totalSamples, totalPackets);
+        printf("Decoded in %.3f s on %d threads, %.1f Msamples/s\n",
+               elapsed, work_pool_threads(pool), totalSamples / elapsed / 1e6);
+    #endif
+
+    work_pool_destroy(pool);
+    free(segments);
+    for (i = 0; i < numFiles; i++) {
+        free(files[i].path);
+    }
+    free(files);
+
+    return 0;
+}
@@ -4,214 +4,299 @@
  * Purpose: Decode Manchester (IEEE) communication where the high side
  *          of a bit is represented by a square wave and low is
  *          relitively unchanging
+ * Build:   cc -O2 -o man_decode man_decode.c man_decoder.c man_demod.c window_avg.c capture_file.c \
+ *             capture_codec.c resampler.c packet_index.c chipcap.c -lm
+ * Usage:   man_decode [-m | -i index.gsfi] [-t high_min_avg] [capture.gsfc | capture.gsfz | capture.txt | -]
+ *          Maps a binary capture, decompresses a compressed one block
+ *          by block, or reads one sample per line from a text file or
+ *          stdin when no file (or "-") is given. Binary and compressed
+ *          captures default to the threshold stored in their header.
+ *          -m uses the matched filter demodulator, which needs no
+ *          threshold, instead of the window average. Binary and
+ *          compressed captures at another rate than MAN_LINE_SAMPLE_RATE
+ *          are resampled to it. -i writes every transmission found to
+ *          a packet index in the same pass, for packet_query.
  * ********************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
-#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "man_decoder.h"
+#include "man_demod.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "resampler.h"
+#include "packet_index.h"
 
 // Comment out to remove DEBUG prints
 #define DEBUG
-#define DEBUG_SUM
+//#define DEBUG_ABS         //  Writes abs of every sample to input_abs.txt
+
+#define CHUNK_SAMPLES           4096
+#define READ_BYTES              (1 << 16)
+#define MAP_CHUNK_FRAMES        (1 << 16)
+
+// Either demodulator behind one feed, both report through print_packet
+typedef struct {
+    bool matched;
+    ManDecoder boxcar;
+    ManDemod demod;
+    int numPackets;
+    PacketIndexWriter *index;       // NULL unless indexing
+} Decoder;
+
+static void decoder_feed(Decoder *dec, const int *samples, int numSamples) {
+    if (dec->matched) man_demod_feed(&dec->demod, samples, numSamples);
+    else man_decoder_feed(&dec->boxcar, samples, numSamples);
+}
 
-#define MAX_BUF                 1000000
-#define HIGH_MIN_AVG            175000
-#define LOW_STATE               0
-#define HIGH_STATE              1
-#define UNKNOWN_STATE           -1
-#define HALF_PERIOD_TC          216     // Tested working for one byte/msg
-#define NUM_SAMPLES_PER_PERIOD  8       // Tested working for one byte/msg 
-#define SAMPLES_PER_CHECK       HALF_PERIOD_TC / NUM_SAMPLES_PER_PERIOD
+static void decoder_feed_s16(Decoder *dec, const int16_t *samples, int numSamples) {
+    if (dec->matched) man_demod_feed_s16(&dec->demod, samples, numSamples);
+    else man_decoder_feed_s16(&dec->boxcar, samples, numSamples);
+}
 
-typedef enum { false, true } bool;
+static void print_packet(const ManPacket *packet, void *userData) {
+    unsigned char bytes[MAN_MAX_PACKET_BITS / 8];
+    Decoder *dec = userData;
+    int num_bytes, i;
 
-int main(int argc, char **argv) {
-    // Algorithm Variables
-    int halfPeriodCount = 0;
-    bool firstHalfPeriod = false;
-    bool startEdge = false;
-    int doubleState = LOW_STATE;
-    int curState = LOW_STATE;
-    int lastState = UNKNOWN_STATE;
-    int secondLastState = UNKNOWN_STATE;
-    int decoded_data[MAX_BUF];
-    int bit_num = 0;
-
-    int i, j, sample, num_samples;
-    int samples[MAX_BUF];
-    for (i = 0; i < MAX_BUF; ++i) {
-        samples[i] = 0;
-        decoded_data[i] = -1;
-    }
-    
-    char *filename = argv[1];
-    FILE *file_in = fopen(filename, "r");
-    if (file_in == NULL) {
-        perror("ERROR main: failed to open the input file.\n");
+    dec->numPackets++;
+    if (dec->index != NULL && !packet_index_writer_add(dec->index, packet)) {
+        perror("ERROR print_packet: failed to write the index.\n");
         exit(1);
     }
 
-    FILE *file_out = fopen("input_abs.txt","w");
-    if (file_out == NULL) {
-        perror("ERROR main: failed to open the output file.\n");
+    #ifdef DEBUG
+        printf("    !!!!! Transmission between samples %lld to %lld, %d bits\n",
+               packet->startSample, packet->endSample, packet->numBits);
+    #endif
+
+    // Convert resulting "bits" to bytes. data is Little Endian
+    printf("Decoded Bytes:\n");
+    num_bytes = man_packet_bytes(packet, bytes, (int)sizeof(bytes));
+    for (i = 0; i < num_bytes; i++) {
+        printf("0x%x\n", bytes[i]);
+    }
+    printf("\n");
+}
+
+/**
+ *  Feeds a run of the mic line, through the resampler when the capture is
+ *  not at the decoder's rate.
+ */
+static void decode_line(Decoder *dec, Resampler *rs, const int16_t *samples, int numSamples) {
+    int16_t out[RESAMPLER_MAX_RATIO * CHUNK_SAMPLES];
+    int offset, used, numOut;
+
+    if (rs == NULL) {
+        decoder_feed_s16(dec, samples, numSamples);
+        return;
+    }
+    for (offset = 0; offset < numSamples; offset += used) {
+        int n = numSamples - offset < CHUNK_SAMPLES ? numSamples - offset : CHUNK_SAMPLES;
+        numOut = resampler_process(rs, samples + offset, n, 1, out, (int)(sizeof(out) / sizeof(out[0])), &used);
+        decoder_feed_s16(dec, out, numOut);
+    }
+}
+
+/**
+ *  The resampler for a capture at sampleRate, or NULL if it needs none.
+ */
+static Resampler *line_resampler(uint32_t sampleRate) {
+    static Resampler rs;
+
+    if (sampleRate == MAN_LINE_SAMPLE_RATE) return NULL;
+    if (!resampler_init(&rs, sampleRate, MAN_LINE_SAMPLE_RATE)) {
+        fprintf(stderr, "WARNING line_resampler: can't resample %u Hz, decoding as is\n", sampleRate);
+        return NULL;
+    }
+    return &rs;
+}
+
+/**
+ *  Feeds channel 0 of a mapped binary capture straight from the mapping.
+ */
+static void decode_binary(Decoder *dec, const CaptureReader *reader) {
+    Resampler *rs = line_resampler(reader->header.sampleRate);
+    int16_t chunk[CHUNK_SAMPLES];
+    uint64_t frame;
+    uint32_t n;
+
+    if (reader->header.channels == 1) {
+        for (frame = 0; frame < reader->header.numFrames; frame += n) {
+            n = reader->header.numFrames - frame < MAP_CHUNK_FRAMES ? (uint32_t)(reader->header.numFrames - frame) : MAP_CHUNK_FRAMES;
+            decode_line(dec, rs, reader->frames + frame, n);
+        }
+        return;
+    }
+
+    for (frame = 0; frame < reader->header.numFrames; frame += n) {
+        n = reader->header.numFrames - frame < CHUNK_SAMPLES ? (uint32_t)(reader->header.numFrames - frame) : CHUNK_SAMPLES;
+        capture_read_channel(reader, frame, n, 0, chunk);
+        decode_line(dec, rs, chunk, n);
+    }
+}
+
+/**
+ *  Decompresses a compressed capture a block at a time into the decoder,
+ *  so only one block is ever held.
+ */
+static void decode_compressed(Decoder *dec, const CaptureCodecReader *reader) {
+    Resampler *rs = line_resampler(reader->header.sampleRate);
+    uint32_t channels = reader->header.channels;
+    int16_t *frames = malloc((size_t)reader->blockFrames * channels * sizeof(int16_t));
+    uint32_t block;
+    int n, k;
+
+    if (frames == NULL) {
+        perror("ERROR decode_compressed: failed to allocate a block.\n");
         exit(1);
     }
 
-    // Read samples from file, take abs, and place into an array
-    num_samples = 0;
-    for (;;) {
-        if (fscanf(file_in, "%d", &sample) <= 0) break;
-        samples[num_samples] = abs(sample);
-        fprintf(file_out, "%d\n", abs(sample));
-        num_samples++;
+    for (block = 0; block < reader->numBlocks; block++) {
+        n = capture_codec_decode_block(reader, block, frames);
+        if (n < 0) {
+            fprintf(stderr, "ERROR decode_compressed: block %u is damaged, stopping there\n", block);
+            break;
+        }
+        for (k = 1; channels > 1 && k < n; k++) frames[k] = frames[(size_t)k * channels];
+        decode_line(dec, rs, frames, n);
     }
+    free(frames);
+}
+
+/**
+ *  Parses a one sample per line capture a block at a time and feeds it.
+ */
+static void decode_text(Decoder *dec, FILE *file_in) {
+    static char text[READ_BYTES];
+    int chunk[CHUNK_SAMPLES];
+    CaptureTextParser parser = {0};
+    size_t length, offset, used;
+    int n;
+
+    #ifdef DEBUG_ABS
+        FILE *file_out = fopen("input_abs.txt","w");
+        if (file_out == NULL) {
+            perror("ERROR main: failed to open the output file.\n");
+            exit(1);
+        }
+    #endif
 
-    fclose(file_in);
-    fclose(file_out);
+    while ((length = fread(text, 1, sizeof(text), file_in)) > 0) {
+        for (offset = 0; offset < length; offset += used) {
+            n = capture_text_parse(&parser, text + offset, length - offset, &used, chunk, CHUNK_SAMPLES);
 
-    #ifdef DEBUG
-         printf("Total number of samples: %d\n", num_samples);
+            #ifdef DEBUG_ABS
+                for (int i = 0; i < n; i++) fprintf(file_out, "%d\n", abs(chunk[i]));
+            #endif
+
+            decoder_feed(dec, chunk, n);
+        }
+    }
+    if (capture_text_finish(&parser, &chunk[0]))
+        decoder_feed(dec, chunk, 1);
+
+    #ifdef DEBUG_ABS
+        fclose(file_out);
     #endif
+}
+/**
+ *  Sets up both demodulators, and the index when one was asked for.
+ */
+static void init_decoder(Decoder *dec, int highMinAvg, uint32_t captureRate, const char *indexPath) {
+    static PacketIndexWriter index;
+
+    man_decoder_init(&dec->boxcar, highMinAvg, print_packet, dec);
+    man_demod_init(&dec->demod, print_packet, dec);
+    if (indexPath == NULL) return;
+
+    if (!packet_index_writer_open(&index, indexPath, captureRate, dec->boxcar.highMinAvg)) {
+        perror("ERROR init_decoder: failed to open the index file.\n");
+        exit(1);
+    }
+    dec->index = &index;
+}
 
-    int halfPeriodSum = 0;
-    // Traverse through all samples applying Manchester Decode
-    for (i = 0; i < num_samples; i += SAMPLES_PER_CHECK) {
-        int avgSamplePrev = 0;
-        int avgSampleNext = 0;
-        int prevSamples = 0;
-        int nextSamples = 0;
-
-        // Find average value for the prev and next set of point around the expected edge
-        for (j = 0; j < SAMPLES_PER_CHECK && i+j < num_samples; j++) {
-            prevSamples += samples[i-j];
-            nextSamples += samples[i+j];
+int main(int argc, char **argv) {
+    static Decoder dec;
+    CaptureReader reader;
+    const char *indexPath = NULL;
+    int highMinAvg = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "mt:i:")) != -1) {
+        switch (opt) {
+            case 'm':
+                dec.matched = true;
+                break;
+            case 't':
+                highMinAvg = atoi(optarg);
+                break;
+            case 'i':
+                indexPath = optarg;
+                break;
+            default:
+                optind = argc + 1;
+                break;
         }
-        avgSamplePrev = prevSamples / SAMPLES_PER_CHECK;
-        avgSampleNext = nextSamples / j;
-
-        // Associate current bit value based on min/max values and check if it's the start bit
-        if ( avgSampleNext >= HIGH_MIN_AVG ) {
-            curState = HIGH_STATE;
-            // Only enters this statement for the rising edge of the start signal
-            if (!startEdge) {
-
-        #ifdef DEBUG
-            printf("    !!!!! Start between samples %d to %d\n\n\n",i ,i+j);
-        #endif
-
-                startEdge = true;
-                firstHalfPeriod = true;
-                halfPeriodCount = SAMPLES_PER_CHECK;
-                halfPeriodSum = 0;
-                doubleState = LOW_STATE;
-            }
-        } else {
-            curState = LOW_STATE;
+    }
+
+    // The index's seek points are where the window average decoder is idle
+    if (optind > argc || optind + 1 < argc || (dec.matched && indexPath != NULL)) {
+        fprintf(stderr, "Usage: %s [-m | -i index.gsfi] [-t high_min_avg] [capture.gsfc | capture.gsfz | capture.txt | -]\n", argv[0]);
+        exit(1);
+    }
+
+    const char *path = optind < argc && strcmp(argv[optind], "-") != 0 ? argv[optind] : NULL;
+    CaptureHeader header;
+
+    if (path != NULL && capture_read_header(path, &header)) {
+        if (!capture_reader_open(&reader, path)) {
+            perror("ERROR main: failed to map the input file.\n");
+            exit(1);
         }
 
-        halfPeriodSum += avgSampleNext;
-
-
-        #ifdef DEBUG
-            printf("Avg for samples %d to %d: %d\n",i ,i+j , avgSampleNext);
-        #endif
-
-        // When start flag is set check for data
-        if (startEdge) {
-            // Increment and check if half period is finished
-            halfPeriodCount += j;
-            if (halfPeriodCount == HALF_PERIOD_TC) {
-                if ((halfPeriodSum / NUM_SAMPLES_PER_PERIOD) > HIGH_MIN_AVG) {
-                    curState = HIGH_STATE;
-                } else {
-                    curState = LOW_STATE;
-                }
-                
-
-                #ifdef DEBUG
-                    printf("Half Period Start- doubleState: %d curState:%d lastState:%d secondLastState:%d\n", doubleState, curState, lastState, secondLastState);
-                #endif
-
-                #ifdef DEBUG_SUM
-                    printf("Half period sum: %d\n", halfPeriodSum);
-                    printf("Number of samples per period: %d\n", NUM_SAMPLES_PER_PERIOD);
-                    printf("Half period Average: %d && Cutoff: %d\n", (halfPeriodSum / NUM_SAMPLES_PER_PERIOD), HIGH_MIN_AVG);
-                    printf("Half period State: %d\n", (halfPeriodSum / NUM_SAMPLES_PER_PERIOD) > HIGH_MIN_AVG);
-                    printf("Half Period Count: %d\n",halfPeriodCount);
-                #endif
-
-                // Reset half period count and sumation
-                halfPeriodSum = 0;
-                halfPeriodCount = 0;
-                
-                // Check if this is the first pass after the start edge
-                if (firstHalfPeriod) {
-                    if (curState == HIGH_STATE) doubleState = HIGH_STATE;
-                    firstHalfPeriod = false;
-
-                    #ifdef DEBUG
-                        printf("    First Half Period- doubleState:%d curState:%d lastState:%d secondLastState:%d\n", doubleState, curState, lastState, secondLastState);
-                    #endif
-
-                }
-                // Check for bit flip
-                else if (curState != lastState && doubleState != curState) {
-
-                    #ifdef DEBUG
-                        printf("            ***** %d detected between samples %d to %d\n", curState, i, i+j);
-                    #endif                    
-
-                    decoded_data[bit_num] = curState;
-                    bit_num++;
-                }
-                // Check for non bit flip
-                else if (curState == lastState && lastState != secondLastState) {
-                    doubleState = curState;
-
-                    #ifdef DEBUG
-                        printf("    NonFlip- doubleState: %d curState:%d lastState:%d secondLastState:%d\n", doubleState, curState, lastState, secondLastState);
-                    #endif
-
-                }
-                // Reset input stream last three states are equivalent
-                else if (curState == lastState && lastState == secondLastState) {
-                    startEdge = false;
-
-                    #ifdef DEBUG
-                        printf("    !!!!! End of transmission detected between samples %d to %d\n", i, i+j);
-                        printf("    !!!!! curState:%d lastState:%d secondLastState:%d\n", curState, lastState, secondLastState);
-                        printf("\n\n");
-                    #endif
-
-                }
-
-                // Push state down the line
-                secondLastState = lastState;
-                lastState = curState;
-
-                #ifdef DEBUG
-                    printf("Half Period count: %d\n",halfPeriodCount);
-                    printf("Half Period sum: %d\n", halfPeriodSum);
-                    printf("Half Period End- doubleState: %d curState:%d lastState:%d secondLastState:%d\n\n\n", doubleState,curState, lastState, secondLastState);
-                #endif
-            }
+        init_decoder(&dec, highMinAvg ? highMinAvg : reader.header.highMinAvg, reader.header.sampleRate, indexPath);
+        decode_binary(&dec, &reader);
+        capture_reader_close(&reader);
+    } else if (path != NULL && capture_codec_read_header(path, &header)) {
+        CaptureCodecReader compressed;
+        if (!capture_codec_reader_open(&compressed, path)) {
+            perror("ERROR main: failed to map the input file.\n");
+            exit(1);
         }
-    }
 
-    
-    // Convert resulting "bits" to bytes. data is Little Endian
-    printf("\n\n\nDecoded Bytes:\n");
-    int byte_val = 0;
-    int power = 7;
-    for (i = bit_num; i >= 0; i--) {
-        byte_val += pow(2,power) * decoded_data[i];
-        power--;
-        if (power < 0) {
-            printf("0x%x\n",byte_val);
-            power = 7;
-            byte_val = 0;
+        init_decoder(&dec, highMinAvg ? highMinAvg : compressed.header.highMinAvg, compressed.header.sampleRate, indexPath);
+        decode_compressed(&dec, &compressed);
+        capture_codec_reader_close(&compressed);
+    } else {
+        FILE *file_in = stdin;
+        if (path != NULL) {
+            file_in = fopen(path, "r");
+            if (file_in == NULL) {
+                perror("ERROR main: failed to open the input file.\n");
+                exit(1);
+            }
         }
+
+        // Text dumps are NSNumber scaled unless they say otherwise
+        init_decoder(&dec, highMinAvg ? highMinAvg : HIGH_MIN_AVG, MAN_LINE_SAMPLE_RATE, indexPath);
+        decode_text(&dec, file_in);
+        if (file_in != stdin) fclose(file_in);
+    }
+    if (dec.matched) man_demod_flush(&dec.demod);
+    else man_decoder_flush(&dec.boxcar);
+    if (dec.index != NULL && !packet_index_writer_close(dec.index, (uint64_t)dec.boxcar.sampleCount)) {
+        perror("ERROR main: failed to finish the index file.\n");
+        exit(1);
     }
-    
+
+    #ifdef DEBUG
+         printf("Total number of samples: %lld\n", dec.matched ? dec.demod.sampleCount : dec.boxcar.sampleCount);
+         printf("Total number of transmissions: %d\n", dec.numPackets);
+    #endif
 
     return 0;
 }
@@ -0,0 +1,391 @@
+/* *********************************************************************
+ * File: man_decoder.c
+ * Author: Michael Bennett
+ * Purpose: Streaming Manchester (IEEE) decode where the high side of a
+ *          bit is represented by a square wave and low is relitively
+ *          unchanging. All state lives in ManDecoder so a capture can
+ *          be fed in chunks of any size. The window loop and the state
+ *          machine are written once, force inlined, and stamped out for
+ *          the timings in MAN_FEED_RATES with the window size and the
+ *          windows per half period as constants, so the window sum
+ *          unrolls and the divisions become multiplies and shifts. Other
+ *          timings fall back to window_avg_s16 and a reciprocal taken
+ *          when the timing is set. A half period is HIGH when its sum
+ *          reaches what the cutoff times its windows would be, so it is
+ *          never divided at all. Nothing here uses floating point.
+ * ********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "man_decoder.h"
+#include "window_avg.h"
+
+// Uncomment to add DEBUG prints
+//#define MAN_DEBUG
+//#define MAN_DEBUG_SUM
+
+static void man_emit_packet(ManDecoder *dec) {
+    if (dec->onPacket != NULL)
+        dec->onPacket(&dec->packet, dec->userData);
+
+    dec->packet.numBits = 0;
+}
+
+static void man_add_bit(ManDecoder *dec, int bit) {
+    if (dec->packet.numBits < MAN_MAX_PACKET_BITS)
+        dec->packet.bits[dec->packet.numBits] = (unsigned char)bit;
+    dec->packet.numBits++;
+}
+
+#define MAN_INLINE          static inline __attribute__((always_inline))
+#define MAN_VECTOR_SAMPLES  8       // int16 samples in a 128 bit vector
+
+/**
+ *  Runs the state machine for one window of halfPeriodTC / windowsPerHalf
+ *  samples (or fewer for the last window of a capture).
+ */
+MAN_INLINE void man_window(ManDecoder *dec, int avgSampleNext, int j, const int halfPeriodTC, const int windowsPerHalf) {
+    long long i = dec->windowStart;
+
+    // Associate current bit value based on min/max values and check if it's the start bit
+    if (avgSampleNext >= dec->highMinAvg) {
+        dec->curState = HIGH_STATE;
+        // Only enters this statement for the rising edge of the start signal
+        if (!dec->startEdge) {
+
+    #ifdef MAN_DEBUG
+            printf("    !!!!! Start between samples %lld to %lld\n\n\n", i, i+j);
+    #endif
+
+            dec->startEdge = true;
+            dec->firstHalfPeriod = true;
+            dec->halfPeriodCount = halfPeriodTC / windowsPerHalf;
+            dec->halfPeriodSum = 0;
+            dec->doubleState = LOW_STATE;
+            dec->packet.startSample = i;
+            dec->packet.numBits = 0;
+            dec->packet.quietBefore = dec->quietWindows;
+        }
+        dec->quietWindows = 0;
+    } else {
+        dec->curState = LOW_STATE;
+        if (dec->quietWindows < INT32_MAX) dec->quietWindows++;
+    }
+
+    dec->halfPeriodSum += avgSampleNext;
+
+    #ifdef MAN_DEBUG
+        printf("Avg for samples %lld to %lld: %d\n", i, i+j, avgSampleNext);
+    #endif
+
+    // Nothing else to do until the start flag is set
+    if (!dec->startEdge) return;
+
+    // Increment and check if half period is finished
+    dec->halfPeriodCount += j;
+    if (dec->halfPeriodCount != halfPeriodTC) return;
+
+    // Same as halfPeriodSum / windowsPerHalf > highMinAvg
+    if (dec->halfPeriodSum >= (dec->highMinAvg + 1) * windowsPerHalf) {
+        dec->curState = HIGH_STATE;
+    } else {
+        dec->curState = LOW_STATE;
+    }
+
+    #ifdef MAN_DEBUG_SUM
+        printf("Half period sum: %d\n", dec->halfPeriodSum);
+        printf("Half period Average: %d && Cutoff: %d\n", dec->halfPeriodSum / windowsPerHalf, dec->highMinAvg);
+        printf("Half Period Count: %d\n", dec->halfPeriodCount);
+    #endif
+
+    // Reset half period count and sumation
+    dec->halfPeriodSum = 0;
+    dec->halfPeriodCount = 0;
+
+    // Check if this is the first pass after the start edge
+    if (dec->firstHalfPeriod) {
+        if (dec->curState == HIGH_STATE) dec->doubleState = HIGH_STATE;
+        dec->firstHalfPeriod = false;
+    }
+    // Check for bit flip
+    else if (dec->curState != dec->lastState && dec->doubleState != dec->curState) {
+
+        #ifdef MAN_DEBUG
+            printf("            ***** %d detected between samples %lld to %lld\n", dec->curState, i, i+j);
+        #endif
+
+        man_add_bit(dec, dec->curState);
+    }
+    // Check for non bit flip
+    else if (dec->curState == dec->lastState && dec->lastState != dec->secondLastState) {
+        dec->doubleState = dec->curState;
+    }
+    // Reset input stream last three states are equivalent
+    else if (dec->curState == dec->lastState && dec->lastState == dec->secondLastState) {
+        dec->startEdge = false;
+
+        #ifdef MAN_DEBUG
+            printf("    !!!!! End of transmission detected between samples %lld to %lld\n\n\n", i, i+j);
+        #endif
+
+        dec->packet.endSample = i + j - 1;
+        man_emit_packet(dec);
+    }
+
+    // Push state down the line
+    dec->secondLastState = dec->lastState;
+    dec->lastState = dec->curState;
+}
+
+static void man_process_window(ManDecoder *dec, int avgSampleNext, int j) {
+    man_window(dec, avgSampleNext, j, dec->halfPeriodTC, dec->windowsPerHalf);
+}
+
+/**
+ *  Whole windows with the timing known at compile time. A window of whole
+ *  vectors is summed in a loop with a constant trip count, which compiles to
+ *  straight vector code, and divided by a constant. Averages are taken a
+ *  batch at a time so the sums stay apart from the state machine.
+ */
+MAN_INLINE int man_feed_windows(ManDecoder *dec, const int16_t *samples, int numSamples,
+                                const int halfPeriodTC, const int windowsPerHalf) {
+    const int window = halfPeriodTC / windowsPerHalf;
+    int32_t avgs[MAN_FEED_WINDOWS];
+    int done = 0;
+    int w, j, n;
+
+    while (numSamples - done >= window) {
+        n = (numSamples - done) / window;
+        if (n > MAN_FEED_WINDOWS) n = MAN_FEED_WINDOWS;
+
+        for (w = 0; w < n; w++) {
+            const int16_t *p = samples + done + w * window;
+            int sum = 0;
+
+            for (j = 0; j < window; j++) {
+                sum += abs(p[j]);
+            }
+            avgs[w] = sum / window;
+        }
+
+        for (w = 0; w < n; w++) {
+            dec->sampleCount += window;
+            man_window(dec, avgs[w], window, halfPeriodTC, windowsPerHalf);
+            dec->windowStart = dec->sampleCount;
+        }
+        done += n * window;
+    }
+
+    return done;
+}
+
+// The MAN_LINE_RATES timings that get their own path, the ones whose window
+// is whole vectors. The 27 sample window of 216/8 and 108/4 measured 0.90x
+// to 1.00x of generic with a constant divide, an unrolled sum and a
+// reciprocal multiply alike, so those timings have no instance and run generic
+#define MAN_FEED_RATES(X) \
+    X(64, 8) \
+    X(32, 4)
+
+#define MAN_FEED_NAME(half, windows)    man_feed_##half##_##windows
+#define MAN_FEED_DEFINE(half, windows) \
+    _Static_assert((half) / (windows) % MAN_VECTOR_SAMPLES == 0, #half "/" #windows " windows are not whole vectors"); \
+    static int MAN_FEED_NAME(half, windows)(ManDecoder *dec, const int16_t *samples, int numSamples) { \
+        return man_feed_windows(dec, samples, numSamples, half, windows); \
+    }
+MAN_FEED_RATES(MAN_FEED_DEFINE)
+
+typedef struct {
+    int halfPeriodTC;
+    int windowsPerHalf;
+    ManWindowFeed feed;
+    const char *name;
+} ManFeedEntry;
+
+#define MAN_FEED_ENTRY(half, windows)   { half, windows, MAN_FEED_NAME(half, windows), #half "/" #windows },
+static const ManFeedEntry manFeeds[] = { MAN_FEED_RATES(MAN_FEED_ENTRY) };
+
+/**
+ *  Any timing: batches of windows through the vector kernel, then the state
+ *  machine with the timing read from the decoder.
+ */
+static int man_feed_generic(ManDecoder *dec, const int16_t *samples, int numSamples) {
+    int32_t avgs[MAN_FEED_WINDOWS];
+    int window = dec->samplesPerCheck;
+    int done = 0;
+    int w, n;
+
+    while (numSamples - done >= window) {
+        n = numSamples - done < MAN_FEED_WINDOWS * window ? numSamples - done : MAN_FEED_WINDOWS * window;
+        n = window_avg_s16(samples + done, n, window, avgs);
+
+        for (w = 0; w < n; w++) {
+            dec->sampleCount += window;
+            man_process_window(dec, avgs[w], window);
+            dec->windowStart = dec->sampleCount;
+        }
+        done += n * window;
+    }
+
+    return done;
+}
+
+
+void man_decoder_init(ManDecoder *dec, int highMinAvg, ManPacketCallback onPacket, void *userData) {
+    memset(dec, 0, sizeof(*dec));
+
+    dec->highMinAvg = highMinAvg > 0 ? highMinAvg : HIGH_MIN_AVG;
+    dec->onPacket = onPacket;
+    dec->userData = userData;
+
+    dec->startEdge = false;
+    dec->firstHalfPeriod = false;
+    dec->doubleState = LOW_STATE;
+    dec->curState = LOW_STATE;
+    dec->lastState = UNKNOWN_STATE;
+    dec->secondLastState = UNKNOWN_STATE;
+
+    man_decoder_set_rate(dec, HALF_PERIOD_TC, NUM_SAMPLES_PER_PERIOD);
+}
+
+
+bool man_decoder_set_rate(ManDecoder *dec, int halfPeriodTC, int windowsPerHalf) {
+    size_t k;
+
+    if (halfPeriodTC <= 0 || windowsPerHalf <= 0 || halfPeriodTC % windowsPerHalf != 0) return false;
+
+    dec->halfPeriodTC = halfPeriodTC;
+    dec->windowsPerHalf = windowsPerHalf;
+    dec->samplesPerCheck = halfPeriodTC / windowsPerHalf;
+    dec->windowRecip = fixed_recip(dec->samplesPerCheck);
+    dec->feedWindows = man_feed_generic;
+    dec->impl = "generic";
+
+    for (k = 0; k < sizeof(manFeeds) / sizeof(manFeeds[0]); k++) {
+        if (manFeeds[k].halfPeriodTC == halfPeriodTC && manFeeds[k].windowsPerHalf == windowsPerHalf) {
+            dec->feedWindows = manFeeds[k].feed;
+            dec->impl = manFeeds[k].name;
+        }
+    }
+    return true;
+}
+
+
+void man_decoder_use_generic(ManDecoder *dec) {
+    dec->feedWindows = man_feed_generic;
+    dec->impl = "generic";
+}
+
+
+const char *man_decoder_impl(const ManDecoder *dec) {
+    return dec->impl;
+}
+
+
+void man_decoder_seek(ManDecoder *dec, long long sampleIndex) {
+    dec->startEdge = false;
+    dec->firstHalfPeriod = false;
+    dec->curState = LOW_STATE;
+    dec->lastState = LOW_STATE;
+    dec->secondLastState = LOW_STATE;
+    dec->halfPeriodCount = 0;
+    dec->halfPeriodSum = 0;
+    dec->quietWindows = 0;
+
+    dec->windowSum = 0;
+    dec->windowCount = 0;
+    dec->windowStart = sampleIndex;
+    dec->sampleCount = sampleIndex;
+    dec->packet.numBits = 0;
+}
+
+
+void man_decoder_feed(ManDecoder *dec, const int *samples, int numSamples) {
+    int k;
+
+    for (k = 0; k < numSamples; k++) {
+        dec->windowSum += abs(samples[k]);
+        dec->windowCount++;
+        dec->sampleCount++;
+
+        if (dec->windowCount == dec->samplesPerCheck) {
+            man_process_window(dec, fixed_div(dec->windowSum, dec->windowRecip), dec->windowCount);
+            dec->windowStart = dec->sampleCount;
+            dec->windowSum = 0;
+            dec->windowCount = 0;
+        }
+    }
+}
+
+
+void man_decoder_feed_s16(ManDecoder *dec, const int16_t *samples, int numSamples) {
+    int head, w;
+
+    // Finish the window left over from the last chunk one sample at a time
+    for (head = 0; head < numSamples && dec->windowCount > 0; head++) {
+        dec->windowSum += abs(samples[head]);
+        dec->windowCount++;
+        dec->sampleCount++;
+
+        if (dec->windowCount == dec->samplesPerCheck) {
+            man_process_window(dec, fixed_div(dec->windowSum, dec->windowRecip), dec->windowCount);
+            dec->windowStart = dec->sampleCount;
+            dec->windowSum = 0;
+            dec->windowCount = 0;
+        }
+    }
+    samples += head;
+    numSamples -= head;
+
+    // Whole windows go through the path picked for the timing
+    head = dec->feedWindows(dec, samples, numSamples);
+    samples += head;
+    numSamples -= head;
+
+    // Start the next partial window
+    for (w = 0; w < numSamples; w++) {
+        dec->windowSum += abs(samples[w]);
+        dec->windowCount++;
+        dec->sampleCount++;
+    }
+}
+
+
+void man_decoder_flush(ManDecoder *dec) {
+    if (dec->windowCount > 0) {
+        // Only the last window of a capture is short
+        man_process_window(dec, fixed_div(dec->windowSum, fixed_recip(dec->windowCount)), dec->windowCount);
+        dec->windowStart = dec->sampleCount;
+        dec->windowSum = 0;
+        dec->windowCount = 0;
+    }
+
+    // Capture ended in the middle of a transmission
+    if (dec->startEdge && dec->packet.numBits > 0) {
+        dec->packet.endSample = dec->sampleCount - 1;
+        man_emit_packet(dec);
+    }
+    dec->startEdge = false;
+}
+
+
+int man_packet_bytes(const ManPacket *packet, unsigned char *bytes, int maxBytes) {
+    int numBits = packet->numBits < MAN_MAX_PACKET_BITS ? packet->numBits : MAN_MAX_PACKET_BITS;
+    int byte_val = 0;
+    int power = 7;
+    int num_bytes = 0;
+    int i;
+
+    for (i = numBits - 1; i >= 0 && num_bytes < maxBytes; i--) {
+        byte_val |= packet->bits[i] << power;
+        power--;
+        if (power < 0) {
+            bytes[num_bytes++] = (unsigned char)byte_val;
+            power = 7;
+            byte_val = 0;
+        }
+    }
+
+    return num_bytes;
+}
@@ -0,0 +1,102 @@
+/* *********************************************************************
+ * File: man_decoder.h
+ * Author: Michael Bennett
+ * Purpose: Streaming Manchester (IEEE) decoder state. Samples are pushed
+ *          in arbitrary sized chunks and decoded packets are handed back
+ *          through a callback, so memory use does not depend on the
+ *          length of the capture.
+ * ********************************************************************/
+#ifndef MAN_DECODER_H
+#define MAN_DECODER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "man_line.h"
+#include "fixed_point.h"
+
+
+#define MAN_MAX_PACKET_BITS     1024    // Bits kept per transmission, extra bits are counted but dropped
+#define MAN_FEED_WINDOWS        256     // Windows averaged per kernel call in man_decoder_feed_s16
+
+// One transmission, start edge to end of transmission
+typedef struct {
+    long long startSample;                      // First sample of the window holding the start edge
+    long long endSample;                        // Last sample of the window where the end was detected
+    int numBits;                                // Bits decoded, may exceed MAN_MAX_PACKET_BITS
+    int quietBefore;                            // LOW windows in a row right before the start edge
+    unsigned char bits[MAN_MAX_PACKET_BITS];    // Decoded bits in the order they were received
+} ManPacket;
+
+typedef void (*ManPacketCallback)(const ManPacket *packet, void *userData);
+
+struct ManDecoder;
+
+// Decodes the whole windows at the start of samples, returns how many samples that took
+typedef int (*ManWindowFeed)(struct ManDecoder *dec, const int16_t *samples, int numSamples);
+
+typedef struct ManDecoder {
+    // Configuration
+    int highMinAvg;                 // Window average at or above this is HIGH
+    ManPacketCallback onPacket;
+    void *userData;
+
+    // Bit timing, HALF_PERIOD_TC and NUM_SAMPLES_PER_PERIOD unless set otherwise
+    int halfPeriodTC;               // Samples per half period
+    int windowsPerHalf;             // Windows averaged per half period
+    int samplesPerCheck;            // Samples per window
+    FixedRecip windowRecip;         // Divides by samplesPerCheck
+    ManWindowFeed feedWindows;      // Specialized for the timing when MAN_FEED_RATES has a path for it
+    const char *impl;
+
+    // Algorithm state carried across chunks
+    bool startEdge;                 // First rise of input signal signifies start edge
+    bool firstHalfPeriod;           // First half period after the start edge
+    int doubleState;                // Marks last double state (HIGH-HIGH or LOW-LOW)
+    int curState;
+    int lastState;
+    int secondLastState;
+    int halfPeriodCount;            // Samples seen in the current half period
+    int halfPeriodSum;              // Sum of window averages in the current half period
+    int quietWindows;               // LOW windows in a row before the current one
+
+    // Partially filled window
+    int windowSum;
+    int windowCount;
+    long long windowStart;          // Absolute index of the first sample in the window
+
+    long long sampleCount;          // Samples fed so far
+    ManPacket packet;               // Transmission being assembled
+} ManDecoder;
+
+// Resets all state. highMinAvg of 0 selects HIGH_MIN_AVG
+void man_decoder_init(ManDecoder *dec, int highMinAvg, ManPacketCallback onPacket, void *userData);
+
+// Sets the bit timing, only between transmissions. False, changing nothing,
+// unless windowsPerHalf evenly divides halfPeriodTC
+bool man_decoder_set_rate(ManDecoder *dec, int halfPeriodTC, int windowsPerHalf);
+
+// Decodes through the generic path whatever the timing, for benchmarks and tests
+void man_decoder_use_generic(ManDecoder *dec);
+
+// Name of the path the decoder's timing runs through, "216/8" or "generic"
+const char *man_decoder_impl(const ManDecoder *dec);
+
+// Numbers the next sample sampleIndex, a multiple of samplesPerCheck, and puts
+// the decoder in the idle state it is left in after an end of transmission. Used
+// to decode a capture in pieces that line up with decoding it from the start
+void man_decoder_seek(ManDecoder *dec, long long sampleIndex);
+
+// Decodes the next numSamples samples of the capture
+void man_decoder_feed(ManDecoder *dec, const int *samples, int numSamples);
+
+// Same as man_decoder_feed for 16 bit captures, averaging whole windows with window_avg_s16
+void man_decoder_feed_s16(ManDecoder *dec, const int16_t *samples, int numSamples);
+
+// Decodes whatever is left in the partial window and reports an unterminated transmission
+void man_decoder_flush(ManDecoder *dec);
+
+// Converts packet bits into bytes, last received bit first (data is Little Endian). Returns bytes written
+int man_packet_bytes(const ManPacket *packet, unsigned char *bytes, int maxBytes);
+
+#endif
@@ -0,0 +1,303 @@
+/* *********************************************************************
+ * File: man_demod.c
+ * Author: Michael Bennett
+ * Purpose: Matched filter Manchester demodulation. Every block of 8
+ *          samples is correlated against a quadrature carrier at a
+ *          quarter of Nyquist, where the HIGH square wave puts its
+ *          fundamental, and the magnitude is the envelope. That rejects
+ *          DC, hum and most of the band instead of rectifying all of it.
+ *          Each bit is then decided by correlating the envelope against
+ *          the two Manchester symbols (LOW-HIGH against HIGH-LOW), which
+ *          comes down to comparing the energy of its two halves. Half
+ *          periods are summed from a running integral of the envelope so
+ *          boundaries can fall between blocks, and an early/late gate on
+ *          the mid-bit transition keeps the bit clock locked.
+ * ********************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "man_demod.h"
+
+// Uncomment to add DEBUG prints
+//#define MAN_DEMOD_DEBUG
+
+#define HISTORY_MASK    (MAN_DEMOD_HISTORY - 1)
+#define NOISE_SHIFT     8       // Noise floor follows the idle envelope over ~256 blocks
+#define HIGH_SHIFT      3       // HIGH level follows decided HIGH halves over ~8 bits
+#define CLOCK_KP        0.25    // Share of a bit's timing error moved into the grid
+#define CLOCK_KI        0.03125 // Share of it moved into the half period
+#define ACQUIRE_BITS    8       // Bits after the start used to search for the half period
+#define ACQUIRE_STEP    0.25    // Half period search step in blocks
+#define ACQUIRE_WAIT    ((2 * ACQUIRE_BITS + 2) * (int)(MAN_DEMOD_HALF_BLOCKS * (1.0 + MAN_DEMOD_TOLERANCE) + 1))
+
+// cos and sin of pi * (i + 0.5) / 4, the carrier over one block
+static const float carrierI[MAN_DEMOD_BLOCK] = {
+     0.92387953f,  0.38268343f, -0.38268343f, -0.92387953f,
+    -0.92387953f, -0.38268343f,  0.38268343f,  0.92387953f
+};
+static const float carrierQ[MAN_DEMOD_BLOCK] = {
+     0.38268343f,  0.92387953f,  0.92387953f,  0.38268343f,
+    -0.38268343f, -0.92387953f, -0.92387953f, -0.38268343f
+};
+
+/**
+ *  Envelope sum from block position x to y, interpolating inside partial blocks.
+ */
+static double demod_integral(const ManDemod *demod, double x) {
+    long long k = (long long)floor(x);
+    double before = demod->prefix[k & HISTORY_MASK];
+    double after = demod->prefix[(k + 1) & HISTORY_MASK];
+
+    return before + (x - k) * (after - before);
+}
+
+static double demod_sum(const ManDemod *demod, double x, double y) {
+    return demod_integral(demod, y) - demod_integral(demod, x);
+}
+
+static void demod_emit_packet(ManDemod *demod) {
+    demod->packet.endSample = demod->numBlocks * MAN_DEMOD_BLOCK - 1;
+
+    #ifdef MAN_DEMOD_DEBUG
+        printf("Transmission %lld to %lld, %d bits, half period %.2f blocks\n", demod->packet.startSample,
+               demod->packet.endSample, demod->packet.numBits, demod->halfPeriod);
+    #endif
+
+    if (demod->onPacket != NULL)
+        demod->onPacket(&demod->packet, demod->userData);
+
+    demod->packet.numBits = 0;
+    demod->inPacket = false;
+    demod->armed = false;
+}
+
+/**
+ *  Picks the half period that makes the first bits after a start edge at t
+ *  most Manchester-like, the most energy moved from one half of each bit to
+ *  the other. A clock off by 10% is off by a whole half period within five
+ *  bits, too fast for the tracking loop to catch from the nominal period.
+ */
+static double demod_acquire(const ManDemod *demod, double t) {
+    double minPeriod = MAN_DEMOD_HALF_BLOCKS * (1.0 - MAN_DEMOD_TOLERANCE);
+    double maxPeriod = MAN_DEMOD_HALF_BLOCKS * (1.0 + MAN_DEMOD_TOLERANCE);
+    double best = MAN_DEMOD_HALF_BLOCKS;
+    double bestScore = -1;
+    double p;
+    int b;
+
+    for (p = minPeriod; p <= maxPeriod; p += ACQUIRE_STEP) {
+        double score = 0;
+        for (b = 0; b < ACQUIRE_BITS; b++) {
+            double x = t + (2 * b + 1) * p;
+            score += fabs(demod_sum(demod, x, x + p) - demod_sum(demod, x + p, x + 2 * p));
+        }
+        if (score > bestScore) {
+            bestScore = score;
+            best = p;
+        }
+    }
+
+    return best;
+}
+
+/**
+ *  Finds the start edge near a detection by the largest rise in envelope
+ *  from one half period to the next, and opens a transmission there if the
+ *  half period after it is really HIGH.
+ */
+static void demod_start(ManDemod *demod) {
+    double h = MAN_DEMOD_HALF_BLOCKS;
+    long long oldest = demod->numBlocks - MAN_DEMOD_HISTORY + 1;
+    long long first = demod->pendingStart - 2 * MAN_DEMOD_HALF_BLOCKS;
+    long long last = demod->pendingStart;
+    long long best = -1;
+    double bestRise = 0;
+    long long t;
+
+    demod->pendingStart = -1;
+    if (first - MAN_DEMOD_HALF_BLOCKS < oldest) first = oldest + MAN_DEMOD_HALF_BLOCKS;
+    if (first < MAN_DEMOD_HALF_BLOCKS) first = MAN_DEMOD_HALF_BLOCKS;
+
+    for (t = first; t <= last; t++) {
+        double rise = demod_sum(demod, t, t + h) - demod_sum(demod, t - h, t);
+        if (rise > bestRise) {
+            bestRise = rise;
+            best = t;
+        }
+    }
+    if (best < 0) return;
+
+    float high = (float)(demod_sum(demod, best, best + h) / h);
+    if (high < demod->noiseFloor * MAN_DEMOD_DETECT || high < MAN_DEMOD_MIN_LEVEL) return;
+
+    demod->inPacket = true;
+    demod->armed = false;
+    demod->highLevel = high;
+    demod->halfPeriod = demod_acquire(demod, best);
+    demod->bitStart = best + demod->halfPeriod;
+    demod->packet.startSample = best * MAN_DEMOD_BLOCK;
+    demod->packet.numBits = 0;
+    demod->packet.quietBefore = demod->quietBlocks * MAN_DEMOD_BLOCK / SAMPLES_PER_CHECK;
+}
+
+/**
+ *  Decides every bit whose envelope is complete: the half with more energy
+ *  is the HIGH one, and two LOW halves are the idle line after the last bit.
+ */
+static void demod_bits(ManDemod *demod) {
+    double minPeriod = MAN_DEMOD_HALF_BLOCKS * (1.0 - MAN_DEMOD_TOLERANCE);
+    double maxPeriod = MAN_DEMOD_HALF_BLOCKS * (1.0 + MAN_DEMOD_TOLERANCE);
+
+    while (demod->inPacket && demod->bitStart + 2.5 * demod->halfPeriod + 1 < demod->numBlocks) {
+        double p = demod->halfPeriod;
+        double mid = demod->bitStart + p;
+        double w = p / 2;
+        double low = demod->noiseFloor;
+        double high = demod->highLevel;
+        double first = demod_sum(demod, demod->bitStart, mid) / p;
+        double second = demod_sum(demod, mid, mid + p) / p;
+        double slice = (low + high) / 2;
+        int bit = second > first;
+
+        if ((first < slice && second < slice) || demod->packet.numBits == MAN_MAX_PACKET_BITS) {
+            demod_emit_packet(demod);
+            return;
+        }
+        demod->packet.bits[demod->packet.numBits++] = (unsigned char)bit;
+        demod->highLevel += (float)(((bit ? second : first) - high) / (1 << HIGH_SHIFT));
+
+        // Energy just either side of the mid-bit transition. Late by e moves
+        // e blocks of the other level across it, whichever way the bit goes
+        double before = demod_sum(demod, mid - w, mid) / w;
+        double after = demod_sum(demod, mid, mid + w) / w;
+        double err = high > low ? (before + after - low - high) * w / (high - low) : 0;
+        if (!bit) err = -err;
+        if (err > w / 2) err = w / 2;
+        if (err < -w / 2) err = -w / 2;
+
+        demod->bitStart += 2 * p - CLOCK_KP * err;
+        demod->halfPeriod -= CLOCK_KI * err;
+        if (demod->halfPeriod < minPeriod) demod->halfPeriod = minPeriod;
+        if (demod->halfPeriod > maxPeriod) demod->halfPeriod = maxPeriod;
+    }
+}
+
+/**
+ *  Takes one envelope block: tracks the noise floor while idle, watches for
+ *  a start, and decides bits while in a transmission.
+ */
+static void demod_block(ManDemod *demod, float envelope) {
+    long long k = demod->numBlocks;
+
+    demod->prefix[(k + 1) & HISTORY_MASK] = demod->prefix[k & HISTORY_MASK] + envelope;
+    demod->numBlocks = k + 1;
+
+    if (demod->inPacket) {
+        demod_bits(demod);
+        return;
+    }
+
+    if (demod->pendingStart >= 0) {
+        if (demod->numBlocks > demod->pendingStart + ACQUIRE_WAIT) {
+            demod_start(demod);
+            demod_bits(demod);
+        }
+        return;
+    }
+
+    if (demod->numBlocks <= MAN_DEMOD_WARMUP) {
+        demod->noiseFloor += (envelope - demod->noiseFloor) / demod->numBlocks;
+        return;
+    }
+
+    float average = (float)(demod_sum(demod, demod->numBlocks - MAN_DEMOD_HALF_BLOCKS, demod->numBlocks) / MAN_DEMOD_HALF_BLOCKS);
+    if (average < demod->noiseFloor * MAN_DEMOD_DETECT || average < MAN_DEMOD_MIN_LEVEL) {
+        demod->noiseFloor += (envelope - demod->noiseFloor) / (1 << NOISE_SHIFT);
+        demod->armed = true;
+        if (demod->quietBlocks < INT32_MAX) demod->quietBlocks++;
+        return;
+    }
+
+    if (demod->armed) demod->pendingStart = demod->numBlocks;
+    demod->quietBlocks = 0;
+}
+
+
+void man_demod_init(ManDemod *demod, ManPacketCallback onPacket, void *userData) {
+    memset(demod, 0, sizeof(*demod));
+
+    demod->onPacket = onPacket;
+    demod->userData = userData;
+    demod->armed = false;
+    demod->pendingStart = -1;
+    demod->halfPeriod = MAN_DEMOD_HALF_BLOCKS;
+}
+
+
+/**
+ *  Correlates samples against the carrier a block at a time. Whole blocks
+ *  are an 8 tap dot product against each carrier, which the compiler
+ *  vectorizes.
+ */
+static void demod_feed_float(ManDemod *demod, const float *samples, int numSamples) {
+    int n = 0;
+    int j;
+
+    // Finish the block left over from the last chunk
+    while (n < numSamples && demod->blockCount > 0) {
+        demod->blockI += samples[n] * carrierI[demod->blockCount];
+        demod->blockQ += samples[n] * carrierQ[demod->blockCount];
+        n++;
+        if (++demod->blockCount == MAN_DEMOD_BLOCK) {
+            demod_block(demod, sqrtf(demod->blockI * demod->blockI + demod->blockQ * demod->blockQ));
+            demod->blockCount = 0;
+        }
+    }
+
+    for (; n + MAN_DEMOD_BLOCK <= numSamples; n += MAN_DEMOD_BLOCK) {
+        float blockI = 0, blockQ = 0;
+        for (j = 0; j < MAN_DEMOD_BLOCK; j++) {
+            blockI += samples[n + j] * carrierI[j];
+            blockQ += samples[n + j] * carrierQ[j];
+        }
+        demod_block(demod, sqrtf(blockI * blockI + blockQ * blockQ));
+    }
+
+    for (; n < numSamples; n++) {
+        if (demod->blockCount == 0) demod->blockI = demod->blockQ = 0;
+        demod->blockI += samples[n] * carrierI[demod->blockCount];
+        demod->blockQ += samples[n] * carrierQ[demod->blockCount];
+        demod->blockCount++;
+    }
+}
+
+void man_demod_feed(ManDemod *demod, const int *samples, int numSamples) {
+    float chunk[MAN_DEMOD_FEED_SAMPLES];
+    int n, k;
+
+    for (; numSamples > 0; samples += n, numSamples -= n) {
+        n = numSamples < MAN_DEMOD_FEED_SAMPLES ? numSamples : MAN_DEMOD_FEED_SAMPLES;
+        for (k = 0; k < n; k++) chunk[k] = (float)samples[k];
+        demod_feed_float(demod, chunk, n);
+        demod->sampleCount += n;
+    }
+}
+
+void man_demod_feed_s16(ManDemod *demod, const int16_t *samples, int numSamples) {
+    float chunk[MAN_DEMOD_FEED_SAMPLES];
+    int n, k;
+
+    for (; numSamples > 0; samples += n, numSamples -= n) {
+        n = numSamples < MAN_DEMOD_FEED_SAMPLES ? numSamples : MAN_DEMOD_FEED_SAMPLES;
+        for (k = 0; k < n; k++) chunk[k] = samples[k];
+        demod_feed_float(demod, chunk, n);
+        demod->sampleCount += n;
+    }
+}
+
+
+void man_demod_flush(ManDemod *demod) {
+    if (demod->inPacket && demod->packet.numBits > 0)
+        demod_emit_packet(demod);
+}
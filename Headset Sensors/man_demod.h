@@ -0,0 +1,61 @@
+/* *********************************************************************
+ * File: man_demod.h
+ * Author: Michael Bennett
+ * Purpose: Matched filter Manchester demodulator for noisy captures.
+ *          Same streaming interface and ManPacket output as ManDecoder,
+ *          so the two can be swapped and their packet yield compared.
+ * ********************************************************************/
+#ifndef MAN_DEMOD_H
+#define MAN_DEMOD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "man_decoder.h"
+
+#define MAN_DEMOD_BLOCK         8       // Samples per I/Q block, one cycle of the HIGH square wave
+#define MAN_DEMOD_HALF_BLOCKS   (HALF_PERIOD_TC / MAN_DEMOD_BLOCK)  // Nominal half period in blocks
+#define MAN_DEMOD_HISTORY       1024    // Envelope blocks kept, a power of two
+#define MAN_DEMOD_WARMUP        64      // Blocks after init only used to measure the noise floor
+#define MAN_DEMOD_DETECT        1.6     // Half period average over the noise floor that starts a transmission
+#define MAN_DEMOD_MIN_LEVEL     256     // and the least it may be, about a square wave of peak 50
+#define MAN_DEMOD_TOLERANCE     0.15    // Half period may be this far off HALF_PERIOD_TC
+#define MAN_DEMOD_FEED_SAMPLES  256     // Samples converted to float per pass
+
+typedef struct {
+    ManPacketCallback onPacket;
+    void *userData;
+
+    // Partial I/Q block carried across chunks
+    float blockI;
+    float blockQ;
+    int blockCount;
+    long long sampleCount;          // Samples fed so far
+
+    // prefix[k % MAN_DEMOD_HISTORY] is the sum of the envelope before block k
+    double prefix[MAN_DEMOD_HISTORY];
+    long long numBlocks;            // Envelope blocks so far
+
+    float noiseFloor;               // Average envelope of the idle line
+    float highLevel;                // Average envelope of HIGH half periods in this transmission
+    bool armed;                     // Line has been quiet since the last transmission
+    int quietBlocks;                // Quiet blocks in a row
+    long long pendingStart;         // Block where a start was detected, waiting for the blocks after it, or -1
+
+    bool inPacket;
+    double halfPeriod;              // Tracked half period in blocks
+    double bitStart;                // Block position where the next bit begins
+
+    ManPacket packet;               // Transmission being assembled
+} ManDemod;
+
+void man_demod_init(ManDemod *demod, ManPacketCallback onPacket, void *userData);
+
+// Demodulates the next numSamples samples of the capture
+void man_demod_feed(ManDemod *demod, const int *samples, int numSamples);
+void man_demod_feed_s16(ManDemod *demod, const int16_t *samples, int numSamples);
+
+// Reports a transmission still in progress at the end of the capture
+void man_demod_flush(ManDemod *demod);
+
+#endif
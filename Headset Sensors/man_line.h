@@ -0,0 +1,31 @@
+/* *********************************************************************
+ * File: man_line.h
+ * Author: Michael Bennett
+ * Purpose: Manchester line constants shared by every decoder: the
+ *          sensor board's bit timing, the HIGH cutoff and the window
+ *          sizes man_decoder is compiled for. Every count of samples is
+ *          at MAN_LINE_SAMPLE_RATE; input at any other rate goes through
+ *          a resampler first.
+ * ********************************************************************/
+#ifndef MAN_LINE_H
+#define MAN_LINE_H
+
+#define MAN_LINE_SAMPLE_RATE    44100
+#define HIGH_MIN_AVG            175000
+#define LOW_STATE               0
+#define HIGH_STATE              1
+#define UNKNOWN_STATE           -1
+#define HALF_PERIOD_TC          216     // Samples per half period at 44.1 kHz, tested working for multi bytes/packet
+#define NUM_SAMPLES_PER_PERIOD  8       // Windows averaged per half period
+#define SAMPLES_PER_CHECK       (HALF_PERIOD_TC / NUM_SAMPLES_PER_PERIOD)
+
+// Bit timings the sensor link runs at, as X(samples per half period,
+// windows per half period). man_decoder has a specialized path for those
+// with a window of whole vectors, the rest decode through the generic path
+#define MAN_LINE_RATES(X) \
+    X(216, 8)       /* 102 bps at 44.1 kHz, the sensor board as built */ \
+    X(108, 4)       /* 204 bps */ \
+    X(64, 8)        /* 345 bps */ \
+    X(32, 4)        /* 689 bps */
+
+#endif
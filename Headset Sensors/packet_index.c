@@ -0,0 +1,200 @@
+/* *********************************************************************
+ * File: packet_index.c
+ * Author: Michael Bennett
+ * Purpose: Packet index writer and memory mapped reader. Entries are
+ *          packed byte by byte like the capture header, and read from
+ *          the mapping one at a time as the search needs them.
+ * ********************************************************************/
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "packet_index.h"
+#include "chipcap.h"
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static void pack_header(const PacketIndexHeader *header, uint8_t *bytes) {
+    memset(bytes, 0, PACKET_INDEX_HEADER_BYTES);
+    memcpy(bytes, PACKET_INDEX_MAGIC, 4);
+    put_u16(bytes + 4, PACKET_INDEX_VERSION);
+    put_u16(bytes + 6, PACKET_INDEX_HEADER_BYTES);
+    put_u32(bytes + 8, header->sampleRate);
+    put_u32(bytes + 12, header->captureRate);
+    put_u32(bytes + 16, (uint32_t)header->highMinAvg);
+    put_u64(bytes + 24, header->numSamples);
+    put_u64(bytes + 32, header->numEntries);
+}
+
+
+bool packet_index_writer_open(PacketIndexWriter *writer, const char *path, uint32_t captureRate, int32_t highMinAvg) {
+    uint8_t bytes[PACKET_INDEX_HEADER_BYTES];
+
+    memset(writer, 0, sizeof(*writer));
+    writer->header.sampleRate = MAN_LINE_SAMPLE_RATE;
+    writer->header.captureRate = captureRate;
+    writer->header.highMinAvg = highMinAvg;
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) return false;
+
+    pack_header(&writer->header, bytes);
+    if (fwrite(bytes, 1, sizeof(bytes), writer->file) != sizeof(bytes)) {
+        fclose(writer->file);
+        writer->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+bool packet_index_writer_add(PacketIndexWriter *writer, const ManPacket *packet) {
+    unsigned char bytes[MAN_MAX_PACKET_BITS / 8];
+    uint8_t entry[PACKET_INDEX_ENTRY_BYTES] = { 0 };
+    int numBytes;
+
+    if (writer->file == NULL) return false;
+
+    // Quiet this long means idle at its start, else the decoder was only
+    // known idle where the last such transmission started
+    if (packet->quietBefore >= PACKET_INDEX_SYNC_WINDOWS)
+        writer->seekSample = packet->startSample - (long long)PACKET_INDEX_SYNC_WINDOWS * SAMPLES_PER_CHECK;
+    if (packet->numBits == 0) return true;
+
+    numBytes = man_packet_bytes(packet, bytes, (int)sizeof(bytes));
+    put_u64(entry, (uint64_t)packet->startSample);
+    put_u64(entry + 8, (uint64_t)packet->endSample);
+    put_u64(entry + 16, (uint64_t)writer->seekSample);
+    put_u16(entry + 24, (uint16_t)(packet->numBits < UINT16_MAX ? packet->numBits : UINT16_MAX));
+    entry[26] = (uint8_t)numBytes;
+    entry[27] = chipcap_valid(bytes, numBytes) ? PACKET_INDEX_GOOD : 0;
+    memcpy(entry + 28, bytes, numBytes < PACKET_INDEX_MAX_BYTES ? numBytes : PACKET_INDEX_MAX_BYTES);
+
+    if (fwrite(entry, 1, sizeof(entry), writer->file) != sizeof(entry)) return false;
+    writer->header.numEntries++;
+    return true;
+}
+
+
+bool packet_index_writer_close(PacketIndexWriter *writer, uint64_t numSamples) {
+    uint8_t bytes[PACKET_INDEX_HEADER_BYTES];
+    bool ok;
+
+    if (writer->file == NULL) return false;
+
+    writer->header.numSamples = numSamples;
+    pack_header(&writer->header, bytes);
+    ok = fseek(writer->file, 0, SEEK_SET) == 0 &&
+         fwrite(bytes, 1, sizeof(bytes), writer->file) == sizeof(bytes);
+    ok = (fclose(writer->file) == 0) && ok;
+    writer->file = NULL;
+
+    return ok;
+}
+
+
+bool packet_index_open(PacketIndexReader *reader, const char *path) {
+    struct stat st;
+    const uint8_t *bytes;
+    uint32_t headerBytes;
+    uint64_t available;
+    int fd;
+
+    memset(reader, 0, sizeof(*reader));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    if (fstat(fd, &st) != 0 || st.st_size < PACKET_INDEX_HEADER_BYTES) {
+        close(fd);
+        return false;
+    }
+
+    reader->mapBytes = (size_t)st.st_size;
+    reader->map = mmap(NULL, reader->mapBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (reader->map == MAP_FAILED) {
+        reader->map = NULL;
+        return false;
+    }
+
+    bytes = reader->map;
+    headerBytes = get_u16(bytes + 6);
+    if (memcmp(bytes, PACKET_INDEX_MAGIC, 4) != 0 || get_u16(bytes + 4) != PACKET_INDEX_VERSION ||
+        headerBytes < PACKET_INDEX_HEADER_BYTES || headerBytes > reader->mapBytes) {
+        packet_index_close(reader);
+        return false;
+    }
+    reader->header.sampleRate = get_u32(bytes + 8);
+    reader->header.captureRate = get_u32(bytes + 12);
+    reader->header.highMinAvg = (int32_t)get_u32(bytes + 16);
+    reader->header.numSamples = get_u64(bytes + 24);
+    reader->header.numEntries = get_u64(bytes + 32);
+
+    // Trust the file size over a count that was never filled in
+    available = (reader->mapBytes - headerBytes) / PACKET_INDEX_ENTRY_BYTES;
+    if (reader->header.numEntries == 0 || reader->header.numEntries > available)
+        reader->header.numEntries = available;
+
+    reader->entries = bytes + headerBytes;
+    return true;
+}
+
+
+void packet_index_close(PacketIndexReader *reader) {
+    if (reader->map != NULL)
+        munmap(reader->map, reader->mapBytes);
+    memset(reader, 0, sizeof(*reader));
+}
+
+
+void packet_index_entry(const PacketIndexReader *reader, uint64_t i, PacketIndexEntry *entry) {
+    const uint8_t *p = reader->entries + i * PACKET_INDEX_ENTRY_BYTES;
+
+    entry->startSample = (int64_t)get_u64(p);
+    entry->endSample = (int64_t)get_u64(p + 8);
+    entry->seekSample = (int64_t)get_u64(p + 16);
+    entry->numBits = get_u16(p + 24);
+    entry->numBytes = p[26];
+    entry->flags = p[27];
+    memcpy(entry->bytes, p + 28, PACKET_INDEX_MAX_BYTES);
+}
+
+
+uint64_t packet_index_find(const PacketIndexReader *reader, int64_t sample) {
+    uint64_t lo = 0, hi = reader->header.numEntries;
+
+    // Transmissions do not overlap, so end samples rise with the entries
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if ((int64_t)get_u64(reader->entries + mid * PACKET_INDEX_ENTRY_BYTES + 8) < sample) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
@@ -0,0 +1,97 @@
+/* *********************************************************************
+ * File: packet_index.h
+ * Author: Michael Bennett
+ * Purpose: Sidecar index of every transmission in a capture, written by
+ *          the decode pass that finds them. Entries are fixed size and
+ *          in sample order, so a time range is found by binary search
+ *          in the mapped file without reading the capture at all.
+ *          Each entry also says where the window average decoder can
+ *          start to decode that transmission again exactly as the full
+ *          pass did: the last point before it where the line had been
+ *          quiet long enough that the decoder had to be idle.
+ *          Samples are the decoder's, at MAN_LINE_SAMPLE_RATE.
+ *
+ *          Layout, all fields little endian:
+ *            0  magic "GSFI"        16  i32 highMinAvg
+ *            4  u16 version         24  u64 numSamples (0 until closed)
+ *            6  u16 headerBytes     32  u64 numEntries (0 until closed)
+ *            8  u32 sampleRate      40  reserved to headerBytes
+ *           12  u32 captureRate
+ *          headerBytes  entries, each
+ *                 0  i64 startSample   24  u16 numBits
+ *                 8  i64 endSample     26  u8 numBytes
+ *                16  i64 seekSample    27  u8 flags
+ *                                      28  u8 bytes[PACKET_INDEX_MAX_BYTES]
+ * ********************************************************************/
+#ifndef PACKET_INDEX_H
+#define PACKET_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "man_decoder.h"
+
+#define PACKET_INDEX_MAGIC          "GSFI"
+#define PACKET_INDEX_EXTENSION      ".gsfi"
+#define PACKET_INDEX_VERSION        1
+#define PACKET_INDEX_HEADER_BYTES   64
+#define PACKET_INDEX_ENTRY_BYTES    48
+#define PACKET_INDEX_MAX_BYTES      20      // Bytes kept per transmission, numBytes counts them all
+
+// A start edge after this many LOW windows cannot be inside a transmission,
+// so the decoder is idle there whatever came before (man_batch's hand off)
+#define PACKET_INDEX_SYNC_WINDOWS   (4 * NUM_SAMPLES_PER_PERIOD)
+
+#define PACKET_INDEX_GOOD           0x01    // A ChipCap2 packet whose check sum matches
+
+typedef struct {
+    uint32_t sampleRate;            // Of the samples counted, MAN_LINE_SAMPLE_RATE
+    uint32_t captureRate;           // Of the capture indexed, which may have been resampled
+    int32_t highMinAvg;             // Threshold the transmissions were found with
+    uint64_t numSamples;
+    uint64_t numEntries;
+} PacketIndexHeader;
+
+typedef struct {
+    int64_t startSample;            // As ManPacket
+    int64_t endSample;
+    int64_t seekSample;             // Window aligned, man_decoder_seek here to find it again
+    uint16_t numBits;
+    uint8_t numBytes;
+    uint8_t flags;
+    uint8_t bytes[PACKET_INDEX_MAX_BYTES];
+} PacketIndexEntry;
+
+typedef struct {
+    FILE *file;
+    PacketIndexHeader header;       // numEntries counts entries written so far
+    int64_t seekSample;             // Latest point the decoder was known idle
+} PacketIndexWriter;
+
+typedef struct {
+    PacketIndexHeader header;       // numEntries is what the file really holds
+    const uint8_t *entries;
+    void *map;
+    size_t mapBytes;
+} PacketIndexReader;
+
+bool packet_index_writer_open(PacketIndexWriter *writer, const char *path, uint32_t captureRate, int32_t highMinAvg);
+
+// Takes every transmission the decoder reports, in order. Empty ones are
+// noise that tripped the start edge and are not kept
+bool packet_index_writer_add(PacketIndexWriter *writer, const ManPacket *packet);
+
+// Fills in the sample and entry counts and closes the file
+bool packet_index_writer_close(PacketIndexWriter *writer, uint64_t numSamples);
+
+// Maps an index. One that was never closed is read up to its last whole entry
+bool packet_index_open(PacketIndexReader *reader, const char *path);
+void packet_index_close(PacketIndexReader *reader);
+
+void packet_index_entry(const PacketIndexReader *reader, uint64_t i, PacketIndexEntry *entry);
+
+// First entry that ends at or after sample, numEntries if none does
+uint64_t packet_index_find(const PacketIndexReader *reader, int64_t sample);
+
+#endif
@@ -0,0 +1,282 @@
+/* *********************************************************************
+ * File: packet_query.c
+ * Author: Michael Bennett
+ * Purpose: Answer "what did the sensor send between these times" from
+ *          a packet index, without decoding the capture again. With the
+ *          capture given, each transmission in the range is decoded
+ *          again from its seek point, touching only the samples around
+ *          it, and checked against what the index holds.
+ * Build:   cc -O2 -o packet_query packet_query.c packet_index.c man_decoder.c window_avg.c chipcap.c \
+ *             capture_file.c capture_codec.c resampler.c -lm
+ * Usage:   packet_query [-s from_seconds] [-e to_seconds] [-d capture.gsfc|capture.gsfz] index.gsfi
+ *          The index is written by man_decode -i. Times are seconds
+ *          from the start of the capture.
+ * ********************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "packet_index.h"
+#include "man_decoder.h"
+#include "chipcap.h"
+#include "capture_file.h"
+#include "capture_codec.h"
+#include "resampler.h"
+
+#define QUERY_CHUNK_SAMPLES     1024
+
+// A binary or compressed capture, read a piece at a time as the decoder needs it
+typedef struct {
+    bool compressed;
+    CaptureReader raw;
+    CaptureCodecReader packed;
+    CaptureHeader header;
+    int16_t *block;                 // Last block decompressed
+    uint32_t blockIndex;
+    int blockFrames;
+    Resampler *rs;                  // NULL for a capture at MAN_LINE_SAMPLE_RATE
+} QuerySource;
+
+typedef struct {
+    const PacketIndexEntry *entry;
+    bool found;
+    bool matches;
+} QueryMatch;
+
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static bool source_open(QuerySource *src, const char *path) {
+    memset(src, 0, sizeof(*src));
+    src->blockIndex = UINT32_MAX;
+
+    if (capture_read_header(path, &src->header)) {
+        if (!capture_reader_open(&src->raw, path)) return false;
+        src->header = src->raw.header;
+    } else {
+        src->compressed = true;
+        if (!capture_codec_reader_open(&src->packed, path)) return false;
+        src->header = src->packed.header;
+        src->block = malloc((size_t)src->packed.blockFrames * src->header.channels * sizeof(int16_t));
+        if (src->block == NULL) return false;
+    }
+
+    if (src->header.sampleRate != MAN_LINE_SAMPLE_RATE) {
+        src->rs = malloc(sizeof(Resampler));
+        if (src->rs == NULL || !resampler_init(src->rs, src->header.sampleRate, MAN_LINE_SAMPLE_RATE)) return false;
+    }
+    return true;
+}
+
+static void source_close(QuerySource *src) {
+    if (src->compressed) capture_codec_reader_close(&src->packed);
+    else capture_reader_close(&src->raw);
+    free(src->block);
+    free(src->rs);
+}
+
+/**
+ *  Copies channel 0 of up to numFrames frames from firstFrame on. Returns
+ *  the frames copied, fewer at the end of the capture or a damaged block.
+ */
+static int source_read(QuerySource *src, uint64_t firstFrame, int numFrames, int16_t *samples) {
+    uint32_t channels = src->header.channels;
+    int n = 0;
+
+    if (firstFrame >= src->header.numFrames) return 0;
+    if (numFrames > (int)(src->header.numFrames - firstFrame)) numFrames = (int)(src->header.numFrames - firstFrame);
+
+    if (!src->compressed) {
+        capture_read_channel(&src->raw, firstFrame, numFrames, 0, samples);
+        return numFrames;
+    }
+
+    while (n < numFrames) {
+        uint64_t frame = firstFrame + n;
+        uint32_t block = (uint32_t)(frame / src->packed.blockFrames);
+        int offset = (int)(frame % src->packed.blockFrames);
+
+        if (block != src->blockIndex) {
+            src->blockFrames = capture_codec_decode_block(&src->packed, block, src->block);
+            src->blockIndex = block;
+        }
+        if (src->blockFrames <= offset) break;
+        for (; offset < src->blockFrames && n < numFrames; offset++, n++) {
+            samples[n] = src->block[(size_t)offset * channels];
+        }
+    }
+    return n;
+}
+
+static void on_redecoded(const ManPacket *packet, void *userData) {
+    QueryMatch *match = userData;
+    unsigned char bytes[MAN_MAX_PACKET_BITS / 8];
+    int numBytes;
+
+    if (match->found || packet->startSample != match->entry->startSample) return;
+
+    numBytes = man_packet_bytes(packet, bytes, (int)sizeof(bytes));
+    match->found = true;
+    match->matches = packet->endSample == match->entry->endSample && numBytes == match->entry->numBytes &&
+                     memcmp(bytes, match->entry->bytes, numBytes < PACKET_INDEX_MAX_BYTES ? numBytes : PACKET_INDEX_MAX_BYTES) == 0;
+}
+
+/**
+ *  Decodes entry again from its seek point. A resampled capture starts
+ *  where a decoder sample falls on a capture frame and a window edge, far
+ *  enough back that the filter has filled by the seek point. Returns the
+ *  decoder samples it took.
+ */
+static long long redecode(QuerySource *src, ManDecoder *dec, const PacketIndexEntry *entry, int highMinAvg, QueryMatch *match) {
+    int16_t samples[QUERY_CHUNK_SAMPLES];
+    int16_t out[RESAMPLER_MAX_RATIO * QUERY_CHUNK_SAMPLES];
+    long long stopSample = entry->endSample + (long long)PACKET_INDEX_SYNC_WINDOWS * SAMPLES_PER_CHECK;
+    long long begin = entry->seekSample;
+    uint64_t frame = (uint64_t)begin;
+    int n, offset, used, numOut;
+
+    if (src->rs != NULL) {
+        long long step = src->rs->up, margin = (long long)RESAMPLER_TAPS * src->rs->up / src->rs->down + 1;
+        while (step % SAMPLES_PER_CHECK) step += src->rs->up;
+        begin = begin - margin < 0 ? 0 : (begin - margin) / step * step;
+        frame = (uint64_t)(begin / src->rs->up * src->rs->down);
+        resampler_reset(src->rs);
+    }
+
+    match->entry = entry;
+    match->found = false;
+    match->matches = false;
+    man_decoder_init(dec, highMinAvg, on_redecoded, match);
+    man_decoder_seek(dec, begin);
+
+    while (!match->found && dec->sampleCount <= stopSample) {
+        n = source_read(src, frame, QUERY_CHUNK_SAMPLES, samples);
+        if (n == 0) {
+            man_decoder_flush(dec);
+            break;
+        }
+        frame += n;
+        if (src->rs == NULL) {
+            man_decoder_feed_s16(dec, samples, n);
+            continue;
+        }
+        for (offset = 0; offset < n; offset += used) {
+            numOut = resampler_process(src->rs, samples + offset, n - offset, 1, out, (int)(sizeof(out) / sizeof(out[0])), &used);
+            man_decoder_feed_s16(dec, out, numOut);
+        }
+    }
+    return dec->sampleCount - begin;
+}
+
+static void print_time(double seconds) {
+    int hours = (int)(seconds / 3600);
+    int minutes = (int)(seconds / 60) % 60;
+
+    printf("%d:%02d:%06.3f", hours, minutes, seconds - 3600.0 * hours - 60.0 * minutes);
+}
+
+static void print_entry(const PacketIndexEntry *entry, uint32_t sampleRate) {
+    int k;
+
+    printf("  ");
+    print_time((double)entry->startSample / sampleRate);
+    printf(" %12lld %12lld %5u bits %s ", (long long)entry->startSample, (long long)entry->endSample,
+           entry->numBits, entry->flags & PACKET_INDEX_GOOD ? "good" : "bad ");
+    for (k = 0; k < entry->numBytes && k < PACKET_INDEX_MAX_BYTES; k++) printf(" %02x", entry->bytes[k]);
+    if (entry->numBytes > PACKET_INDEX_MAX_BYTES) printf(" ...");
+    if (entry->flags & PACKET_INDEX_GOOD) {
+        float humidity, temperature;
+        chipcap_convert(entry->bytes, &humidity, &temperature);
+        printf("  %.2f %%RH %.2f C", humidity, temperature);
+    }
+}
+
+
+int main(int argc, char **argv) {
+    static ManDecoder dec;
+    PacketIndexReader index;
+    PacketIndexEntry entry;
+    QuerySource src;
+    QueryMatch match;
+    const char *capturePath = NULL;
+    double from = 0, to = INFINITY;
+    double start, findSeconds, decodeSeconds = 0;
+    long long decodedSamples = 0;
+    uint64_t first, i;
+    int listed = 0, found = 0, matched = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:e:d:")) != -1) {
+        switch (opt) {
+            case 's':
+                from = atof(optarg);
+                break;
+            case 'e':
+                to = atof(optarg);
+                break;
+            case 'd':
+                capturePath = optarg;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Usage: %s [-s from_seconds] [-e to_seconds] [-d capture.gsfc|capture.gsfz] index.gsfi\n", argv[0]);
+        return 1;
+    }
+
+    if (!packet_index_open(&index, argv[optind])) {
+        perror("ERROR main: failed to map the index.\n");
+        return 1;
+    }
+    if (capturePath != NULL && !source_open(&src, capturePath)) {
+        perror("ERROR main: failed to open the capture.\n");
+        return 1;
+    }
+
+    printf("%s: %llu transmissions in %.1f s, capture at %u Hz\n", argv[optind],
+           (unsigned long long)index.header.numEntries, (double)index.header.numSamples / index.header.sampleRate,
+           index.header.captureRate);
+
+    start = now_seconds();
+    first = packet_index_find(&index, (int64_t)(from * index.header.sampleRate));
+    findSeconds = now_seconds() - start;
+
+    for (i = first; i < index.header.numEntries; i++) {
+        packet_index_entry(&index, i, &entry);
+        if ((double)entry.startSample / index.header.sampleRate > to) break;
+        print_entry(&entry, index.header.sampleRate);
+        listed++;
+
+        if (capturePath != NULL) {
+            start = now_seconds();
+            decodedSamples += redecode(&src, &dec, &entry, index.header.highMinAvg, &match);
+            decodeSeconds += now_seconds() - start;
+            found += match.found;
+            matched += match.matches;
+            printf("  %s", !match.found ? "NOT FOUND" : match.matches ? "matches" : "DIFFERS");
+        }
+        printf("\n");
+    }
+
+    printf("%d transmissions from ", listed);
+    print_time(from);
+    printf(", found in %.1f us\n", findSeconds * 1e6);
+    if (capturePath != NULL) {
+        printf("Decoded again: %d found, %d match the index, %.1f s of samples in %.2f ms\n", found, matched,
+               (double)decodedSamples / MAN_LINE_SAMPLE_RATE, decodeSeconds * 1e3);
+        source_close(&src);
+    }
+
+    packet_index_close(&index);
+    return capturePath != NULL && matched != listed ? 1 : 0;
+}
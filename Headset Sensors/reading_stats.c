@@ -0,0 +1,180 @@
+/* *********************************************************************
+ * File: reading_stats.c
+ * Author: Michael Bennett
+ * Purpose: Per packet reading summary published through a sequence
+ *          count, as in io_stats. The outlier test compares a reading
+ *          against the median and median absolute deviation of the
+ *          last READING_STATS_WINDOW readings. Rejected readings still
+ *          enter the window, so a real step in humidity or temperature
+ *          is accepted once most of the window has moved with it.
+ *          Everything the writer does is integer, the readers convert.
+ * ********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "reading_stats.h"
+#include "fixed_point.h"
+
+#define MAD_TO_SIGMA    97164   // MAD of normal noise times 1.4826 is its standard deviation, Q16.16
+
+// ChipCap2 output range of each quantity, and the least spread the outlier
+// test assumes so a steady run of identical readings rejects nothing
+static const int32_t rangeLow[READING_QUANTITIES]  = { 0, -40 * FIXED_Q16_ONE };
+static const int32_t rangeHigh[READING_QUANTITIES] = { 100 * FIXED_Q16_ONE, 125 * FIXED_Q16_ONE };
+static const int32_t minSpread[READING_QUANTITIES] = { FIXED_Q16_ONE / 2, FIXED_Q16_ONE / 4 };
+
+void reading_stats_init(ReadingStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+
+static void sort_values(int32_t *values, int n) {
+    int i, j;
+
+    for (i = 1; i < n; i++) {
+        int32_t v = values[i];
+        for (j = i; j > 0 && values[j - 1] > v; j--) values[j] = values[j - 1];
+        values[j] = v;
+    }
+}
+
+static int32_t median_of_sorted(const int32_t *values, int n) {
+    return n & 1 ? values[n / 2] : (int32_t)(((int64_t)values[n / 2 - 1] + values[n / 2]) / 2);
+}
+
+/**
+ *  Whether value is too far off the median of the window to be believed.
+ *  Sorts copies, READING_STATS_WINDOW is small enough for that to be cheap.
+ */
+static bool is_outlier(const ReadingStats *stats, ReadingQuantity q, int32_t value) {
+    int32_t sorted[READING_STATS_WINDOW];
+    int n = stats->windowCount, k;
+
+    if (n < READING_STATS_MIN_WINDOW) return false;
+
+    memcpy(sorted, stats->window[q], n * sizeof(int32_t));
+    sort_values(sorted, n);
+    int32_t median = median_of_sorted(sorted, n);
+
+    for (k = 0; k < n; k++) sorted[k] = abs(stats->window[q][k] - median);
+    sort_values(sorted, n);
+    int64_t spread = ((int64_t)median_of_sorted(sorted, n) * MAD_TO_SIGMA) >> FIXED_Q16_SHIFT;
+    if (spread < minSpread[q]) spread = minSpread[q];
+
+    return llabs((int64_t)value - median) > READING_STATS_MAD_LIMIT * spread;
+}
+
+static int histogram_bin(ReadingQuantity q, int32_t value) {
+    int64_t bin = ((int64_t)value - rangeLow[q]) * READING_STATS_BINS / (rangeHigh[q] - rangeLow[q]);
+
+    if (bin < 0) return 0;
+    return bin < READING_STATS_BINS ? (int)bin : READING_STATS_BINS - 1;
+}
+
+static void summary_add(ReadingSummary *s, ReadingQuantity q, int32_t value, uint64_t count) {
+    if (count == 1) {
+        s->origin = s->min = s->max = s->ewma = value;
+    } else {
+        if (value < s->min) s->min = value;
+        if (value > s->max) s->max = value;
+        // Arithmetic shift, so a fall moves the average as far as a rise
+        s->ewma += (value - s->ewma) >> READING_STATS_EWMA_SHIFT;
+    }
+
+    // A difference of two readings is under 2^24, its square fits with room for billions more
+    int64_t d = (int64_t)value - s->origin;
+    s->sum += d;
+    s->squares += (d * d + FIXED_Q16_ONE / 2) >> FIXED_Q16_SHIFT;
+    s->histogram[histogram_bin(q, value)]++;
+}
+
+
+bool reading_stats_add(ReadingStats *stats, int32_t humidity, int32_t temperature) {
+    ReadingStatsCounters *c = &stats->counters;
+    int32_t values[READING_QUANTITIES] = { humidity, temperature };
+    uint32_t sequence = stats->sequence;
+    bool outlier = false;
+    int q;
+
+    for (q = 0; q < READING_QUANTITIES; q++) {
+        if (is_outlier(stats, (ReadingQuantity)q, values[q])) outlier = true;
+    }
+
+    __atomic_store_n(&stats->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (outlier) {
+        c->rejected++;
+    } else {
+        c->count++;
+        for (q = 0; q < READING_QUANTITIES; q++) {
+            summary_add(&c->quantity[q], (ReadingQuantity)q, values[q], c->count);
+        }
+    }
+
+    __atomic_store_n(&stats->sequence, sequence + 2, __ATOMIC_RELEASE);
+
+    for (q = 0; q < READING_QUANTITIES; q++) {
+        stats->window[q][stats->windowIndex] = values[q];
+    }
+    stats->windowIndex = (stats->windowIndex + 1) % READING_STATS_WINDOW;
+    if (stats->windowCount < READING_STATS_WINDOW) stats->windowCount++;
+
+    return !outlier;
+}
+
+
+void reading_stats_snapshot(const ReadingStats *stats, ReadingStatsCounters *out) {
+    uint32_t before, after;
+
+    do {
+        before = __atomic_load_n(&stats->sequence, __ATOMIC_ACQUIRE);
+        memcpy(out, &stats->counters, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&stats->sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
+
+
+double reading_stats_mean(const ReadingStatsCounters *counters, ReadingQuantity q) {
+    const ReadingSummary *s = &counters->quantity[q];
+
+    if (counters->count == 0) return 0.0;
+    return (s->origin + (double)s->sum / counters->count) / FIXED_Q16_ONE;
+}
+
+
+double reading_stats_variance(const ReadingStatsCounters *counters, ReadingQuantity q) {
+    const ReadingSummary *s = &counters->quantity[q];
+    double sum = (double)s->sum / FIXED_Q16_ONE;
+
+    if (counters->count < 2) return 0.0;
+    double m2 = (double)s->squares / FIXED_Q16_ONE - sum * sum / counters->count;
+    return m2 > 0 ? m2 / (counters->count - 1) : 0.0;
+}
+
+
+float reading_stats_quantile(const ReadingStatsCounters *counters, ReadingQuantity q, double p) {
+    const ReadingSummary *s = &counters->quantity[q];
+    float low = fixed_q16_to_float(rangeLow[q]);
+    float width = fixed_q16_to_float(rangeHigh[q] - rangeLow[q]) / READING_STATS_BINS;
+    double rank;
+    uint64_t seen = 0;
+    int b;
+
+    if (counters->count == 0) return 0.0f;
+    if (p < 0) p = 0;
+    if (p > 1) p = 1;
+    rank = p * (counters->count - 1);
+
+    for (b = 0; b < READING_STATS_BINS - 1; b++) {
+        if (seen + s->histogram[b] > rank) break;
+        seen += s->histogram[b];
+    }
+
+    // Spread the bin's readings evenly across it, but stay inside what was seen
+    float value = low + width * (b + (float)((rank - seen + 0.5) / s->histogram[b]));
+    if (value < fixed_q16_to_float(s->min)) value = fixed_q16_to_float(s->min);
+    if (value > fixed_q16_to_float(s->max)) value = fixed_q16_to_float(s->max);
+    return value;
+}
@@ -0,0 +1,78 @@
+/* *********************************************************************
+ * File: reading_stats.h
+ * Author: Michael Bennett
+ * Purpose: Running summary of ChipCap2 readings, updated once per packet
+ *          in constant time and memory on the decoding thread: mean and
+ *          variance, min and max, a moving average and a fixed size
+ *          histogram for quantiles. A reading far off the median of the
+ *          last few is counted as rejected instead. Any other thread can
+ *          take a consistent snapshot while collection goes on, the same
+ *          way io_stats is read. The writer keeps Q16.16 readings and
+ *          integer sums, so the decoding thread does no floating point;
+ *          the reader side functions convert.
+ * ********************************************************************/
+#ifndef READING_STATS_H
+#define READING_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define READING_STATS_WINDOW        15      // Recent readings the outlier test takes its median from
+#define READING_STATS_MIN_WINDOW    5       // Readings needed before anything is rejected
+#define READING_STATS_MAD_LIMIT     5       // Rejected this many scaled MADs off the window median
+#define READING_STATS_EWMA_SHIFT    3       // Moving average weights a new reading 1/8
+#define READING_STATS_BINS          1024    // Histogram bins over each quantity's ChipCap2 range
+
+typedef enum {
+    READING_HUMIDITY,               // %RH, 0 to 100
+    READING_TEMPERATURE,            // C, -40 to 125
+    READING_QUANTITIES
+} ReadingQuantity;
+
+// Readings are Q16.16. Sums are taken from the first reading, so they stay
+// small and the variance doesn't cancel to nothing
+typedef struct {
+    int32_t origin;                 // First reading accepted
+    int64_t sum;                    // Readings less origin
+    int64_t squares;                // Their squares, Q16.16 too
+    int32_t min;
+    int32_t max;
+    int32_t ewma;
+    uint32_t histogram[READING_STATS_BINS];
+} ReadingSummary;
+
+typedef struct {
+    uint64_t count;                 // Readings accepted
+    uint64_t rejected;              // Readings dropped as outliers
+    ReadingSummary quantity[READING_QUANTITIES];
+} ReadingStatsCounters;
+
+typedef struct {
+    uint32_t sequence;              // Odd while a reading is being added
+    ReadingStatsCounters counters;
+
+    // Only touched by the writer
+    int32_t window[READING_QUANTITIES][READING_STATS_WINDOW];
+    int windowCount;
+    int windowIndex;
+} ReadingStats;
+
+void reading_stats_init(ReadingStats *stats);
+
+// Writer: adds one packet's Q16.16 reading, false if it was rejected as an
+// outlier. A reading only counts as accepted if neither quantity is off
+bool reading_stats_add(ReadingStats *stats, int32_t humidity, int32_t temperature);
+
+// Reader: copies a consistent set of counters, never blocks the writer
+void reading_stats_snapshot(const ReadingStats *stats, ReadingStatsCounters *out);
+
+// Mean, 0 before the first reading
+double reading_stats_mean(const ReadingStatsCounters *counters, ReadingQuantity q);
+
+// Sample variance, 0 until there are two readings
+double reading_stats_variance(const ReadingStatsCounters *counters, ReadingQuantity q);
+
+// Value at quantile p (0-1), interpolated inside its histogram bin
+float reading_stats_quantile(const ReadingStatsCounters *counters, ReadingQuantity q, double p);
+
+#endif
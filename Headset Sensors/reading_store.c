@@ -0,0 +1,381 @@
+/* *********************************************************************
+ * File: reading_store.c
+ * Author: Michael Bennett
+ * Purpose: Reading history rings and their roll up. Each bucket level
+ *          keeps the bucket still filling apart from its ring and moves
+ *          it in when a reading lands in a later period, so a level never
+ *          holds two buckets for one period. Records are packed byte by
+ *          byte like the capture header.
+ * ********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "reading_store.h"
+
+#define READ_RECORDS    4096
+
+static const int64_t levelPeriodMs[READING_STORE_LEVELS] = { 0, 1000, 60 * 1000, 60 * 60 * 1000 };
+static const uint32_t levelCapacity[READING_STORE_LEVELS] = {
+    READING_STORE_RAW_CAPACITY, READING_STORE_SECOND_CAPACITY, READING_STORE_MINUTE_CAPACITY, READING_STORE_HOUR_CAPACITY
+};
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+// Both saturate where the multiple is out of range, as for a range from INT64_MIN
+static int64_t floor_to(int64_t t, int64_t period) {
+    int64_t q = t / period - (t % period < 0);
+    return q < INT64_MIN / period ? INT64_MIN : q * period;
+}
+
+static int64_t ceil_to(int64_t t, int64_t period) {
+    int64_t f = floor_to(t, period);
+    if (f == t) return t;
+    return f > INT64_MAX - period ? INT64_MAX : f + period;
+}
+
+
+static void bucket_start(ReadingBucket *bucket, int64_t timeMs, const int32_t *value) {
+    int q;
+
+    bucket->timeMs = timeMs;
+    bucket->count = 1;
+    for (q = 0; q < READING_QUANTITIES; q++) {
+        bucket->min[q] = bucket->max[q] = value[q];
+        bucket->sum[q] = value[q];
+    }
+}
+
+static void bucket_merge(ReadingBucket *dst, const ReadingBucket *src) {
+    int q;
+
+    if (src->count == 0) return;
+    if (dst->count == 0) {
+        *dst = *src;
+        return;
+    }
+    for (q = 0; q < READING_QUANTITIES; q++) {
+        if (src->min[q] < dst->min[q]) dst->min[q] = src->min[q];
+        if (src->max[q] > dst->max[q]) dst->max[q] = src->max[q];
+        dst->sum[q] += src->sum[q];
+    }
+    dst->count += src->count;
+}
+
+static uint32_t slot(const ReadingLevel *lv, uint32_t i) {
+    return (lv->head - lv->count + i) & (lv->capacity - 1);
+}
+
+static int64_t entry_time(const ReadingLevel *lv, uint32_t i) {
+    uint32_t s = slot(lv, i);
+    return lv->points != NULL ? lv->points[s].timeMs : lv->buckets[s].timeMs;
+}
+
+static void entry_bucket(const ReadingLevel *lv, uint32_t i, ReadingBucket *out) {
+    uint32_t s = slot(lv, i);
+
+    if (lv->buckets != NULL) {
+        *out = lv->buckets[s];
+        return;
+    }
+    bucket_start(out, lv->points[s].timeMs, lv->points[s].value);
+}
+
+/**
+ *  First entry of the ring at or after timeMs, count if none is.
+ */
+static uint32_t lower_bound(const ReadingLevel *lv, int64_t timeMs) {
+    uint32_t lo = 0, hi = lv->count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (entry_time(lv, mid) < timeMs) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+ *  Makes room for one more entry, forgetting the oldest if the ring is full.
+ */
+static uint32_t level_push(ReadingLevel *lv) {
+    uint32_t s = lv->head;
+
+    if (lv->count == lv->capacity) {
+        lv->lostBeforeMs = entry_time(lv, 0) + (lv->periodMs ? lv->periodMs : 1);
+        lv->count--;
+    }
+    lv->head = (lv->head + 1) & (lv->capacity - 1);
+    lv->count++;
+    return s;
+}
+
+static void add_reading(ReadingStore *store, int64_t timeMs, const int32_t *value) {
+    ReadingBucket reading;
+    int l;
+
+    if (store->total > 0 && timeMs < store->lastMs) timeMs = store->lastMs;
+    store->lastMs = timeMs;
+    store->total++;
+
+    ReadingLevel *raw = &store->level[READING_STORE_RAW];
+    uint32_t s = level_push(raw);
+    raw->points[s].timeMs = timeMs;
+    memcpy(raw->points[s].value, value, sizeof(raw->points[s].value));
+
+    for (l = READING_STORE_SECOND; l < READING_STORE_LEVELS; l++) {
+        ReadingLevel *lv = &store->level[l];
+        int64_t start = floor_to(timeMs, lv->periodMs);
+
+        if (lv->open.count > 0 && lv->open.timeMs != start) {
+            lv->buckets[level_push(lv)] = lv->open;
+            lv->open.count = 0;
+        }
+        bucket_start(&reading, start, value);
+        bucket_merge(&lv->open, &reading);
+    }
+}
+
+
+bool reading_store_init(ReadingStore *store) {
+    int l;
+
+    memset(store, 0, sizeof(*store));
+    for (l = 0; l < READING_STORE_LEVELS; l++) {
+        ReadingLevel *lv = &store->level[l];
+
+        lv->periodMs = levelPeriodMs[l];
+        lv->capacity = levelCapacity[l];
+        lv->lostBeforeMs = INT64_MIN;
+        if (l == READING_STORE_RAW) lv->points = malloc(lv->capacity * sizeof(ReadingPoint));
+        else lv->buckets = malloc(lv->capacity * sizeof(ReadingBucket));
+        if (lv->points == NULL && lv->buckets == NULL) {
+            reading_store_free(store);
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void reading_store_free(ReadingStore *store) {
+    int l;
+
+    for (l = 0; l < READING_STORE_LEVELS; l++) {
+        free(store->level[l].points);
+        free(store->level[l].buckets);
+    }
+    memset(store, 0, sizeof(*store));
+}
+
+
+bool reading_store_open(ReadingStore *store, const char *path) {
+    uint8_t header[READING_STORE_HEADER_BYTES];
+    uint8_t *records;
+    long validBytes = READING_STORE_HEADER_BYTES;
+    size_t n, k;
+    FILE *file;
+
+    if (!reading_store_init(store)) return false;
+
+    file = fopen(path, "rb");
+    if (file != NULL) {
+        uint32_t headerBytes;
+
+        if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, READING_STORE_MAGIC, 4) != 0 ||
+            get_u16(header + 4) != READING_STORE_VERSION || get_u32(header + 8) != READING_STORE_RECORD_BYTES ||
+            (headerBytes = get_u16(header + 6)) < READING_STORE_HEADER_BYTES || fseek(file, headerBytes, SEEK_SET) != 0) {
+            fclose(file);
+            reading_store_free(store);
+            return false;
+        }
+
+        records = malloc(READ_RECORDS * READING_STORE_RECORD_BYTES);
+        if (records == NULL) {
+            fclose(file);
+            reading_store_free(store);
+            return false;
+        }
+        validBytes = headerBytes;
+        while ((n = fread(records, READING_STORE_RECORD_BYTES, READ_RECORDS, file)) > 0) {
+            for (k = 0; k < n; k++) {
+                const uint8_t *p = records + k * READING_STORE_RECORD_BYTES;
+                int32_t value[READING_QUANTITIES] = { (int32_t)get_u32(p + 8), (int32_t)get_u32(p + 12) };
+                add_reading(store, (int64_t)get_u64(p), value);
+            }
+            validBytes += (long)(n * READING_STORE_RECORD_BYTES);
+        }
+        free(records);
+        fclose(file);
+
+        // Drop a record the last session did not finish writing
+        if (truncate(path, validBytes) != 0 || (store->file = fopen(path, "ab")) == NULL) {
+            reading_store_free(store);
+            return false;
+        }
+        return true;
+    }
+
+    store->file = fopen(path, "wb");
+    if (store->file == NULL) {
+        reading_store_free(store);
+        return false;
+    }
+    memset(header, 0, sizeof(header));
+    memcpy(header, READING_STORE_MAGIC, 4);
+    put_u16(header + 4, READING_STORE_VERSION);
+    put_u16(header + 6, READING_STORE_HEADER_BYTES);
+    put_u32(header + 8, READING_STORE_RECORD_BYTES);
+    if (fwrite(header, 1, sizeof(header), store->file) != sizeof(header)) {
+        reading_store_close(store);
+        return false;
+    }
+    return true;
+}
+
+
+bool reading_store_close(ReadingStore *store) {
+    bool ok = true;
+
+    if (store->file != NULL) ok = fclose(store->file) == 0;
+    store->file = NULL;
+    reading_store_free(store);
+    return ok;
+}
+
+
+bool reading_store_add(ReadingStore *store, int64_t timeMs, int32_t humidity, int32_t temperature) {
+    int32_t value[READING_QUANTITIES] = { humidity, temperature };
+    uint8_t record[READING_STORE_RECORD_BYTES];
+
+    add_reading(store, timeMs, value);
+    if (store->file == NULL) return true;
+
+    put_u64(record, (uint64_t)store->lastMs);
+    put_u32(record + 8, (uint32_t)humidity);
+    put_u32(record + 12, (uint32_t)temperature);
+    return fwrite(record, 1, sizeof(record), store->file) == sizeof(record);
+}
+
+
+bool reading_store_flush(ReadingStore *store) {
+    return store->file == NULL || fflush(store->file) == 0;
+}
+
+
+int reading_store_query(const ReadingStore *store, int level, int64_t fromMs, int64_t toMs,
+                        ReadingBucket *out, int maxOut) {
+    const ReadingLevel *lv = &store->level[level];
+    uint32_t i;
+    int n = 0;
+
+    for (i = lower_bound(lv, fromMs); i < lv->count && n < maxOut && entry_time(lv, i) < toMs; i++) {
+        entry_bucket(lv, i, &out[n++]);
+    }
+    if (lv->open.count > 0 && n < maxOut && lv->open.timeMs >= fromMs && lv->open.timeMs < toMs)
+        out[n++] = lv->open;
+    return n;
+}
+
+
+int reading_store_level_for(const ReadingStore *store, int64_t fromMs, int64_t toMs, int maxPoints) {
+    int l;
+
+    for (l = 0; l < READING_STORE_LEVELS - 1; l++) {
+        const ReadingLevel *lv = &store->level[l];
+        uint32_t first = lower_bound(lv, fromMs);
+
+        if (fromMs < lv->lostBeforeMs) continue;
+        if (lower_bound(lv, toMs) - first + (lv->open.count > 0) <= (uint32_t)maxPoints) return l;
+    }
+    return READING_STORE_LEVELS - 1;
+}
+
+/**
+ *  Adds the entries of level starting in [fromMs, toMs) to out.
+ */
+static void add_entries(const ReadingStore *store, int level, int64_t fromMs, int64_t toMs, ReadingBucket *out) {
+    const ReadingLevel *lv = &store->level[level];
+    ReadingBucket bucket;
+    uint32_t i;
+
+    for (i = lower_bound(lv, fromMs); i < lv->count && entry_time(lv, i) < toMs; i++) {
+        entry_bucket(lv, i, &bucket);
+        bucket_merge(out, &bucket);
+    }
+    if (lv->open.count > 0 && lv->open.timeMs >= fromMs && lv->open.timeMs < toMs)
+        bucket_merge(out, &lv->open);
+}
+
+/**
+ *  Whole buckets of level inside the range, then each edge from the next
+ *  level down. An edge the next level has already forgotten is counted as
+ *  the whole bucket of this level holding it.
+ */
+static bool summarize(const ReadingStore *store, int level, int64_t fromMs, int64_t toMs, ReadingBucket *out) {
+    const ReadingLevel *lv = &store->level[level];
+    int64_t edges[2][2];
+    bool exact = true;
+    int e;
+
+    if (fromMs >= toMs) return true;
+    if (level == READING_STORE_RAW) {
+        add_entries(store, level, fromMs, toMs, out);
+        return fromMs >= lv->lostBeforeMs;
+    }
+
+    int64_t first = ceil_to(fromMs, lv->periodMs);
+    int64_t last = floor_to(toMs, lv->periodMs);
+    if (first < last) {
+        add_entries(store, level, first, last, out);
+        exact = first >= lv->lostBeforeMs;
+        edges[0][0] = fromMs, edges[0][1] = first;
+        edges[1][0] = last, edges[1][1] = toMs;
+    } else {
+        edges[0][0] = fromMs, edges[0][1] = toMs;
+        edges[1][0] = edges[1][1] = toMs;
+    }
+
+    for (e = 0; e < 2; e++) {
+        if (edges[e][0] >= edges[e][1]) continue;
+        if (edges[e][0] >= store->level[level - 1].lostBeforeMs) {
+            exact = summarize(store, level - 1, edges[e][0], edges[e][1], out) && exact;
+        } else {
+            add_entries(store, level, floor_to(edges[e][0], lv->periodMs), edges[e][1], out);
+            exact = false;
+        }
+    }
+    return exact;
+}
+
+
+bool reading_store_summary(const ReadingStore *store, int64_t fromMs, int64_t toMs, ReadingBucket *out) {
+    memset(out, 0, sizeof(*out));
+    out->timeMs = fromMs;
+    return summarize(store, READING_STORE_LEVELS - 1, fromMs, toMs, out);
+}
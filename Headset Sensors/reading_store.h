@@ -0,0 +1,116 @@
+/* *********************************************************************
+ * File: reading_store.h
+ * Author: Michael Bennett
+ * Purpose: Timestamped history of ChipCap2 readings in fixed memory, for
+ *          trends across sessions. Readings go into a ring of raw
+ *          readings and roll up into rings of 1 s, 1 min and 1 h buckets
+ *          holding the count, min, max and sum of each quantity, so the
+ *          coarser levels reach much further back than the raw one.
+ *          Every ring is in time order, so a range is found by binary
+ *          search, and a summary of any range takes whole buckets of the
+ *          coarsest level that fits and only goes finer at its edges.
+ *          The store is kept in an append-only file of raw readings and
+ *          rebuilt from it when opened. Values are Q16.16 as
+ *          chipcap_convert_q16 makes them, so sums are exact. Not real-time
+ *          safe and not thread safe, use it from one queue.
+ *
+ *          File layout, all fields little endian:
+ *            0  magic "GSFR"         8  u32 recordBytes
+ *            4  u16 version         12  reserved to headerBytes
+ *            6  u16 headerBytes
+ *          headerBytes  records, each
+ *                 0  i64 timeMs, Unix milliseconds
+ *                 8  i32 humidity
+ *                12  i32 temperature
+ * ********************************************************************/
+#ifndef READING_STORE_H
+#define READING_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "reading_stats.h"
+
+#define READING_STORE_MAGIC         "GSFR"
+#define READING_STORE_EXTENSION     ".gsfr"
+#define READING_STORE_VERSION       1
+#define READING_STORE_HEADER_BYTES  16
+#define READING_STORE_RECORD_BYTES  16
+
+// Levels, finest first
+#define READING_STORE_RAW           0
+#define READING_STORE_SECOND        1
+#define READING_STORE_MINUTE        2
+#define READING_STORE_HOUR          3
+#define READING_STORE_LEVELS        4
+
+#define READING_STORE_RAW_CAPACITY      (1 << 16)   // ~9 h at two readings a second
+#define READING_STORE_SECOND_CAPACITY   (1 << 15)   // ~9 h
+#define READING_STORE_MINUTE_CAPACITY   (1 << 16)   // ~45 days
+#define READING_STORE_HOUR_CAPACITY     (1 << 14)   // ~1.9 years
+
+// One raw reading (count 1) or the readings of one bucket's period
+typedef struct {
+    int64_t timeMs;                 // Of the reading, or the start of the period
+    uint32_t count;
+    int32_t min[READING_QUANTITIES];
+    int32_t max[READING_QUANTITIES];
+    int64_t sum[READING_QUANTITIES];
+} ReadingBucket;
+
+typedef struct {
+    int64_t timeMs;
+    int32_t value[READING_QUANTITIES];
+} ReadingPoint;
+
+typedef struct {
+    int64_t periodMs;               // 0 for the raw level
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t head;                  // Slot the next entry goes in
+    ReadingPoint *points;           // Raw level only
+    ReadingBucket *buckets;         // Other levels
+    ReadingBucket open;             // Bucket still filling, count 0 before the first reading
+    int64_t lostBeforeMs;           // Readings before this are no longer all in the level
+} ReadingLevel;
+
+typedef struct {
+    ReadingLevel level[READING_STORE_LEVELS];
+    int64_t lastMs;                 // Time of the newest reading
+    uint64_t total;                 // Readings added, including those replayed from the file
+    FILE *file;                     // Appended to, NULL when not persisted
+} ReadingStore;
+
+// Allocates the rings. Nothing is persisted until reading_store_open
+bool reading_store_init(ReadingStore *store);
+void reading_store_free(ReadingStore *store);
+
+// Initializes the store from path, creating it if needed, and appends every
+// later reading to it. A record cut short by a crash is dropped
+bool reading_store_open(ReadingStore *store, const char *path);
+
+// Flushes and closes the file and frees the store
+bool reading_store_close(ReadingStore *store);
+
+// Adds a reading. One older than the newest is stored at the newest's time,
+// so the levels stay in order if the clock steps back
+bool reading_store_add(ReadingStore *store, int64_t timeMs, int32_t humidity, int32_t temperature);
+
+bool reading_store_flush(ReadingStore *store);
+
+// Copies the entries of level starting in [fromMs, toMs), oldest first,
+// the bucket still filling included. Returns how many, at most maxOut
+int reading_store_query(const ReadingStore *store, int level, int64_t fromMs, int64_t toMs,
+                        ReadingBucket *out, int maxOut);
+
+// Finest level that still holds fromMs and covers the range in at most
+// maxPoints entries, else the coarsest. For plotting a range at a width
+int reading_store_level_for(const ReadingStore *store, int64_t fromMs, int64_t toMs, int maxPoints);
+
+// Count, min, max and sum of every reading in [fromMs, toMs). Returns false
+// if part of the range is only left in a coarser bucket than it needs, which
+// was then counted whole
+bool reading_store_summary(const ReadingStore *store, int64_t fromMs, int64_t toMs, ReadingBucket *out);
+
+#endif
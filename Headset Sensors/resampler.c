@@ -0,0 +1,157 @@
+/* *********************************************************************
+ * File: resampler.c
+ * Author: Michael Bennett
+ * Purpose: Polyphase resampling. Output k falls k * down / up inputs in;
+ *          phase tracks that position past the newest input in steps of
+ *          1/up, so the ratio is kept exactly however long it runs.
+ *          The filter is a Blackman windowed sinc designed once at init,
+ *          each phase scaled to unity gain at DC.
+ * ********************************************************************/
+#include <math.h>
+#include <string.h>
+
+#include "resampler.h"
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/**
+ *  Taps for an output frac of an input past the middle of the delay line:
+ *  tap t weighs the input RESAMPLER_TAPS / 2 - 1 - t before that point.
+ */
+static void design_phase(int16_t *coeffs, double frac, double cutoff) {
+    double taps[RESAMPLER_TAPS];
+    double sum = 0;
+    int t, largest = 0, total = 0;
+
+    for (t = 0; t < RESAMPLER_TAPS; t++) {
+        double x = frac + RESAMPLER_TAPS / 2 - 1 - t;
+        double arg = 2 * M_PI * x / RESAMPLER_TAPS;
+        double window = 0.42 + 0.5 * cos(arg) + 0.08 * cos(2 * arg);
+        double sinc = x == 0 ? 1 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+
+        taps[t] = sinc * window;
+        sum += taps[t];
+    }
+
+    // Rounding is made up on the largest tap so DC passes exactly
+    for (t = 0; t < RESAMPLER_TAPS; t++) {
+        coeffs[t] = (int16_t)lround(taps[t] / sum * (1 << RESAMPLER_COEFF_SHIFT));
+        total += coeffs[t];
+        if (coeffs[t] > coeffs[largest]) largest = t;
+    }
+    coeffs[largest] += (1 << RESAMPLER_COEFF_SHIFT) - total;
+}
+
+
+bool resampler_init(Resampler *rs, uint32_t inRate, uint32_t outRate) {
+    double cutoff;
+    uint32_t g;
+    int p;
+
+    memset(rs, 0, sizeof(*rs));
+    rs->inRate = inRate;
+    rs->outRate = outRate;
+    rs->up = 1;
+    rs->down = 1;
+    rs->phases = 1;
+    rs->upRecip = fixed_recip(1);
+
+    if (inRate == 0 || outRate == 0 || inRate > RESAMPLER_MAX_RATIO * (uint64_t)outRate ||
+        outRate > RESAMPLER_MAX_RATIO * (uint64_t)inRate) return false;
+    if (inRate == outRate) return true;
+
+    g = gcd(inRate, outRate);
+    if (outRate / g > INT32_MAX / RESAMPLER_MAX_PHASES) return false;
+    rs->up = (int)(outRate / g);
+    rs->down = (int)(inRate / g);
+    rs->phases = rs->up < RESAMPLER_MAX_PHASES ? rs->up : RESAMPLER_MAX_PHASES;
+    rs->upRecip = fixed_recip(rs->up);
+
+    // Cycles per input sample, below the Nyquist frequency of the lower rate
+    cutoff = RESAMPLER_CUTOFF * (outRate < inRate ? (double)outRate / inRate : 1.0);
+    for (p = 0; p < rs->phases; p++) {
+        design_phase(rs->coeffs[p], (double)p / rs->phases, cutoff);
+    }
+    return true;
+}
+
+
+void resampler_reset(Resampler *rs) {
+    memset(rs->delay, 0, sizeof(rs->delay));
+    rs->delayPos = 0;
+    rs->phase = 0;
+}
+
+
+bool resampler_passthrough(const Resampler *rs) {
+    return rs->up == rs->down;
+}
+
+
+int resampler_max_output(const Resampler *rs, int numIn) {
+    return (int)(((long long)numIn * rs->up + rs->down - 1) / rs->down) + 1;
+}
+
+
+static inline int16_t resampler_dot(const int16_t *coeffs, const int16_t *window) {
+    int32_t acc = 1 << (RESAMPLER_COEFF_SHIFT - 1);
+    int t;
+
+    for (t = 0; t < RESAMPLER_TAPS; t++) {
+        acc += coeffs[t] * window[t];
+    }
+    acc >>= RESAMPLER_COEFF_SHIFT;
+    return (int16_t)(acc > INT16_MAX ? INT16_MAX : acc < INT16_MIN ? INT16_MIN : acc);
+}
+
+
+int resampler_process(Resampler *rs, const int16_t *in, int numIn, int stride, int16_t *out, int maxOut, int *used) {
+    int perInput = (rs->up + rs->down - 1) / rs->down;
+    int numOut = 0, k;
+
+    if (resampler_passthrough(rs)) {
+        int n = numIn < maxOut ? numIn : maxOut;
+        for (k = 0; k < n; k++) out[k] = in[k * stride];
+        *used = n;
+        return n;
+    }
+
+    for (k = 0; k < numIn && maxOut - numOut >= perInput; k++) {
+        int16_t sample = in[k * stride];
+
+        rs->delay[rs->delayPos] = sample;
+        rs->delay[rs->delayPos + RESAMPLER_TAPS] = sample;
+        rs->delayPos = rs->delayPos + 1 == RESAMPLER_TAPS ? 0 : rs->delayPos + 1;
+
+        const int16_t *window = rs->delay + rs->delayPos;
+        while (rs->phase < rs->up) {
+            int p = rs->phases == rs->up ? rs->phase : fixed_div(rs->phase * rs->phases, rs->upRecip);
+            out[numOut++] = resampler_dot(rs->coeffs[p], window);
+            rs->phase += rs->down;
+        }
+        rs->phase -= rs->up;
+    }
+
+    *used = k;
+    return numOut;
+}
+
+
+int resampler_skip(Resampler *rs, int numIn) {
+    long long advance = (long long)numIn * rs->up;
+    long long numOut = 0;
+
+    if (resampler_passthrough(rs)) return numIn;
+
+    // An output every down of phase until it has passed all numIn inputs' worth
+    if (rs->phase < advance) numOut = (advance - rs->phase + rs->down - 1) / rs->down;
+    rs->phase = (int)(rs->phase + numOut * rs->down - advance);
+    return (int)numOut;
+}
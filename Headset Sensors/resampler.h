@@ -0,0 +1,64 @@
+/* *********************************************************************
+ * File: resampler.h
+ * Author: Michael Bennett
+ * Purpose: Rational polyphase resampler that brings the mic line to the
+ *          rate the decoders are timed for, whatever rate the hardware
+ *          runs at. The rate ratio is reduced to up/down; each output is
+ *          one RESAMPLER_TAPS dot product of the newest inputs with the
+ *          windowed sinc phase it falls on. Ratios with more phases than
+ *          RESAMPLER_MAX_PHASES (44101 Hz and the like) use the nearest
+ *          of that many. Storage is fixed and coefficients are Q14, so
+ *          resampler_process runs on the render thread.
+ * ********************************************************************/
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fixed_point.h"
+
+#define RESAMPLER_TAPS          32      // Inputs each output is filtered from
+#define RESAMPLER_MAX_PHASES    512
+#define RESAMPLER_MAX_RATIO     8       // Either rate may be at most this many times the other
+#define RESAMPLER_CUTOFF        0.45    // Passband edge as a fraction of the lower of the two rates
+#define RESAMPLER_COEFF_SHIFT   14
+
+typedef struct {
+    uint32_t inRate;
+    uint32_t outRate;
+    int up;                         // outRate / inRate in lowest terms
+    int down;
+    int phases;                     // Coefficient sets, up unless that is over RESAMPLER_MAX_PHASES
+    FixedRecip upRecip;
+    int phase;                      // Position of the next output past the newest input, in 1/up of an input
+    int16_t coeffs[RESAMPLER_MAX_PHASES][RESAMPLER_TAPS];
+    int16_t delay[2 * RESAMPLER_TAPS];      // Last RESAMPLER_TAPS inputs, written twice so they read in one run
+    int delayPos;
+} Resampler;
+
+// Designs the filter for inRate to outRate. False, leaving a pass through,
+// for a rate of 0 or a ratio past RESAMPLER_MAX_RATIO, so RESAMPLER_MAX_RATIO
+// outputs per input is always room enough. Not real-time safe
+bool resampler_init(Resampler *rs, uint32_t inRate, uint32_t outRate);
+
+// Forgets the inputs seen so far
+void resampler_reset(Resampler *rs);
+
+// True when the rates match and resampler_process only copies
+bool resampler_passthrough(const Resampler *rs);
+
+// Most outputs numIn inputs can produce
+int resampler_max_output(const Resampler *rs, int numIn);
+
+// Resamples every stride'th entry of in into out until the inputs run out
+// or out has no room for what the next input might produce. Returns the
+// outputs written, used is set to the inputs taken
+int resampler_process(Resampler *rs, const int16_t *in, int numIn, int stride, int16_t *out, int maxOut, int *used);
+
+// Steps over numIn inputs that were never heard, keeping the ratio exact.
+// Returns the outputs they would have produced; the filter carries on from
+// the inputs before them
+int resampler_skip(Resampler *rs, int numIn);
+
+#endif
@@ -0,0 +1,91 @@
+/* *********************************************************************
+ * File: sample_ring.c
+ * Author: Michael Bennett
+ * Purpose: Lock free single-producer/single-consumer int16 ring. head
+ *          and tail are free running counters, each written by only one
+ *          side and published with release/acquire ordering.
+ * ********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample_ring.h"
+
+bool sample_ring_init(SampleRing *ring, uint32_t capacity) {
+    uint32_t size = 1;
+
+    memset(ring, 0, sizeof(*ring));
+    while (size < capacity) size <<= 1;
+
+    ring->buffer = calloc(size, sizeof(int16_t));
+    if (ring->buffer == NULL) return false;
+
+    ring->capacity = size;
+    ring->mask = size - 1;
+    return true;
+}
+
+
+void sample_ring_free(SampleRing *ring) {
+    free(ring->buffer);
+    memset(ring, 0, sizeof(*ring));
+}
+
+
+void sample_ring_reset(SampleRing *ring) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+}
+
+
+uint32_t sample_ring_write(SampleRing *ring, const int16_t *samples, uint32_t count, uint32_t stride) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t space = ring->capacity - (head - tail);
+    uint32_t n = count < space ? count : space;
+    uint32_t i;
+
+    if (stride == 1) {
+        // Copy in at most two runs around the end of the buffer
+        uint32_t start = head & ring->mask;
+        uint32_t first = ring->capacity - start;
+        if (first > n) first = n;
+        memcpy(ring->buffer + start, samples, first * sizeof(int16_t));
+        memcpy(ring->buffer, samples + first, (n - first) * sizeof(int16_t));
+    } else {
+        for (i = 0; i < n; i++) {
+            ring->buffer[(head + i) & ring->mask] = samples[i * stride];
+        }
+    }
+
+    __atomic_store_n(&ring->head, head + n, __ATOMIC_RELEASE);
+    if (n < count) ring->dropped += count - n;
+
+    return n;
+}
+
+
+uint32_t sample_ring_read(SampleRing *ring, int16_t *samples, uint32_t count) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t avail = head - tail;
+    uint32_t n = count < avail ? count : avail;
+    uint32_t start = tail & ring->mask;
+    uint32_t first = ring->capacity - start;
+
+    if (first > n) first = n;
+    memcpy(samples, ring->buffer + start, first * sizeof(int16_t));
+    memcpy(samples + first, ring->buffer, (n - first) * sizeof(int16_t));
+
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+
+uint32_t sample_ring_available(const SampleRing *ring) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    return head - tail;
+}
@@ -0,0 +1,39 @@
+/* *********************************************************************
+ * File: sample_ring.h
+ * Author: Michael Bennett
+ * Purpose: Fixed capacity single-producer/single-consumer ring of int16
+ *          samples. Reads and writes never lock or allocate so the
+ *          producer side is safe to call from the audio render thread.
+ * ********************************************************************/
+#ifndef SAMPLE_RING_H
+#define SAMPLE_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct {
+    int16_t *buffer;                // Storage, allocated once by sample_ring_init
+    uint32_t capacity;              // Power of two
+    uint32_t mask;
+    uint32_t head;                  // Total samples written, only changed by the producer
+    uint32_t tail;                  // Total samples read, only changed by the consumer
+    uint32_t dropped;               // Samples the producer could not fit, only changed by the producer
+} SampleRing;
+
+// Allocates storage rounded up to a power of two. Not real-time safe
+bool sample_ring_init(SampleRing *ring, uint32_t capacity);
+void sample_ring_free(SampleRing *ring);
+
+// Empties the ring. Only call while neither side is running
+void sample_ring_reset(SampleRing *ring);
+
+// Producer: copies every stride'th sample in, returns how many fit. The rest are counted in dropped
+uint32_t sample_ring_write(SampleRing *ring, const int16_t *samples, uint32_t count, uint32_t stride);
+
+// Consumer: copies up to count samples out, returns how many were read
+uint32_t sample_ring_read(SampleRing *ring, int16_t *samples, uint32_t count);
+
+// Samples waiting to be read. Exact from the consumer thread, a lower bound elsewhere
+uint32_t sample_ring_available(const SampleRing *ring);
+
+#endif
@@ -0,0 +1,2144 @@
+/* *********************************************************************
+ * File: sensor_bench.c
+ * Author: Michael Bennett
+ * Purpose: Host side benchmarks for the portable decode pieces. Each
+ *          mode checks the fast path against its reference before
+ *          timing it.
+ * Build:   cc -O3 -march=native -pthread -o sensor_bench sensor_bench.c window_avg.c tone_gen.c \
+ *             signal_gen.c sensor_decoder.c reading_stats.c man_decoder.c man_demod.c chipcap.c io_stats.c \
+ *             sensor_io.c sample_ring.c link_rate.c sensor_frame.c sensor_fec.c trace_log.c resampler.c \
+ *             capture_file.c capture_codec.c reading_store.c -lm
+ * Usage:   sensor_bench window [num_samples]
+ *          sensor_bench tone [seconds_of_audio]
+ *          sensor_bench decode [packets_per_point]
+ *          sensor_bench iostats [packets]
+ *          sensor_bench rates [packets_per_timing]
+ *          sensor_bench link [seconds_per_run]
+ *          sensor_bench frames [trials_per_point]
+ *          sensor_bench repeat [seconds_per_run]
+ *          sensor_bench fec [bursts_per_point]
+ *          sensor_bench trace [packets]
+ *          sensor_bench resample [packets_per_rate]
+ *          sensor_bench codec [packets_per_line]
+ *          sensor_bench store [days]
+ * ********************************************************************/
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "window_avg.h"
+#include "tone_gen.h"
+#include "signal_gen.h"
+#include "sensor_decoder.h"
+#include "man_decoder.h"
+#include "man_demod.h"
+#include "io_stats.h"
+#include "sensor_io.h"
+#include "link_rate.h"
+#include "sensor_frame.h"
+#include "chipcap.h"
+#include "resampler.h"
+#include "capture_codec.h"
+#include "reading_store.h"
+
+#define BENCH_SAMPLES           (1 << 24)
+#define BENCH_WINDOW            27      // SAMPLES_PER_CHECK
+#define BENCH_MIN_SECONDS       0.5
+
+#define TONE_SAMPLE_RATE        44100.0
+#define TONE_FREQ               20000.0
+#define TONE_AMPLITUDE          (32767.0f / 2)
+#define TONE_BUFFER_FRAMES      256     // ~5.8 ms, just over the preferred IO buffer
+#define TONE_SECONDS            3600    // Audio rendered before checking purity again
+#define TONE_SFDR_FRAMES        4410    // 20 kHz lands on bin 2000
+#define TONE_MIN_SFDR_DB        80.0
+
+#define DECODE_PACKETS          500     // Packets per SNR point
+#define DECODE_BUFFER_FRAMES    256     // sensor_decoder gets the IO callback's buffers
+#define DECODE_CHUNK_FRAMES     4096    // man_decoder gets man_decode's chunks
+#define DECODE_SNR_DB           30      // Line used for throughput and latency
+#define DECODE_AMPLITUDE        1200    // Peak SAMPLE_HIGH_MIN_AVG suits, for modes that run man_decoder at that cutoff
+#define DECODE_CLOCK_OFFSET     0.08    // Off nominal sensor clock for the second sweep
+#define IOSTATS_PACKETS         200
+#define IOSTATS_PERIOD_NS       (DECODE_BUFFER_FRAMES * 1000000000ull / 44100)
+#define IOSTATS_MISS_EVERY      97      // Simulated callbacks that overrun their buffer
+#define IOSTATS_LATE_EVERY      500     // and that start a buffer late
+#define IOSTATS_RETRY_EVERY     1000    // and that are waitACycle retries
+#define LINK_SECONDS            120     // Simulated audio per run
+#define LINK_GAP_SAMPLES        1000    // Sensor idles this long before and after each packet
+#define LINK_LISTEN_THRESHOLD   4000    // Sensor hears the command tone over this
+#define LINK_BEST_RATE          2       // Fastest rate the simulated line carries
+#define LINK_MIN_SPEEDUP        1.5     // Readings per second over the base rate training must reach
+#define FRAMES_TRIALS           1000000 // Corrupted packets per number of flipped bits
+#define FRAMES_MAX_FLIPS        4
+#define FRAMES_BURST            4       // Readings per burst for the parse timing
+#define REPEAT_SECONDS          300     // Simulated audio per run
+#define REPEAT_FRAMES           4       // Readings per burst
+#define REPEAT_QUEUE            32      // Readings the sensor has been asked for again and not yet resent
+#define REPEAT_MAX_READINGS     (1 << 22)   // Reading numbers the payload carries
+#define REPEAT_MIN_GAIN         1.2     // Unique readings per second over waitACycle where frames often fail
+#define REPEAT_MIN_BURSTS       50      // Fewer and a lost burst or two swings the comparison
+#define FEC_BURSTS              100     // Bursts per bit error rate
+#define FEC_SENSORS             4       // Readings per burst
+#define FEC_MIN_GAIN            2.0     // Where bits go wrong often, coded frames must be lost this much less
+#define TRACE_BENCH_CAPACITY    (1 << 20)   // The decode runs far faster than real time, so the whole run fits
+#define TRACE_MAX_P99_US        5.0     // Callback time tracing every record type may add at p99
+#define RESAMPLE_CARRIER_FREQ   (MAN_LINE_SAMPLE_RATE / 8.0)    // The HIGH square wave's fundamental
+#define RESAMPLE_TONE_SAMPLES   (1 << 16)
+#define RESAMPLE_TONE_AMPLITUDE 16384.0
+#define RESAMPLE_MAX_CARRIER_DB 0.1     // Carrier gain may be this far from unity
+#define RESAMPLE_MAX_IMAGE_DB   -60.0   // Tones that would alias onto the carrier must be this far down
+#define CODEC_THREADS           4       // Decoding blocks in parallel, as man_batch does
+#define CODEC_MIN_QUIET_RATIO   4.0     // A noiseless line with the usual gaps must shrink this much
+#define STORE_DAYS              30      // Simulated history, a month
+#define STORE_PERIOD_MS         500     // A reading every half second, with jitter
+#define STORE_QUERIES           2000    // Random ranges per span
+#define STORE_CHECKS            20      // of them checked against a scan of every reading
+#define STORE_PLOT_POINTS       512     // Width the ranges are plotted at
+#define DECODE_MATCH_SAMPLES    (8 * HALF_PERIOD_TC)    // Longest a decoder may take to report a packet
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill_random(int16_t *samples, int n) {
+    unsigned int seed = 12345;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        samples[i] = (int16_t)(seed >> 16);
+    }
+    // Make sure the abs(-32768) corner is covered
+    samples[0] = -32768;
+}
+
+static void print_rate(const char *name, long long samples, double seconds) {
+    printf("  %-14s %10.1f Msamples/s\n", name, samples / seconds / 1e6);
+}
+
+
+/**
+ *  The loop both decoders ran before window_avg: abs and sum one window at a time.
+ */
+static int window_loop(const int16_t *samples, int num_samples, int32_t *avgs) {
+    int num_windows = 0;
+    int i, j;
+
+    for (i = 0; i + BENCH_WINDOW <= num_samples; i += BENCH_WINDOW) {
+        int nextSamples = 0;
+        for (j = 0; j < BENCH_WINDOW; j++) {
+            nextSamples += abs(samples[i+j]);
+        }
+        avgs[num_windows++] = nextSamples / j;
+    }
+
+    return num_windows;
+}
+
+static int bench_window(int num_samples) {
+    int16_t *samples = malloc(num_samples * sizeof(int16_t));
+    int32_t *ref = malloc((num_samples / BENCH_WINDOW + 1) * sizeof(int32_t));
+    int32_t *out = malloc((num_samples / BENCH_WINDOW + 1) * sizeof(int32_t));
+    long long total;
+    double start, elapsed;
+    int n, n_ref, i;
+
+    if (samples == NULL || ref == NULL || out == NULL) {
+        perror("ERROR bench_window: failed to allocate buffers.\n");
+        return 1;
+    }
+    fill_random(samples, num_samples);
+
+    n_ref = window_loop(samples, num_samples, ref);
+    n = window_avg_s16(samples, num_samples, BENCH_WINDOW, out);
+    if (n != n_ref || memcmp(ref, out, n * sizeof(int32_t)) != 0) {
+        printf("ERROR bench_window: %s kernel does not match the reference loop\n", window_avg_impl());
+        return 1;
+    }
+
+    printf("window: %d samples, window %d, kernel %s\n", num_samples, BENCH_WINDOW, window_avg_impl());
+
+    total = 0;
+    start = now_seconds();
+    do {
+        window_loop(samples, num_samples, ref);
+        total += num_samples;
+    } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+    print_rate("current loop", total, elapsed);
+
+    total = 0;
+    start = now_seconds();
+    do {
+        window_avg_s16_scalar(samples, num_samples, BENCH_WINDOW, out);
+        total += num_samples;
+    } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+    print_rate("scalar", total, elapsed);
+
+    total = 0;
+    start = now_seconds();
+    do {
+        window_avg_s16(samples, num_samples, BENCH_WINDOW, out);
+        total += num_samples;
+    } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+    print_rate(window_avg_impl(), total, elapsed);
+
+    // Keep the results live
+    for (i = 0, n_ref = 0; i < n; i++) n_ref += out[i] + ref[i];
+    if (n_ref == 1) printf("\n");
+
+    free(samples);
+    free(ref);
+    free(out);
+    return 0;
+}
+
+
+/**
+ *  The tone loop hardwareIOCallback ran before tone_gen, interleaved stereo
+ *  with the command channel on.
+ */
+static void tone_loop(float *sinPhase, int16_t *sampleBuffer, int inNumberFrames) {
+    float freq = TONE_FREQ;
+    float sampleRate = TONE_SAMPLE_RATE;
+    float phase = *sinPhase;
+    float sinSignal;
+    int sampleIdx;
+
+    double phaseInc = 2 * M_PI * freq / sampleRate;
+
+    for (sampleIdx = 0; sampleIdx < inNumberFrames; ++sampleIdx) {
+        sinSignal = sin(phase);
+        sampleBuffer[2 * sampleIdx] = 0;
+        sampleBuffer[2 * sampleIdx + 1] = (int16_t)((sinSignal * 32767.0f) / 2);
+
+        phase += phaseInc;
+        if (phase >= 2 * M_PI * freq) {
+            phase -= (2 * M_PI * freq);
+        }
+    }
+    *sinPhase = phase;
+}
+
+static void tone_gen_loop(ToneGen *power, ToneGen *command, int16_t *sampleBuffer, int inNumberFrames) {
+    tone_gen_render_s16(power, sampleBuffer, inNumberFrames, 2);
+    tone_gen_render_s16(command, sampleBuffer + 1, inNumberFrames, 2);
+}
+
+static int bench_tone(int seconds) {
+    int16_t buffer[2 * TONE_BUFFER_FRAMES];
+    int16_t *check = malloc(2 * TONE_SFDR_FRAMES * sizeof(int16_t));
+    long long frames, total;
+    double start, elapsed;
+    double sfdrStart[2], sfdrLater[2];
+    float phase = 0;
+    ToneGen power, command;
+    int n;
+
+    if (check == NULL) {
+        perror("ERROR bench_tone: failed to allocate buffers.\n");
+        return 1;
+    }
+
+    // Same setup as the app: power tone off, command tone at half scale
+    tone_gen_init(&power, TONE_FREQ, TONE_SAMPLE_RATE, 0.0f);
+    tone_gen_init(&command, TONE_FREQ, TONE_SAMPLE_RATE, TONE_AMPLITUDE);
+
+    printf("tone: %.0f Hz at %.0f Hz, %d frame buffers\n", TONE_FREQ, TONE_SAMPLE_RATE, TONE_BUFFER_FRAMES);
+
+    // Purity right away and after an hour of buffers
+    tone_loop(&phase, check, TONE_SFDR_FRAMES);
+    sfdrStart[0] = tone_sfdr_db(check + 1, TONE_SFDR_FRAMES, 2, TONE_SAMPLE_RATE, TONE_FREQ);
+    tone_gen_loop(&power, &command, check, TONE_SFDR_FRAMES);
+    sfdrStart[1] = tone_sfdr_db(check + 1, TONE_SFDR_FRAMES, 2, TONE_SAMPLE_RATE, TONE_FREQ);
+
+    for (frames = 0; frames < (long long)(seconds * TONE_SAMPLE_RATE); frames += TONE_BUFFER_FRAMES) {
+        tone_loop(&phase, buffer, TONE_BUFFER_FRAMES);
+        tone_gen_loop(&power, &command, buffer, TONE_BUFFER_FRAMES);
+    }
+
+    tone_loop(&phase, check, TONE_SFDR_FRAMES);
+    sfdrLater[0] = tone_sfdr_db(check + 1, TONE_SFDR_FRAMES, 2, TONE_SAMPLE_RATE, TONE_FREQ);
+    tone_gen_loop(&power, &command, check, TONE_SFDR_FRAMES);
+    sfdrLater[1] = tone_sfdr_db(check + 1, TONE_SFDR_FRAMES, 2, TONE_SAMPLE_RATE, TONE_FREQ);
+
+    printf("  %-14s SFDR %6.1f dB at start, %6.1f dB after %d s\n", "current loop", sfdrStart[0], sfdrLater[0], seconds);
+    printf("  %-14s SFDR %6.1f dB at start, %6.1f dB after %d s\n", "tone_gen", sfdrStart[1], sfdrLater[1], seconds);
+
+    total = 0;
+    start = now_seconds();
+    do {
+        for (n = 0; n < 64; n++) tone_loop(&phase, buffer, TONE_BUFFER_FRAMES);
+        total += 64 * TONE_BUFFER_FRAMES;
+    } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+    printf("  %-14s %10.2f ns/frame\n", "current loop", elapsed / total * 1e9);
+
+    total = 0;
+    start = now_seconds();
+    do {
+        for (n = 0; n < 64; n++) tone_gen_loop(&power, &command, buffer, TONE_BUFFER_FRAMES);
+        total += 64 * TONE_BUFFER_FRAMES;
+    } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+    printf("  %-14s %10.2f ns/frame\n", "tone_gen", elapsed / total * 1e9);
+
+    free(check);
+
+    if (sfdrStart[1] < TONE_MIN_SFDR_DB || sfdrLater[1] < TONE_MIN_SFDR_DB) {
+        printf("ERROR bench_tone: tone_gen SFDR below %.0f dB\n", TONE_MIN_SFDR_DB);
+        return 1;
+    }
+    return 0;
+}
+
+
+/**
+ *  How one decoder did against the generator's truth. Each decoded packet is
+ *  matched to the last packet that ended before it was reported, if that was
+ *  recently enough; anything else is spurious and any packet passed over was
+ *  missed.
+ */
+typedef struct {
+    const SignalGenPacket *truth;
+    int numTruth;
+    int next;                       // First truth packet not matched or passed over
+    const SensorDecoder *sensor;    // Source of the report time for sensor_decoder
+    int highMinAvg;                 // man_decoder's cutoff, matched to the line as capture_synth records it
+    int good;                       // Packets delivered with every byte right
+    int matched;
+    int spurious;
+    long long bits;                 // Bits of matched packets
+    long long bitErrors;
+    long long latencySum;           // Samples from the end of a packet to its report
+    long long latencyMax;
+} DecodeScore;
+
+static void score_init(DecodeScore *score, const SignalGenPacket *truth, int numTruth) {
+    memset(score, 0, sizeof(*score));
+    score->truth = truth;
+    score->numTruth = numTruth;
+    score->highMinAvg = SAMPLE_HIGH_MIN_AVG;
+}
+
+static void score_packet(DecodeScore *score, const uint8_t *bytes, int numBytes, bool good, long long at) {
+    const SignalGenPacket *truth;
+    int errors = 0;
+    int i = score->next;
+    int b;
+
+    while (i + 1 < score->numTruth && score->truth[i + 1].endSample <= at) i++;
+    if (i >= score->numTruth || score->truth[i].endSample > at ||
+        at - score->truth[i].endSample > DECODE_MATCH_SAMPLES) {
+        score->spurious++;
+        return;
+    }
+    truth = &score->truth[i];
+    score->next = i + 1;
+    score->matched++;
+
+    // Missing or extra bytes count as all bits wrong
+    for (b = 0; b < CHIPCAP_PACKET_BYTES; b++) {
+        errors += b < numBytes ? __builtin_popcount(bytes[b] ^ truth->bytes[b]) : 8;
+    }
+    if (numBytes > CHIPCAP_PACKET_BYTES) errors += 8 * (numBytes - CHIPCAP_PACKET_BYTES);
+    score->bits += 8 * CHIPCAP_PACKET_BYTES;
+    score->bitErrors += errors;
+    if (good && errors == 0) score->good++;
+
+    score->latencySum += at - truth->endSample;
+    if (at - truth->endSample > score->latencyMax) score->latencyMax = at - truth->endSample;
+}
+
+static void score_sensor_packet(const uint8_t *bytes, int numBytes, bool good, void *userData) {
+    DecodeScore *score = userData;
+    score_packet(score, bytes, numBytes, good, score->sensor->sampleCount);
+}
+
+static void score_man_packet(const ManPacket *packet, void *userData) {
+    unsigned char bytes[MAN_MAX_PACKET_BITS / 8];
+    int numBytes = man_packet_bytes(packet, bytes, (int)sizeof(bytes));
+
+    // Packets of less than a byte are clicks, not transmissions
+    if (packet->numBits >= 8)
+        score_packet(userData, bytes, numBytes, chipcap_valid(bytes, numBytes), packet->endSample);
+}
+
+static void run_sensor_decoder(void *decoder, const int16_t *samples, long long numSamples, DecodeScore *score) {
+    SensorDecoder *dec = decoder;
+    long long i;
+    int n;
+
+    sensor_decoder_init(dec);
+    sensor_decoder_set_packet_callback(dec, score_sensor_packet, score);
+    score->sensor = dec;
+    for (i = 0; i < numSamples; i += n) {
+        n = numSamples - i < DECODE_BUFFER_FRAMES ? (int)(numSamples - i) : DECODE_BUFFER_FRAMES;
+        sensor_decoder_process(dec, samples + i, n, 1);
+    }
+}
+
+static void run_man_decoder(void *decoder, const int16_t *samples, long long numSamples, DecodeScore *score) {
+    ManDecoder *dec = decoder;
+    long long i;
+    int n;
+
+    man_decoder_init(dec, score->highMinAvg, score_man_packet, score);
+    for (i = 0; i < numSamples; i += n) {
+        n = numSamples - i < DECODE_CHUNK_FRAMES ? (int)(numSamples - i) : DECODE_CHUNK_FRAMES;
+        man_decoder_feed_s16(dec, samples + i, n);
+    }
+    man_decoder_flush(dec);
+}
+
+static void run_man_demod(void *decoder, const int16_t *samples, long long numSamples, DecodeScore *score) {
+    ManDemod *demod = decoder;
+    long long i;
+    int n;
+
+    man_demod_init(demod, score_man_packet, score);
+    for (i = 0; i < numSamples; i += n) {
+        n = numSamples - i < DECODE_CHUNK_FRAMES ? (int)(numSamples - i) : DECODE_CHUNK_FRAMES;
+        man_demod_feed_s16(demod, samples + i, n);
+    }
+    man_demod_flush(demod);
+}
+
+typedef void (*DecodeRunner)(void *decoder, const int16_t *samples, long long numSamples, DecodeScore *score);
+
+typedef struct {
+    const char *name;
+    DecodeRunner run;
+    void *decoder;
+} BenchDecoder;
+
+static void print_header(const char *condition, const char *variable, const BenchDecoder *decoders, int numDecoders) {
+    int d;
+
+    printf("\n  %-12s", condition);
+    for (d = 0; d < numDecoders; d++) printf("  %-17s", decoders[d].name);
+    printf("\n  %-12s", variable);
+    for (d = 0; d < numDecoders; d++) printf("  %7s %9s", "PER", "BER");
+    printf("\n");
+}
+
+/**
+ *  Runs every decoder over one generated capture and prints their error
+ *  rates: packet error rate over every packet sent, bit error rate over the
+ *  packets each decoder found. Each decoder's packet error rate goes in per.
+ */
+static int decode_point(const SignalGenConfig *config, int numPackets, SignalGenPacket *truth,
+                        const BenchDecoder *decoders, int numDecoders, double *per) {
+    DecodeScore score;
+    int16_t *samples;
+    long long numSamples = signal_gen_render(config, numPackets, &samples, truth);
+    int d;
+
+    if (numSamples < 0) {
+        perror("ERROR decode_point: failed to generate the capture.\n");
+        return 1;
+    }
+
+    for (d = 0; d < numDecoders; d++) {
+        score_init(&score, truth, numPackets);
+        score.highMinAvg = signal_gen_high_min_avg(config);
+        decoders[d].run(decoders[d].decoder, samples, numSamples, &score);
+        per[d] = 1.0 - (double)score.good / score.numTruth;
+        printf("  %7.4f %9.2e", per[d], score.bits ? (double)score.bitErrors / score.bits : 1.0);
+    }
+    printf("\n");
+
+    free(samples);
+    return 0;
+}
+
+static int bench_decode(int numPackets) {
+    static const double snrs[] = { -3, 0, 3, 6, 9, 12, 15, 20, 30 };
+    static const double clocks[] = { 0, DECODE_CLOCK_OFFSET };
+    static const double levels[] = { 300, 600, DECODE_AMPLITUDE, 4000, 16000 };
+    SignalGenPacket *truth = malloc(numPackets * sizeof(SignalGenPacket));
+    // sensor_decoder first and man_decoder second, the check below compares them
+    BenchDecoder decoders[] = {
+        { "sensor_decoder", run_sensor_decoder, malloc(sizeof(SensorDecoder)) },
+        { "man_decoder", run_man_decoder, malloc(sizeof(ManDecoder)) },
+        { "man_demod", run_man_demod, malloc(sizeof(ManDemod)) },
+    };
+    int numDecoders = (int)(sizeof(decoders) / sizeof(decoders[0]));
+    double per[sizeof(decoders) / sizeof(decoders[0])];
+    int failed = 0;
+    SignalGenConfig config;
+    DecodeScore score;
+    char condition[32];
+    int16_t *samples;
+    long long numSamples, total;
+    double start, elapsed;
+    int c, d, k;
+
+    for (d = 0; d < numDecoders; d++) {
+        if (decoders[d].decoder == NULL) truth = NULL;
+    }
+    if (truth == NULL) {
+        perror("ERROR bench_decode: failed to allocate buffers.\n");
+        return 1;
+    }
+
+    signal_gen_default(&config);
+    config.amplitude = DECODE_AMPLITUDE;
+    signal_gen_set_snr(&config, DECODE_SNR_DB);
+    numSamples = signal_gen_render(&config, numPackets, &samples, truth);
+    if (numSamples < 0) {
+        perror("ERROR bench_decode: failed to generate the capture.\n");
+        return 1;
+    }
+
+    printf("decode: %d packets per point, peak %.0f, %d dB SNR for timing\n", numPackets, config.amplitude, DECODE_SNR_DB);
+
+    for (d = 0; d < numDecoders; d++) {
+        total = 0;
+        start = now_seconds();
+        do {
+            score_init(&score, truth, numPackets);
+            score.highMinAvg = signal_gen_high_min_avg(&config);
+            decoders[d].run(decoders[d].decoder, samples, numSamples, &score);
+            total += numSamples;
+        } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+        printf("  %-14s %10.1f Msamples/s, latency %.1f ms mean %.1f ms max, %d/%d good\n", decoders[d].name,
+               total / elapsed / 1e6, score.matched ? score.latencySum * 1e3 / score.matched / config.sampleRate : 0,
+               score.latencyMax * 1e3 / config.sampleRate, score.good, numPackets);
+    }
+    free(samples);
+
+    for (c = 0; c < (int)(sizeof(clocks) / sizeof(clocks[0])); c++) {
+        snprintf(condition, sizeof(condition), "clock %+.0f%%", clocks[c] * 100);
+        print_header(condition, "SNR dB", decoders, numDecoders);
+
+        for (k = 0; k < (int)(sizeof(snrs) / sizeof(snrs[0])); k++) {
+            signal_gen_default(&config);
+            config.amplitude = DECODE_AMPLITUDE;
+            signal_gen_set_snr(&config, snrs[k]);
+            config.clockOffset = clocks[c];
+            config.seed = 1000 * c + k + 1;
+
+            printf("  %-12.0f", snrs[k]);
+            if (decode_point(&config, numPackets, truth, decoders, numDecoders, per) != 0) return 1;
+
+            // On its own clock man_decoder's fixed windows are at their best, the live decoder must keep up there
+            if (clocks[c] == 0 && per[0] > per[1]) {
+                printf("ERROR bench_decode: sensor_decoder loses more packets than man_decoder at %.0f dB\n", snrs[k]);
+                failed++;
+            }
+        }
+    }
+
+    // Same SNR at other line levels
+    snprintf(condition, sizeof(condition), "%d dB SNR", DECODE_SNR_DB);
+    print_header(condition, "peak", decoders, numDecoders);
+    for (k = 0; k < (int)(sizeof(levels) / sizeof(levels[0])); k++) {
+        signal_gen_default(&config);
+        config.amplitude = levels[k];
+        signal_gen_set_snr(&config, DECODE_SNR_DB);
+        config.seed = 3000 + k;
+
+        printf("  %-12.0f", levels[k]);
+        if (decode_point(&config, numPackets, truth, decoders, numDecoders, per) != 0) return 1;
+    }
+
+    free(truth);
+    for (d = 0; d < numDecoders; d++) free(decoders[d].decoder);
+    return failed ? 1 : 0;
+}
+
+/**
+ *  man_decoder over a capture at one bit timing, through the path it picks
+ *  for that timing or through the generic one.
+ */
+static void run_man_rate(ManDecoder *dec, int halfPeriod, int windows, bool generic,
+                         const int16_t *samples, long long numSamples, DecodeScore *score) {
+    long long i;
+    int n;
+
+    man_decoder_init(dec, SAMPLE_HIGH_MIN_AVG, score_man_packet, score);
+    man_decoder_set_rate(dec, halfPeriod, windows);
+    if (generic) man_decoder_use_generic(dec);
+    for (i = 0; i < numSamples; i += n) {
+        n = numSamples - i < DECODE_CHUNK_FRAMES ? (int)(numSamples - i) : DECODE_CHUNK_FRAMES;
+        man_decoder_feed_s16(dec, samples + i, n);
+    }
+    man_decoder_flush(dec);
+}
+
+static int bench_rates(int numPackets) {
+    static const int rates[][2] = {
+#define RATE_ENTRY(half, windows)   { half, windows },
+        MAN_LINE_RATES(RATE_ENTRY)
+#undef RATE_ENTRY
+    };
+    SignalGenPacket *truth = malloc(numPackets * sizeof(SignalGenPacket));
+    ManDecoder *dec = malloc(sizeof(ManDecoder));
+    SignalGenConfig config;
+    DecodeScore score[2];
+    int failed = 0;
+    int r, g;
+
+    if (truth == NULL || dec == NULL) {
+        perror("ERROR bench_rates: failed to allocate buffers.\n");
+        return 1;
+    }
+
+    printf("rates: %d packets per timing, peak %d, %d dB SNR\n", numPackets, DECODE_AMPLITUDE, DECODE_SNR_DB);
+
+    for (r = 0; r < (int)(sizeof(rates) / sizeof(rates[0])); r++) {
+        int halfPeriod = rates[r][0], windows = rates[r][1];
+        double rate[2];
+        int16_t *samples;
+
+        signal_gen_default(&config);
+        config.bitRate = config.sampleRate / (2 * halfPeriod);
+        config.amplitude = DECODE_AMPLITUDE;
+        config.gapSamples = 20 * halfPeriod;
+        config.gapJitter = 10 * halfPeriod;
+        signal_gen_set_snr(&config, DECODE_SNR_DB);
+        long long numSamples = signal_gen_render(&config, numPackets, &samples, truth);
+        if (numSamples < 0) {
+            perror("ERROR bench_rates: failed to generate the capture.\n");
+            return 1;
+        }
+
+        for (g = 0; g < 2; g++) {
+            long long total = 0;
+            double start = now_seconds(), elapsed;
+            do {
+                score_init(&score[g], truth, numPackets);
+                run_man_rate(dec, halfPeriod, windows, g == 1, samples, numSamples, &score[g]);
+                total += numSamples;
+            } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+            rate[g] = total / elapsed / 1e6;
+        }
+        free(samples);
+
+        man_decoder_set_rate(dec, halfPeriod, windows);
+        printf("  %3d/%d %6.0f bps  %-8s %8.1f Msamples/s  generic %8.1f Msamples/s  %.2fx  %d/%d good\n",
+               halfPeriod, windows, config.bitRate, man_decoder_impl(dec), rate[0], rate[1], rate[0] / rate[1],
+               score[1].good, numPackets);
+
+        // Both paths must find the same packets with the same bits
+        if (score[0].good != score[1].good || score[0].matched != score[1].matched ||
+            score[0].spurious != score[1].spurious || score[0].bitErrors != score[1].bitErrors ||
+            score[0].latencySum != score[1].latencySum) {
+            printf("ERROR bench_rates: %d/%d specialized and generic decodes differ\n", halfPeriod, windows);
+            failed++;
+        }
+    }
+
+    free(truth);
+    free(dec);
+    return failed ? 1 : 0;
+}
+
+
+/**
+ *  Render thread side of the instrumentation check: the processIO decode
+ *  of a generated capture on a simulated clock, with some callbacks made
+ *  slow or late on purpose, and the counters it should end up with.
+ */
+typedef struct {
+    IoStats stats;
+    const int16_t *samples;
+    long long numSamples;
+    IoStatsCounters expected;
+    double recordNs;                // Mean cost of io_stats_record
+    volatile int done;
+} IoStatsRun;
+
+static void *iostats_callbacks(void *arg) {
+    IoStatsRun *run = arg;
+    static SensorDecoder dec;
+    uint64_t clock = 1000000;
+    double recordSeconds = 0;
+    long long i;
+    int k = 0;
+
+    sensor_decoder_init(&dec);
+    for (i = 0; i + DECODE_BUFFER_FRAMES <= run->numSamples; i += DECODE_BUFFER_FRAMES, k++) {
+        IoStatsCycle cycle = { .frames = DECODE_BUFFER_FRAMES };
+        uint64_t duration = 20000 + (uint64_t)(k % 50) * 7000;
+        double start;
+
+        if (k % IOSTATS_LATE_EVERY == IOSTATS_LATE_EVERY - 1) {
+            clock += IOSTATS_PERIOD_NS;
+            run->expected.overruns++;
+        }
+        if (k % IOSTATS_MISS_EVERY == IOSTATS_MISS_EVERY - 1) {
+            duration = IOSTATS_PERIOD_NS + 100000;
+            run->expected.deadlineMisses++;
+        }
+
+        if (k % IOSTATS_RETRY_EVERY == IOSTATS_RETRY_EVERY - 1) {
+            cycle.retries = 1;
+        } else {
+            long long bits = dec.bitsDecoded;
+            int packets = dec.goodPackets;
+            int badPackets = dec.badPackets;
+            sensor_decoder_process(&dec, run->samples + i, DECODE_BUFFER_FRAMES, 1);
+            cycle.samples = DECODE_BUFFER_FRAMES;
+            cycle.bits = (uint32_t)(dec.bitsDecoded - bits);
+            cycle.packets = dec.goodPackets - packets;
+            cycle.badPackets = dec.badPackets - badPackets;
+        }
+
+        start = now_seconds();
+        io_stats_record(&run->stats, clock, clock + duration, &cycle);
+        recordSeconds += now_seconds() - start;
+
+        run->expected.callbacks++;
+        run->expected.frames += cycle.frames;
+        run->expected.samples += cycle.samples;
+        run->expected.bits += cycle.bits;
+        run->expected.packets += cycle.packets;
+        run->expected.badPackets += cycle.badPackets;
+        run->expected.retries += cycle.retries;
+        run->expected.durationSumNs += duration;
+        if (duration > run->expected.durationMaxNs) run->expected.durationMaxNs = duration;
+        run->expected.histogram[io_stats_bucket(duration)]++;
+
+        clock += IOSTATS_PERIOD_NS;
+    }
+
+    run->recordNs = recordSeconds / k * 1e9;
+    __atomic_store_n(&run->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/**
+ *  A snapshot is consistent when every callback in it is counted everywhere.
+ */
+static bool iostats_consistent(const IoStatsCounters *c, const IoStatsCounters *last) {
+    uint64_t histogram = 0;
+    int b;
+
+    for (b = 0; b < IO_STATS_BUCKETS; b++) histogram += c->histogram[b];
+
+    return histogram == c->callbacks && c->frames == c->callbacks * DECODE_BUFFER_FRAMES &&
+           c->samples + c->retries * DECODE_BUFFER_FRAMES == c->frames &&
+           c->callbacks >= last->callbacks && c->bits >= last->bits && c->packets >= last->packets;
+}
+
+static int bench_iostats(int numPackets) {
+    static IoStatsRun run;
+    SignalGenPacket *truth = malloc(numPackets * sizeof(SignalGenPacket));
+    SignalGenConfig config;
+    IoStatsCounters snapshot, last;
+    int16_t *samples;
+    pthread_t writer;
+    long long snapshots = 0;
+    int failed = 0;
+
+    signal_gen_default(&config);
+    signal_gen_set_snr(&config, DECODE_SNR_DB);
+    run.numSamples = truth == NULL ? -1 : signal_gen_render(&config, numPackets, &samples, truth);
+    if (run.numSamples < 0) {
+        perror("ERROR bench_iostats: failed to generate the capture.\n");
+        return 1;
+    }
+    run.samples = samples;
+    io_stats_init(&run.stats, config.sampleRate);
+
+    printf("iostats: %d packets in %d frame callbacks, snapshots taken while they run\n", numPackets, DECODE_BUFFER_FRAMES);
+
+    memset(&last, 0, sizeof(last));
+    pthread_create(&writer, NULL, iostats_callbacks, &run);
+    while (!__atomic_load_n(&run.done, __ATOMIC_ACQUIRE)) {
+        io_stats_snapshot(&run.stats, &snapshot);
+        if (!iostats_consistent(&snapshot, &last)) failed++;
+        last = snapshot;
+        snapshots++;
+    }
+    pthread_join(writer, NULL);
+
+    io_stats_snapshot(&run.stats, &snapshot);
+    printf("  %lld snapshots, %d inconsistent\n", snapshots, failed);
+    printf("  %llu callbacks, %llu deadline misses, %llu overruns, %llu retries\n", (unsigned long long)snapshot.callbacks,
+           (unsigned long long)snapshot.deadlineMisses, (unsigned long long)snapshot.overruns, (unsigned long long)snapshot.retries);
+    printf("  %llu samples, %llu bits, %llu packets, %llu bad CRC\n", (unsigned long long)snapshot.samples,
+           (unsigned long long)snapshot.bits, (unsigned long long)snapshot.packets, (unsigned long long)snapshot.badPackets);
+    printf("  duration p50 %.0f us, p99 %.0f us, max %.0f us\n", io_stats_percentile_ns(&snapshot, 50) / 1e3,
+           io_stats_percentile_ns(&snapshot, 99) / 1e3, snapshot.durationMaxNs / 1e3);
+    printf("  io_stats_record %.1f ns\n", run.recordNs);
+
+    if (memcmp(&snapshot, &run.expected, sizeof(snapshot)) != 0) {
+        printf("ERROR bench_iostats: counters do not match the simulated callbacks\n");
+        failed++;
+    }
+    // A retry skips a buffer, which can cost the packet it lands in and the one after
+    if (snapshot.packets + 2 * snapshot.retries < (uint64_t)numPackets) {
+        printf("ERROR bench_iostats: %llu of %d packets decoded\n", (unsigned long long)snapshot.packets, numPackets);
+        failed++;
+    }
+
+    free(samples);
+    free(truth);
+    return failed ? 1 : 0;
+}
+
+
+/**
+ *  Closed loop link training: a simulated sensor listens to the command
+ *  channel sensor_io_render writes, follows rate messages unless it
+ *  is a legacy board, and answers each request tone with a packet. The
+ *  line corrupts packets more often the faster they are sent.
+ */
+typedef struct {
+    bool legacy;                    // Ignores rate messages, always sends at the base rate
+    int rate;
+    LinkListener listener;
+    int16_t *samples;               // Packet being sent, with its gaps
+    long long numSamples;
+    long long next;
+    uint32_t seed;
+    int sent;
+} LinkSensor;
+
+// Chance the line flips a bit of a packet at each rate
+static const double linkCorrupt[LINK_RATES] = { 0.0, 0.01, 0.03, 0.6 };
+
+static bool link_sensor_packet(LinkSensor *sensor) {
+    int halfPeriod = link_rate_half_period(sensor->rate);
+    SignalGenConfig config;
+    SignalGenPacket truth;
+
+    signal_gen_default(&config);
+    config.bitRate = config.sampleRate / (2 * halfPeriod);
+    config.amplitude = DECODE_AMPLITUDE;
+    config.gapSamples = LINK_GAP_SAMPLES;
+    config.gapJitter = 0;
+    config.seed = ++sensor->seed;
+    signal_gen_set_snr(&config, DECODE_SNR_DB);
+
+    free(sensor->samples);
+    sensor->numSamples = signal_gen_render(&config, 1, &sensor->samples, &truth);
+    if (sensor->numSamples < 0) return false;
+    sensor->next = 0;
+    sensor->sent++;
+
+    // A flipped bit swaps the halves of one Manchester bit in the middle of the packet
+    if ((sensor->seed * 2654435761u) % 1000 < linkCorrupt[sensor->rate] * 1000) {
+        int16_t *first = sensor->samples + truth.startSample + halfPeriod + 2 * 20 * halfPeriod;
+        int k;
+        for (k = 0; k < halfPeriod; k++) {
+            int16_t t = first[k];
+            first[k] = first[k + halfPeriod];
+            first[k + halfPeriod] = t;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    int packets;
+    int badPackets;
+    int sent;
+    int finalRate;
+    uint32_t changes;
+} LinkRun;
+
+static int link_run(SensorIO *io, bool training, bool legacy, int seconds, LinkRun *result) {
+    int16_t frames[2 * DECODE_BUFFER_FRAMES];
+    LinkSensor sensor;
+    IoStatsCycle cycle;
+    long long callbacks = (long long)seconds * 44100 / DECODE_BUFFER_FRAMES, c;
+    uint32_t k;
+
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.legacy = legacy;
+    link_listener_init(&sensor.listener, 44100, LINK_LISTEN_THRESHOLD);
+    io->linkTraining = training;
+    sensor_io_reset(io, 44100);
+
+    for (c = 0; c < callbacks; c++) {
+        for (k = 0; k < DECODE_BUFFER_FRAMES; k++) {
+            if (sensor.next >= sensor.numSamples && sensor.listener.requested && !link_sensor_packet(&sensor)) {
+                perror("ERROR bench_link: failed to generate a packet.\n");
+                return 1;
+            }
+            frames[2 * k] = sensor.next < sensor.numSamples ? sensor.samples[sensor.next++] : 0;
+            frames[2 * k + 1] = 0;
+        }
+
+        memset(&cycle, 0, sizeof(cycle));
+        sensor_io_render(io, frames, DECODE_BUFFER_FRAMES, 2, &cycle);
+
+        int message = link_listener_feed(&sensor.listener, frames + 1, DECODE_BUFFER_FRAMES, 2);
+        if (message >= 0 && !(message & LINK_MSG_NAK) && !sensor.legacy) sensor.rate = message;
+    }
+
+    free(sensor.samples);
+    result->packets = io->decoder.goodPackets;
+    result->badPackets = io->decoder.badPackets;
+    result->sent = sensor.sent;
+    result->finalRate = io->link.rate;
+    result->changes = io->link.changes;
+    return 0;
+}
+
+static int bench_link(int seconds) {
+    static const struct {
+        const char *name;
+        bool training;
+        bool legacy;
+    } runs[] = {
+        { "fixed",    false, false },
+        { "trained",  true,  false },
+        { "legacy",   true,  true },
+    };
+    SensorIO *io = malloc(sizeof(SensorIO));
+    LinkRun result[3];
+    int failed = 0;
+    int r;
+
+    if (io == NULL || !sensor_io_init(io, 0)) {
+        perror("ERROR bench_link: failed to allocate the IO state.\n");
+        return 1;
+    }
+
+    printf("link: %d s per run, %d frame callbacks, bit flips per packet", seconds, DECODE_BUFFER_FRAMES);
+    for (r = 0; r < LINK_RATES; r++) printf(" %.0f bps %.0f%%", link_rate_bits_per_second(r, 44100), linkCorrupt[r] * 100);
+    printf("\n");
+
+    for (r = 0; r < 3; r++) {
+        if (link_run(io, runs[r].training, runs[r].legacy, seconds, &result[r]) != 0) return 1;
+        printf("  %-8s %5d sent %5d good %4d bad CRC  %6.2f readings/s  ends at %4.0f bps after %u changes\n",
+               runs[r].name, result[r].sent, result[r].packets, result[r].badPackets, (double)result[r].packets / seconds,
+               link_rate_bits_per_second(result[r].finalRate, 44100), result[r].changes);
+    }
+
+    if (result[1].finalRate != LINK_BEST_RATE) {
+        printf("ERROR bench_link: training ended at rate %d, not %d\n", result[1].finalRate, LINK_BEST_RATE);
+        failed++;
+    }
+    if (result[1].packets < LINK_MIN_SPEEDUP * result[0].packets) {
+        printf("ERROR bench_link: training delivered %d readings, under %.1fx the fixed rate's %d\n",
+               result[1].packets, LINK_MIN_SPEEDUP, result[0].packets);
+        failed++;
+    }
+    // A legacy board costs the failed attempts, but must end up at the base rate
+    if (result[2].finalRate != 0 || result[2].packets < 0.9 * result[0].packets) {
+        printf("ERROR bench_link: legacy sensor ended at rate %d with %d readings\n", result[2].finalRate, result[2].packets);
+        failed++;
+    }
+
+    sensor_io_free(io);
+    free(io);
+    return failed ? 1 : 0;
+}
+
+
+static uint32_t frames_random(uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// Flips flips distinct bits of bytes[0..numBytes)
+static void frames_flip(uint8_t *bytes, int numBytes, int flips, uint32_t *rng) {
+    int flipped[FRAMES_MAX_FLIPS];
+    int f = 0, g;
+
+    while (f < flips) {
+        int bit = frames_random(rng) % (8 * numBytes);
+        for (g = 0; g < f && flipped[g] != bit; g++) {}
+        if (g < f) continue;
+        flipped[f++] = bit;
+        bytes[bit >> 3] ^= 1 << (bit & 7);
+    }
+}
+
+/**
+ *  How often a ChipCap2 packet and a framed reading with bits flipped on
+ *  the line still pass their check, then the cost of parsing a burst.
+ */
+static int bench_frames(int trials) {
+    uint8_t packet[CHIPCAP_PACKET_BYTES], frame[SENSOR_MAX_BYTES], burst[SENSOR_MAX_BYTES];
+    uint8_t bits[SENSOR_MAX_BYTES + 1];
+    SensorFrame parsed;
+    uint32_t rng = 1;
+    int failed = 0;
+    int flips, t, b;
+
+    printf("frames: %d corrupted readings per point, check sum vs CRC-8\n", trials);
+    printf("  flips  check sum passed  CRC-8 passed\n");
+
+    for (flips = 1; flips <= FRAMES_MAX_FLIPS; flips++) {
+        long long sumPassed = 0, crcPassed = 0;
+
+        for (t = 0; t < trials; t++) {
+            int offset = SENSOR_FRAME_HEADER;
+
+            for (b = 1; b < CHIPCAP_PACKET_BYTES; b++) packet[b] = (uint8_t)frames_random(&rng);
+            packet[0] = (uint8_t)chipcap_checksum(packet, CHIPCAP_PACKET_BYTES);
+            int numBytes = sensor_frame_begin(frame, (int)sizeof(frame), t, false);
+            numBytes = sensor_frame_append(frame, numBytes, (int)sizeof(frame), SENSOR_FRAME_CHIPCAP2, 0,
+                                           packet + 1, CHIPCAP_PACKET_BYTES - 1);
+
+            // The sequence byte is checked along with the frame, the sync word is only searched for
+            frames_flip(packet, CHIPCAP_PACKET_BYTES, flips, &rng);
+            frames_flip(frame + SENSOR_FRAME_HEADER - 1, numBytes - SENSOR_FRAME_HEADER + 1, flips, &rng);
+            sumPassed += chipcap_valid(packet, CHIPCAP_PACKET_BYTES);
+            // Only a frame the decoder would store as a reading can pass on a wrong one
+            crcPassed += sensor_frame_parse(frame, numBytes, &offset, &parsed) == SENSOR_FRAME_GOOD &&
+                         parsed.type == SENSOR_FRAME_CHIPCAP2;
+        }
+        printf("  %5d  %15.4f%%  %11.4f%%\n", flips, 100.0 * sumPassed / trials, 100.0 * crcPassed / trials);
+
+        // The CRC catches every error of up to 3 bits in a ChipCap2 frame
+        if (flips < 4 && crcPassed > 0) {
+            printf("ERROR bench_frames: %lld frames with %d flipped bits passed\n", crcPassed, flips);
+            failed++;
+        }
+    }
+
+    // A burst as the decoder holds it: packed bits with stray ones ahead of the sync word
+    int numBytes = sensor_frame_begin(burst, (int)sizeof(burst), 0, false);
+    for (t = 0; t < FRAMES_BURST; t++) {
+        for (b = 0; b < CHIPCAP_PACKET_BYTES - 1; b++) packet[b] = (uint8_t)frames_random(&rng);
+        numBytes = sensor_frame_append(burst, numBytes, (int)sizeof(burst), SENSOR_FRAME_CHIPCAP2, t, packet, CHIPCAP_PACKET_BYTES - 1);
+    }
+    memset(bits, 0, sizeof(bits));
+    for (b = 0; b < 8 * numBytes; b++) {
+        if ((burst[b >> 3] >> (b & 7)) & 1) bits[(b + 3) >> 3] |= 1 << ((b + 3) & 7);
+    }
+
+    long long bursts = 0, good = 0;
+    double start = now_seconds(), elapsed;
+    do {
+        for (t = 0; t < 1000; t++) {
+            int offset = SENSOR_FRAME_HEADER;
+            int n = sensor_frame_unpack(bits, 8 * numBytes + 3, frame);
+            while (sensor_frame_parse(frame, n, &offset, &parsed) == SENSOR_FRAME_GOOD) good++;
+        }
+        bursts += 1000;
+    } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+    printf("  burst of %d readings, %d bits: %.0f ns to find and check\n", FRAMES_BURST, 8 * numBytes, elapsed / bursts * 1e9);
+
+    if (good != bursts * FRAMES_BURST) {
+        printf("ERROR bench_frames: %lld of %lld frames parsed\n", good, bursts * FRAMES_BURST);
+        failed++;
+    }
+    return failed ? 1 : 0;
+}
+
+
+/**
+ *  Selective repeat against waitACycle: a simulated sensor sends bursts of
+ *  REPEAT_FRAMES numbered readings, and the line breaks each frame by
+ *  itself. With NAKs the sensor resends just the frames asked for, ahead
+ *  of new readings. Without them it resends its whole last burst when the
+ *  host drops the request tone for a cycle. Unique readings count once
+ *  however often they arrive.
+ */
+typedef struct {
+    bool selective;                 // Answers NAKs, otherwise repeats a burst on a retry
+    double corrupt;                 // Chance each frame has a bit flipped on the line
+    LinkListener listener;
+    uint32_t lastRetries;
+    int sequence;
+    uint32_t history[LINK_SEQUENCE_WINDOW][REPEAT_FRAMES];     // Readings of the last bursts by sequence
+    int historySequence[LINK_SEQUENCE_WINDOW];
+    int historyCount[LINK_SEQUENCE_WINDOW];
+    uint32_t queue[REPEAT_QUEUE];   // Readings NAKed and waiting to be resent
+    int queueCount;
+    uint32_t nextReading;
+    uint32_t rng;
+    int16_t *samples;
+    long long numSamples;
+    long long next;
+    int bursts;
+    int resent;                     // Frames sent again
+} RepeatSensor;
+
+typedef struct {
+    uint8_t *seen;                  // Per reading number
+    uint32_t unique;
+    uint32_t duplicates;
+} RepeatHost;
+
+static const double repeatCorrupt[] = { 0.0, 0.05, 0.15, 0.3 };
+
+static void repeat_host_packet(const uint8_t *bytes, int numBytes, bool good, void *userData) {
+    RepeatHost *host = userData;
+
+    if (!good || numBytes != SENSOR_FRAME_OVERHEAD + 4 || bytes[0] >> 4 != SENSOR_FRAME_CHIPCAP2) return;
+    uint32_t reading = (uint32_t)bytes[2] << 16 | bytes[3] << 8 | bytes[4];
+    if (reading >= REPEAT_MAX_READINGS) return;
+    if (host->seen[reading]) {
+        host->duplicates++;
+    } else {
+        host->seen[reading] = 1;
+        host->unique++;
+    }
+}
+
+static void repeat_sensor_nak(RepeatSensor *sensor, int message) {
+    int s;
+
+    for (s = 0; s < LINK_SEQUENCE_WINDOW; s++) {
+        if (sensor->historySequence[s] < 0 || (sensor->historySequence[s] & 0xf) != LINK_NAK_SEQUENCE(message)) continue;
+        if (LINK_NAK_FRAME(message) < sensor->historyCount[s] && sensor->queueCount < REPEAT_QUEUE)
+            sensor->queue[sensor->queueCount++] = sensor->history[s][LINK_NAK_FRAME(message)];
+        return;
+    }
+}
+
+static bool repeat_sensor_burst(RepeatSensor *sensor) {
+    uint8_t burst[SENSOR_FRAME_HEADER + REPEAT_FRAMES * (SENSOR_FRAME_OVERHEAD + 4)];
+    int slot = sensor->sequence % LINK_SEQUENCE_WINDOW;
+    uint32_t *readings = sensor->history[slot];
+    SignalGenConfig config;
+    long long start;
+    int n = 0, f;
+
+    if (!sensor->selective && sensor->listener.retries != sensor->lastRetries && sensor->bursts > 0) {
+        int last = (sensor->sequence + LINK_SEQUENCE_WINDOW - 1) % LINK_SEQUENCE_WINDOW;
+        memcpy(readings, sensor->history[last], sizeof(sensor->history[last]));
+        n = sensor->historyCount[last];
+        sensor->resent += n;
+    } else {
+        for (f = 0; f < sensor->queueCount && n < REPEAT_FRAMES; f++) readings[n++] = sensor->queue[f];
+        sensor->resent += n;
+        sensor->queueCount -= n;
+        memmove(sensor->queue, sensor->queue + n, sensor->queueCount * sizeof(uint32_t));
+        while (n < REPEAT_FRAMES) readings[n++] = sensor->nextReading++;
+    }
+    sensor->lastRetries = sensor->listener.retries;
+    sensor->historySequence[slot] = sensor->sequence;
+    sensor->historyCount[slot] = n;
+
+    int numBytes = sensor_frame_begin(burst, (int)sizeof(burst), sensor->sequence, false);
+    for (f = 0; f < n; f++) {
+        uint8_t payload[4] = { (uint8_t)(readings[f] >> 16), (uint8_t)(readings[f] >> 8), (uint8_t)readings[f], 0 };
+        numBytes = sensor_frame_append(burst, numBytes, (int)sizeof(burst), SENSOR_FRAME_CHIPCAP2, f, payload, 4);
+    }
+    sensor->sequence = (sensor->sequence + 1) & 0xff;
+
+    signal_gen_default(&config);
+    config.amplitude = DECODE_AMPLITUDE;
+    config.gapSamples = LINK_GAP_SAMPLES;
+    config.gapJitter = 0;
+    config.seed = sensor->rng;
+    signal_gen_set_snr(&config, DECODE_SNR_DB);
+
+    free(sensor->samples);
+    sensor->numSamples = signal_gen_render_bytes(&config, burst, numBytes, &sensor->samples, &start);
+    if (sensor->numSamples < 0) return false;
+    sensor->next = 0;
+    sensor->bursts++;
+
+    // Swap the halves of one Manchester bit in the payload of each frame the line breaks
+    for (f = 0; f < n; f++) {
+        if (frames_random(&sensor->rng) % 1000 >= sensor->corrupt * 1000) continue;
+        int bit = 8 * (SENSOR_FRAME_HEADER + f * (SENSOR_FRAME_OVERHEAD + 4) + 2) + frames_random(&sensor->rng) % 32;
+        int16_t *first = sensor->samples + start + HALF_PERIOD_TC + 2 * bit * HALF_PERIOD_TC;
+        int k;
+        for (k = 0; k < HALF_PERIOD_TC; k++) {
+            int16_t t = first[k];
+            first[k] = first[k + HALF_PERIOD_TC];
+            first[k + HALF_PERIOD_TC] = t;
+        }
+    }
+    return true;
+}
+
+typedef struct {
+    uint32_t unique;
+    uint32_t duplicates;
+    uint32_t generated;
+    int bursts;
+    int resent;
+    uint64_t naks;
+    uint64_t retries;
+} RepeatRun;
+
+static int repeat_run(SensorIO *io, bool selective, double corrupt, int seconds, RepeatHost *host, RepeatRun *result) {
+    int16_t frames[2 * DECODE_BUFFER_FRAMES];
+    RepeatSensor sensor;
+    IoStatsCycle cycle;
+    IoStatsCounters counters;
+    long long callbacks = (long long)seconds * 44100 / DECODE_BUFFER_FRAMES, c;
+    uint32_t k;
+    int s;
+
+    memset(&sensor, 0, sizeof(sensor));
+    sensor.selective = selective;
+    sensor.corrupt = corrupt;
+    sensor.rng = 0x9e3779b9u;
+    for (s = 0; s < LINK_SEQUENCE_WINDOW; s++) sensor.historySequence[s] = -1;
+    link_listener_init(&sensor.listener, 44100, LINK_LISTEN_THRESHOLD);
+
+    memset(host->seen, 0, REPEAT_MAX_READINGS);
+    host->unique = 0;
+    host->duplicates = 0;
+    io->linkTraining = false;
+    io->selectiveRepeat = selective;
+    sensor_io_reset(io, 44100);
+    sensor_decoder_set_packet_callback(&io->decoder, repeat_host_packet, host);
+
+    for (c = 0; c < callbacks; c++) {
+        for (k = 0; k < DECODE_BUFFER_FRAMES; k++) {
+            if (sensor.next >= sensor.numSamples && sensor.listener.requested && !repeat_sensor_burst(&sensor)) {
+                perror("ERROR bench_repeat: failed to generate a burst.\n");
+                return 1;
+            }
+            frames[2 * k] = sensor.next < sensor.numSamples ? sensor.samples[sensor.next++] : 0;
+            frames[2 * k + 1] = 0;
+        }
+
+        memset(&cycle, 0, sizeof(cycle));
+        sensor_io_render(io, frames, DECODE_BUFFER_FRAMES, 2, &cycle);
+        io_stats_record(&io->stats, 0, 0, &cycle);
+
+        int message = link_listener_feed(&sensor.listener, frames + 1, DECODE_BUFFER_FRAMES, 2);
+        if (message >= 0 && (message & LINK_MSG_NAK) && sensor.selective) repeat_sensor_nak(&sensor, message);
+    }
+
+    free(sensor.samples);
+    io_stats_snapshot(&io->stats, &counters);
+    result->unique = host->unique;
+    result->duplicates = host->duplicates;
+    result->generated = sensor.nextReading;
+    result->bursts = sensor.bursts;
+    result->resent = sensor.resent;
+    result->naks = counters.naks;
+    result->retries = counters.retries;
+    return 0;
+}
+
+static int bench_repeat(int seconds) {
+    int numPoints = (int)(sizeof(repeatCorrupt) / sizeof(repeatCorrupt[0]));
+    SensorIO *io = malloc(sizeof(SensorIO));
+    RepeatHost host;
+    RepeatRun result[2];
+    int failed = 0;
+    int p, r;
+
+    host.seen = malloc(REPEAT_MAX_READINGS);
+    if (io == NULL || host.seen == NULL || !sensor_io_init(io, 0)) {
+        perror("ERROR bench_repeat: failed to allocate the IO state.\n");
+        return 1;
+    }
+
+    printf("repeat: %d s per run, %d readings per burst at %.0f bps\n", seconds, REPEAT_FRAMES, link_rate_bits_per_second(0, 44100));
+    printf("  frames hit  scheme      bursts  resent  retries   NAKs  duplicates  unique  missing  readings/s\n");
+
+    for (p = 0; p < numPoints; p++) {
+        for (r = 0; r < 2; r++) {
+            if (repeat_run(io, r == 1, repeatCorrupt[p], seconds, &host, &result[r]) != 0) return 1;
+            printf("  %9.0f%%  %-10s  %6d  %6d  %7llu  %5llu  %10u  %6u  %7u  %10.2f\n",
+                   repeatCorrupt[p] * 100, r ? "selective" : "waitACycle", result[r].bursts, result[r].resent,
+                   (unsigned long long)result[r].retries, (unsigned long long)result[r].naks, result[r].duplicates,
+                   result[r].unique, result[r].generated - result[r].unique, (double)result[r].unique / seconds);
+        }
+
+        // Selective repeat never does worse, and does much better once frames often fail. A
+        // short run has too few bursts for either to show
+        if (result[0].bursts < REPEAT_MIN_BURSTS || result[1].bursts < REPEAT_MIN_BURSTS) {
+            printf("  under %d bursts, not compared\n", REPEAT_MIN_BURSTS);
+            continue;
+        }
+        if (result[1].unique < 0.98 * result[0].unique) {
+            printf("ERROR bench_repeat: selective repeat delivered %u readings, waitACycle %u\n", result[1].unique, result[0].unique);
+            failed++;
+        }
+        if (repeatCorrupt[p] >= 0.15 && result[1].unique < REPEAT_MIN_GAIN * result[0].unique) {
+            printf("ERROR bench_repeat: selective repeat delivered %u readings, under %.1fx waitACycle's %u\n",
+                   result[1].unique, REPEAT_MIN_GAIN, result[0].unique);
+            failed++;
+        }
+    }
+
+    free(host.seen);
+    sensor_io_free(io);
+    free(io);
+    return failed ? 1 : 0;
+}
+
+
+typedef struct {
+    int good;                       // Readings delivered right
+    int wrong;                      // delivered wrong, a frame corrected to the wrong bytes
+    int corrected;
+    int uncorrectable;              // Frames that failed their check, each a NAK or a retry
+    int bits;                       // Sent per burst
+} FecRun;
+
+static int fec_run(SensorDecoder *dec, bool coded, double bitErrorRate, int bursts, FecRun *result) {
+    int numReadings = bursts * FEC_SENSORS;
+    SignalGenPacket *truth = malloc(numReadings * sizeof(SignalGenPacket));
+    SignalGenConfig config;
+    int16_t *samples;
+    long long numSamples, i;
+    int n, r, t = 0;
+
+    signal_gen_default(&config);
+    config.amplitude = DECODE_AMPLITUDE;
+    config.framedSensors = FEC_SENSORS;
+    config.codedBursts = coded;
+    config.bitErrorRate = bitErrorRate;
+    signal_gen_set_snr(&config, DECODE_SNR_DB);
+    if (truth == NULL || (numSamples = signal_gen_render(&config, numReadings, &samples, truth)) < 0) {
+        perror("ERROR bench_fec: failed to generate the capture.\n");
+        free(truth);
+        return 1;
+    }
+
+    sensor_decoder_init(dec);
+    for (i = 0; i < numSamples; i += n) {
+        n = numSamples - i < DECODE_BUFFER_FRAMES ? (int)(numSamples - i) : DECODE_BUFFER_FRAMES;
+        sensor_decoder_process(dec, samples + i, n, 1);
+    }
+
+    // Readings come out in the order sent, less the lost ones
+    memset(result, 0, sizeof(*result));
+    for (r = 0; r < sensor_decoder_reading_count(dec); r++) {
+        int match = t;
+        while (match < numReadings && (truth[match].humidity != fixed_q16_to_float(dec->readings.humidity[r]) ||
+                                       truth[match].temperature != fixed_q16_to_float(dec->readings.temperature[r]) ||
+                                       truth[match].sensor != dec->readings.sensor[r])) match++;
+        if (match == numReadings) {
+            result->wrong++;
+        } else {
+            result->good++;
+            t = match + 1;
+        }
+    }
+    result->corrected = dec->correctedPackets;
+    result->uncorrectable = dec->badPackets;
+    result->bits = 8 * (SENSOR_FRAME_HEADER + FEC_SENSORS * (CHIPCAP_PACKET_BYTES - 1 +
+                                                             (coded ? SENSOR_FRAME_CODED_OVERHEAD : SENSOR_FRAME_OVERHEAD)));
+
+    free(samples);
+    free(truth);
+    return 0;
+}
+
+/**
+ *  Plain against coded bursts on a line that sends bits wrong at random:
+ *  readings lost, frames put right, and the airtime the parity costs. Then
+ *  the cost of checking a coded burst.
+ */
+static int bench_fec(int bursts) {
+    static const double bitErrorRates[] = { 0.0, 0.001, 0.003, 0.01 };
+    int numPoints = (int)(sizeof(bitErrorRates) / sizeof(bitErrorRates[0]));
+    SensorDecoder *dec = malloc(sizeof(SensorDecoder));
+    uint8_t burst[SENSOR_MAX_BYTES], frame[SENSOR_MAX_BYTES], payload[CHIPCAP_PACKET_BYTES - 1];
+    SensorFrame parsed;
+    FecRun result[2];
+    uint32_t rng = 1;
+    int failed = 0;
+    int p, c, t, b;
+
+    if (dec == NULL) {
+        perror("ERROR bench_fec: failed to allocate the decoder.\n");
+        return 1;
+    }
+
+    printf("fec: %d bursts of %d readings per point\n", bursts, FEC_SENSORS);
+    printf("  bit errors  burst   bits  lost readings  corrected  failed check  wrong\n");
+    for (p = 0; p < numPoints; p++) {
+        for (c = 0; c < 2; c++) {
+            if (fec_run(dec, c == 1, bitErrorRates[p], bursts, &result[c]) != 0) return 1;
+            printf("  %10.3f  %-5s  %5d  %12.1f%%  %9d  %12d  %5d\n", bitErrorRates[p], c ? "coded" : "plain",
+                   result[c].bits, 100.0 - 100.0 * result[c].good / (bursts * FEC_SENSORS), result[c].corrected,
+                   result[c].uncorrectable, result[c].wrong);
+            if (result[c].wrong > 0) {
+                printf("ERROR bench_fec: %d wrong readings delivered\n", result[c].wrong);
+                failed++;
+            }
+        }
+
+        int plainLost = bursts * FEC_SENSORS - result[0].good, codedLost = bursts * FEC_SENSORS - result[1].good;
+        if (bitErrorRates[p] == 0 && (plainLost > 0 || codedLost > 0 || result[1].corrected > 0)) {
+            printf("ERROR bench_fec: %d plain and %d coded readings lost on a clean line\n", plainLost, codedLost);
+            failed++;
+        }
+        if (bitErrorRates[p] >= 0.003 && codedLost * FEC_MIN_GAIN > plainLost) {
+            printf("ERROR bench_fec: coded bursts lost %d readings, plain ones %d\n", codedLost, plainLost);
+            failed++;
+        }
+    }
+    free(dec);
+
+    // Checking a coded burst, clean and with one byte of a frame wrong
+    int numBytes = sensor_frame_begin(burst, (int)sizeof(burst), 0, true);
+    for (t = 0; t < FEC_SENSORS; t++) {
+        for (b = 0; b < CHIPCAP_PACKET_BYTES - 1; b++) payload[b] = (uint8_t)frames_random(&rng);
+        numBytes = sensor_frame_append(burst, numBytes, (int)sizeof(burst), SENSOR_FRAME_CHIPCAP2, t, payload, CHIPCAP_PACKET_BYTES - 1);
+    }
+    for (c = 0; c < 2; c++) {
+        long long checked = 0, good = 0, corrected = 0;
+        double start = now_seconds(), elapsed;
+        do {
+            for (t = 0; t < 1000; t++) {
+                int offset = SENSOR_FRAME_HEADER;
+                memcpy(frame, burst, numBytes);
+                if (c) frame[SENSOR_FRAME_HEADER + 3] ^= 0x5a;
+                while (sensor_frame_parse(frame, numBytes, &offset, &parsed) == SENSOR_FRAME_GOOD) {
+                    good++;
+                    corrected += parsed.corrected;
+                }
+            }
+            checked += 1000;
+        } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+        printf("  coded burst of %d readings, %s: %.0f ns to check\n", FEC_SENSORS, c ? "one byte wrong" : "clean",
+               elapsed / checked * 1e9);
+
+        if (good != checked * FEC_SENSORS || corrected != c * checked) {
+            printf("ERROR bench_fec: %lld of %lld frames checked, %lld corrected\n", good, checked * FEC_SENSORS, corrected);
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+typedef struct {
+    DecodeScore score;
+    FILE *printOut;                 // Prints each packet the way DEBUG_PACKETS did when set
+} TraceBenchRun;
+
+static void trace_bench_packet(const uint8_t *bytes, int numBytes, bool good, void *userData) {
+    TraceBenchRun *run = userData;
+
+    score_packet(&run->score, bytes, numBytes, good, run->score.sensor->sampleCount);
+    if (run->printOut != NULL) {
+        fprintf(run->printOut, "\nDecoded Bytes:\n");
+        for (int i = 0; i < numBytes; i++) {
+            if (i == 0) fprintf(run->printOut, "Recieved Check Sum: ");
+            fprintf(run->printOut, "0x%x\n", bytes[i]);
+        }
+        if (!good) fprintf(run->printOut, "Bad CRC - Discarding Packet\n");
+    }
+}
+
+static int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ *  Decodes one capture in callback sized buffers, timing every call.
+ */
+static void trace_bench_run(SensorDecoder *dec, TraceLog *trace, const int16_t *samples, long long numSamples,
+                            TraceBenchRun *run, uint64_t *callNs, int *numCalls) {
+    long long i;
+    int n;
+
+    sensor_decoder_init(dec);
+    sensor_decoder_set_packet_callback(dec, trace_bench_packet, run);
+    sensor_decoder_set_trace(dec, trace);
+    run->score.sensor = dec;
+    *numCalls = 0;
+    for (i = 0; i < numSamples; i += n) {
+        n = numSamples - i < DECODE_BUFFER_FRAMES ? (int)(numSamples - i) : DECODE_BUFFER_FRAMES;
+        uint64_t startNs = io_stats_now_ns();
+        sensor_decoder_process(dec, samples + i, n, 1);
+        callNs[(*numCalls)++] = io_stats_now_ns() - startNs;
+    }
+}
+
+static int bench_trace(int numPackets) {
+    static const char *names[] = { "off", "printf", "trace default", "trace all" };
+    SignalGenPacket *truth = malloc(numPackets * sizeof(SignalGenPacket));
+    SensorDecoder *dec = malloc(sizeof(SensorDecoder));
+    SignalGenConfig config;
+    TraceBenchRun run;
+    TraceLog trace;
+    TraceWriter writer;
+    int16_t *samples;
+    uint64_t *callNs;
+    double p99[4];
+    long long numSamples;
+    int numCalls, m, failed = 0;
+
+    if (truth == NULL || dec == NULL) {
+        perror("ERROR bench_trace: failed to allocate buffers.\n");
+        return 1;
+    }
+
+    signal_gen_default(&config);
+    config.amplitude = DECODE_AMPLITUDE;
+    signal_gen_set_snr(&config, DECODE_SNR_DB);
+    numSamples = signal_gen_render(&config, numPackets, &samples, truth);
+    callNs = malloc((numSamples / DECODE_BUFFER_FRAMES + 1) * sizeof(uint64_t));
+    if (numSamples < 0 || callNs == NULL) {
+        perror("ERROR bench_trace: failed to generate the capture.\n");
+        return 1;
+    }
+
+    printf("trace: %d packets, %d frame callbacks, ring of %d records drained to /dev/null\n",
+           numPackets, DECODE_BUFFER_FRAMES, TRACE_BENCH_CAPACITY);
+    printf("  %-14s %8s %8s %8s %10s %8s\n", "decoder", "mean us", "p99 us", "max us", "records", "dropped");
+    for (m = 0; m < 4; m++) {
+        bool tracing = m >= 2;
+        double sum = 0;
+
+        memset(&run, 0, sizeof(run));
+        score_init(&run.score, truth, numPackets);
+        if (m == 1) run.printOut = fopen("/dev/null", "w");
+        if (tracing && (!trace_log_init(&trace, TRACE_BENCH_CAPACITY, m == 3 ? TRACE_ALL_MASK : TRACE_DEFAULT_MASK) ||
+                        !trace_writer_start(&writer, &trace, "/dev/null", (uint32_t)config.sampleRate))) {
+            perror("ERROR bench_trace: failed to start the trace.\n");
+            return 1;
+        }
+
+        trace_bench_run(dec, tracing ? &trace : NULL, samples, numSamples, &run, callNs, &numCalls);
+
+        if (tracing) trace_writer_stop(&writer);
+        if (run.printOut != NULL) fclose(run.printOut);
+
+        for (int c = 0; c < numCalls; c++) sum += callNs[c];
+        qsort(callNs, numCalls, sizeof(uint64_t), compare_ns);
+        p99[m] = callNs[(int)(0.99 * (numCalls - 1))] / 1e3;
+        printf("  %-14s %8.2f %8.2f %8.2f %10llu %8u\n", names[m], sum / numCalls / 1e3, p99[m], callNs[numCalls - 1] / 1e3,
+               tracing ? (unsigned long long)writer.written : 0ULL, tracing ? writer.header.dropped : 0);
+
+        if (run.score.good != numPackets) {
+            printf("ERROR bench_trace: %d of %d packets good with %s\n", run.score.good, numPackets, names[m]);
+            failed++;
+        }
+        if (tracing) trace_log_free(&trace);
+    }
+    if (p99[3] - p99[0] > TRACE_MAX_P99_US) {
+        printf("ERROR bench_trace: tracing added %.2f us at p99\n", p99[3] - p99[0]);
+        failed++;
+    }
+
+    // What a record costs the render thread against the lines DEBUG_PACKETS printed per packet
+    if (trace_log_init(&trace, TRACE_BENCH_CAPACITY, TRACE_ALL_MASK)) {
+        uint8_t bytes[CHIPCAP_PACKET_BYTES] = { 0x21, 0x3a, 0x55, 0x66, 0x10 };
+        long long writes = 0;
+        double start = now_seconds(), elapsed;
+        TraceRecord chunk[TRACE_CHUNK];
+        do {
+            for (int k = 0; k < TRACE_CHUNK; k++)
+                trace_log_write(&trace, TRACE_PACKET, (uint64_t)k, 1, 0x21, bytes, (int)sizeof(bytes));
+            trace_log_read(&trace, chunk, TRACE_CHUNK);
+            writes += TRACE_CHUNK;
+        } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+        printf("  trace_log_write %.1f ns a record, read back included\n", elapsed / writes * 1e9);
+        trace_log_free(&trace);
+    }
+
+    free(callNs);
+    free(samples);
+    free(truth);
+    free(dec);
+    return failed ? 1 : 0;
+}
+
+static const uint32_t resampleRates[] = { 48000, 96000, 32000, 88200, 22050, 44101 };
+
+/**
+ *  Gain through the resampler of a full scale tone at freq, RMS out over
+ *  RMS in once the filter has filled.
+ */
+static double resample_gain(Resampler *rs, uint32_t inRate, double freq) {
+    int16_t in[DECODE_BUFFER_FRAMES];
+    int16_t out[RESAMPLER_MAX_RATIO * DECODE_BUFFER_FRAMES];
+    double sumIn = 0, sumOut = 0, phase = 0;
+    long long k, numIn = 0;
+    int offset, used, n, i;
+
+    resampler_reset(rs);
+    for (k = 0; k < RESAMPLE_TONE_SAMPLES; k += DECODE_BUFFER_FRAMES) {
+        for (i = 0; i < DECODE_BUFFER_FRAMES; i++) {
+            in[i] = (int16_t)lrint(RESAMPLE_TONE_AMPLITUDE * sin(phase));
+            phase = fmod(phase + 2 * M_PI * freq / inRate, 2 * M_PI);
+            if (k > 0) sumIn += (double)in[i] * in[i], numIn++;
+        }
+        for (offset = 0; offset < DECODE_BUFFER_FRAMES; offset += used) {
+            n = resampler_process(rs, in + offset, DECODE_BUFFER_FRAMES - offset, 1, out, (int)(sizeof(out) / sizeof(out[0])), &used);
+            if (k == 0) continue;
+            for (i = 0; i < n; i++) sumOut += (double)out[i] * out[i];
+        }
+    }
+    // The same stretch of time holds outRate / inRate as many outputs
+    return sqrt(sumOut / (numIn * (double)rs->outRate / inRate)) / sqrt(sumIn / numIn);
+}
+
+/**
+ *  Decodes a capture at rate through the render path in callback sized
+ *  buffers. Returns the good packets, or the good packets sensor_decoder
+ *  finds taking the same samples as they come when raw is set.
+ */
+static int resample_decode(SensorIO *io, uint32_t rate, int numPackets, bool raw) {
+    int16_t frames[2 * DECODE_BUFFER_FRAMES];
+    SignalGenPacket *truth = malloc(numPackets * sizeof(SignalGenPacket));
+    SignalGenConfig config;
+    IoStatsCycle cycle;
+    int16_t *samples;
+    long long numSamples, i;
+    int n, k, good;
+
+    signal_gen_default(&config);
+    config.amplitude = DECODE_AMPLITUDE;
+    signal_gen_set_snr(&config, DECODE_SNR_DB);
+    config.gapSamples = (int)(config.gapSamples * (double)rate / config.sampleRate);
+    config.gapJitter = (int)(config.gapJitter * (double)rate / config.sampleRate);
+    config.sampleRate = rate;
+    if (truth == NULL || (numSamples = signal_gen_render(&config, numPackets, &samples, truth)) < 0) {
+        free(truth);
+        return -1;
+    }
+
+    sensor_io_reset(io, raw ? MAN_LINE_SAMPLE_RATE : rate);
+    for (i = 0; i < numSamples; i += n) {
+        n = numSamples - i < DECODE_BUFFER_FRAMES ? (int)(numSamples - i) : DECODE_BUFFER_FRAMES;
+        for (k = 0; k < n; k++) {
+            frames[2 * k] = samples[i + k];
+            frames[2 * k + 1] = 0;
+        }
+        memset(&cycle, 0, sizeof(cycle));
+        sensor_io_render(io, frames, n, 2, &cycle);
+    }
+    good = io->decoder.goodPackets;
+
+    free(samples);
+    free(truth);
+    return good;
+}
+
+static int bench_resample(int numPackets) {
+    Resampler *rs = malloc(sizeof(Resampler));
+    SensorIO *io = malloc(sizeof(SensorIO));
+    int16_t *in = malloc(MAN_LINE_SAMPLE_RATE * RESAMPLER_MAX_RATIO * sizeof(int16_t));
+    int16_t out[RESAMPLER_MAX_RATIO * DECODE_BUFFER_FRAMES];
+    int failed = 0, r;
+
+    if (rs == NULL || in == NULL || io == NULL || !sensor_io_init(io, 0)) {
+        perror("ERROR bench_resample: failed to allocate buffers.\n");
+        return 1;
+    }
+    fill_random(in, MAN_LINE_SAMPLE_RATE * RESAMPLER_MAX_RATIO);
+
+    printf("resample: to %d Hz, %d taps, %d frame callbacks, %d packets per rate\n",
+           MAN_LINE_SAMPLE_RATE, RESAMPLER_TAPS, DECODE_BUFFER_FRAMES, numPackets);
+    printf("  %-8s %8s %10s %10s %12s %12s %8s %8s\n", "rate", "phases", "carrier dB", "image dB", "us/s audio", "ns/output",
+           "good", "as is");
+    for (r = 0; r < (int)(sizeof(resampleRates) / sizeof(resampleRates[0])); r++) {
+        uint32_t rate = resampleRates[r];
+        long long seconds = 0, outputs = 0;
+        double start, elapsed, carrier, image = -INFINITY;
+        char imageText[16] = "-";
+        int offset, used, good, asIs;
+
+        if (!resampler_init(rs, rate, MAN_LINE_SAMPLE_RATE)) {
+            printf("ERROR bench_resample: can't resample %u Hz\n", rate);
+            failed++;
+            continue;
+        }
+
+        // The carrier must pass as it is, and above the output's band
+        // nothing may fold back onto it
+        carrier = 20 * log10(resample_gain(rs, rate, RESAMPLE_CARRIER_FREQ));
+        if (rate / 2.0 > MAN_LINE_SAMPLE_RATE - RESAMPLE_CARRIER_FREQ)
+            image = 20 * log10(resample_gain(rs, rate, MAN_LINE_SAMPLE_RATE - RESAMPLE_CARRIER_FREQ));
+        if (isfinite(image)) snprintf(imageText, sizeof(imageText), "%.1f", image);
+
+        // One second of audio at a time in callback sized pieces
+        resampler_reset(rs);
+        start = now_seconds();
+        do {
+            for (uint32_t k = 0; k < rate; k += DECODE_BUFFER_FRAMES) {
+                int numIn = rate - k < DECODE_BUFFER_FRAMES ? (int)(rate - k) : DECODE_BUFFER_FRAMES;
+                for (offset = 0; offset < numIn; offset += used)
+                    outputs += resampler_process(rs, in + k + offset, numIn - offset, 1, out, (int)(sizeof(out) / sizeof(out[0])), &used);
+            }
+            seconds++;
+        } while ((elapsed = now_seconds() - start) < BENCH_MIN_SECONDS);
+
+        // and against what the decoder makes of the line without the resampler
+        good = resample_decode(io, rate, numPackets, false);
+        asIs = resample_decode(io, rate, numPackets, true);
+        printf("  %-8u %8d %10.3f %10s %12.1f %12.2f %4d/%d %4d/%d\n", rate, rs->phases, carrier, imageText,
+               elapsed / seconds * 1e6, elapsed / outputs * 1e9, good, numPackets, asIs, numPackets);
+
+        if (fabs(carrier) > RESAMPLE_MAX_CARRIER_DB) {
+            printf("ERROR bench_resample: carrier gain %.3f dB at %u Hz\n", carrier, rate);
+            failed++;
+        }
+        if (image > RESAMPLE_MAX_IMAGE_DB) {
+            printf("ERROR bench_resample: image at %.1f dB from %u Hz\n", image, rate);
+            failed++;
+        }
+        if (good != numPackets) {
+            printf("ERROR bench_resample: %d of %d packets good at %u Hz\n", good, numPackets, rate);
+            failed++;
+        }
+    }
+
+    sensor_io_free(io);
+    free(io);
+    free(in);
+    free(rs);
+    return failed ? 1 : 0;
+}
+
+typedef struct {
+    const char *name;
+    double snrDb;                   // 0 for a noiseless line
+    int gapSamples;                 // 0 keeps signal_gen's
+} CodecLine;
+
+static const CodecLine codecLines[] = {
+    { "noiseless", 0, 0 },
+    { "40 dB", 40, 0 },
+    { "30 dB", 30, 0 },
+    { "20 dB", 20, 0 },
+    { "30 dB, 1 s gaps", 30, MAN_LINE_SAMPLE_RATE },
+};
+
+typedef struct {
+    const CaptureCodecReader *reader;
+    int first;
+    int step;
+    long long frames;
+    bool damaged;
+} CodecWorker;
+
+static void *codec_worker(void *arg) {
+    CodecWorker *worker = arg;
+    int16_t *frames = malloc(worker->reader->blockFrames * sizeof(int16_t));
+    uint32_t block;
+    int n;
+
+    worker->frames = 0;
+    worker->damaged = frames == NULL;
+    for (block = worker->first; frames != NULL && block < worker->reader->numBlocks; block += worker->step) {
+        if ((n = capture_codec_decode_block(worker->reader, block, frames)) < 0) worker->damaged = true;
+        else worker->frames += n;
+    }
+    free(frames);
+    return NULL;
+}
+
+/**
+ *  Decodes every block on CODEC_THREADS threads. Returns the frames decoded,
+ *  or -1 if any block was damaged.
+ */
+static long long codec_parallel(const CaptureCodecReader *reader) {
+    pthread_t threads[CODEC_THREADS];
+    CodecWorker workers[CODEC_THREADS];
+    long long frames = 0;
+    bool damaged = false;
+    int t;
+
+    for (t = 0; t < CODEC_THREADS; t++) {
+        workers[t] = (CodecWorker){ reader, t, CODEC_THREADS, 0, false };
+        pthread_create(&threads[t], NULL, codec_worker, &workers[t]);
+    }
+    for (t = 0; t < CODEC_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        frames += workers[t].frames;
+        damaged |= workers[t].damaged;
+    }
+    return damaged ? -1 : frames;
+}
+
+static int bench_codec(int numPackets) {
+    SignalGenPacket *truth = malloc(numPackets * sizeof(SignalGenPacket));
+    int16_t *decoded = NULL;
+    ManDecoder *dec = malloc(sizeof(ManDecoder));
+    char path[] = "/tmp/sensor_bench_XXXXXX";
+    int failed = 0, fd, l;
+
+    if (truth == NULL || dec == NULL || (fd = mkstemp(path)) < 0) {
+        perror("ERROR bench_codec: failed to allocate buffers.\n");
+        return 1;
+    }
+    close(fd);
+
+    printf("codec: %d frame blocks, %d packets per line, %d threads for parallel decode\n",
+           CAPTURE_CODEC_BLOCK_FRAMES, numPackets, CODEC_THREADS);
+    printf("  %-16s %8s %12s %12s %12s %8s %8s\n", "line", "ratio", "encode Ms/s", "decode Ms/s", "parallel Ms/s",
+           "raw", "stream");
+    for (l = 0; l < (int)(sizeof(codecLines) / sizeof(codecLines[0])); l++) {
+        const CodecLine *line = &codecLines[l];
+        SignalGenConfig config;
+        CaptureCodecWriter writer;
+        CaptureCodecReader reader;
+        CaptureHeader header;
+        DecodeScore raw, stream;
+        int16_t *samples;
+        long long numSamples, frame, runs;
+        double start, encodeSeconds, decodeSeconds, parallelSeconds, ratio;
+        uint32_t block;
+        int n;
+
+        signal_gen_default(&config);
+        config.amplitude = DECODE_AMPLITUDE;
+        if (line->snrDb > 0) signal_gen_set_snr(&config, line->snrDb);
+        if (line->gapSamples > 0) config.gapSamples = line->gapSamples;
+        if ((numSamples = signal_gen_render(&config, numPackets, &samples, truth)) < 0) {
+            perror("ERROR bench_codec: failed to render the line.\n");
+            return 1;
+        }
+        free(decoded);
+        decoded = malloc((numSamples + CAPTURE_CODEC_BLOCK_FRAMES) * sizeof(int16_t));
+        if (decoded == NULL) {
+            perror("ERROR bench_codec: failed to allocate buffers.\n");
+            return 1;
+        }
+
+        // Callback sized writes, the way the capture queue drains the ring
+        capture_header_init(&header, MAN_LINE_SAMPLE_RATE, 1, "sensor_bench");
+        start = now_seconds();
+        capture_codec_writer_open(&writer, path, &header);
+        for (frame = 0; frame < numSamples; frame += n) {
+            n = numSamples - frame < DECODE_BUFFER_FRAMES ? (int)(numSamples - frame) : DECODE_BUFFER_FRAMES;
+            capture_codec_writer_write(&writer, samples + frame, n);
+        }
+        if (!capture_codec_writer_close(&writer) || !capture_codec_reader_open(&reader, path)) {
+            perror("ERROR bench_codec: failed to write the capture.\n");
+            return 1;
+        }
+        encodeSeconds = now_seconds() - start;
+        ratio = (CAPTURE_HEADER_BYTES + numSamples * 2.0) / reader.mapBytes;
+
+        runs = 0;
+        start = now_seconds();
+        do {
+            for (frame = 0, block = 0; block < reader.numBlocks; block++) {
+                if ((n = capture_codec_decode_block(&reader, block, decoded + frame)) < 0) break;
+                frame += n;
+            }
+            runs++;
+        } while ((decodeSeconds = now_seconds() - start) < BENCH_MIN_SECONDS);
+        decodeSeconds /= runs;
+
+        if (frame != numSamples || memcmp(decoded, samples, numSamples * sizeof(int16_t)) != 0) {
+            printf("ERROR bench_codec: %s did not decode to what was written\n", line->name);
+            failed++;
+        }
+
+        runs = 0;
+        start = now_seconds();
+        do {
+            if (codec_parallel(&reader) != numSamples) {
+                printf("ERROR bench_codec: %s failed to decode in parallel\n", line->name);
+                failed++;
+            }
+            runs++;
+        } while ((parallelSeconds = now_seconds() - start) < BENCH_MIN_SECONDS);
+        parallelSeconds /= runs;
+
+        // The decoder fed block by block must see what it sees fed the samples
+        score_init(&raw, truth, numPackets);
+        run_man_decoder(dec, samples, numSamples, &raw);
+        score_init(&stream, truth, numPackets);
+        man_decoder_init(dec, SAMPLE_HIGH_MIN_AVG, score_man_packet, &stream);
+        for (block = 0; block < reader.numBlocks; block++) {
+            if ((n = capture_codec_decode_block(&reader, block, decoded)) < 0) break;
+            man_decoder_feed_s16(dec, decoded, n);
+        }
+        man_decoder_flush(dec);
+
+        printf("  %-16s %7.2fx %12.1f %12.1f %12.1f %4d/%d %4d/%d\n", line->name, ratio,
+               numSamples / encodeSeconds / 1e6, numSamples / decodeSeconds / 1e6,
+               numSamples / parallelSeconds / 1e6, raw.good, numPackets, stream.good, numPackets);
+
+        if (stream.good != raw.good || stream.matched != raw.matched || stream.spurious != raw.spurious) {
+            printf("ERROR bench_codec: %s decodes differently from the compressed capture\n", line->name);
+            failed++;
+        }
+        if (l == 0 && ratio < CODEC_MIN_QUIET_RATIO) {
+            printf("ERROR bench_codec: %s only compressed %.2fx\n", line->name, ratio);
+            failed++;
+        }
+
+        capture_codec_reader_close(&reader);
+        free(samples);
+    }
+
+    unlink(path);
+    free(decoded);
+    free(dec);
+    free(truth);
+    return failed ? 1 : 0;
+}
+
+
+static const struct {
+    const char *name;
+    int64_t ms;                     // 0 for the whole history
+    bool recent;                    // Only ranges the raw level still holds
+} storeSpans[] = {
+    { "1 minute", 60 * 1000LL, false },
+    { "1 hour", 3600 * 1000LL, false },
+    { "1 day", 86400 * 1000LL, false },
+    { "1 week", 7 * 86400 * 1000LL, false },
+    { "whole", 0, false },
+    { "1 minute, recent", 60 * 1000LL, true },
+    { "1 hour, recent", 3600 * 1000LL, true },
+};
+
+static uint32_t store_random(uint64_t *state) {
+    *state = *state * 6364136223846793005ull + 1442695040888963407ull;
+    return (uint32_t)(*state >> 33);
+}
+
+/**
+ *  Summary of every reading in [fromMs, toMs) by scanning them all.
+ */
+static void store_scan(const ReadingPoint *points, long long numPoints, int64_t fromMs, int64_t toMs, ReadingBucket *out) {
+    long long lo = 0, hi = numPoints;
+    int q;
+
+    memset(out, 0, sizeof(*out));
+    while (lo < hi) {
+        long long mid = lo + (hi - lo) / 2;
+        if (points[mid].timeMs < fromMs) lo = mid + 1;
+        else hi = mid;
+    }
+    for (; lo < numPoints && points[lo].timeMs < toMs; lo++) {
+        for (q = 0; q < READING_QUANTITIES; q++) {
+            int32_t v = points[lo].value[q];
+            if (out->count == 0 || v < out->min[q]) out->min[q] = v;
+            if (out->count == 0 || v > out->max[q]) out->max[q] = v;
+            out->sum[q] += v;
+        }
+        out->count++;
+    }
+}
+
+static bool store_same(const ReadingBucket *a, const ReadingBucket *b) {
+    return a->count == b->count && memcmp(a->min, b->min, sizeof(a->min)) == 0 &&
+           memcmp(a->max, b->max, sizeof(a->max)) == 0 && memcmp(a->sum, b->sum, sizeof(a->sum)) == 0;
+}
+
+static bool store_covers(const ReadingBucket *wide, const ReadingBucket *exact) {
+    int q;
+
+    if (wide->count < exact->count) return false;
+    for (q = 0; q < READING_QUANTITIES && exact->count > 0; q++) {
+        if (wide->min[q] > exact->min[q] || wide->max[q] < exact->max[q]) return false;
+    }
+    return true;
+}
+
+/**
+ *  Inserts a month of readings into the store, in memory and persisted,
+ *  reopens it, then times plotting and summarizing random ranges. Summaries
+ *  of ranges the store still holds at the resolution they need must match a
+ *  scan of every reading; older ones must at least cover it.
+ */
+// Where level still holds every reading, no earlier than the first one
+static int64_t store_held_from(const ReadingStore *store, int level, int64_t firstMs) {
+    int64_t lostBeforeMs = store->level[level].lostBeforeMs;
+    return lostBeforeMs > firstMs ? lostBeforeMs : firstMs;
+}
+
+static int bench_store(int days) {
+    long long numPoints = (long long)days * 86400 * 1000 / STORE_PERIOD_MS;
+    ReadingPoint *points = malloc(numPoints * sizeof(ReadingPoint));
+    ReadingBucket *plot = malloc(STORE_PLOT_POINTS * sizeof(ReadingBucket));
+    ReadingStore *store = malloc(sizeof(ReadingStore));
+    char path[] = "/tmp/sensor_bench_XXXXXX";
+    const int64_t startMs = 1700000000000LL;
+    uint64_t rng = 1;
+    double start, memorySeconds, fileSeconds, openSeconds;
+    long long i;
+    int failed = 0, fd, s, l;
+
+    if (points == NULL || plot == NULL || store == NULL || (fd = mkstemp(path)) < 0) {
+        perror("ERROR bench_store: failed to allocate buffers.\n");
+        return 1;
+    }
+    close(fd);
+    unlink(path);
+
+    // A daily swing with noise, both in the ChipCap2's Q16.16 steps
+    for (i = 0; i < numPoints; i++) {
+        double day = sin(2 * M_PI * i * STORE_PERIOD_MS / 86400000.0);
+        points[i].timeMs = startMs + i * STORE_PERIOD_MS + store_random(&rng) % 50;
+        points[i].value[READING_HUMIDITY] = (int32_t)((45 + 15 * day) * 65536) + (int32_t)(store_random(&rng) % 65536);
+        points[i].value[READING_TEMPERATURE] = (int32_t)((22 - 6 * day) * 65536) + (int32_t)(store_random(&rng) % 32768);
+    }
+    int64_t endMs = points[numPoints - 1].timeMs + 1;
+
+    reading_store_init(store);
+    start = now_seconds();
+    for (i = 0; i < numPoints; i++) {
+        reading_store_add(store, points[i].timeMs, points[i].value[READING_HUMIDITY], points[i].value[READING_TEMPERATURE]);
+    }
+    memorySeconds = now_seconds() - start;
+    reading_store_free(store);
+
+    start = now_seconds();
+    if (!reading_store_open(store, path)) {
+        perror("ERROR bench_store: failed to create the store.\n");
+        return 1;
+    }
+    for (i = 0; i < numPoints; i++) {
+        if (!reading_store_add(store, points[i].timeMs, points[i].value[READING_HUMIDITY], points[i].value[READING_TEMPERATURE])) {
+            printf("ERROR bench_store: failed to append reading %lld\n", i);
+            failed++;
+            break;
+        }
+    }
+    fileSeconds = now_seconds() - start;
+    reading_store_close(store);
+
+    start = now_seconds();
+    if (!reading_store_open(store, path)) {
+        perror("ERROR bench_store: failed to reopen the store.\n");
+        return 1;
+    }
+    openSeconds = now_seconds() - start;
+    if (store->total != (uint64_t)numPoints || store->lastMs != points[numPoints - 1].timeMs) {
+        printf("ERROR bench_store: reopened with %llu readings of %lld\n", (unsigned long long)store->total, numPoints);
+        failed++;
+    }
+
+    printf("store: %d days, %lld readings, %.1f MB file, %.1f MB in memory\n", days, numPoints,
+           (READING_STORE_HEADER_BYTES + numPoints * READING_STORE_RECORD_BYTES) / 1e6,
+           (READING_STORE_RAW_CAPACITY * sizeof(ReadingPoint) + (READING_STORE_SECOND_CAPACITY + READING_STORE_MINUTE_CAPACITY +
+            READING_STORE_HOUR_CAPACITY) * sizeof(ReadingBucket)) / 1e6);
+    printf("  insert %.1f M/s in memory, %.1f M/s persisted, reopen %.0f ms\n", numPoints / memorySeconds / 1e6,
+           numPoints / fileSeconds / 1e6, openSeconds * 1e3);
+    for (l = 0; l < READING_STORE_LEVELS; l++) {
+        const ReadingLevel *lv = &store->level[l];
+        printf("  level %d: %u entries from %.1f h back\n", l, lv->count + (lv->open.count > 0),
+               (endMs - store_held_from(store, l, points[0].timeMs)) / 3.6e6);
+    }
+
+    printf("  %-16s %10s %12s %12s %8s\n", "span", "plot us", "summary us", "level", "exact");
+    for (s = 0; s < (int)(sizeof(storeSpans) / sizeof(storeSpans[0])); s++) {
+        int64_t firstMs = points[0].timeMs;
+        if (storeSpans[s].recent) firstMs = store_held_from(store, READING_STORE_RAW, firstMs);
+        int64_t span = storeSpans[s].ms ? storeSpans[s].ms : endMs - firstMs;
+        double plotSeconds = 0, summarySeconds = 0;
+        int levels[READING_STORE_LEVELS] = { 0 };
+        int exact = 0, q;
+
+        if (span > endMs - firstMs) {
+            printf("  %-16s longer than the %.1f h stored, skipped\n", storeSpans[s].name, (endMs - firstMs) / 3.6e6);
+            continue;
+        }
+
+        for (q = 0; q < STORE_QUERIES; q++) {
+            int64_t fromMs = firstMs + (int64_t)(((uint64_t)store_random(&rng) << 32 | store_random(&rng)) % (uint64_t)(endMs - firstMs - span + 1));
+            int64_t toMs = fromMs + span;
+            ReadingBucket summary, scan;
+            bool isExact;
+            int level, n;
+
+            start = now_seconds();
+            level = reading_store_level_for(store, fromMs, toMs, STORE_PLOT_POINTS);
+            n = reading_store_query(store, level, fromMs, toMs, plot, STORE_PLOT_POINTS);
+            plotSeconds += now_seconds() - start;
+            levels[level]++;
+
+            start = now_seconds();
+            isExact = reading_store_summary(store, fromMs, toMs, &summary);
+            summarySeconds += now_seconds() - start;
+            exact += isExact;
+
+            if (storeSpans[s].recent && !isExact) {
+                printf("ERROR bench_store: %s summary from %lld is not exact\n", storeSpans[s].name, (long long)(fromMs - startMs));
+                failed++;
+            }
+            if (n == 0 && level > READING_STORE_RAW) {
+                printf("ERROR bench_store: nothing to plot in a %s range\n", storeSpans[s].name);
+                failed++;
+            }
+            if (q < STORE_CHECKS || (isExact && q < 4 * STORE_CHECKS)) {
+                store_scan(points, numPoints, fromMs, toMs, &scan);
+                if (isExact ? !store_same(&summary, &scan) : !store_covers(&summary, &scan)) {
+                    printf("ERROR bench_store: %s summary from %lld %s the readings\n", storeSpans[s].name,
+                           (long long)(fromMs - startMs), isExact ? "differs from" : "does not cover");
+                    failed++;
+                }
+            }
+        }
+
+        printf("  %-16s %10.2f %12.2f  %4d/%d/%d/%d %7.1f%%\n", storeSpans[s].name, plotSeconds / STORE_QUERIES * 1e6,
+               summarySeconds / STORE_QUERIES * 1e6, levels[0], levels[1], levels[2], levels[3], 100.0 * exact / STORE_QUERIES);
+    }
+
+    // Everything the raw level still holds, and whole minutes back to where the minutes start
+    {
+        ReadingBucket summary, scan;
+        int64_t fromMs = store_held_from(store, READING_STORE_RAW, points[0].timeMs);
+        int64_t minuteMs = (store_held_from(store, READING_STORE_MINUTE, points[0].timeMs) + 59999) / 60000 * 60000;
+
+        if (!reading_store_summary(store, fromMs, endMs, &summary) ||
+            (store_scan(points, numPoints, fromMs, endMs, &scan), !store_same(&summary, &scan))) {
+            printf("ERROR bench_store: summary of the raw readings is not exact\n");
+            failed++;
+        }
+        if (!reading_store_summary(store, minuteMs, endMs / 60000 * 60000, &summary) ||
+            (store_scan(points, numPoints, minuteMs, endMs / 60000 * 60000, &scan), !store_same(&summary, &scan))) {
+            printf("ERROR bench_store: summary of whole minutes is not exact\n");
+            failed++;
+        }
+    }
+
+    reading_store_close(store);
+    unlink(path);
+    free(store);
+    free(plot);
+    free(points);
+    return failed ? 1 : 0;
+}
+
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "window";
+    int arg = argc > 2 ? atoi(argv[2]) : 0;
+
+    if (strcmp(mode, "window") == 0)
+        return bench_window(arg > 0 ? arg : BENCH_SAMPLES);
+    if (strcmp(mode, "tone") == 0)
+        return bench_tone(arg > 0 ? arg : TONE_SECONDS);
+    if (strcmp(mode, "decode") == 0)
+        return bench_decode(arg > 0 ? arg : DECODE_PACKETS);
+    if (strcmp(mode, "iostats") == 0)
+        return bench_iostats(arg > 0 ? arg : IOSTATS_PACKETS);
+    if (strcmp(mode, "rates") == 0)
+        return bench_rates(arg > 0 ? arg : DECODE_PACKETS);
+    if (strcmp(mode, "link") == 0)
+        return bench_link(arg > 0 ? arg : LINK_SECONDS);
+    if (strcmp(mode, "frames") == 0)
+        return bench_frames(arg > 0 ? arg : FRAMES_TRIALS);
+    if (strcmp(mode, "repeat") == 0)
+        return bench_repeat(arg > 0 ? arg : REPEAT_SECONDS);
+    if (strcmp(mode, "fec") == 0)
+        return bench_fec(arg > 0 ? arg : FEC_BURSTS);
+    if (strcmp(mode, "trace") == 0)
+        return bench_trace(arg > 0 ? arg : DECODE_PACKETS);
+    if (strcmp(mode, "resample") == 0)
+        return bench_resample(arg > 0 ? arg : IOSTATS_PACKETS);
+    if (strcmp(mode, "codec") == 0)
+        return bench_codec(arg > 0 ? arg : DECODE_PACKETS);
+    if (strcmp(mode, "store") == 0)
+        return bench_store(arg > 0 ? arg : STORE_DAYS);
+
+    fprintf(stderr, "Usage: %s window [num_samples]\n"
+                    "       %s tone [seconds_of_audio]\n"
+                    "       %s decode [packets_per_point]\n"
+                    "       %s iostats [packets]\n"
+                    "       %s rates [packets_per_timing]\n"
+                    "       %s link [seconds_per_run]\n"
+                    "       %s frames [trials_per_point]\n"
+                    "       %s repeat [seconds_per_run]\n"
+                    "       %s fec [bursts_per_point]\n"
+                    "       %s trace [packets]\n"
+                    "       %s resample [packets_per_rate]\n"
+                    "       %s codec [packets_per_line]\n"
+                    "       %s store [days]\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0],
+                    argv[0], argv[0], argv[0], argv[0], argv[0]);
+    return 1;
+}
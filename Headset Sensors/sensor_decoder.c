@@ -0,0 +1,484 @@
+/* *********************************************************************
+ * File: sensor_decoder.c
+ * Author: Michael Bennett
+ * Purpose: Real-time Manchester decode of ChipCap2 packets from the
+ *          headset mic line. The rectified signal is averaged over whole
+ *          cycles of the HIGH square wave, about a quarter of a half
+ *          period, and sliced halfway between the idle noise floor and the
+ *          mean level of HIGH half periods. An early/late loop moves the
+ *          half period grid toward sliced edges near it and trims the
+ *          half period, so the decoder follows a sensor clock that is off
+ *          its nominal half period. Each half period is decided by a
+ *          majority of its samples. Levels and the grid are fixed point, the
+ *          gains are powers of two.
+ * ********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+
+#include "sensor_decoder.h"
+#include "chipcap.h"
+
+#define NOISE_SHIFT     8       // Noise floor follows the idle envelope over ~256 samples
+#define HIGH_SHIFT      2       // HIGH level follows the mean envelope of HIGH half periods over ~4 of them
+#define CLOCK_KP_SHIFT  2       // Quarter of an edge's timing error moved into the grid
+#define CLOCK_KI_SHIFT  5       // 1/32 of it moved into the half period
+#define ACQUIRE_EDGES   8       // Edges after the start tracked with the faster gains below
+#define ACQUIRE_KP_SHIFT 1
+#define ACQUIRE_KI_SHIFT 3
+#define EDGE_GATE_DIV   3       // Edges further than a third of a half period off the grid are ignored
+
+/**
+ *  Averages the envelope over whole cycles of the HIGH square wave, about a
+ *  quarter of the half period, and re-sums the taps already kept so the
+ *  envelope carries on at the new length.
+ */
+static void sensor_decoder_set_env_window(SensorDecoder *dec, int halfPeriod) {
+    int window = (halfPeriod >> SENSOR_ENV_HALF_SHIFT) / SENSOR_ENV_WINDOW * SENSOR_ENV_WINDOW;
+    if (window < SENSOR_ENV_WINDOW) window = SENSOR_ENV_WINDOW;
+    if (window > SENSOR_ENV_MAX_WINDOW) window = SENSOR_ENV_MAX_WINDOW;
+
+    dec->envWindow = window;
+    dec->envRecip = fixed_recip(window);
+    dec->envSum = 0;
+    for (int i = 1; i <= window; i++)
+        dec->envSum += dec->envTaps[(dec->envIndex - i) & (SENSOR_ENV_MAX_WINDOW - 1)];
+}
+
+
+void sensor_decoder_init(SensorDecoder *dec) {
+    memset(dec, 0, sizeof(*dec));
+
+    dec->minLevel = SENSOR_MIN_LEVEL;
+    dec->noiseFloor = 0;
+    dec->armed = true;
+    dec->level = LOW_STATE;
+    dec->inPacket = false;
+    dec->nominalHalfPeriod = HALF_PERIOD_TC;
+    dec->halfPeriod = HALF_PERIOD_TC << FIXED_Q16_SHIFT;
+    sensor_decoder_set_env_window(dec, HALF_PERIOD_TC);
+    dec->bit_num = 0;
+    dec->nextSequence = -1;
+    reading_stats_init(&dec->readingStats);
+}
+
+
+void sensor_decoder_set_rate(SensorDecoder *dec, int halfPeriod) {
+    dec->nominalHalfPeriod = halfPeriod > 0 ? halfPeriod : HALF_PERIOD_TC;
+    sensor_decoder_set_env_window(dec, dec->nominalHalfPeriod);
+}
+
+
+int sensor_decoder_reading_count(const SensorDecoder *dec) {
+    return __atomic_load_n(&dec->numReadings, __ATOMIC_ACQUIRE);
+}
+
+
+bool sensor_decoder_copy_reading(const SensorDecoder *dec, int n, SensorReading *out) {
+    int slot = n & (SENSOR_MAX_READINGS - 1);
+
+    if (n < 0 || n >= sensor_decoder_reading_count(dec)) return false;
+
+    out->humidity = dec->readings.humidity[slot];
+    out->temperature = dec->readings.temperature[slot];
+    out->sample = dec->readings.sample[slot];
+    out->sensor = dec->readings.sensor[slot];
+
+    // Pairs with the fence in sensor_decoder_add_reading. Any store of reading
+    // n + SENSOR_MAX_READINGS seen above means its count is seen here
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&dec->numReadings, __ATOMIC_RELAXED) - n < SENSOR_MAX_READINGS;
+}
+
+
+void sensor_decoder_set_trace(SensorDecoder *dec, TraceLog *trace) {
+    dec->trace = trace;
+}
+
+
+static void sensor_decoder_trace(SensorDecoder *dec, TraceType type, long long sample, int arg, uint32_t value,
+                                 const void *data, int numBytes) {
+    if (dec->trace != NULL) trace_log_write(dec->trace, type, (uint64_t)sample, (uint16_t)arg, value, data, numBytes);
+}
+
+
+void sensor_decoder_set_packet_callback(SensorDecoder *dec, SensorPacketCallback onPacket, void *userData) {
+    dec->onPacket = onPacket;
+    dec->userData = userData;
+}
+
+
+/**
+ *  Stores a reading over the oldest and publishes it to other threads. The
+ *  fence keeps the slot stores behind the last published count, so a reader
+ *  that sees part of them sees the count that says the slot is reused.
+ */
+static void sensor_decoder_add_reading(SensorDecoder *dec, int sensor, int32_t humidity, int32_t temperature) {
+    reading_stats_add(&dec->readingStats, humidity, temperature);
+
+    int n = dec->numReadings;
+    int slot = n & (SENSOR_MAX_READINGS - 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    dec->readings.humidity[slot] = humidity;
+    dec->readings.temperature[slot] = temperature;
+    dec->readings.sample[slot] = dec->sampleCount;
+    dec->readings.sensor[slot] = (uint8_t)sensor;
+    __atomic_store_n(&dec->numReadings, n + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *  Reports and stores the frames of a burst, in the order they were sent,
+ *  and notes the ones that failed so they can be asked for again.
+ *
+ *  @return SENSOR_DECODE_* flags
+ */
+static int sensor_decoder_end_burst(SensorDecoder *dec, const SensorFrame *frames, const SensorFrameStatus *status, int numFrames, int goodFrames) {
+    int sequence = frames[0].sequence;
+    int flags = 0;
+
+    // With every frame bad the sequence byte itself is suspect, so the one expected is asked for.
+    // A good frame's is right, the FEC may have put it right after earlier frames were parsed
+    if (goodFrames == 0 && dec->nextSequence >= 0) sequence = dec->nextSequence;
+    for (int f = 0; f < numFrames && goodFrames > 0; f++) {
+        if (status[f] == SENSOR_FRAME_GOOD) {
+            sequence = frames[f].sequence;
+            break;
+        }
+    }
+    dec->nextSequence = (sequence + 1) & 0xff;
+
+    for (int f = 0; f < numFrames; f++) {
+        const SensorFrame *frame = &frames[f];
+        bool good = status[f] == SENSOR_FRAME_GOOD;
+
+        sensor_decoder_trace(dec, TRACE_FRAME, dec->sampleCount, status[f], (uint32_t)(sequence << 16 | f << 8 | frame->corrected),
+                             frame->bytes, frame->length + SENSOR_FRAME_OVERHEAD);
+        if (dec->onPacket != NULL)
+            dec->onPacket(frame->bytes, frame->length + SENSOR_FRAME_OVERHEAD, good, dec->userData);
+
+        if (!good) {
+            dec->badPackets++;
+            flags |= SENSOR_DECODE_BAD_CRC;
+            if (dec->numNaks < SENSOR_MAX_NAKS) {
+                dec->naks[dec->numNaks].sequence = (uint8_t)sequence;
+                dec->naks[dec->numNaks].frame = (uint8_t)f;
+                dec->numNaks++;
+            }
+            continue;
+        }
+        dec->goodPackets++;
+        if (frame->corrected) dec->correctedPackets++;
+        flags |= SENSOR_DECODE_PACKET;
+
+        // Sensor types this app doesn't read still count as good packets
+        if (frame->type == SENSOR_FRAME_CHIPCAP2 && frame->length == CHIPCAP_PACKET_BYTES - 1) {
+            int32_t humidity, temperature;
+            // chipcap_convert_q16 skips the check sum byte a packet starts with
+            chipcap_convert_q16(frame->payload - 1, &humidity, &temperature);
+            sensor_decoder_add_reading(dec, frame->id, humidity, temperature);
+        }
+    }
+
+    return flags;
+}
+
+/**
+ *  Pulls bytes out of the packed bits and checks them as a burst of frames
+ *  and as a ChipCap2 packet. A burst with a good frame wins; a transmission
+ *  with none is a ChipCap2 packet if its check sum matches, since the sync
+ *  word can turn up inside one, and a bad burst otherwise.
+ *  ChipCap2 bytes are cut from the end of the transmission back, check sum
+ *  first, so stray bits at the start are dropped. Nothing here allocates.
+ *
+ *  @return SENSOR_DECODE_* flags
+ */
+static int sensor_decoder_end_packet(SensorDecoder *dec) {
+    uint8_t sensorData[SENSOR_MAX_BYTES];
+    uint8_t burst[SENSOR_MAX_BYTES];
+    SensorFrame frames[SENSOR_MAX_FRAMES];
+    SensorFrameStatus status[SENSOR_MAX_FRAMES];
+    int num_bytes = dec->bit_num / 8;
+    int stray = dec->bit_num % 8;
+    int checkSum;
+    int numFrames = 0, goodFrames = 0;
+
+    for (int i = 0; i < num_bytes; i++) {
+        int first = dec->bit_num - 8 * (i + 1);
+        int word = dec->bitBuffer[first >> 3] | dec->bitBuffer[(first >> 3) + 1] << 8;
+        sensorData[i] = (uint8_t)(word >> (first & 7));
+    }
+
+    // Stray bits ahead of the first whole byte still count toward the check sum
+    checkSum = 0;
+    if (num_bytes > 0) {
+        checkSum = chipcap_checksum(sensorData, num_bytes);
+        if (stray) checkSum += __builtin_popcount(dec->bitBuffer[0] & ((1 << stray) - 1));
+    }
+
+    int burstBytes = sensor_frame_unpack(dec->bitBuffer, dec->bit_num, burst);
+    int offset = SENSOR_FRAME_HEADER;
+    while (burstBytes > 0 && numFrames < SENSOR_MAX_FRAMES &&
+           (status[numFrames] = sensor_frame_parse(burst, burstBytes, &offset, &frames[numFrames])) != SENSOR_FRAME_END) {
+        goodFrames += status[numFrames] == SENSOR_FRAME_GOOD;
+        numFrames++;
+    }
+
+    if (dec->trace != NULL && (dec->trace->enabled & TRACE_MASK(TRACE_BITS))) {
+        for (int b = 0; b < dec->bit_num; b += 64) {
+            int n = dec->bit_num - b < 64 ? dec->bit_num - b : 64;
+            sensor_decoder_trace(dec, TRACE_BITS, dec->sampleCount, b, (uint32_t)n, dec->bitBuffer + b / 8, (n + 7) / 8);
+        }
+    }
+
+    // Clear binary input
+    dec->bit_num = 0;
+
+    bool good = num_bytes >= CHIPCAP_PACKET_BYTES && sensorData[0] == checkSum;
+    if (goodFrames > 0 || (numFrames > 0 && !good))
+        return sensor_decoder_end_burst(dec, frames, status, numFrames, goodFrames);
+
+    if (dec->onPacket != NULL)
+        dec->onPacket(sensorData, num_bytes, good, dec->userData);
+    sensor_decoder_trace(dec, TRACE_PACKET, dec->sampleCount, good, (uint32_t)checkSum, sensorData, num_bytes);
+
+    // Verify checksum
+    if (!good) {
+        dec->badPackets++;
+        return SENSOR_DECODE_BAD_CRC;
+    }
+
+    dec->goodPackets++;
+
+    int32_t humidity, temperature;
+    chipcap_convert_q16(sensorData, &humidity, &temperature);
+    sensor_decoder_add_reading(dec, 0, humidity, temperature);
+
+    return SENSOR_DECODE_PACKET;
+}
+
+
+/**
+ *  Envelope that starts a transmission. Over the noise floor by a margin of the
+ *  floor itself, or once a packet has decoded, by no more than half the way up
+ *  to its HIGH level, which is the closer of the two on a noisy line.
+ */
+static int32_t sensor_decoder_start_level(const SensorDecoder *dec) {
+    int32_t level = dec->noiseFloor + (dec->noiseFloor >> SENSOR_NOISE_SHIFT);
+    int32_t minLevel = dec->minLevel << SENSOR_LEVEL_SHIFT;
+
+    if (dec->signalLevel > dec->noiseFloor) {
+        int32_t signal = dec->noiseFloor + (dec->signalLevel - dec->noiseFloor) / 2;
+        if (signal < level) level = signal;
+    }
+    return level > minLevel ? level : minLevel;
+}
+
+/**
+ *  Starts a transmission at sample n. The envelope crosses the start level
+ *  early in its rise, so the grid is put where the slicing level is crossed.
+ */
+static void sensor_decoder_start(SensorDecoder *dec, long long n, int32_t env) {
+    dec->inPacket = true;
+    dec->startHalf = true;
+    dec->halfIndex = 0;
+    dec->halfHigh = 0;
+    dec->halfSamples = 0;
+    dec->halfEnv = 0;
+    dec->level = HIGH_STATE;
+    dec->highLevel = env;
+    dec->halfPeriod = dec->nominalHalfPeriod << FIXED_Q16_SHIFT;
+    dec->lastBoundary = (n - dec->envWindow / 2) * FIXED_Q16_ONE;
+    dec->nextBoundary = dec->lastBoundary + dec->halfPeriod;
+    dec->bit_num = 0;
+    dec->edges = 0;
+    dec->startRun = 0;
+
+    sensor_decoder_trace(dec, TRACE_START, n, 0, (uint32_t)(env >> SENSOR_LEVEL_SHIFT), &dec->noiseFloor, sizeof(dec->noiseFloor));
+}
+
+/**
+ *  Ends the transmission. Bits go on to the check sum, and a good packet's HIGH
+ *  level is kept for the next start; a line that went HIGH and stayed there is
+ *  louder noise than the floor was tracking, so the floor jumps to it.
+ */
+static int sensor_decoder_stop(SensorDecoder *dec, bool stuckHigh) {
+    dec->inPacket = false;
+    dec->level = LOW_STATE;
+
+    sensor_decoder_trace(dec, TRACE_END, dec->sampleCount, 0, (uint32_t)dec->bit_num, &dec->halfPeriod, sizeof(dec->halfPeriod));
+
+    if (stuckHigh) {
+        dec->armed = false;
+        if (dec->bit_num == 0) {
+            dec->noiseFloor = dec->highLevel;
+            return 0;
+        }
+    }
+    if (dec->bit_num == 0) return 0;
+
+    int flags = sensor_decoder_end_packet(dec);
+    if (flags & SENSOR_DECODE_PACKET) dec->signalLevel = dec->highLevel;
+    return flags;
+}
+
+/**
+ *  Decides the half period that just ended and pairs half periods into bits:
+ *  LOW-HIGH is a 1, HIGH-LOW is a 0, LOW-LOW is the idle line after the last bit.
+ */
+static int sensor_decoder_half_period(SensorDecoder *dec) {
+    int half = 2 * dec->halfHigh > dec->halfSamples ? HIGH_STATE : LOW_STATE;
+    int32_t mean = dec->halfSamples > 0 ? (int32_t)(dec->halfEnv / dec->halfSamples) : 0;
+
+    sensor_decoder_trace(dec, TRACE_HALF, dec->sampleCount, dec->halfHigh, (uint32_t)dec->halfSamples,
+                         &dec->lastBoundary, sizeof(dec->lastBoundary));
+
+    dec->halfHigh = 0;
+    dec->halfSamples = 0;
+    dec->halfEnv = 0;
+    dec->lastBoundary = dec->nextBoundary;
+    dec->nextBoundary += dec->halfPeriod;
+
+    // A start half period that is mostly LOW was a click, not a transmission.
+    // Otherwise it is all HIGH, so its mean is where the HIGH level starts
+    if (dec->startHalf) {
+        dec->startHalf = false;
+        if (half == LOW_STATE) dec->inPacket = false;
+        dec->highLevel = mean;
+        return 0;
+    }
+
+    // The mean of a whole half period, as slicing samples over the midpoint
+    // would pull the level up on a noisy line
+    if (half == HIGH_STATE)
+        dec->highLevel += (mean - dec->highLevel) >> HIGH_SHIFT;
+
+    if (dec->halfIndex == 0) {
+        dec->firstHalf = half;
+        dec->halfIndex = 1;
+        return 0;
+    }
+    dec->halfIndex = 0;
+
+    if (dec->firstHalf != half) {
+        // Shift the bit into the packed buffer, clearing each byte as it is started
+        if ((dec->bit_num & 7) == 0) dec->bitBuffer[dec->bit_num >> 3] = 0;
+        dec->bitBuffer[dec->bit_num >> 3] |= (uint8_t)(half << (dec->bit_num & 7));
+        dec->bit_num++;
+        dec->bitsDecoded++;
+        return dec->bit_num == SENSOR_MAX_BITS ? sensor_decoder_stop(dec, false) : 0;
+    }
+
+    return sensor_decoder_stop(dec, half == HIGH_STATE);
+}
+
+/**
+ *  Moves the grid toward an edge sliced at sample n, early or late of the
+ *  nearest boundary. The envelope crosses the slicing level half its window
+ *  after the line does, and an edge far off any boundary is noise crossing
+ *  the slicer, not a transition.
+ */
+static void sensor_decoder_edge(SensorDecoder *dec, long long n) {
+    long long t = (n - dec->envWindow / 2) * FIXED_Q16_ONE;
+    long long err = (t - dec->lastBoundary) < (dec->nextBoundary - t) ? t - dec->lastBoundary : t - dec->nextBoundary;
+    int32_t nominal = dec->nominalHalfPeriod << FIXED_Q16_SHIFT;
+    int32_t minPeriod = nominal - nominal / 100 * SENSOR_CLOCK_TOLERANCE;
+    int32_t maxPeriod = nominal + nominal / 100 * SENSOR_CLOCK_TOLERANCE;
+
+    bool acquiring = dec->edges < ACQUIRE_EDGES;
+    if (!acquiring && (err > dec->halfPeriod / EDGE_GATE_DIV || -err > dec->halfPeriod / EDGE_GATE_DIV)) return;
+    dec->edges++;
+
+    // Arithmetic shifts, so a late edge moves the grid as far as an early one
+    dec->nextBoundary += err >> (acquiring ? ACQUIRE_KP_SHIFT : CLOCK_KP_SHIFT);
+    dec->halfPeriod += (int32_t)(err >> (acquiring ? ACQUIRE_KI_SHIFT : CLOCK_KI_SHIFT));
+    if (dec->halfPeriod < minPeriod) dec->halfPeriod = minPeriod;
+    if (dec->halfPeriod > maxPeriod) dec->halfPeriod = maxPeriod;
+
+    // Noise edges early in every half period would otherwise push the boundary away for good
+    if (dec->nextBoundary < dec->lastBoundary + dec->halfPeriod / 2)
+        dec->nextBoundary = dec->lastBoundary + dec->halfPeriod / 2;
+    if (dec->nextBoundary > dec->lastBoundary + dec->halfPeriod * 3 / 2)
+        dec->nextBoundary = dec->lastBoundary + dec->halfPeriod * 3 / 2;
+}
+
+
+/**
+ *  The envelope carries on across the hole as if the line had not changed.
+ *  A transmission it cut through has lost its bit timing, so it is dropped
+ *  and the line must go idle before the next start.
+ */
+void sensor_decoder_skip(SensorDecoder *dec, int numFrames) {
+    if (numFrames <= 0) return;
+
+    if (dec->inPacket) {
+        sensor_decoder_trace(dec, TRACE_END, dec->sampleCount, 0, 0, &dec->halfPeriod, sizeof(dec->halfPeriod));
+        dec->inPacket = false;
+        dec->level = LOW_STATE;
+        dec->bit_num = 0;
+        dec->armed = false;
+    }
+    dec->startRun = 0;
+    dec->sampleCount += numFrames;
+}
+
+
+int sensor_decoder_process(SensorDecoder *dec, const int16_t *samples, int numFrames, int stride) {
+    int flags = 0;
+
+    for (int k = 0; k < numFrames; k++) {
+        long long n = dec->sampleCount++;
+        int mag = abs(samples[k * stride]);
+
+        // Running average of |sample| over whole cycles of the HIGH square wave
+        dec->envSum += mag - dec->envTaps[(dec->envIndex - dec->envWindow) & (SENSOR_ENV_MAX_WINDOW - 1)];
+        dec->envTaps[dec->envIndex] = mag;
+        dec->envIndex = (dec->envIndex + 1) & (SENSOR_ENV_MAX_WINDOW - 1);
+        int32_t env = fixed_div(dec->envSum, dec->envRecip) << SENSOR_LEVEL_SHIFT;
+
+        // Learn the idle line before looking for transmissions, its mean once the warmup is over
+        if (dec->warmup < SENSOR_NOISE_WARMUP) {
+            dec->noiseFloor += fixed_div(dec->envSum, dec->envRecip);
+            if (++dec->warmup == SENSOR_NOISE_WARMUP)
+                dec->noiseFloor = (int32_t)(((int64_t)dec->noiseFloor << SENSOR_LEVEL_SHIFT) / SENSOR_NOISE_WARMUP);
+            continue;
+        }
+
+        if (!dec->inPacket) {
+            int32_t startLevel = sensor_decoder_start_level(dec);
+
+            if (env < startLevel) {
+                dec->noiseFloor += (env - dec->noiseFloor) >> NOISE_SHIFT;
+                dec->armed = true;
+                dec->startRun = 0;
+            } else if (dec->armed && ++dec->startRun == SENSOR_START_CONFIRM) {
+                sensor_decoder_start(dec, n - (SENSOR_START_CONFIRM - 1), env);
+            }
+            continue;
+        }
+
+        // Slice halfway between the floor and the HIGH level, with a quarter of the gap as hysteresis
+        int32_t gap = dec->highLevel - dec->noiseFloor;
+        int32_t mid = dec->noiseFloor + gap / 2;
+        int level = dec->level;
+        if (env >= mid + gap / 4) level = HIGH_STATE;
+        else if (env <= mid - gap / 4) level = LOW_STATE;
+
+        if (level != dec->level) {
+            if (!dec->startHalf) sensor_decoder_edge(dec, n);
+            dec->level = level;
+        }
+
+        // The start half period is known HIGH, judge it against the start level
+        if (dec->startHalf) {
+            dec->halfHigh += env >= sensor_decoder_start_level(dec);
+        } else {
+            dec->halfHigh += level;
+        }
+        dec->halfSamples++;
+        dec->halfEnv += env;
+
+        if ((n + 1) * FIXED_Q16_ONE >= dec->nextBoundary)
+            flags |= sensor_decoder_half_period(dec);
+    }
+
+    return flags;
+}
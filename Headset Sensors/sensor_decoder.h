@@ -0,0 +1,159 @@
+/* *********************************************************************
+ * File: sensor_decoder.h
+ * Author: Michael Bennett
+ * Purpose: Real-time Manchester decode of the headset mic line used by
+ *          GSFSensorIOController. Plain C with all storage fixed at
+ *          compile time so it can run on the audio render thread. The
+ *          slicing level follows the signal and noise levels and the bit
+ *          clock is recovered from the edges, so neither the volume nor
+ *          the sensor board's clock has to be exact. Integer only, the
+ *          readings come out in Q16.16 like chipcap_convert_q16's.
+ * ********************************************************************/
+#ifndef SENSOR_DECODER_H
+#define SENSOR_DECODER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fixed_point.h"
+#include "man_line.h"
+#include "reading_stats.h"
+#include "sensor_frame.h"
+#include "trace_log.h"
+
+// HIGH_MIN_AVG was tuned against dumps of NSNumber pointers, which carry the
+// sample in bit 8 and up. This is the same cutoff in real sample units, still
+// used by the offline decoder and recorded in capture headers.
+#define SAMPLE_HIGH_MIN_AVG     (HIGH_MIN_AVG >> 8)
+
+#define SENSOR_ENV_WINDOW       8       // Samples in the envelope average, whole cycles of the HIGH square wave
+#define SENSOR_ENV_HALF_SHIFT   2       // as many as fit in the half period shifted down this far, at least one cycle
+#define SENSOR_ENV_MAX_WINDOW   64      // and no more than this, a power of two
+#define SENSOR_MIN_LEVEL        64      // Envelope a start edge must reach however quiet the line is
+#define SENSOR_NOISE_SHIFT      1       // and how far over the noise floor, floor >> this, until a packet gives the HIGH level
+#define SENSOR_START_CONFIRM    16      // for this many samples in a row
+#define SENSOR_NOISE_WARMUP     512     // Samples after init only used to measure the noise floor
+#define SENSOR_LEVEL_SHIFT      8       // Fraction bits of the slicer levels
+#define SENSOR_CLOCK_TOLERANCE  15      // Percent the half period may be off the nominal one
+#define SENSOR_MAX_BITS         512     // Bits kept per transmission, room for a burst of several framed sensors
+#define SENSOR_MAX_BYTES        (SENSOR_MAX_BITS / 8)
+#define SENSOR_MAX_READINGS     4096    // Latest readings kept, a power of two. readingStats summarizes all of them
+
+// Flags returned by sensor_decoder_process
+#define SENSOR_DECODE_PACKET    0x1     // At least one good packet decoded
+#define SENSOR_DECODE_BAD_CRC   0x2     // At least one packet failed its check sum
+
+#define SENSOR_MAX_FRAMES       (SENSOR_MAX_BYTES / (SENSOR_FRAME_OVERHEAD + 1))     // Frames parsed per burst
+#define SENSOR_MAX_NAKS         16      // Failed frames held for the IO callback to ask for again
+
+// Readings as parallel arrays, so averaging one quantity walks contiguous values.
+// Reading n is in slot n & (SENSOR_MAX_READINGS - 1), overwritten SENSOR_MAX_READINGS later
+typedef struct {
+    int32_t humidity[SENSOR_MAX_READINGS];      // %RH, Q16.16
+    int32_t temperature[SENSOR_MAX_READINGS];   // C, Q16.16
+    long long sample[SENSOR_MAX_READINGS];      // sampleCount when the reading was decoded
+    uint8_t sensor[SENSOR_MAX_READINGS];        // ID from the frame header, 0 for an unframed packet
+} SensorReadings;
+
+// One reading copied out of SensorReadings
+typedef struct {
+    int32_t humidity;               // %RH, Q16.16
+    int32_t temperature;            // C, Q16.16
+    long long sample;
+    int sensor;
+} SensorReading;
+
+// A frame that failed its CRC, by the sequence of its burst and its place in it
+typedef struct {
+    uint8_t sequence;
+    uint8_t frame;
+} SensorNak;
+
+// Called from the decoding thread with every packet's bytes, check sum first,
+// or every frame's from its header, whether or not it checks
+typedef void (*SensorPacketCallback)(const uint8_t *bytes, int numBytes, bool good, void *userData);
+
+typedef struct {
+    int minLevel;                   // Start edges need at least this envelope
+
+    // Envelope, average of |sample| over the last envWindow samples
+    int envTaps[SENSOR_ENV_MAX_WINDOW];
+    int envSum;
+    int envIndex;
+    int envWindow;                  // Samples averaged, longer for slower rates to keep noise out of the slicer
+    FixedRecip envRecip;            // Divides by envWindow
+
+    // Slicer, levels in envelope units with SENSOR_LEVEL_SHIFT fraction bits
+    int32_t noiseFloor;             // Envelope of the idle line, the warmup sum until SENSOR_NOISE_WARMUP
+    int warmup;                     // Samples heard toward SENSOR_NOISE_WARMUP
+    int32_t highLevel;              // Envelope of HIGH half periods in this transmission
+    int32_t signalLevel;            // highLevel of the last transmission that decoded, 0 before one has
+    bool armed;                     // Line has been below the start level since the last transmission
+    int startRun;                   // Samples in a row at or over the start level
+    int level;                      // Sliced envelope, LOW_STATE or HIGH_STATE
+
+    // Bit clock
+    int nominalHalfPeriod;          // Samples per half period the sensor is sending at, HALF_PERIOD_TC unless set
+    bool inPacket;
+    bool startHalf;                 // Still in the HIGH half period that starts a transmission
+    int halfIndex;                  // 0 for the first half of a bit, 1 for the second
+    int firstHalf;                  // Level of the first half of the current bit
+    int halfHigh;                   // HIGH samples in the current half period
+    int halfSamples;                // Samples in the current half period
+    long long halfEnv;              // Envelope summed over the current half period
+    int edges;                      // Edges seen since the start
+    int32_t halfPeriod;             // Tracked half period in samples, Q16.16
+    long long lastBoundary;         // Absolute sample index where the current half period began, Q16.16
+    long long nextBoundary;         // and where it ends
+
+    int bit_num;
+    long long sampleCount;          // Samples pushed so far
+    uint8_t bitBuffer[SENSOR_MAX_BYTES + 1];   // Bits in the order received, packed LSB first, plus a spare byte for the last read
+
+    // Written by the decoding thread, published through numReadings
+    SensorReadings readings;
+    int numReadings;                // Every reading so far, readings holds the last SENSOR_MAX_READINGS
+    ReadingStats readingStats;      // Every good packet, including those readings no longer holds
+    int goodPackets;                // A burst counts each frame
+    int badPackets;                 // Failed their check, past correcting for a coded burst
+    int correctedPackets;           // Good only once the FEC put them right, counted in goodPackets too
+    long long bitsDecoded;
+
+    // Framed bursts, for selective repeat
+    int nextSequence;               // Sequence the next burst should have, -1 before the first
+    SensorNak naks[SENSOR_MAX_NAKS];    // Failed frames since the caller last cleared numNaks
+    int numNaks;
+
+    SensorPacketCallback onPacket;  // Optional, for tools and tests
+    void *userData;
+    TraceLog *trace;                // Optional, records starts, ends, packets and frames as they are decided
+} SensorDecoder;
+
+void sensor_decoder_init(SensorDecoder *dec);
+
+// Decodes every stride'th sample of the buffer. Returns SENSOR_DECODE_* flags
+int sensor_decoder_process(SensorDecoder *dec, const int16_t *samples, int numFrames, int stride);
+
+// Counts numFrames samples that were never heard, so sampleCount stays in
+// step with the line. Whatever transmission was in progress is dropped
+void sensor_decoder_skip(SensorDecoder *dec, int numFrames);
+
+// Half period of the link rate the sensor was told to send at. Takes effect
+// from the next transmission, the envelope length at once, so only call from
+// the decoding thread
+void sensor_decoder_set_rate(SensorDecoder *dec, int halfPeriod);
+
+// Readings published so far. Safe to call from a thread other than the decoder's
+int sensor_decoder_reading_count(const SensorDecoder *dec);
+
+// Copies reading n from a thread other than the decoder's. False if it is not
+// published yet, or the decoder has started overwriting its slot, which can
+// happen during the copy. Never blocks the decoder
+bool sensor_decoder_copy_reading(const SensorDecoder *dec, int n, SensorReading *out);
+
+void sensor_decoder_set_packet_callback(SensorDecoder *dec, SensorPacketCallback onPacket, void *userData);
+
+// Records into trace from the decoding thread, NULL for none
+void sensor_decoder_set_trace(SensorDecoder *dec, TraceLog *trace);
+
+#endif
@@ -0,0 +1,27 @@
+/* *********************************************************************
+ * File: sensor_fec.h
+ * Author: Michael Bennett
+ * Purpose: Forward error correction for framed bursts. Each frame gets
+ *          two Reed-Solomon parity bytes over GF(256), enough to put one
+ *          wrong byte anywhere in it right. The burst's sequence byte
+ *          leads every frame's code word without being sent again, so a
+ *          hit on it is put right frame by frame. A flipped bit or a slip
+ *          of up to 8 bits inside one byte costs the sensor no resend.
+ * ********************************************************************/
+#ifndef SENSOR_FEC_H
+#define SENSOR_FEC_H
+
+#include <stdint.h>
+
+#define SENSOR_FEC_PARITY       2       // Parity bytes after each frame
+#define SENSOR_FEC_MAX_BYTES    254     // Code word bytes, sequence byte and parity included, past this a wrong byte can't be placed
+
+// Writes the SENSOR_FEC_PARITY parity bytes of sequence followed by bytes
+void sensor_fec_encode(int sequence, const uint8_t *bytes, int numBytes, uint8_t *parity);
+
+// Checks sequence followed by numBytes bytes, parity last, and puts one
+// wrong byte right in place. Returns the bytes corrected, 0 or 1, or -1
+// when more than one is wrong
+int sensor_fec_correct(uint8_t *sequence, uint8_t *bytes, int numBytes);
+
+#endif
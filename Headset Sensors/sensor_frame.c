@@ -0,0 +1,190 @@
+/* *********************************************************************
+ * File: sensor_frame.c
+ * Author: Michael Bennett
+ * Purpose: Burst framing and its CRC. The CRC-8 has Hamming distance 4
+ *          over frames this short, sequence byte included, so any one to
+ *          three flipped bits and any burst of up to 8 are caught as long
+ *          as the length is right, which it must be for a known sensor
+ *          type. The ChipCap2 check sum only counts set bits and misses a
+ *          0 and a 1 flipped together. Coded frames are corrected first
+ *          and still have to pass the CRC, which catches most of the
+ *          code words with two bytes wrong that correct to a third.
+ * ********************************************************************/
+#include <string.h>
+
+#include "sensor_frame.h"
+
+// CRC-8 of every byte value, polynomial x^8 + x^2 + x + 1
+static const uint8_t crc8Table[256] = {
+    0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15, 0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d,
+    0x70, 0x77, 0x7e, 0x79, 0x6c, 0x6b, 0x62, 0x65, 0x48, 0x4f, 0x46, 0x41, 0x54, 0x53, 0x5a, 0x5d,
+    0xe0, 0xe7, 0xee, 0xe9, 0xfc, 0xfb, 0xf2, 0xf5, 0xd8, 0xdf, 0xd6, 0xd1, 0xc4, 0xc3, 0xca, 0xcd,
+    0x90, 0x97, 0x9e, 0x99, 0x8c, 0x8b, 0x82, 0x85, 0xa8, 0xaf, 0xa6, 0xa1, 0xb4, 0xb3, 0xba, 0xbd,
+    0xc7, 0xc0, 0xc9, 0xce, 0xdb, 0xdc, 0xd5, 0xd2, 0xff, 0xf8, 0xf1, 0xf6, 0xe3, 0xe4, 0xed, 0xea,
+    0xb7, 0xb0, 0xb9, 0xbe, 0xab, 0xac, 0xa5, 0xa2, 0x8f, 0x88, 0x81, 0x86, 0x93, 0x94, 0x9d, 0x9a,
+    0x27, 0x20, 0x29, 0x2e, 0x3b, 0x3c, 0x35, 0x32, 0x1f, 0x18, 0x11, 0x16, 0x03, 0x04, 0x0d, 0x0a,
+    0x57, 0x50, 0x59, 0x5e, 0x4b, 0x4c, 0x45, 0x42, 0x6f, 0x68, 0x61, 0x66, 0x73, 0x74, 0x7d, 0x7a,
+    0x89, 0x8e, 0x87, 0x80, 0x95, 0x92, 0x9b, 0x9c, 0xb1, 0xb6, 0xbf, 0xb8, 0xad, 0xaa, 0xa3, 0xa4,
+    0xf9, 0xfe, 0xf7, 0xf0, 0xe5, 0xe2, 0xeb, 0xec, 0xc1, 0xc6, 0xcf, 0xc8, 0xdd, 0xda, 0xd3, 0xd4,
+    0x69, 0x6e, 0x67, 0x60, 0x75, 0x72, 0x7b, 0x7c, 0x51, 0x56, 0x5f, 0x58, 0x4d, 0x4a, 0x43, 0x44,
+    0x19, 0x1e, 0x17, 0x10, 0x05, 0x02, 0x0b, 0x0c, 0x21, 0x26, 0x2f, 0x28, 0x3d, 0x3a, 0x33, 0x34,
+    0x4e, 0x49, 0x40, 0x47, 0x52, 0x55, 0x5c, 0x5b, 0x76, 0x71, 0x78, 0x7f, 0x6a, 0x6d, 0x64, 0x63,
+    0x3e, 0x39, 0x30, 0x37, 0x22, 0x25, 0x2c, 0x2b, 0x06, 0x01, 0x08, 0x0f, 0x1a, 0x1d, 0x14, 0x13,
+    0xae, 0xa9, 0xa0, 0xa7, 0xb2, 0xb5, 0xbc, 0xbb, 0x96, 0x91, 0x98, 0x9f, 0x8a, 0x8d, 0x84, 0x83,
+    0xde, 0xd9, 0xd0, 0xd7, 0xc2, 0xc5, 0xcc, 0xcb, 0xe6, 0xe1, 0xe8, 0xef, 0xfa, 0xfd, 0xf4, 0xf3,
+};
+
+// Payload length of each sensor type, 0 for types this app doesn't know
+static const uint8_t typeLength[16] = {
+    [SENSOR_FRAME_CHIPCAP2] = 4,
+};
+
+uint8_t sensor_frame_crc8(int sequence, const uint8_t *bytes, int numBytes) {
+    uint8_t crc = crc8Table[SENSOR_FRAME_CRC_INIT ^ (uint8_t)sequence];
+    int i;
+
+    for (i = 0; i < numBytes; i++) crc = crc8Table[crc ^ bytes[i]];
+    return crc;
+}
+
+// The 8 bits starting at bit offset, the spare byte keeps the read in bounds
+static uint8_t bits_byte(const uint8_t *bits, int offset) {
+    int word = bits[offset >> 3] | bits[(offset >> 3) + 1] << 8;
+    return (uint8_t)(word >> (offset & 7));
+}
+
+
+/**
+ *  First bit offset of a sync word, and which one it is. The coded one is
+ *  also found with one bit wrong, the frames after it can survive that much.
+ */
+static int find_sync(const uint8_t *bits, int numBits, int *sync) {
+    int offset, pass;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (offset = 0; offset + SENSOR_FRAME_SYNC_BITS <= numBits; offset++) {
+            *sync = bits_byte(bits, offset) << 8 | bits_byte(bits, offset + 8);
+            if (pass == 0 && (*sync == SENSOR_FRAME_SYNC || *sync == SENSOR_FRAME_SYNC_CODED)) return offset;
+            if (pass == 1 && __builtin_popcount(*sync ^ SENSOR_FRAME_SYNC_CODED) == 1) {
+                *sync = SENSOR_FRAME_SYNC_CODED;
+                return offset;
+            }
+        }
+    }
+    return -1;
+}
+
+
+int sensor_frame_unpack(const uint8_t *bits, int numBits, uint8_t *burst) {
+    int sync, offset = find_sync(bits, numBits, &sync), n, i;
+
+    if (offset < 0 || offset + 8 * SENSOR_FRAME_HEADER > numBits) return -1;
+
+    n = (numBits - offset) / 8;
+    burst[0] = (uint8_t)(sync >> 8);
+    burst[1] = (uint8_t)(sync & 0xff);
+    for (i = 2; i < n; i++) burst[i] = bits_byte(bits, offset + 8 * i);
+    return n;
+}
+
+
+int sensor_frame_sequence(const uint8_t *burst) {
+    return burst[SENSOR_FRAME_HEADER - 1];
+}
+
+
+bool sensor_frame_coded(const uint8_t *burst) {
+    return burst[0] == SENSOR_FRAME_SYNC_CODED >> 8 && burst[1] == (SENSOR_FRAME_SYNC_CODED & 0xff);
+}
+
+/**
+ *  Corrects a coded frame as if its payload were length bytes. Only changes
+ *  the burst when that gives a frame of that length which passes its CRC.
+ *  Returns the bytes corrected, or -1.
+ */
+static int frame_correct(uint8_t *burst, uint8_t *bytes, int left, int length) {
+    uint8_t word[SENSOR_FRAME_MAX_PAYLOAD + SENSOR_FRAME_CODED_OVERHEAD];
+    uint8_t sequence = (uint8_t)sensor_frame_sequence(burst);
+    int numBytes = length + SENSOR_FRAME_CODED_OVERHEAD;
+
+    if (length > SENSOR_FRAME_MAX_PAYLOAD || numBytes > left) return -1;
+
+    memcpy(word, bytes, numBytes);
+    int corrected = sensor_fec_correct(&sequence, word, numBytes);
+    if (corrected < 0 || word[1] != length || (typeLength[word[0] >> 4] && typeLength[word[0] >> 4] != length) ||
+        sensor_frame_crc8(sequence, word, length + 2) != word[length + 2])
+        return -1;
+
+    memcpy(bytes, word, numBytes);
+    burst[SENSOR_FRAME_HEADER - 1] = sequence;
+    return corrected;
+}
+
+
+SensorFrameStatus sensor_frame_parse(uint8_t *burst, int numBytes, int *offset, SensorFrame *frame) {
+    uint8_t *bytes = burst + *offset;
+    int left = numBytes - *offset;
+    bool coded = sensor_frame_coded(burst);
+    int overhead = coded ? SENSOR_FRAME_CODED_OVERHEAD : SENSOR_FRAME_OVERHEAD;
+
+    if (left < overhead) return SENSOR_FRAME_END;
+
+    // A wrong header or length byte would move the parity, so a known
+    // type's own length is tried before the length byte's
+    frame->corrected = 0;
+    if (coded) {
+        int known = typeLength[bytes[0] >> 4];
+        int corrected = known ? frame_correct(burst, bytes, left, known) : -1;
+        if (corrected < 0 && bytes[1] != known) corrected = frame_correct(burst, bytes, left, bytes[1]);
+        if (corrected > 0) frame->corrected = corrected;
+    }
+
+    frame->sequence = sensor_frame_sequence(burst);
+    frame->bytes = bytes;
+    frame->type = bytes[0] >> 4;
+    frame->id = bytes[0] & 0xf;
+    frame->length = bytes[1];
+    frame->payload = bytes + 2;
+
+    // A flipped length bit would move the CRC, so a known type must have its
+    // own length. A length past the burst is as likely a flipped bit as a cut off frame
+    if (frame->length > SENSOR_FRAME_MAX_PAYLOAD || frame->length + overhead > left ||
+        (typeLength[frame->type] && frame->length != typeLength[frame->type])) {
+        if (frame->length + overhead > left) frame->length = left - overhead;
+        *offset = numBytes;
+        return SENSOR_FRAME_BAD;
+    }
+
+    // With a length that fits, the next frame is still found past a failed one
+    *offset += frame->length + overhead;
+    if (sensor_frame_crc8(frame->sequence, bytes, frame->length + 2) != bytes[frame->length + 2])
+        return SENSOR_FRAME_BAD;
+    return SENSOR_FRAME_GOOD;
+}
+
+
+int sensor_frame_begin(uint8_t *burst, int maxBytes, int sequence, bool coded) {
+    int sync = coded ? SENSOR_FRAME_SYNC_CODED : SENSOR_FRAME_SYNC;
+
+    if (maxBytes < SENSOR_FRAME_HEADER) return -1;
+    burst[0] = (uint8_t)(sync >> 8);
+    burst[1] = (uint8_t)(sync & 0xff);
+    burst[2] = (uint8_t)sequence;
+    return SENSOR_FRAME_HEADER;
+}
+
+
+int sensor_frame_append(uint8_t *burst, int numBytes, int maxBytes, int type, int id, const uint8_t *payload, int length) {
+    uint8_t *bytes = burst + numBytes;
+    bool coded = sensor_frame_coded(burst);
+    int overhead = coded ? SENSOR_FRAME_CODED_OVERHEAD : SENSOR_FRAME_OVERHEAD;
+
+    if (length > SENSOR_FRAME_MAX_PAYLOAD || numBytes + length + overhead > maxBytes) return -1;
+
+    bytes[0] = (uint8_t)((type & 0xf) << 4 | (id & 0xf));
+    bytes[1] = (uint8_t)length;
+    memcpy(bytes + 2, payload, length);
+    bytes[length + 2] = sensor_frame_crc8(sensor_frame_sequence(burst), bytes, length + 2);
+    if (coded) sensor_fec_encode(sensor_frame_sequence(burst), bytes, length + SENSOR_FRAME_OVERHEAD, bytes + length + SENSOR_FRAME_OVERHEAD);
+    return numBytes + length + overhead;
+}
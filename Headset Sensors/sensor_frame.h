@@ -0,0 +1,79 @@
+/* *********************************************************************
+ * File: sensor_frame.h
+ * Author: Michael Bennett
+ * Purpose: Framed transmissions, so several sensors can share one burst.
+ *          A burst is the sync word and a sequence byte followed by
+ *          frames back to back, each a header byte (sensor type in the
+ *          high nibble, sensor ID in the low one), a payload length byte,
+ *          the payload and a CRC-8 over the burst's sequence byte and the
+ *          frame's header, length and payload. The sequence counts bursts
+ *          so a frame that failed can be asked for again. A burst sent
+ *          with SENSOR_FRAME_SYNC_CODED adds sensor_fec parity to every
+ *          frame, and a frame one byte off is put right instead. Unlike ChipCap2
+ *          packets, bursts are sent first byte first, LSB first, so the
+ *          decoder reads them forward in one pass. A transmission with no
+ *          sync word, or no frame that checks, is taken as a ChipCap2
+ *          packet the way the sensor board has always sent them.
+ * ********************************************************************/
+#ifndef SENSOR_FRAME_H
+#define SENSOR_FRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensor_fec.h"
+
+#define SENSOR_FRAME_SYNC           0x2dd4  // High byte sent first
+#define SENSOR_FRAME_SYNC_CODED     0xd42d  // Frames carry FEC parity, 12 bits off the plain sync word
+#define SENSOR_FRAME_SYNC_BITS      16
+#define SENSOR_FRAME_HEADER         3       // Sync word and sequence byte, the first frame starts after them
+#define SENSOR_FRAME_OVERHEAD       3       // Header, length and CRC around each payload
+#define SENSOR_FRAME_CODED_OVERHEAD (SENSOR_FRAME_OVERHEAD + SENSOR_FEC_PARITY)
+#define SENSOR_FRAME_MAX_PAYLOAD    32
+#define SENSOR_FRAME_CRC_INIT       0xff    // CRC-8 polynomial 0x07, so a run of zeros still changes it
+
+// Sensor types, the header's high nibble
+#define SENSOR_FRAME_CHIPCAP2       0x1     // The 4 ChipCap2 data bytes, humidity first
+
+typedef enum {
+    SENSOR_FRAME_END,               // No whole frame left in the burst
+    SENSOR_FRAME_GOOD,
+    SENSOR_FRAME_BAD                // Failed its CRC past correcting, or had a length that can't be right and hides the frames after it
+} SensorFrameStatus;
+
+typedef struct {
+    int sequence;                   // Of the burst the frame came in
+    int type;
+    int id;
+    int length;
+    const uint8_t *payload;         // Points into the burst
+    const uint8_t *bytes;           // The whole frame from its header, length + SENSOR_FRAME_OVERHEAD bytes without parity
+    int corrected;                  // Bytes the FEC put right, sequence byte included
+} SensorFrame;
+
+// CRC of a frame's header, length and payload in a burst with this sequence
+uint8_t sensor_frame_crc8(int sequence, const uint8_t *bytes, int numBytes);
+
+// Finds the first sync word, plain or coded, in numBits bits packed LSB
+// first in the order received, the coded one even with a bit wrong, and
+// copies the whole bytes from it on into burst. Returns the byte count, or -1 with no sync word or sequence. bits
+// needs a readable byte past the last bit, burst room for numBits / 8 bytes
+int sensor_frame_unpack(const uint8_t *bits, int numBits, uint8_t *burst);
+
+int sensor_frame_sequence(const uint8_t *burst);
+bool sensor_frame_coded(const uint8_t *burst);
+
+// Parses the frame at burst[*offset], starting at SENSOR_FRAME_HEADER, and
+// moves offset past it. A known sensor type with another length is bad,
+// and so is a length running past the burst, clipped to it. Either ends the
+// burst, a frame that only failed its CRC doesn't. Coded frames are
+// corrected in place, the sequence byte too
+SensorFrameStatus sensor_frame_parse(uint8_t *burst, int numBytes, int *offset, SensorFrame *frame);
+
+// Sensor side, for tools and tests: starts a burst with the sync word and
+// sequence, then appends frames, with parity if coded. Each returns the
+// burst's new length, or -1 when out of room
+int sensor_frame_begin(uint8_t *burst, int maxBytes, int sequence, bool coded);
+int sensor_frame_append(uint8_t *burst, int numBytes, int maxBytes, int type, int id, const uint8_t *payload, int length);
+
+#endif
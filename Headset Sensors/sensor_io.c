@@ -0,0 +1,167 @@
+/* *********************************************************************
+ * File: sensor_io.c
+ * Author: Michael Bennett
+ * Purpose: Render callback body shared by every audio IO backend.
+ * ********************************************************************/
+#include <math.h>
+#include <string.h>
+
+#include "sensor_io.h"
+
+bool sensor_io_init(SensorIO *io, uint32_t rawInputCapacity) {
+    memset(io, 0, sizeof(*io));
+    if (rawInputCapacity && !sample_ring_init(&io->rawInput, rawInputCapacity)) return false;
+
+    sensor_io_reset(io, 0);
+    return true;
+}
+
+
+void sensor_io_free(SensorIO *io) {
+    if (io->rawInput.buffer) sample_ring_free(&io->rawInput);
+}
+
+
+void sensor_io_reset(SensorIO *io, double sampleRate) {
+    io->reqNewData = true;
+    io->waitACycle = false;
+    io->sampleRate = sampleRate;
+    tone_gen_init(&io->powerTone, POWER_TONE_FREQ, sampleRate, POWER_TONE_AMPLITUDE);
+    tone_gen_init(&io->commandTone, COMMAND_TONE_FREQ, sampleRate, COMMAND_TONE_AMPLITUDE);
+    sensor_decoder_init(&io->decoder);
+    sensor_decoder_set_trace(&io->decoder, io->trace);
+    resampler_init(&io->micResampler, sampleRate > 0 ? (uint32_t)lround(sampleRate) : MAN_LINE_SAMPLE_RATE, MAN_LINE_SAMPLE_RATE);
+    link_rate_init(&io->link, sampleRate);
+    link_command_init(&io->command, sampleRate);
+    // The sensor may still be at a faster rate from the last collection
+    if (io->linkTraining) link_command_send(&io->command, LINK_MSG_RATE(0));
+    io_stats_init(&io->stats, sampleRate);
+}
+
+
+static void sensor_io_trace(SensorIO *io, TraceType type, int arg, uint32_t value) {
+    if (io->trace != NULL) trace_log_write(io->trace, type, (uint64_t)io->decoder.sampleCount, (uint16_t)arg, value, NULL, 0);
+}
+
+/**
+ *  Queues a command tone message and traces it, arg 0 when the queue was full.
+ */
+static bool sensor_io_send(SensorIO *io, int message) {
+    bool sent = link_command_send(&io->command, message);
+
+    sensor_io_trace(io, TRACE_MESSAGE, sent, (uint32_t)message);
+    return sent;
+}
+
+
+/**
+ *  Decodes the mic line, through the resampler a chunk at a time unless the
+ *  hardware is already at the decoder's rate.
+ *
+ *  @return SENSOR_DECODE_* flags
+ */
+static int sensor_io_decode(SensorIO *io, const int16_t *buffer, uint32_t numFrames, uint32_t channels) {
+    int flags = 0, used, n;
+
+    if (resampler_passthrough(&io->micResampler))
+        return sensor_decoder_process(&io->decoder, buffer, (int)numFrames, (int)channels);
+
+    while (numFrames > 0) {
+        n = resampler_process(&io->micResampler, buffer, (int)numFrames, (int)channels,
+                              io->decodeChunk, SENSOR_IO_DECODE_CHUNK, &used);
+        flags |= sensor_decoder_process(&io->decoder, io->decodeChunk, n, 1);
+        buffer += used * channels;
+        numFrames -= used;
+    }
+    return flags;
+}
+
+
+/**
+ *  Process Input readinga and fills right channel output buffer with any response
+ *
+ *  @param io        Render thread state
+ *  @param buffer    Interleaved input, the mic line is the first channel
+ *  @param numFrames Frames in buffer
+ *  @param channels  Samples per frame
+ *  @param cycle     Filled with what was decoded for the callback's stats
+ */
+static void processIO(SensorIO *io, const int16_t *buffer, uint32_t numFrames, uint32_t channels, IoStatsCycle *cycle) {
+    if (io->waitACycle) {
+        io->waitACycle = false;
+        io->reqNewData = true;
+        cycle->retries = 1;
+        sensor_io_trace(io, TRACE_RETRY, 0, numFrames);
+        // Not decoded, but still counted so reading times stay on the line's clock
+        sensor_decoder_skip(&io->decoder, resampler_skip(&io->micResampler, (int)numFrames));
+        return;
+    }
+
+    if (io->rawInput.capacity)
+        sample_ring_write(&io->rawInput, buffer, numFrames, channels);
+
+    // Realtime decode
+    long long bits = io->decoder.bitsDecoded;
+    int packets = io->decoder.goodPackets;
+    int badPackets = io->decoder.badPackets;
+    int corrected = io->decoder.correctedPackets;
+    int flags = sensor_io_decode(io, buffer, numFrames, channels);
+    cycle->samples = numFrames;
+    cycle->bits = (uint32_t)(io->decoder.bitsDecoded - bits);
+    cycle->packets = io->decoder.goodPackets - packets;
+    cycle->badPackets = io->decoder.badPackets - badPackets;
+    cycle->corrected = io->decoder.correctedPackets - corrected;
+    if (io->linkTraining && link_rate_update(&io->link, (int)cycle->packets, (int)cycle->badPackets, numFrames)) {
+        sensor_decoder_set_rate(&io->decoder, link_rate_half_period(io->link.rate));
+        sensor_io_send(io, LINK_MSG_RATE(io->link.rate));
+    }
+
+    // Only the frames that failed are asked for again, the request tone carries on around the NAKs
+    if (io->selectiveRepeat && io->decoder.numNaks > 0) {
+        for (int n = 0; n < io->decoder.numNaks; n++) {
+            const SensorNak *nak = &io->decoder.naks[n];
+            if (nak->frame < LINK_NAK_FRAMES &&
+                sensor_io_send(io, LINK_MSG_NAK_OF(nak->sequence, nak->frame)))
+                cycle->naks++;
+        }
+    } else if (flags & SENSOR_DECODE_BAD_CRC) {
+        io->reqNewData = false;
+        io->waitACycle = true;
+    }
+    io->decoder.numNaks = 0;
+}
+
+
+void sensor_io_render(SensorIO *io, int16_t *frames, uint32_t numFrames, uint32_t channels, IoStatsCycle *cycle) {
+    uint32_t c, k, sent = 0;
+
+    cycle->frames = numFrames;
+    processIO(io, frames, numFrames, channels, cycle);
+
+    // Power tone on the left channel, commands to Atmel on the right as necessary
+    tone_gen_render_s16(&io->powerTone, frames, numFrames, channels);
+    if (channels < 2) return;
+
+    if (link_command_active(&io->command))
+        sent = link_command_render(&io->command, &io->commandTone, frames + 1, numFrames, channels);
+    if (io->reqNewData)
+        tone_gen_render_s16(&io->commandTone, frames + sent * channels + 1, numFrames - sent, channels);
+    else
+        tone_gen_render_silent(&io->commandTone, frames + sent * channels + 1, numFrames - sent, channels);
+
+    // Any other channel would play the mic back out
+    for (c = 2; c < channels; c++) {
+        for (k = 0; k < numFrames; k++) frames[k * channels + c] = 0;
+    }
+}
+
+
+const char *sensor_io_event_name(SensorIOEvent event) {
+    switch (event) {
+        case SENSOR_IO_INTERRUPT_BEGAN: return "interrupt began";
+        case SENSOR_IO_INTERRUPT_ENDED: return "interrupt ended";
+        case SENSOR_IO_ROUTE_REMOVED:   return "sensor removed";
+        case SENSOR_IO_ROUTE_ADDED:     return "sensor inserted";
+    }
+    return "unknown";
+}
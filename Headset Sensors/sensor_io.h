@@ -0,0 +1,79 @@
+/* *********************************************************************
+ * File: sensor_io.h
+ * Author: Michael Bennett
+ * Purpose: The sensor's half of the audio IO callback, apart from the
+ *          backend that owns the audio device. A backend (RemoteIO in
+ *          GSFSensorIOController, sensor_io_replay on the host) calls
+ *          sensor_io_render once per buffer from its real-time thread,
+ *          times the call into stats, and reports interruptions and
+ *          route changes as SensorIOEvents from some other thread. The
+ *          tones and messages are rendered at the hardware rate; the mic
+ *          line is resampled to MAN_LINE_SAMPLE_RATE for the decoder
+ *          when the hardware runs at another.
+ * ********************************************************************/
+#ifndef SENSOR_IO_H
+#define SENSOR_IO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensor_decoder.h"
+#include "sample_ring.h"
+#include "tone_gen.h"
+#include "io_stats.h"
+#include "link_rate.h"
+#include "resampler.h"
+
+#define POWER_TONE_FREQ         20000.0
+#define POWER_TONE_AMPLITUDE    0.0f                // 60534.0f/2 powers the sensor board, off for now
+#define COMMAND_TONE_FREQ       20000.0
+#define COMMAND_TONE_AMPLITUDE  (32767.0f/2)        // Right channel, sent while requesting data
+#define SENSOR_IO_DECODE_CHUNK  512                 // Resampled mic samples handed to the decoder at a time
+
+// What a backend reports besides buffers. Each maps to the AVAudioSession
+// notification GSFSensorIOController handles the same way
+typedef enum {
+    SENSOR_IO_INTERRUPT_BEGAN,      // Another app took the audio session, no buffers until it ends
+    SENSOR_IO_INTERRUPT_ENDED,
+    SENSOR_IO_ROUTE_REMOVED,        // Sensor unplugged, AVAudioSessionRouteChangeReasonOldDeviceUnavailable
+    SENSOR_IO_ROUTE_ADDED           // Sensor plugged in, AVAudioSessionRouteChangeReasonNewDeviceAvailable
+} SensorIOEvent;
+
+// State shared with the audio render thread. Only plain C lives here so the
+// callback never messages Objective-C objects, allocates or locks.
+typedef struct {
+    double sampleRate;
+    ToneGen powerTone;                  // Left channel
+    ToneGen commandTone;                // Right channel, only audible while reqNewData
+    volatile bool reqNewData;           // Flag for new communication to micro
+    bool waitACycle;
+    bool linkTraining;                  // Negotiate a faster bit rate, kept across resets
+    bool selectiveRepeat;               // NAK a burst's failed frames instead of waitACycle, kept across resets
+    LinkRate link;
+    LinkCommand command;                // Messages keyed onto the command tone
+    SensorDecoder decoder;              // Counts samples at MAN_LINE_SAMPLE_RATE
+    Resampler micResampler;             // Hardware rate to MAN_LINE_SAMPLE_RATE
+    int16_t decodeChunk[SENSOR_IO_DECODE_CHUNK];
+    SampleRing rawInput;                // Raw mic input for captures, unused when allocated empty
+    IoStats stats;                      // Written by the render thread only, recorded by the backend
+    TraceLog *trace;                    // Optional, set by the backend and kept across resets
+} SensorIO;
+
+// Allocates the raw input ring, capacity 0 for none. Not real-time safe
+bool sensor_io_init(SensorIO *io, uint32_t rawInputCapacity);
+void sensor_io_free(SensorIO *io);
+
+// Starts a new collection at the hardware's sampleRate. Only call while the
+// backend is stopped. A rate too far from MAN_LINE_SAMPLE_RATE to resample
+// is decoded as it comes
+void sensor_io_reset(SensorIO *io, double sampleRate);
+
+// Render thread: decodes the mic line from channel 0 of the interleaved
+// buffer, then overwrites the buffer with the power tone on channel 0 and
+// the command tone on channel 1, or messages to the sensor while any are
+// queued. Fills cycle for the backend to record
+void sensor_io_render(SensorIO *io, int16_t *frames, uint32_t numFrames, uint32_t channels, IoStatsCycle *cycle);
+
+const char *sensor_io_event_name(SensorIOEvent event);
+
+#endif
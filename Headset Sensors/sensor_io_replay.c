@@ -0,0 +1,179 @@
+/* *********************************************************************
+ * File: sensor_io_replay.c
+ * Author: Michael Bennett
+ * Purpose: Capture replay backend. The simulated clock puts each
+ *          callback's start at the end of its buffer plus jitter and
+ *          its end that far on by the measured run time, so stats and
+ *          deadlines read the same as on a device that runs the decode
+ *          at this machine's speed.
+ * ********************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sensor_io_replay.h"
+
+#define REPLAY_FRAMES           256
+#define REPLAY_CHANNELS         2
+#define REPLAY_JITTER           0.1
+#define REPLAY_DEADLINE         1.0
+#define REPLAY_SEED             1
+
+typedef struct {
+    uint64_t frame;
+    SensorIOEvent event;
+} ReplayEdge;
+
+static uint32_t replay_rand(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static int compare_edges(const void *a, const void *b) {
+    const ReplayEdge *x = a, *y = b;
+    return x->frame < y->frame ? -1 : x->frame > y->frame;
+}
+
+static void sleep_until_ns(uint64_t wakeNs) {
+    uint64_t now = io_stats_now_ns();
+    struct timespec ts;
+
+    if (wakeNs <= now) return;
+    ts.tv_sec = (time_t)((wakeNs - now) / 1000000000u);
+    ts.tv_nsec = (long)((wakeNs - now) % 1000000000u);
+    nanosleep(&ts, NULL);
+}
+
+
+void sensor_replay_default(SensorReplayConfig *config) {
+    memset(config, 0, sizeof(*config));
+    config->framesPerCallback = REPLAY_FRAMES;
+    config->channels = REPLAY_CHANNELS;
+    config->jitter = REPLAY_JITTER;
+    config->deadline = REPLAY_DEADLINE;
+    config->seed = REPLAY_SEED;
+}
+
+
+bool sensor_replay_add_event(SensorReplayConfig *config, SensorReplayEventType type, double atSeconds, double seconds) {
+    if (config->numEvents >= SENSOR_REPLAY_MAX_EVENTS) return false;
+
+    config->events[config->numEvents].type = type;
+    config->events[config->numEvents].atSeconds = atSeconds;
+    config->events[config->numEvents].seconds = seconds;
+    config->numEvents++;
+    return true;
+}
+
+
+bool sensor_replay_run(const SensorReplayConfig *config, const CaptureReader *reader, SensorIO *io,
+                       const SensorReplayHooks *hooks, SensorReplayResult *result) {
+    ReplayEdge edges[2 * SENSOR_REPLAY_MAX_EVENTS];
+    uint32_t frames = config->framesPerCallback;
+    uint32_t channels = config->channels ? config->channels : 1;
+    double rate = reader->header.sampleRate;
+    double periodNs = frames * 1e9 / rate;
+    uint64_t deadlineNs = (uint64_t)(config->deadline * periodNs);
+    uint64_t loadNs = (uint64_t)(config->load * periodNs);
+    uint64_t wallBase = io_stats_now_ns();
+    uint32_t seed = config->seed ? config->seed : REPLAY_SEED;
+    uint64_t frame, dropping = 0;
+    int numEdges = 0, next = 0, interrupted = 0, e;
+    bool unplugged = false, running = true;
+    int16_t *mono, *buffer;
+
+    memset(result, 0, sizeof(*result));
+    result->minSlackNs = INT64_MAX;
+    if (frames == 0) return false;
+
+    mono = malloc(frames * sizeof(int16_t));
+    buffer = calloc((size_t)frames * channels, sizeof(int16_t));
+    if (mono == NULL || buffer == NULL) {
+        free(mono);
+        free(buffer);
+        return false;
+    }
+
+    // Each event is a start and an end, in capture order
+    for (e = 0; e < config->numEvents; e++) {
+        const SensorReplayEvent *event = &config->events[e];
+        bool interrupt = event->type == SENSOR_REPLAY_INTERRUPT;
+
+        edges[numEdges].frame = (uint64_t)(event->atSeconds * rate);
+        edges[numEdges++].event = interrupt ? SENSOR_IO_INTERRUPT_BEGAN : SENSOR_IO_ROUTE_REMOVED;
+        edges[numEdges].frame = (uint64_t)((event->atSeconds + event->seconds) * rate);
+        edges[numEdges++].event = interrupt ? SENSOR_IO_INTERRUPT_ENDED : SENSOR_IO_ROUTE_ADDED;
+    }
+    qsort(edges, numEdges, sizeof(ReplayEdge), compare_edges);
+
+    for (frame = 0; frame + frames <= reader->header.numFrames; frame += frames) {
+        // The buffer is full once its last frame is in, the callback can't start before
+        uint64_t filledNs = (uint64_t)((frame + frames) * 1e9 / rate);
+
+        while (next < numEdges && edges[next].frame <= frame) {
+            SensorIOEvent event = edges[next++].event;
+
+            if (event == SENSOR_IO_INTERRUPT_BEGAN) interrupted++;
+            else if (event == SENSOR_IO_INTERRUPT_ENDED) interrupted--;
+            else unplugged = event == SENSOR_IO_ROUTE_REMOVED;
+
+            if (hooks && hooks->onEvent)
+                running = hooks->onEvent(event, frame / rate, hooks->userData);
+        }
+
+        if (config->realTime) sleep_until_ns(wallBase + filledNs);
+
+        if (interrupted > 0 || unplugged || !running) {
+            result->idleBuffers++;
+            dropping = 0;
+            continue;
+        }
+        if (dropping) {
+            dropping--;
+            result->droppedBuffers++;
+            continue;
+        }
+
+        capture_read_channel(reader, frame, frames, 0, mono);
+        for (uint32_t k = 0; k < frames; k++) buffer[k * channels] = mono[k];
+
+        uint64_t jitterNs = (uint64_t)((replay_rand(&seed) / 4294967296.0) * config->jitter * periodNs);
+        if (config->realTime) sleep_until_ns(wallBase + filledNs + jitterNs);
+
+        IoStatsCycle cycle = { .frames = frames };
+        uint64_t t0 = io_stats_now_ns();
+        sensor_io_render(io, buffer, frames, channels, &cycle);
+        while (loadNs && io_stats_now_ns() - t0 < loadNs) {}
+        uint64_t runNs = io_stats_now_ns() - t0;
+
+        uint64_t startNs = config->realTime ? t0 : filledNs + jitterNs;
+        io_stats_record(&io->stats, startNs, startNs + runNs, &cycle);
+
+        // Buffers that fill while a late callback is still running are overwritten
+        int64_t slackNs = (int64_t)deadlineNs - (int64_t)(jitterNs + runNs);
+        if (slackNs < result->minSlackNs) result->minSlackNs = slackNs;
+        if (slackNs < 0) {
+            result->deadlineMisses++;
+            dropping = (uint64_t)((-slackNs + periodNs - 1) / periodNs);
+        }
+        result->callbacks++;
+
+        if (hooks && hooks->onCallback) {
+            SensorReplayCallback callback = {
+                .firstFrame = frame,
+                .numFrames = frames,
+                .startSeconds = (filledNs + jitterNs) * 1e-9,
+                .endSeconds = (filledNs + jitterNs + runNs) * 1e-9,
+                .missed = slackNs < 0
+            };
+            hooks->onCallback(&callback, hooks->userData);
+        }
+    }
+
+    free(mono);
+    free(buffer);
+    return true;
+}
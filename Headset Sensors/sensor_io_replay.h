@@ -0,0 +1,84 @@
+/* *********************************************************************
+ * File: sensor_io_replay.h
+ * Author: Michael Bennett
+ * Purpose: Host stand-in for the RemoteIO backend. Feeds a capture
+ *          through sensor_io_render in callback sized buffers, on a
+ *          simulated clock or paced in real time, with jittered
+ *          callback starts, interruptions and the sensor being pulled
+ *          and put back. A callback that runs past its deadline costs
+ *          the input that arrived meanwhile, as on a device, so decoder
+ *          changes can be checked for deadline misses and latency to a
+ *          reading without a phone.
+ * ********************************************************************/
+#ifndef SENSOR_IO_REPLAY_H
+#define SENSOR_IO_REPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sensor_io.h"
+#include "capture_file.h"
+
+#define SENSOR_REPLAY_MAX_EVENTS    32
+
+typedef enum {
+    SENSOR_REPLAY_INTERRUPT,        // INTERRUPT_BEGAN, then INTERRUPT_ENDED when it is over
+    SENSOR_REPLAY_UNPLUG            // ROUTE_REMOVED, then ROUTE_ADDED when it is plugged back in
+} SensorReplayEventType;
+
+typedef struct {
+    SensorReplayEventType type;
+    double atSeconds;               // Capture time it starts
+    double seconds;                 // How long it lasts
+} SensorReplayEvent;
+
+typedef struct {
+    uint32_t framesPerCallback;     // 256 is what a 5 ms preferred buffer gets at 44.1 kHz
+    uint32_t channels;              // Interleaved channels per buffer, the mic line is channel 0
+    double jitter;                  // Callbacks start up to this fraction of a period after their buffer fills
+    double deadline;                // Fraction of a period a callback has from its buffer filling to returning
+    double load;                    // Extra busy time per callback, as a fraction of a period
+    bool realTime;                  // Sleep until each callback is due instead of running flat out
+    uint32_t seed;                  // Jitter
+    SensorReplayEvent events[SENSOR_REPLAY_MAX_EVENTS];
+    int numEvents;
+} SensorReplayConfig;
+
+// One callback, as seen from the capture's clock
+typedef struct {
+    uint64_t firstFrame;            // Capture frame the buffer started at
+    uint32_t numFrames;
+    double startSeconds;            // Buffer filled plus jitter
+    double endSeconds;              // and when the callback returned
+    bool missed;                    // Returned after the deadline
+} SensorReplayCallback;
+
+typedef struct {
+    // Between callbacks, like the AVAudioSession notifications. Returns
+    // whether IO should be running afterwards, reset io before restarting
+    bool (*onEvent)(SensorIOEvent event, double atSeconds, void *userData);
+    // After each callback, outside its timing
+    void (*onCallback)(const SensorReplayCallback *callback, void *userData);
+    void *userData;
+} SensorReplayHooks;
+
+typedef struct {
+    uint64_t callbacks;
+    uint64_t deadlineMisses;        // Callbacks whose jitter plus run time passed the deadline
+    uint64_t droppedBuffers;        // Buffers that arrived while a late callback was still running
+    uint64_t idleBuffers;           // Buffers that went by interrupted, unplugged or stopped
+    int64_t minSlackNs;             // Closest any callback came to the deadline, negative once missed
+} SensorReplayResult;
+
+void sensor_replay_default(SensorReplayConfig *config);
+
+// Adds an event, false once SENSOR_REPLAY_MAX_EVENTS are set
+bool sensor_replay_add_event(SensorReplayConfig *config, SensorReplayEventType type, double atSeconds, double seconds);
+
+// Replays channel 0 of the capture on the calling thread, which plays the
+// audio thread. io must already be reset to the capture's sample rate.
+// False if the buffer could not be allocated
+bool sensor_replay_run(const SensorReplayConfig *config, const CaptureReader *reader, SensorIO *io,
+                       const SensorReplayHooks *hooks, SensorReplayResult *result);
+
+#endif
@@ -0,0 +1,419 @@
+/* *********************************************************************
+ * File: sensor_replay.c
+ * Author: Michael Bennett
+ * Purpose: Run a capture through the app's render callback on the host
+ *          and report what the collector would have seen: readings,
+ *          callback timing, deadline misses and, given capture_synth's
+ *          list of what was sent, how long each packet took to become
+ *          a reading. Interruptions and unplugging are handled the way
+ *          GSFSensorIOController handles them, so a restart loses the
+ *          readings of the collection before it.
+ * Build:   cc -O2 -pthread -o sensor_replay sensor_replay.c sensor_io_replay.c sensor_io.c sensor_decoder.c \
+ *             reading_stats.c chipcap.c tone_gen.c sample_ring.c io_stats.c capture_file.c link_rate.c \
+ *             sensor_frame.c sensor_fec.c trace_log.c resampler.c capture_codec.c -lm
+ * Usage:   sensor_replay [-f frames] [-j jitter] [-d deadline] [-l load] [-r] [-S seed]
+ *                        [-i at:seconds]... [-u at:seconds]... [-R] [-t truth.txt] [-v]
+ *                        [-T trace.gsft [-a]] capture.gsfc|capture.gsfz
+ *          -j, -d and -l are fractions of a callback period. -i
+ *          interrupts the session and -u unplugs the sensor for the
+ *          given time. -R restarts after an interruption, which the
+ *          controller does not do yet. -r paces callbacks in real time.
+ *          -T writes the trace the app would, -a adds every half period
+ *          and the raw bits to it. A compressed capture is decompressed
+ *          whole before the replay, so callbacks time only the app.
+ * ********************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sensor_io_replay.h"
+#include "chipcap.h"
+#include "capture_codec.h"
+
+#define REPLAY_MAX_PACKETS      (1 << 16)
+#define REPLAY_MATCH_SECONDS    1.0     // Longest a packet may take to become a reading
+#define REPLAY_TRACE_CAPACITY   (1 << 20)   // Replays run faster than real time, so the ring is deeper than the app's
+
+typedef struct {
+    long long startSample;
+    long long endSample;
+    uint8_t bytes[5];
+    bool matched;
+} TruthPacket;
+
+typedef struct {
+    uint8_t bytes[5];
+    double readySeconds;            // When the callback that decoded it returned, -1 until then
+    uint64_t readyFrame;
+} Reading;
+
+typedef struct {
+    SensorIO io;
+    bool resume;
+    bool verbose;
+    IoStatsCounters total;          // Stats of collections already reset
+    Reading *readings;
+    int numReadings;
+    int pending;                    // First reading not yet given a time
+    int badPackets;
+    int restarts;
+} ReplayState;
+
+
+static void on_packet(const uint8_t *bytes, int numBytes, bool good, void *userData) {
+    ReplayState *state = userData;
+    bool framed = good && numBytes == 4 + SENSOR_FRAME_OVERHEAD && bytes[0] >> 4 == SENSOR_FRAME_CHIPCAP2;
+
+    if (!good || (numBytes != 5 && !framed)) {
+        state->badPackets++;
+        return;
+    }
+    if (state->numReadings == REPLAY_MAX_PACKETS) return;
+
+    // A framed reading is kept the way capture_synth prints it, check sum first
+    uint8_t *reading = state->readings[state->numReadings].bytes;
+    if (framed) {
+        memcpy(reading + 1, bytes + 2, 4);
+        reading[0] = (uint8_t)chipcap_checksum(reading, 5);
+    } else {
+        memcpy(reading, bytes, 5);
+    }
+    state->readings[state->numReadings].readySeconds = -1;
+    state->numReadings++;
+}
+
+/**
+ *  What startCollecting does to the render state: sensor_io_reset in setUpSensorIO.
+ */
+static void start_collecting(ReplayState *state) {
+    IoStatsCounters counters;
+
+    io_stats_snapshot(&state->io.stats, &counters);
+    io_stats_merge(&state->total, &counters);
+
+    sensor_io_reset(&state->io, state->io.sampleRate);
+    sensor_decoder_set_packet_callback(&state->io.decoder, on_packet, state);
+    state->restarts++;
+}
+
+/**
+ *  GSFSensorIOController's audioInterrupt and audioRouteChangeListener.
+ */
+static bool on_event(SensorIOEvent event, double atSeconds, void *userData) {
+    ReplayState *state = userData;
+    bool running = false;
+
+    switch (event) {
+        case SENSOR_IO_INTERRUPT_BEGAN:
+        case SENSOR_IO_ROUTE_REMOVED:
+            break;
+
+        case SENSOR_IO_INTERRUPT_ENDED:
+            if (state->resume) {
+                start_collecting(state);
+                running = true;
+            }
+            break;
+
+        case SENSOR_IO_ROUTE_ADDED:
+            start_collecting(state);
+            running = true;
+            break;
+    }
+
+    if (state->verbose)
+        printf("%9.3f s  %s%s\n", atSeconds, sensor_io_event_name(event), running ? ", collecting" : "");
+    return running;
+}
+
+static void on_callback(const SensorReplayCallback *callback, void *userData) {
+    ReplayState *state = userData;
+
+    for (; state->pending < state->numReadings; state->pending++) {
+        Reading *reading = &state->readings[state->pending];
+
+        reading->readySeconds = callback->endSeconds;
+        reading->readyFrame = callback->firstFrame + callback->numFrames;
+        if (state->verbose)
+            printf("%9.3f s  reading 0x%02x 0x%02x 0x%02x 0x%02x 0x%02x\n", reading->readySeconds,
+                   reading->bytes[0], reading->bytes[1], reading->bytes[2], reading->bytes[3], reading->bytes[4]);
+    }
+}
+
+
+static int read_truth(const char *path, TruthPacket *truth, int maxPackets) {
+    unsigned int b[5];
+    float humidity, temperature;
+    int n = 0, k;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) return -1;
+
+    while (n < maxPackets &&
+           fscanf(file, "%lld %lld %x %x %x %x %x %f %f", &truth[n].startSample, &truth[n].endSample,
+                  &b[0], &b[1], &b[2], &b[3], &b[4], &humidity, &temperature) == 9) {
+        for (k = 0; k < 5; k++) truth[n].bytes[k] = (uint8_t)b[k];
+        truth[n].matched = false;
+        n++;
+    }
+    fclose(file);
+    return n;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ *  Matches each reading to the latest unmatched packet with the same bytes
+ *  that had ended by then and prints the latency from its last sample.
+ */
+static void report_latency(const ReplayState *state, TruthPacket *truth, int numTruth, double rate) {
+    double *latency = malloc((state->numReadings + 1) * sizeof(double));
+    double sum = 0;
+    int numLatency = 0, spurious = 0, cursor = 0, r, t;
+
+    if (latency == NULL) return;
+
+    for (r = 0; r < state->numReadings; r++) {
+        const Reading *reading = &state->readings[r];
+        int found = -1;
+
+        if (reading->readySeconds < 0) continue;
+        while (cursor < numTruth && truth[cursor].endSample <= (long long)reading->readyFrame) cursor++;
+
+        for (t = cursor - 1; t >= 0; t--) {
+            if (truth[t].endSample < (long long)reading->readyFrame - (long long)(REPLAY_MATCH_SECONDS * rate)) break;
+            if (!truth[t].matched && memcmp(truth[t].bytes, reading->bytes, 5) == 0) {
+                found = t;
+                break;
+            }
+        }
+        if (found < 0) {
+            spurious++;
+            continue;
+        }
+
+        truth[found].matched = true;
+        latency[numLatency] = reading->readySeconds - truth[found].endSample / rate;
+        sum += latency[numLatency++];
+    }
+
+    printf("Packets sent %d, read %d (%.1f%%), spurious readings %d\n", numTruth, numLatency,
+           numTruth ? 100.0 * numLatency / numTruth : 0.0, spurious);
+    if (numLatency) {
+        qsort(latency, numLatency, sizeof(double), compare_doubles);
+        printf("Latency to reading: mean %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+               1e3 * sum / numLatency, 1e3 * latency[numLatency / 2],
+               1e3 * latency[(int)(0.99 * (numLatency - 1))], 1e3 * latency[numLatency - 1]);
+    }
+    free(latency);
+}
+
+
+/**
+ *  What collectSensorData would report for the last collection.
+ */
+static void print_reading_stats(const ReadingStats *stats) {
+    static const char *names[READING_QUANTITIES] = { "Humidity", "Temperature" };
+    ReadingStatsCounters counters;
+    int q;
+
+    reading_stats_snapshot(stats, &counters);
+    printf("Last collection: %llu readings, %llu rejected as outliers\n",
+           (unsigned long long)counters.count, (unsigned long long)counters.rejected);
+    if (counters.count == 0) return;
+
+    for (q = 0; q < READING_QUANTITIES; q++) {
+        const ReadingSummary *s = &counters.quantity[q];
+        printf("%s: mean %.2f, sd %.2f, min %.2f, p50 %.2f, max %.2f, moving average %.2f\n", names[q],
+               reading_stats_mean(&counters, q), sqrt(reading_stats_variance(&counters, q)), fixed_q16_to_float(s->min),
+               reading_stats_quantile(&counters, q, 0.5), fixed_q16_to_float(s->max), fixed_q16_to_float(s->ewma));
+    }
+}
+
+
+/**
+ *  Decompresses a whole compressed capture into reader, which owns the
+ *  frames rather than a mapping. Stops at a damaged block.
+ */
+static bool load_compressed(CaptureReader *reader, const char *path) {
+    CaptureCodecReader compressed;
+    int16_t *frames;
+    uint64_t frame = 0;
+    uint32_t block;
+    int n;
+
+    if (!capture_codec_reader_open(&compressed, path)) return false;
+    frames = malloc((size_t)(compressed.header.numFrames + compressed.blockFrames) * compressed.header.channels * sizeof(int16_t));
+    if (frames == NULL) {
+        capture_codec_reader_close(&compressed);
+        return false;
+    }
+
+    for (block = 0; block < compressed.numBlocks; block++) {
+        n = capture_codec_decode_block(&compressed, block, frames + frame * compressed.header.channels);
+        if (n < 0) {
+            fprintf(stderr, "WARNING load_compressed: block %u is damaged, replaying up to it\n", block);
+            break;
+        }
+        frame += n;
+    }
+
+    memset(reader, 0, sizeof(*reader));
+    reader->header = compressed.header;
+    reader->header.numFrames = frame;
+    reader->frames = frames;
+    capture_codec_reader_close(&compressed);
+    return true;
+}
+
+static bool parse_event(SensorReplayConfig *config, SensorReplayEventType type, const char *arg) {
+    double at, seconds;
+
+    if (sscanf(arg, "%lf:%lf", &at, &seconds) != 2 || at < 0 || seconds < 0) return false;
+    return sensor_replay_add_event(config, type, at, seconds);
+}
+
+int main(int argc, char **argv) {
+    static ReplayState state;
+    static TruthPacket truth[REPLAY_MAX_PACKETS];
+    SensorReplayConfig config;
+    SensorReplayResult result;
+    SensorReplayHooks hooks = { on_event, on_callback, &state };
+    CaptureReader reader;
+    bool compressed;
+    IoStatsCounters counters;
+    TraceLog trace;
+    TraceWriter traceWriter;
+    const char *truthPath = NULL;
+    const char *tracePath = NULL;
+    uint32_t traceMask = TRACE_DEFAULT_MASK;
+    int numTruth = 0;
+    int opt;
+    bool ok = true;
+
+    sensor_replay_default(&config);
+
+    while ((opt = getopt(argc, argv, "f:j:d:l:rS:i:u:Rt:vT:a")) != -1) {
+        switch (opt) {
+            case 'f':
+                config.framesPerCallback = (uint32_t)atoi(optarg);
+                break;
+            case 'j':
+                config.jitter = atof(optarg);
+                break;
+            case 'd':
+                config.deadline = atof(optarg);
+                break;
+            case 'l':
+                config.load = atof(optarg);
+                break;
+            case 'r':
+                config.realTime = true;
+                break;
+            case 'S':
+                config.seed = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                ok = ok && parse_event(&config, SENSOR_REPLAY_INTERRUPT, optarg);
+                break;
+            case 'u':
+                ok = ok && parse_event(&config, SENSOR_REPLAY_UNPLUG, optarg);
+                break;
+            case 'R':
+                state.resume = true;
+                break;
+            case 't':
+                truthPath = optarg;
+                break;
+            case 'v':
+                state.verbose = true;
+                break;
+            case 'T':
+                tracePath = optarg;
+                break;
+            case 'a':
+                traceMask = TRACE_ALL_MASK;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+    }
+
+    if (!ok || optind + 1 != argc || config.framesPerCallback == 0) {
+        fprintf(stderr, "Usage: %s [-f frames] [-j jitter] [-d deadline] [-l load] [-r] [-S seed]\n"
+                        "       [-i at:seconds]... [-u at:seconds]... [-R] [-t truth.txt] [-v]\n"
+                        "       [-T trace.gsft [-a]] capture.gsfc|capture.gsfz\n", argv[0]);
+        return 1;
+    }
+
+    compressed = capture_codec_read_header(argv[optind], &reader.header);
+    if (compressed ? !load_compressed(&reader, argv[optind]) : !capture_reader_open(&reader, argv[optind])) {
+        perror("ERROR main: failed to map the input file.\n");
+        return 1;
+    }
+    if (truthPath != NULL && (numTruth = read_truth(truthPath, truth, REPLAY_MAX_PACKETS)) < 0) {
+        perror("ERROR main: failed to open the truth file.\n");
+        return 1;
+    }
+
+    state.readings = malloc(REPLAY_MAX_PACKETS * sizeof(Reading));
+    if (state.readings == NULL || !sensor_io_init(&state.io, 0)) {
+        perror("ERROR main: failed to allocate the IO state.\n");
+        return 1;
+    }
+    if (tracePath != NULL) {
+        if (!trace_log_init(&trace, REPLAY_TRACE_CAPACITY, traceMask) ||
+            !trace_writer_start(&traceWriter, &trace, tracePath, MAN_LINE_SAMPLE_RATE)) {
+            perror("ERROR main: failed to open the trace file.\n");
+            return 1;
+        }
+        state.io.trace = &trace;
+    }
+    sensor_io_reset(&state.io, reader.header.sampleRate);
+    sensor_decoder_set_packet_callback(&state.io.decoder, on_packet, &state);
+
+    if (!sensor_replay_run(&config, &reader, &state.io, &hooks, &result)) {
+        perror("ERROR main: failed to replay the capture.\n");
+        return 1;
+    }
+    io_stats_snapshot(&state.io.stats, &counters);
+    io_stats_merge(&state.total, &counters);
+    if (tracePath != NULL) {
+        if (!trace_writer_stop(&traceWriter)) perror("ERROR main: failed to finish the trace file.\n");
+    }
+
+    double periodMs = 1e3 * config.framesPerCallback / reader.header.sampleRate;
+    printf("%s: %llu frames at %u Hz, %u frames per callback (%.2f ms)%s\n", argv[optind],
+           (unsigned long long)reader.header.numFrames, reader.header.sampleRate,
+           config.framesPerCallback, periodMs, config.realTime ? ", real time" : "");
+    printf("Callbacks %llu, deadline (%.0f%% of a period, %.0f%% jitter) missed %llu, buffers dropped %llu, idle %llu\n",
+           (unsigned long long)result.callbacks, 100 * config.deadline, 100 * config.jitter,
+           (unsigned long long)result.deadlineMisses, (unsigned long long)result.droppedBuffers,
+           (unsigned long long)result.idleBuffers);
+    if (result.callbacks)
+        printf("Callback time: mean %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us, min slack %.1f us\n",
+               state.total.durationSumNs / 1e3 / state.total.callbacks,
+               io_stats_percentile_ns(&state.total, 50) / 1e3, io_stats_percentile_ns(&state.total, 99) / 1e3,
+               state.total.durationMaxNs / 1e3, result.minSlackNs / 1e3);
+    printf("Readings %d, bad packets %d, collections %d\n", state.numReadings, state.badPackets, state.restarts + 1);
+    if (tracePath != NULL)
+        printf("Trace %s: %llu records, %u dropped\n", tracePath,
+               (unsigned long long)traceWriter.written, traceWriter.header.dropped);
+    print_reading_stats(&state.io.decoder.readingStats);
+
+    if (truthPath != NULL)
+        report_latency(&state, truth, numTruth, reader.header.sampleRate);
+
+    if (compressed) free((void *)reader.frames);
+    else capture_reader_close(&reader);
+    sensor_io_free(&state.io);
+    if (tracePath != NULL) trace_log_free(&trace);
+    free(state.readings);
+    return 0;
+}
@@ -0,0 +1,223 @@
+/* *********************************************************************
+ * File: signal_gen.c
+ * Author: Michael Bennett
+ * Purpose: Synthetic ChipCap2 packet captures. Time runs in fractional
+ *          samples so clock offset and drift stretch half periods by
+ *          less than a sample, like a real RC clock would.
+ * ********************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "signal_gen.h"
+#include "sensor_decoder.h"
+#include "sensor_frame.h"
+
+#define MAX_BURST_READINGS  15      // Frame IDs are a nibble
+
+typedef struct {
+    const SignalGenConfig *config;
+    int16_t *samples;
+    long long length;
+    long long capacity;
+    double t;                       // Time of the end of the last symbol, in samples
+    uint32_t rng;
+    long long dropoutLeft;
+} SignalGenState;
+
+static uint32_t gen_random(SignalGenState *gen) {
+    // xorshift32, the same stream on every platform
+    gen->rng ^= gen->rng << 13;
+    gen->rng ^= gen->rng >> 17;
+    gen->rng ^= gen->rng << 5;
+    return gen->rng;
+}
+
+static double gen_uniform(SignalGenState *gen) {
+    return (gen_random(gen) >> 8) * (1.0 / (1 << 24));
+}
+
+static double gen_gauss(SignalGenState *gen) {
+    double u = gen_uniform(gen) + 1.0 / (1 << 25);
+    double v = gen_uniform(gen);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static int gen_push(SignalGenState *gen, int high) {
+    const SignalGenConfig *config = gen->config;
+    double v;
+
+    if (gen->length == gen->capacity) {
+        long long capacity = gen->capacity ? gen->capacity * 2 : 1 << 20;
+        int16_t *samples = realloc(gen->samples, capacity * sizeof(int16_t));
+        if (samples == NULL) return -1;
+        gen->samples = samples;
+        gen->capacity = capacity;
+    }
+
+    v = config->dcOffset;
+    if (high) v += (long long)(gen->length * 2 * config->toneFreq / config->sampleRate) % 2 ? -config->amplitude : config->amplitude;
+    if (config->noise > 0) v += config->noise * gen_gauss(gen);
+
+    // Dropouts start at random and blank the line, whatever it carries
+    if (gen->dropoutLeft == 0 && config->dropoutRate > 0 &&
+        gen_uniform(gen) < config->dropoutRate / config->sampleRate)
+        gen->dropoutLeft = config->dropoutSamples;
+    if (gen->dropoutLeft > 0) {
+        gen->dropoutLeft--;
+        v = 0;
+    }
+
+    if (v > INT16_MAX) v = INT16_MAX;
+    if (v < INT16_MIN) v = INT16_MIN;
+    gen->samples[gen->length++] = (int16_t)lrint(v);
+
+    return 0;
+}
+
+static int gen_symbol(SignalGenState *gen, int high, double duration) {
+    gen->t += duration;
+    while (gen->length < (long long)gen->t) {
+        if (gen_push(gen, high) != 0) return -1;
+    }
+    return 0;
+}
+
+static double gen_half_period(const SignalGenState *gen) {
+    const SignalGenConfig *config = gen->config;
+    double offset = config->clockOffset + config->clockDrift * gen->t / config->sampleRate;
+
+    return config->sampleRate / (2 * config->bitRate) * (1 + offset);
+}
+
+
+void signal_gen_default(SignalGenConfig *config) {
+    memset(config, 0, sizeof(*config));
+
+    config->sampleRate = 44100;
+    config->bitRate = 44100.0 / (2 * HALF_PERIOD_TC);
+    config->toneFreq = 44100.0 / 8;
+    config->amplitude = 8000;
+    config->gapSamples = 4000;
+    config->gapJitter = 2000;
+    config->seed = 1;
+}
+
+
+void signal_gen_set_snr(SignalGenConfig *config, double snrDb) {
+    // A square wave's power is its peak squared
+    config->noise = config->amplitude / pow(10, snrDb / 20);
+}
+
+
+int signal_gen_high_min_avg(const SignalGenConfig *config) {
+    // Mean |x| of Gaussian noise is sqrt(2 / pi) of its deviation
+    double idle = fabs(config->dcOffset) + config->noise * sqrt(2 / M_PI);
+    return (int)((config->amplitude + idle) / 2);
+}
+
+
+static void gen_reading(SignalGenState *gen, SignalGenPacket *packet) {
+    uint8_t *bytes = packet->bytes;
+
+    // Status bits and the unused low temperature bits are 0, like the sensor sends them
+    bytes[1] = gen_random(gen) & 0x3f;
+    bytes[2] = gen_random(gen) & 0xff;
+    bytes[3] = gen_random(gen) & 0xff;
+    bytes[4] = gen_random(gen) & 0xfc;
+    bytes[0] = (uint8_t)chipcap_checksum(bytes, CHIPCAP_PACKET_BYTES);
+    chipcap_convert(bytes, &packet->humidity, &packet->temperature);
+}
+
+static int gen_byte(SignalGenState *gen, uint8_t byte) {
+    int k;
+
+    for (k = 0; k < 8; k++) {
+        int bit = (byte >> k) & 1;
+        if (gen->config->bitErrorRate > 0 && gen_uniform(gen) < gen->config->bitErrorRate) bit = !bit;
+        if (gen_symbol(gen, !bit, gen_half_period(gen)) != 0) return -1;
+        if (gen_symbol(gen, bit, gen_half_period(gen)) != 0) return -1;
+    }
+    return 0;
+}
+
+
+long long signal_gen_render(const SignalGenConfig *config, int numPackets,
+                            int16_t **samples, SignalGenPacket *packets) {
+    uint8_t burst[SENSOR_FRAME_HEADER + MAX_BURST_READINGS * (CHIPCAP_PACKET_BYTES - 1 + SENSOR_FRAME_CODED_OVERHEAD)];
+    bool framed = config->framedSensors > 0;
+    int perBurst = !framed ? 1 : config->framedSensors < MAX_BURST_READINGS ? config->framedSensors : MAX_BURST_READINGS;
+    SignalGenState gen;
+    int p, b, q;
+
+    memset(&gen, 0, sizeof(gen));
+    gen.config = config;
+    gen.rng = config->seed ? config->seed : 1;
+
+    for (p = 0; p < numPackets; p += perBurst) {
+        int inBurst = numPackets - p < perBurst ? numPackets - p : perBurst;
+        double gap = config->gapSamples + (config->gapJitter > 0 ? gen_random(&gen) % (config->gapJitter + 1) : 0);
+        int numBytes = sensor_frame_begin(burst, (int)sizeof(burst), p / perBurst, config->codedBursts);
+
+        for (q = 0; q < inBurst; q++) {
+            gen_reading(&gen, &packets[p + q]);
+            packets[p + q].sensor = framed ? q : 0;
+            numBytes = sensor_frame_append(burst, numBytes, (int)sizeof(burst), SENSOR_FRAME_CHIPCAP2, q,
+                                           packets[p + q].bytes + 1, CHIPCAP_PACKET_BYTES - 1);
+        }
+
+        if (gen_symbol(&gen, 0, gap) != 0) goto fail;
+        long long start = gen.length;
+
+        // A packet goes out last byte first, a burst first byte first
+        if (gen_symbol(&gen, 1, gen_half_period(&gen)) != 0) goto fail;
+        for (b = 0; b < (framed ? numBytes : CHIPCAP_PACKET_BYTES); b++) {
+            if (gen_byte(&gen, framed ? burst[b] : packets[p].bytes[CHIPCAP_PACKET_BYTES - 1 - b]) != 0) goto fail;
+        }
+
+        for (q = 0; q < inBurst; q++) {
+            packets[p + q].startSample = start;
+            packets[p + q].endSample = gen.length - 1;
+        }
+    }
+
+    // Idle tail long enough for any decoder to see the end of the last packet
+    if (gen_symbol(&gen, 0, config->gapSamples) != 0) goto fail;
+
+    *samples = gen.samples;
+    return gen.length;
+
+fail:
+    free(gen.samples);
+    *samples = NULL;
+    return -1;
+}
+
+
+long long signal_gen_render_bytes(const SignalGenConfig *config, const uint8_t *bytes, int numBytes,
+                                  int16_t **samples, long long *start) {
+    SignalGenState gen;
+    int b;
+
+    memset(&gen, 0, sizeof(gen));
+    gen.config = config;
+    gen.rng = config->seed ? config->seed : 1;
+
+    double gap = config->gapSamples + (config->gapJitter > 0 ? gen_random(&gen) % (config->gapJitter + 1) : 0);
+    if (gen_symbol(&gen, 0, gap) != 0) goto fail;
+    *start = gen.length;
+
+    if (gen_symbol(&gen, 1, gen_half_period(&gen)) != 0) goto fail;
+    for (b = 0; b < numBytes; b++) {
+        if (gen_byte(&gen, bytes[b]) != 0) goto fail;
+    }
+    if (gen_symbol(&gen, 0, config->gapSamples) != 0) goto fail;
+
+    *samples = gen.samples;
+    return gen.length;
+
+fail:
+    free(gen.samples);
+    *samples = NULL;
+    return -1;
+}
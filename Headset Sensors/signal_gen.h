@@ -0,0 +1,73 @@
+/* *********************************************************************
+ * File: signal_gen.h
+ * Author: Michael Bennett
+ * Purpose: Synthetic headset mic captures of ChipCap2 packets for tests
+ *          and benchmarks. Packets are sent the way the sensor board
+ *          sends them (start half period, bytes last to first, LSB
+ *          first, a 1 as LOW-HIGH) and the line can be made as bad as
+ *          needed: level, DC offset, noise, sensor clock error and
+ *          drift, dropouts and bits sent wrong. Every packet's truth is
+ *          returned with it.
+ * ********************************************************************/
+#ifndef SIGNAL_GEN_H
+#define SIGNAL_GEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chipcap.h"
+
+typedef struct {
+    double sampleRate;              // Hz, as the hardware would sample the line
+    double bitRate;                 // Bits per second at the nominal sensor clock
+    double toneFreq;                // Hz of the HIGH square wave
+    double amplitude;               // Peak of the HIGH square wave
+    double dcOffset;
+    double noise;                   // Standard deviation of the added Gaussian noise
+    double clockOffset;             // Sensor clock error, 0.05 makes every half period 5% longer
+    double clockDrift;              // Change in clockOffset per second
+    double dropoutRate;             // Dropouts per second, each zeroes dropoutSamples samples
+    int dropoutSamples;
+    int gapSamples;                 // Idle line before each packet
+    int gapJitter;                  // plus up to this many samples more
+    int framedSensors;              // 0 sends ChipCap2 packets, N sends each N readings as one burst of frames
+    bool codedBursts;               // with FEC parity on every frame
+    double bitErrorRate;            // Chance each bit goes out inverted, whatever the noise
+    uint32_t seed;
+} SignalGenConfig;
+
+typedef struct {
+    long long startSample;          // First sample of the start half period
+    long long endSample;            // Last sample of the last bit
+    uint8_t bytes[CHIPCAP_PACKET_BYTES];    // In decoded order, check sum first
+    float humidity;
+    float temperature;
+    int sensor;                     // Frame ID, readings of one burst are numbered from 0
+} SignalGenPacket;
+
+// The sensor board as designed: 44.1 kHz, HALF_PERIOD_TC half periods, a
+// square wave toggling every 4 samples, a quiet line. Gaps and dropouts
+// are in samples, so keep them as they are when changing sampleRate
+void signal_gen_default(SignalGenConfig *config);
+
+// Sets noise for the given SNR in dB, HIGH square wave power over noise power
+void signal_gen_set_snr(SignalGenConfig *config, double snrDb);
+
+// man_decoder cutoff for the line: halfway between the window average of
+// the idle line and of a HIGH half period
+int signal_gen_high_min_avg(const SignalGenConfig *config);
+
+// Renders numPackets packets, each after its gap, into a malloc'd buffer.
+// Fills packets[0..numPackets) and returns the sample count, or -1. With
+// framedSensors set, packets are readings and every reading in a burst
+// shares its start and end
+long long signal_gen_render(const SignalGenConfig *config, int numPackets,
+                            int16_t **samples, SignalGenPacket *packets);
+
+// Renders one transmission of numBytes bytes, first byte first, after its gap
+// into a malloc'd buffer, for tools that build their own bursts. Returns the
+// sample count, or -1, and the first sample of the start half period in start
+long long signal_gen_render_bytes(const SignalGenConfig *config, const uint8_t *bytes, int numBytes,
+                                  int16_t **samples, long long *start);
+
+#endif
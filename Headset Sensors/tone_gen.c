@@ -0,0 +1,120 @@
+/* *********************************************************************
+ * File: tone_gen.c
+ * Author: Michael Bennett
+ * Purpose: Rotator based sine tone generator. Each buffer restarts the
+ *          rotator from the exact phase, so rounding in the rotator can
+ *          not build up from one buffer to the next.
+ * ********************************************************************/
+#include <math.h>
+#include <stdlib.h>
+
+#include "tone_gen.h"
+
+#define SFDR_MAIN_LOBE_BINS     4       // Blackman-Harris main lobe half width
+
+void tone_gen_init(ToneGen *tone, double frequency, double sampleRate, float amplitude) {
+    tone->phase = 0.0;
+    tone->amplitude = amplitude;
+    tone_gen_set_frequency(tone, frequency, sampleRate);
+}
+
+
+void tone_gen_set_frequency(ToneGen *tone, double frequency, double sampleRate) {
+    tone->frequency = frequency;
+    tone->sampleRate = sampleRate;
+    tone->phaseInc = sampleRate > 0 ? 2 * M_PI * frequency / sampleRate : 0.0;
+    tone->stepRe = cos(tone->phaseInc);
+    tone->stepIm = sin(tone->phaseInc);
+}
+
+
+void tone_gen_set_amplitude(ToneGen *tone, float amplitude) {
+    tone->amplitude = amplitude;
+}
+
+
+static void tone_gen_advance(ToneGen *tone, uint32_t numFrames) {
+    tone->phase = fmod(tone->phase + tone->phaseInc * numFrames, 2 * M_PI);
+    if (tone->phase < 0) tone->phase += 2 * M_PI;
+}
+
+
+void tone_gen_render_s16(ToneGen *tone, int16_t *out, uint32_t numFrames, uint32_t stride) {
+    double re = cos(tone->phase);
+    double im = sin(tone->phase);
+    double amp = tone->amplitude;
+    uint32_t k;
+
+    if (tone->amplitude == 0.0f) {
+        tone_gen_render_silent(tone, out, numFrames, stride);
+        return;
+    }
+
+    for (k = 0; k < numFrames; k++) {
+        double next = re * tone->stepRe - im * tone->stepIm;
+        double v = im * amp;
+
+        out[(size_t)k * stride] = (int16_t)(v >= 0 ? v + 0.5 : v - 0.5);
+
+        im = re * tone->stepIm + im * tone->stepRe;
+        re = next;
+    }
+
+    tone_gen_advance(tone, numFrames);
+}
+
+
+void tone_gen_render_silent(ToneGen *tone, int16_t *out, uint32_t numFrames, uint32_t stride) {
+    uint32_t k;
+
+    for (k = 0; k < numFrames; k++) {
+        out[(size_t)k * stride] = 0;
+    }
+
+    tone_gen_advance(tone, numFrames);
+}
+
+
+double tone_sfdr_db(const int16_t *samples, uint32_t numSamples, uint32_t stride,
+                    double sampleRate, double frequency) {
+    double *x = malloc(numSamples * sizeof(double));
+    double toneMag = 0, spurMag = 0;
+    uint32_t toneBin, n, k;
+
+    if (x == NULL || numSamples < 16) {
+        free(x);
+        return 0.0;
+    }
+
+    // 4 term Blackman-Harris, sidelobes below -92 dB
+    for (n = 0; n < numSamples; n++) {
+        double a = 2 * M_PI * n / (numSamples - 1);
+        double w = 0.35875 - 0.48829 * cos(a) + 0.14128 * cos(2 * a) - 0.01168 * cos(3 * a);
+        x[n] = samples[(size_t)n * stride] * w;
+    }
+
+    toneBin = (uint32_t)(frequency * numSamples / sampleRate + 0.5);
+
+    // Goertzel for every bin up to Nyquist, skipping DC
+    for (k = 1; k <= numSamples / 2; k++) {
+        double coeff = 2 * cos(2 * M_PI * k / numSamples);
+        double s1 = 0, s2 = 0, mag;
+
+        for (n = 0; n < numSamples; n++) {
+            double s0 = x[n] + coeff * s1 - s2;
+            s2 = s1;
+            s1 = s0;
+        }
+        mag = s1 * s1 + s2 * s2 - coeff * s1 * s2;
+
+        if (k + SFDR_MAIN_LOBE_BINS >= toneBin && k <= toneBin + SFDR_MAIN_LOBE_BINS) {
+            if (mag > toneMag) toneMag = mag;
+        } else if (mag > spurMag) {
+            spurMag = mag;
+        }
+    }
+    free(x);
+
+    if (spurMag <= 0) spurMag = 1e-30;
+    return 10 * log10(toneMag / spurMag);
+}
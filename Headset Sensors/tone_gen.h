@@ -0,0 +1,42 @@
+/* *********************************************************************
+ * File: tone_gen.h
+ * Author: Michael Bennett
+ * Purpose: Sine tone generator for the power and command channels.
+ *          Phase is kept exactly and wrapped once per buffer; samples
+ *          inside a buffer come from a complex rotator, so rendering
+ *          costs a few multiplies per sample and no libm calls.
+ * ********************************************************************/
+#ifndef TONE_GEN_H
+#define TONE_GEN_H
+
+#include <stdint.h>
+
+typedef struct {
+    double frequency;               // Hz
+    double sampleRate;              // Hz
+    float amplitude;                // Peak, in int16 units
+    double phase;                   // Phase of the next sample, always in [0, 2*pi)
+    double phaseInc;                // Radians per sample
+    double stepRe;                  // cos(phaseInc)
+    double stepIm;                  // sin(phaseInc)
+} ToneGen;
+
+void tone_gen_init(ToneGen *tone, double frequency, double sampleRate, float amplitude);
+
+// Changes pitch without a phase jump
+void tone_gen_set_frequency(ToneGen *tone, double frequency, double sampleRate);
+void tone_gen_set_amplitude(ToneGen *tone, float amplitude);
+
+// Writes numFrames samples to every stride'th entry of out
+void tone_gen_render_s16(ToneGen *tone, int16_t *out, uint32_t numFrames, uint32_t stride);
+
+// Writes silence but advances the phase as if the tone had played
+void tone_gen_render_silent(ToneGen *tone, int16_t *out, uint32_t numFrames, uint32_t stride);
+
+// Spurious free dynamic range of a tone at frequency in dB: the tone's
+// bin over the largest other bin of a Blackman-Harris windowed DFT. Not
+// real-time safe, for tests and benchmarks
+double tone_sfdr_db(const int16_t *samples, uint32_t numSamples, uint32_t stride,
+                    double sampleRate, double frequency);
+
+#endif
@@ -0,0 +1,165 @@
+/* *********************************************************************
+ * File: trace_dump.c
+ * Author: Michael Bennett
+ * Purpose: Print a trace written by the app or sensor_replay -T, one
+ *          line per record, timed from the decoder's sample count, the
+ *          way the decoder's DEBUG prints used to read.
+ * Build:   cc -O2 -pthread -o trace_dump trace_dump.c trace_log.c
+ * Usage:   trace_dump [-s] trace.gsft
+ *          -s prints only how many records of each type there were.
+ * ********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace_log.h"
+#include "sensor_decoder.h"
+#include "sensor_frame.h"
+#include "link_rate.h"
+
+static void print_bits(const TraceRecord *record) {
+    int b;
+
+    printf("bits %u-%u: ", record->arg, record->arg + record->value - 1);
+    for (b = 0; b < (int)record->value && b < 64; b++) {
+        printf("%d", (record->data[b >> 3] >> (b & 7)) & 1);
+        if (b % 8 == 7) printf(" ");
+    }
+}
+
+static void print_frame(const TraceRecord *record) {
+    static const char *status[] = { "end", "good", "bad CRC" };
+    int corrected = record->value & 0xff;
+
+    printf("frame %u of burst %u: sensor type %d ID %d, %d bytes, %s", (record->value >> 8) & 0xff,
+           record->value >> 16, record->data[0] >> 4, record->data[0] & 0xf, record->data[1],
+           record->arg == SENSOR_FRAME_GOOD && corrected ? "corrected" : record->arg <= SENSOR_FRAME_BAD ? status[record->arg] : "?");
+}
+
+static void print_message(const TraceRecord *record) {
+    int message = (int)record->value;
+
+    if (message & LINK_MSG_NAK)
+        printf("message 0x%02x, NAK burst %d frame %d", message, LINK_NAK_SEQUENCE(message), LINK_NAK_FRAME(message));
+    else
+        printf("message 0x%02x, rate %d", message, message);
+    if (!record->arg) printf(", dropped with the queue full");
+}
+
+// Version 1 traces hold the levels and grid as float and double
+static double record_level(const TraceRecord *record, int version, int fractionBits) {
+    float f;
+    int32_t q;
+
+    if (version < 2) {
+        memcpy(&f, record->data, sizeof(f));
+        return f;
+    }
+    memcpy(&q, record->data, sizeof(q));
+    return (double)q / (1 << fractionBits);
+}
+
+static void print_record(const TraceRecord *record, double sampleRate, int version) {
+    double d;
+    int64_t q;
+    int i;
+
+    printf("%12.6f s  ", sampleRate ? record->sample / sampleRate : 0.0);
+    switch ((TraceType)record->type) {
+        case TRACE_START:
+            printf("start, envelope %u, noise floor %.0f", record->value, record_level(record, version, SENSOR_LEVEL_SHIFT));
+            break;
+        case TRACE_END:
+            printf("end, %u bits, half period %.2f", record->value, record_level(record, version, FIXED_Q16_SHIFT));
+            break;
+        case TRACE_HALF:
+            if (version < 2) {
+                memcpy(&d, record->data, sizeof(d));
+            } else {
+                memcpy(&q, record->data, sizeof(q));
+                d = (double)q / FIXED_Q16_ONE;
+            }
+            printf("half period from %.0f: %u of %u HIGH", d, record->arg, record->value);
+            break;
+        case TRACE_BITS:
+            print_bits(record);
+            break;
+        case TRACE_PACKET:
+            printf("packet");
+            for (i = 0; i < 5; i++) printf(" 0x%02x", record->data[i]);
+            printf(", check sum 0x%02x, %s", record->value, record->arg ? "good" : "bad CRC");
+            break;
+        case TRACE_FRAME:
+            print_frame(record);
+            break;
+        case TRACE_RETRY:
+            printf("retry, request tone off for %u frames", record->value);
+            break;
+        case TRACE_MESSAGE:
+            print_message(record);
+            break;
+        default:
+            printf("unknown type %u", record->type);
+            break;
+    }
+    printf("\n");
+}
+
+
+int main(int argc, char **argv) {
+    TraceHeader header;
+    TraceRecord record;
+    unsigned long long counts[TRACE_TYPES + 1] = { 0 };
+    unsigned long long total = 0, lastSample = 0;
+    bool summary = false;
+    int opt, t;
+
+    while ((opt = getopt(argc, argv, "s")) != -1) {
+        switch (opt) {
+            case 's':
+                summary = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s] trace.gsft\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind + 1 != argc) {
+        fprintf(stderr, "Usage: %s [-s] trace.gsft\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[optind], "rb");
+    if (file == NULL) {
+        perror("ERROR main: failed to open the trace file.\n");
+        return 1;
+    }
+    if (!trace_read_header(file, &header)) {
+        fprintf(stderr, "ERROR main: %s is not a trace.\n", argv[optind]);
+        fclose(file);
+        return 1;
+    }
+
+    time_t start = (time_t)header.startTime;
+    printf("%s: version %u, %u Hz, started %s", argv[optind], header.version, header.sampleRate, ctime(&start));
+
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        counts[record.type < TRACE_TYPES ? record.type : TRACE_TYPES]++;
+        lastSample = record.sample;
+        total++;
+        if (!summary) print_record(&record, header.sampleRate, header.version);
+    }
+    fclose(file);
+
+    if (summary) {
+        for (t = TRACE_START; t <= TRACE_TYPES; t++) {
+            if (counts[t]) printf("%-8s %llu\n", trace_type_name((TraceType)t), counts[t]);
+        }
+        printf("%llu records over %.3f s\n", total, header.sampleRate ? lastSample / (double)header.sampleRate : 0.0);
+    }
+    if (header.dropped) printf("%u records dropped while tracing\n", header.dropped);
+
+    return 0;
+}
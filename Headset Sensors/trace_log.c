@@ -0,0 +1,267 @@
+/* *********************************************************************
+ * File: trace_log.c
+ * Author: Michael Bennett
+ * Purpose: Trace ring, its drain thread and the file header. head and
+ *          tail are free running counters as in sample_ring. The header
+ *          is packed byte by byte like a capture's; records are written
+ *          as they are in memory, which is little endian on every target
+ *          we build for.
+ * ********************************************************************/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "trace_log.h"
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #error "trace records are stored as little endian"
+#endif
+
+_Static_assert(sizeof(TraceRecord) == 24, "trace records are read back by their size in the header");
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, (uint16_t)v);
+    put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    put_u32(p, (uint32_t)v);
+    put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static void pack_header(const TraceHeader *header, uint8_t *bytes) {
+    memset(bytes, 0, TRACE_HEADER_BYTES);
+    memcpy(bytes, TRACE_MAGIC, 4);
+    put_u16(bytes + 4, TRACE_VERSION);
+    put_u16(bytes + 6, TRACE_HEADER_BYTES);
+    put_u16(bytes + 8, sizeof(TraceRecord));
+    put_u32(bytes + 12, header->sampleRate);
+    put_u64(bytes + 16, (uint64_t)header->startTime);
+    put_u32(bytes + 24, header->dropped);
+    put_u32(bytes + 28, header->enabled);
+}
+
+
+bool trace_log_init(TraceLog *log, uint32_t capacity, uint32_t enabled) {
+    uint32_t size = 1;
+
+    memset(log, 0, sizeof(*log));
+    while (size < capacity) size <<= 1;
+
+    log->records = calloc(size, sizeof(TraceRecord));
+    if (log->records == NULL) return false;
+
+    log->capacity = size;
+    log->mask = size - 1;
+    log->enabled = enabled;
+    return true;
+}
+
+
+void trace_log_free(TraceLog *log) {
+    free(log->records);
+    memset(log, 0, sizeof(*log));
+}
+
+
+void trace_log_reset(TraceLog *log) {
+    log->head = 0;
+    log->tail = 0;
+    log->dropped = 0;
+}
+
+
+bool trace_log_write(TraceLog *log, TraceType type, uint64_t sample, uint16_t arg, uint32_t value,
+                     const void *data, int numBytes) {
+    uint32_t head = log->head;
+    TraceRecord *record;
+
+    if (!(log->enabled & TRACE_MASK(type))) return true;
+
+    if (head - __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE) == log->capacity) {
+        log->dropped++;
+        return false;
+    }
+
+    record = &log->records[head & log->mask];
+    record->sample = sample;
+    record->type = (uint16_t)type;
+    record->arg = arg;
+    record->value = value;
+    if (numBytes > (int)sizeof(record->data)) numBytes = sizeof(record->data);
+    if (numBytes < 0) numBytes = 0;
+    if (numBytes > 0) memcpy(record->data, data, numBytes);
+    memset(record->data + numBytes, 0, sizeof(record->data) - numBytes);
+
+    __atomic_store_n(&log->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+
+uint32_t trace_log_read(TraceLog *log, TraceRecord *records, uint32_t count) {
+    uint32_t tail = log->tail;
+    uint32_t head = __atomic_load_n(&log->head, __ATOMIC_ACQUIRE);
+    uint32_t avail = head - tail;
+    uint32_t n = count < avail ? count : avail;
+    uint32_t start = tail & log->mask;
+    uint32_t first = log->capacity - start;
+
+    if (first > n) first = n;
+    memcpy(records, log->records + start, first * sizeof(TraceRecord));
+    memcpy(records + first, log->records, (n - first) * sizeof(TraceRecord));
+
+    __atomic_store_n(&log->tail, tail + n, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+
+static void trace_writer_drain(TraceWriter *writer) {
+    TraceRecord chunk[TRACE_CHUNK];
+    uint32_t n;
+
+    while ((n = trace_log_read(writer->log, chunk, TRACE_CHUNK)) > 0) {
+        writer->written += fwrite(chunk, sizeof(TraceRecord), n, writer->file);
+    }
+}
+
+/**
+ *  Drains every TRACE_DRAIN_MS until stopped. The render thread never
+ *  signals, so the wait is only cut short by trace_writer_stop.
+ */
+static void *trace_writer_run(void *arg) {
+    TraceWriter *writer = arg;
+    struct timespec until;
+    struct timeval now;
+
+    pthread_mutex_lock(&writer->lock);
+    while (writer->running) {
+        gettimeofday(&now, NULL);
+        long long ns = now.tv_usec * 1000LL + TRACE_DRAIN_MS * 1000000LL;
+        until.tv_sec = now.tv_sec + ns / 1000000000LL;
+        until.tv_nsec = ns % 1000000000LL;
+        while (writer->running && pthread_cond_timedwait(&writer->wake, &writer->lock, &until) != ETIMEDOUT) {}
+
+        pthread_mutex_unlock(&writer->lock);
+        trace_writer_drain(writer);
+        fflush(writer->file);
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+
+bool trace_writer_start(TraceWriter *writer, TraceLog *log, const char *path, uint32_t sampleRate) {
+    uint8_t bytes[TRACE_HEADER_BYTES];
+
+    memset(writer, 0, sizeof(*writer));
+    writer->log = log;
+    writer->header.version = TRACE_VERSION;
+    writer->header.sampleRate = sampleRate;
+    writer->header.startTime = (int64_t)time(NULL);
+    writer->header.enabled = log->enabled;
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == NULL) return false;
+
+    // dropped stays 0 until stop, a trace that was never closed is read to its last whole record
+    pack_header(&writer->header, bytes);
+    if (fwrite(bytes, 1, sizeof(bytes), writer->file) != sizeof(bytes)) goto fail;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->wake, NULL);
+    writer->running = true;
+    if (pthread_create(&writer->thread, NULL, trace_writer_run, writer) != 0) {
+        pthread_cond_destroy(&writer->wake);
+        pthread_mutex_destroy(&writer->lock);
+        goto fail;
+    }
+    return true;
+
+fail:
+    fclose(writer->file);
+    writer->file = NULL;
+    return false;
+}
+
+
+bool trace_writer_stop(TraceWriter *writer) {
+    uint8_t bytes[TRACE_HEADER_BYTES];
+    bool ok;
+
+    if (writer->file == NULL) return false;
+
+    pthread_mutex_lock(&writer->lock);
+    writer->running = false;
+    pthread_cond_signal(&writer->wake);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    pthread_cond_destroy(&writer->wake);
+    pthread_mutex_destroy(&writer->lock);
+
+    // The producer may still be running, anything it writes now stays in the ring
+    trace_writer_drain(writer);
+    writer->header.dropped = __atomic_load_n(&writer->log->dropped, __ATOMIC_RELAXED);
+    pack_header(&writer->header, bytes);
+    ok = fseek(writer->file, 0, SEEK_SET) == 0 &&
+         fwrite(bytes, 1, sizeof(bytes), writer->file) == sizeof(bytes);
+    ok = (fclose(writer->file) == 0) && ok;
+    writer->file = NULL;
+
+    return ok;
+}
+
+
+bool trace_read_header(FILE *file, TraceHeader *header) {
+    uint8_t bytes[TRACE_HEADER_BYTES];
+    uint16_t headerBytes;
+
+    if (fread(bytes, 1, sizeof(bytes), file) != sizeof(bytes) || memcmp(bytes, TRACE_MAGIC, 4) != 0) return false;
+
+    header->version = get_u16(bytes + 4);
+    headerBytes = get_u16(bytes + 6);
+    if (get_u16(bytes + 8) != sizeof(TraceRecord) || headerBytes < TRACE_HEADER_BYTES) return false;
+    header->sampleRate = get_u32(bytes + 12);
+    header->startTime = (int64_t)get_u64(bytes + 16);
+    header->dropped = get_u32(bytes + 24);
+    header->enabled = get_u32(bytes + 28);
+
+    return fseek(file, headerBytes, SEEK_SET) == 0;
+}
+
+
+const char *trace_type_name(TraceType type) {
+    switch (type) {
+        case TRACE_START:   return "start";
+        case TRACE_END:     return "end";
+        case TRACE_HALF:    return "half";
+        case TRACE_BITS:    return "bits";
+        case TRACE_PACKET:  return "packet";
+        case TRACE_FRAME:   return "frame";
+        case TRACE_RETRY:   return "retry";
+        case TRACE_MESSAGE: return "message";
+        case TRACE_TYPES:   break;
+    }
+    return "unknown";
+}
@@ -0,0 +1,117 @@
+/* *********************************************************************
+ * File: trace_log.h
+ * Author: Michael Bennett
+ * Purpose: Binary trace of what the decoder and the IO callback decide,
+ *          cheap enough to leave on. The render thread writes fixed size
+ *          records into a lock free single-producer/single-consumer ring,
+ *          like SampleRing, and a background thread drains them to a
+ *          file for trace_dump to print. A full ring drops records and
+ *          counts them, writing one never locks, allocates or formats.
+ *
+ *          File layout, all fields little endian: a 32 byte header
+ *            0  magic "GSFT"        12  u32 sampleRate
+ *            4  u16 version         16  i64 startTime, Unix seconds
+ *            6  u16 headerBytes     24  u32 dropped (0 until closed)
+ *            8  u16 recordBytes     28  u32 enabled, TRACE_MASK bits
+ *           10  u16 reserved
+ *          followed by TraceRecords in the order they were written.
+ * ********************************************************************/
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC             "GSFT"
+#define TRACE_VERSION           2       // 1 had float and double levels and boundaries
+#define TRACE_HEADER_BYTES      32
+#define TRACE_EXTENSION         ".gsft"
+#define TRACE_DRAIN_MS          100     // Background thread wakes this often
+#define TRACE_CHUNK             256     // Records moved to the file per ring read
+
+// What a record holds. arg, value and data are per type
+typedef enum {
+    TRACE_START = 1,                // Transmission started: value envelope, data i32 noise floor, 8 fraction bits
+    TRACE_END,                      // and ended: value bits, data i32 half period, Q16.16
+    TRACE_HALF,                     // Half period decided: arg HIGH samples, value samples, data i64 boundary, Q16.16
+    TRACE_BITS,                     // Up to 64 bits of a transmission: arg first bit, value bits, data packed LSB first
+    TRACE_PACKET,                   // ChipCap2 packet: arg good, value computed check sum, data bytes check sum first
+    TRACE_FRAME,                    // Frame of a burst: arg SensorFrameStatus, value sequence << 16 | index << 8 | corrected,
+                                    // data the frame from its header, first 8 bytes
+    TRACE_RETRY,                    // IO callback dropped the request tone for a cycle: value frames
+    TRACE_MESSAGE,                  // IO callback sent a command tone message: arg queued, value message
+    TRACE_TYPES
+} TraceType;
+
+#define TRACE_MASK(type)        (1u << (type))
+#define TRACE_DEFAULT_MASK      (TRACE_MASK(TRACE_START) | TRACE_MASK(TRACE_END) | TRACE_MASK(TRACE_PACKET) | \
+                                 TRACE_MASK(TRACE_FRAME) | TRACE_MASK(TRACE_RETRY) | TRACE_MASK(TRACE_MESSAGE))
+#define TRACE_ALL_MASK          (TRACE_MASK(TRACE_TYPES) - 2)   // Adds a record per half period and the raw bits
+
+typedef struct {
+    uint64_t sample;                // Decoder sample count when it was written, at the header's sampleRate
+    uint16_t type;
+    uint16_t arg;
+    uint32_t value;
+    uint8_t data[8];
+} TraceRecord;
+
+typedef struct {
+    TraceRecord *records;           // Storage, allocated once by trace_log_init
+    uint32_t capacity;              // Power of two
+    uint32_t mask;
+    uint32_t head;                  // Total records written, only changed by the producer
+    uint32_t tail;                  // Total records read, only changed by the consumer
+    uint32_t dropped;               // Records the producer could not fit, only changed by the producer
+    uint32_t enabled;               // TRACE_MASK bits of the types recorded, the rest cost a test
+} TraceLog;
+
+typedef struct {
+    uint16_t version;
+    uint32_t sampleRate;
+    int64_t startTime;
+    uint32_t dropped;
+    uint32_t enabled;
+} TraceHeader;
+
+// Drains a TraceLog to a file on its own thread
+typedef struct {
+    TraceLog *log;
+    FILE *file;
+    TraceHeader header;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool running;
+    uint64_t written;
+} TraceWriter;
+
+// Allocates storage rounded up to a power of two, recording the enabled types. Not real-time safe
+bool trace_log_init(TraceLog *log, uint32_t capacity, uint32_t enabled);
+void trace_log_free(TraceLog *log);
+
+// Empties the ring. Only call while neither side is running
+void trace_log_reset(TraceLog *log);
+
+// Producer: records one event if its type is enabled. numBytes of data are
+// copied, at most 8, the rest of data is zeroed. Returns false when dropped
+bool trace_log_write(TraceLog *log, TraceType type, uint64_t sample, uint16_t arg, uint32_t value,
+                     const void *data, int numBytes);
+
+// Consumer: copies up to count records out, returns how many were read
+uint32_t trace_log_read(TraceLog *log, TraceRecord *records, uint32_t count);
+
+// Opens path and starts draining log into it every TRACE_DRAIN_MS. Not real-time safe
+bool trace_writer_start(TraceWriter *writer, TraceLog *log, const char *path, uint32_t sampleRate);
+
+// Drains whatever is left, fills in the dropped count and closes the file
+bool trace_writer_stop(TraceWriter *writer);
+
+// Reads the header of an open trace, leaving file at the first record
+bool trace_read_header(FILE *file, TraceHeader *header);
+
+const char *trace_type_name(TraceType type);
+
+#endif
@@ -0,0 +1,183 @@
+/* *********************************************************************
+ * File: window_avg.c
+ * Author: Michael Bennett
+ * Purpose: Vectorized rectify-and-average over back to back windows.
+ *          Each window is covered by whole vector loads plus one load
+ *          that ends on the last sample of the window with the lanes
+ *          already counted masked off, so nothing is read outside the
+ *          window and odd sizes like SAMPLES_PER_CHECK (27) still
+ *          vectorize. The x86 paths sum |x| - 32768 with madd so that
+ *          abs(-32768) survives the signed multiply, and add the bias
+ *          back once per window. Averages divide by a reciprocal taken
+ *          once per call.
+ * ********************************************************************/
+#include <stdlib.h>
+
+#include "window_avg.h"
+#include "fixed_point.h"
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define WINDOW_AVG_AVX2
+    #define VECTOR_LANES    16
+#elif defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+    #define WINDOW_AVG_SSE2
+    #define VECTOR_LANES    8
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define WINDOW_AVG_NEON
+    #define VECTOR_LANES    8
+#endif
+
+#if defined(VECTOR_LANES)
+// Loading VECTOR_LANES entries from tailMask + 16 - VECTOR_LANES + r keeps the top r lanes
+static const int16_t tailMask[32] = {
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+#endif
+
+int window_avg_s16_scalar(const int16_t *samples, int numSamples, int windowSize, int32_t *avgs) {
+    FixedRecip recip = fixed_recip(windowSize);
+    int numWindows = numSamples / windowSize;
+    int w, j;
+
+    for (w = 0; w < numWindows; w++) {
+        const int16_t *p = samples + w * windowSize;
+        int nextSamples = 0;
+
+        for (j = 0; j < windowSize; j++) {
+            nextSamples += abs(p[j]);
+        }
+        avgs[w] = fixed_div(nextSamples, recip);
+    }
+
+    return numWindows;
+}
+
+
+#if defined(WINDOW_AVG_AVX2)
+
+static inline __m256i abs_bias(__m256i x) {
+    return _mm256_xor_si256(_mm256_abs_epi16(x), _mm256_set1_epi16((short)0x8000));
+}
+
+static inline int32_t window_sum(const int16_t *p, int full, int r, __m256i mask, int windowSize) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    int k;
+
+    for (k = 0; k < full; k++) {
+        __m256i v = abs_bias(_mm256_loadu_si256((const __m256i *)(p + k * VECTOR_LANES)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(v, ones));
+    }
+    if (r) {
+        __m256i v = abs_bias(_mm256_loadu_si256((const __m256i *)(p + windowSize - VECTOR_LANES)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_and_si256(v, mask), ones));
+    }
+
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(s) + 32768 * (full * VECTOR_LANES + r);
+}
+
+#elif defined(WINDOW_AVG_SSE2)
+
+static inline __m128i abs_bias(__m128i x) {
+    __m128i sign = _mm_srai_epi16(x, 15);
+    __m128i a = _mm_sub_epi16(_mm_xor_si128(x, sign), sign);
+    return _mm_xor_si128(a, _mm_set1_epi16((short)0x8000));
+}
+
+static inline int32_t window_sum(const int16_t *p, int full, int r, __m128i mask, int windowSize) {
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    int k;
+
+    for (k = 0; k < full; k++) {
+        __m128i v = abs_bias(_mm_loadu_si128((const __m128i *)(p + k * VECTOR_LANES)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(v, ones));
+    }
+    if (r) {
+        __m128i v = abs_bias(_mm_loadu_si128((const __m128i *)(p + windowSize - VECTOR_LANES)));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_and_si128(v, mask), ones));
+    }
+
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_cvtsi128_si32(acc) + 32768 * (full * VECTOR_LANES + r);
+}
+
+#elif defined(WINDOW_AVG_NEON)
+
+// vabsq_s16 leaves -32768 as 0x8000, which is 32768 read as unsigned
+static inline int32_t window_sum(const int16_t *p, int full, int r, uint16x8_t mask, int windowSize) {
+    uint32x4_t acc = vdupq_n_u32(0);
+    int k;
+
+    for (k = 0; k < full; k++) {
+        uint16x8_t v = vreinterpretq_u16_s16(vabsq_s16(vld1q_s16(p + k * VECTOR_LANES)));
+        acc = vpadalq_u16(acc, v);
+    }
+    if (r) {
+        uint16x8_t v = vreinterpretq_u16_s16(vabsq_s16(vld1q_s16(p + windowSize - VECTOR_LANES)));
+        acc = vpadalq_u16(acc, vandq_u16(v, mask));
+    }
+
+#if defined(__aarch64__)
+    return (int32_t)vaddvq_u32(acc);
+#else
+    uint64x2_t s = vpaddlq_u32(acc);
+    return (int32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+#endif
+}
+
+#endif
+
+
+int window_avg_s16(const int16_t *samples, int numSamples, int windowSize, int32_t *avgs) {
+#if defined(VECTOR_LANES)
+    FixedRecip recip = fixed_recip(windowSize);
+    int numWindows = numSamples / windowSize;
+    int full = windowSize / VECTOR_LANES;
+    int r = windowSize % VECTOR_LANES;
+    int w;
+
+    // The tail load starts windowSize - VECTOR_LANES into the window
+    if (windowSize < VECTOR_LANES)
+        return window_avg_s16_scalar(samples, numSamples, windowSize, avgs);
+
+#if defined(WINDOW_AVG_AVX2)
+    __m256i mask = _mm256_loadu_si256((const __m256i *)(tailMask + 16 - VECTOR_LANES + r));
+#elif defined(WINDOW_AVG_SSE2)
+    __m128i mask = _mm_loadu_si128((const __m128i *)(tailMask + 16 - VECTOR_LANES + r));
+#else
+    uint16x8_t mask = vreinterpretq_u16_s16(vld1q_s16(tailMask + 16 - VECTOR_LANES + r));
+#endif
+
+    for (w = 0; w < numWindows; w++) {
+        avgs[w] = fixed_div(window_sum(samples + w * windowSize, full, r, mask, windowSize), recip);
+    }
+
+    return numWindows;
+#else
+    return window_avg_s16_scalar(samples, numSamples, windowSize, avgs);
+#endif
+}
+
+
+const char *window_avg_impl(void) {
+#if defined(WINDOW_AVG_AVX2)
+    return "avx2";
+#elif defined(WINDOW_AVG_SSE2)
+    return "sse2";
+#elif defined(WINDOW_AVG_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,25 @@
+/* *********************************************************************
+ * File: window_avg.h
+ * Author: Michael Bennett
+ * Purpose: Rectify-and-average kernel for the half period energy
+ *          detector. Splits a block of samples into back to back
+ *          windows and returns the average of |sample| over each one.
+ *          Uses AVX2, SSE2 or NEON when the compiler targets them and
+ *          plain C otherwise.
+ * ********************************************************************/
+#ifndef WINDOW_AVG_H
+#define WINDOW_AVG_H
+
+#include <stdint.h>
+
+// Averages |sample| over each full window of windowSize samples, same
+// integer division as the decoders. Returns the number of windows written
+int window_avg_s16(const int16_t *samples, int numSamples, int windowSize, int32_t *avgs);
+
+// Plain C reference, always available
+int window_avg_s16_scalar(const int16_t *samples, int numSamples, int windowSize, int32_t *avgs);
+
+// Name of the implementation window_avg_s16 was built with
+const char *window_avg_impl(void);
+
+#endif
@@ -0,0 +1,184 @@
+/* *********************************************************************
+ * File: work_pool.c
+ * Author: Michael Bennett
+ * Purpose: Work stealing pthread pool. Tasks are dealt round robin into
+ *          per worker deques before the run starts, so a worker only
+ *          touches another deque's lock when it steals.
+ * ********************************************************************/
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "work_pool.h"
+
+typedef struct {
+    WorkPoolTask fn;
+    void *arg;
+} WorkPoolItem;
+
+typedef struct {
+    pthread_mutex_t lock;
+    WorkPoolItem *items;
+    int front;                      // Next task to steal
+    int back;                       // One past the next task the owner runs
+} WorkPoolDeque;
+
+typedef struct {
+    WorkPool *pool;
+    int index;
+} WorkPoolWorker;
+
+struct WorkPool {
+    int numThreads;
+    int maxTasks;
+    int numTasks;
+    WorkPoolDeque *deques;
+    WorkPoolWorker *workers;
+};
+
+WorkPool *work_pool_create(int numThreads, int maxTasks) {
+    WorkPool *pool;
+    int i;
+
+    if (numThreads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (maxTasks <= 0) return NULL;
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL) return NULL;
+
+    pool->numThreads = numThreads;
+    pool->maxTasks = maxTasks;
+    pool->deques = calloc(numThreads, sizeof(WorkPoolDeque));
+    pool->workers = calloc(numThreads, sizeof(WorkPoolWorker));
+    if (pool->deques == NULL || pool->workers == NULL) {
+        free(pool->deques);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+
+    for (i = 0; i < numThreads; i++) {
+        // Each deque can hold every task, so dealing never has to check room
+        pool->deques[i].items = malloc(((maxTasks + numThreads - 1) / numThreads) * sizeof(WorkPoolItem));
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pool->deques[i].items == NULL) {
+            pool->numThreads = i + 1;
+            work_pool_destroy(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+
+void work_pool_destroy(WorkPool *pool) {
+    int i;
+
+    if (pool == NULL) return;
+
+    for (i = 0; i < pool->numThreads; i++) {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+    free(pool->deques);
+    free(pool->workers);
+    free(pool);
+}
+
+
+int work_pool_threads(const WorkPool *pool) {
+    return pool->numThreads;
+}
+
+
+int work_pool_add(WorkPool *pool, WorkPoolTask fn, void *arg) {
+    WorkPoolDeque *deque;
+
+    if (pool->numTasks >= pool->maxTasks) return -1;
+
+    deque = &pool->deques[pool->numTasks % pool->numThreads];
+    deque->items[deque->back].fn = fn;
+    deque->items[deque->back].arg = arg;
+    deque->back++;
+    pool->numTasks++;
+
+    return 0;
+}
+
+
+/**
+ *  Takes the newest task from the worker's own deque, or the oldest from the
+ *  first other deque that still has one. Returns 0 when every deque is empty.
+ */
+static int work_pool_take(WorkPool *pool, int self, WorkPoolItem *item) {
+    WorkPoolDeque *deque = &pool->deques[self];
+    int found = 0;
+    int i;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->back > deque->front) {
+        *item = deque->items[--deque->back];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    for (i = 1; !found && i < pool->numThreads; i++) {
+        deque = &pool->deques[(self + i) % pool->numThreads];
+
+        pthread_mutex_lock(&deque->lock);
+        if (deque->back > deque->front) {
+            *item = deque->items[deque->front++];
+            found = 1;
+        }
+        pthread_mutex_unlock(&deque->lock);
+    }
+
+    return found;
+}
+
+static void *work_pool_worker(void *arg) {
+    WorkPoolWorker *worker = arg;
+    WorkPoolItem item;
+
+    // Tasks never queue more tasks, so one empty sweep means the run is done
+    while (work_pool_take(worker->pool, worker->index, &item)) {
+        item.fn(item.arg, worker->index);
+    }
+
+    return NULL;
+}
+
+
+int work_pool_run(WorkPool *pool) {
+    pthread_t *threads = malloc(pool->numThreads * sizeof(pthread_t));
+    int started, i;
+
+    if (threads == NULL) return -1;
+
+    // The calling thread works as worker 0
+    for (started = 1; started < pool->numThreads; started++) {
+        if (pthread_create(&threads[started], NULL, work_pool_worker, &pool->workers[started]) != 0)
+            break;
+    }
+    work_pool_worker(&pool->workers[0]);
+
+    // Workers that failed to start have their deques stolen by the rest
+    for (i = 1; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    for (i = 0; i < pool->numThreads; i++) {
+        pool->deques[i].front = 0;
+        pool->deques[i].back = 0;
+    }
+    pool->numTasks = 0;
+
+    return 0;
+}
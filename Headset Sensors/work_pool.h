@@ -0,0 +1,28 @@
+/* *********************************************************************
+ * File: work_pool.h
+ * Author: Michael Bennett
+ * Purpose: Fixed size pthread pool for the host side batch tools. Each
+ *          worker owns a deque of tasks, takes from its own back and
+ *          steals from the front of the others once it runs dry.
+ * ********************************************************************/
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+typedef void (*WorkPoolTask)(void *arg, int worker);
+
+typedef struct WorkPool WorkPool;
+
+// Returns NULL on failure. numThreads of 0 uses one thread per online CPU
+WorkPool *work_pool_create(int numThreads, int maxTasks);
+
+void work_pool_destroy(WorkPool *pool);
+
+int work_pool_threads(const WorkPool *pool);
+
+// Queues a task before work_pool_run. Returns -1 when maxTasks are queued
+int work_pool_add(WorkPool *pool, WorkPoolTask fn, void *arg);
+
+// Runs every queued task and returns once all of them have finished
+int work_pool_run(WorkPool *pool);
+
+#endif
@@ -7,6 +7,76 @@
 //
 
 #import <XCTest/XCTest.h>
+#import <pthread.h>
+
+#import "sample_ring.h"
+#import "tone_gen.h"
+#import "sensor_decoder.h"
+#import "chipcap.h"
+#import "signal_gen.h"
+#import "io_stats.h"
+#import "sensor_io.h"
+#import "reading_stats.h"
+#import "link_rate.h"
+#import "sensor_frame.h"
+#import "trace_log.h"
+#import "fixed_point.h"
+#import "window_avg.h"
+#import "resampler.h"
+#import "capture_codec.h"
+#import "reading_store.h"
+#import "cubic_bezier.h"
+
+#define RING_TEST_CAPACITY  1024
+#define RING_TEST_SAMPLES   (1 << 22)
+
+#define TONE_TEST_RATE      44100.0
+#define TONE_TEST_FREQ      20000.0
+#define TONE_TEST_BUFFER    256
+#define TONE_TEST_SECONDS   600
+#define TONE_TEST_FRAMES    4410        // 20 kHz lands on bin 2000
+
+#define DECODE_TEST_PACKETS 20
+#define DECODE_TEST_NOISE   6.0         // Light hiss
+
+#define STATS_TEST_CALLBACKS    200000
+#define STATS_TEST_FRAMES       256
+#define STATS_TEST_PERIOD_NS    5805000 // 256 frames at 44.1 kHz
+
+// Producer side of the ring test, writes a counting sequence in odd sized chunks
+static void *ringTestProducer(void *arg) {
+    SampleRing *ring = arg;
+    int16_t chunk[97];
+    uint32_t next = 0;
+    uint32_t n = 1;
+    
+    while (next < RING_TEST_SAMPLES) {
+        n = n % 97 + 1;
+        if (n > RING_TEST_SAMPLES - next) n = RING_TEST_SAMPLES - next;
+        for (uint32_t k = 0; k < n; k++) {
+            chunk[k] = (int16_t)(next + k);
+        }
+        next += sample_ring_write(ring, chunk, n, 1);
+    }
+    
+    return NULL;
+}
+
+// Render thread side of the stats test: a callback every period, every 10th
+// one too slow, every 100th one a period late
+static void *statsTestCallbacks(void *arg) {
+    IoStats *stats = arg;
+    uint64_t clock = 1000000;
+    
+    for (int k = 0; k < STATS_TEST_CALLBACKS; k++) {
+        IoStatsCycle cycle = { .frames = STATS_TEST_FRAMES, .samples = STATS_TEST_FRAMES, .bits = k % 2, .packets = k % 40 == 0 };
+        if (k % 100 == 99) clock += STATS_TEST_PERIOD_NS;
+        io_stats_record(stats, clock, clock + (k % 10 == 9 ? STATS_TEST_PERIOD_NS + 1000 : 100000), &cycle);
+        clock += STATS_TEST_PERIOD_NS;
+    }
+    
+    return NULL;
+}
 
 @interface Headset_SensorsTests : XCTestCase
 
@@ -26,6 +96,843 @@
     [super tearDown];
 }
 
+- (void)testSampleRingTwoThreads
+{
+    SampleRing ring;
+    pthread_t producer;
+    int16_t chunk[61];
+    uint32_t expected = 0;
+    BOOL inOrder = YES;
+    
+    XCTAssertTrue(sample_ring_init(&ring, RING_TEST_CAPACITY));
+    XCTAssertEqual(pthread_create(&producer, NULL, ringTestProducer, &ring), 0);
+    
+    // Consume on this thread and check nothing is lost or reordered
+    while (expected < RING_TEST_SAMPLES) {
+        uint32_t n = sample_ring_read(&ring, chunk, 61);
+        for (uint32_t k = 0; k < n; k++, expected++) {
+            if (chunk[k] != (int16_t)expected) inOrder = NO;
+        }
+    }
+    pthread_join(producer, NULL);
+    
+    XCTAssertTrue(inOrder);
+    XCTAssertEqual(sample_ring_available(&ring), 0u);
+    sample_ring_free(&ring);
+}
+
+- (void)testIOStatsSnapshotsWhileRecording
+{
+    static IoStats stats;
+    IoStatsCounters snapshot, last = { 0 };
+    pthread_t writer;
+    BOOL consistent = YES;
+    
+    io_stats_init(&stats, 44100);
+    XCTAssertEqual(pthread_create(&writer, NULL, statsTestCallbacks, &stats), 0);
+    
+    // Every snapshot must count each callback everywhere or nowhere
+    do {
+        io_stats_snapshot(&stats, &snapshot);
+        uint64_t histogram = 0;
+        for (int b = 0; b < IO_STATS_BUCKETS; b++) histogram += snapshot.histogram[b];
+        if (histogram != snapshot.callbacks || snapshot.samples != snapshot.callbacks * STATS_TEST_FRAMES ||
+            snapshot.callbacks < last.callbacks) consistent = NO;
+        last = snapshot;
+    } while (snapshot.callbacks < STATS_TEST_CALLBACKS);
+    pthread_join(writer, NULL);
+    
+    XCTAssertTrue(consistent);
+    XCTAssertEqual(snapshot.deadlineMisses, (uint64_t)STATS_TEST_CALLBACKS / 10);
+    XCTAssertEqual(snapshot.overruns, (uint64_t)STATS_TEST_CALLBACKS / 100);
+    XCTAssertEqual(snapshot.bits, (uint64_t)STATS_TEST_CALLBACKS / 2);
+    XCTAssertEqual(snapshot.packets, (uint64_t)STATS_TEST_CALLBACKS / 40);
+    XCTAssertEqual(io_stats_percentile_ns(&snapshot, 50) / 1000, 112ull);    // 100 us lands in [96, 112)
+    XCTAssertEqual(snapshot.durationMaxNs, (uint64_t)STATS_TEST_PERIOD_NS + 1000);
+}
+
+- (void)testSampleRingStrideAndOverflow
+{
+    SampleRing ring;
+    int16_t interleaved[2 * 40];
+    int16_t out[40];
+    
+    // Capacity rounds up to a power of two
+    XCTAssertTrue(sample_ring_init(&ring, 24));
+    XCTAssertEqual(ring.capacity, 32u);
+    
+    for (int k = 0; k < 40; k++) {
+        interleaved[2 * k] = k;
+        interleaved[2 * k + 1] = -1;
+    }
+    
+    // Only the first channel is kept and what does not fit is counted as dropped
+    XCTAssertEqual(sample_ring_write(&ring, interleaved, 40, 2), 32u);
+    XCTAssertEqual(ring.dropped, 8u);
+    XCTAssertEqual(sample_ring_read(&ring, out, 40), 32u);
+    for (int k = 0; k < 32; k++) {
+        XCTAssertEqual(out[k], k);
+    }
+    sample_ring_free(&ring);
+}
+
+- (void)testToneGenSpectralPurity
+{
+    ToneGen tone;
+    int16_t buffer[TONE_TEST_BUFFER];
+    int16_t check[TONE_TEST_FRAMES];
+    
+    tone_gen_init(&tone, TONE_TEST_FREQ, TONE_TEST_RATE, 32767.0f/2);
+    
+    // Ten minutes of callbacks must not wear the tone down
+    for (long frames = 0; frames < (long)(TONE_TEST_SECONDS * TONE_TEST_RATE); frames += TONE_TEST_BUFFER) {
+        tone_gen_render_s16(&tone, buffer, TONE_TEST_BUFFER, 1);
+        XCTAssertTrue(tone.phase >= 0 && tone.phase < 2 * M_PI);
+    }
+    
+    tone_gen_render_s16(&tone, check, TONE_TEST_FRAMES, 1);
+    XCTAssertGreaterThan(tone_sfdr_db(check, TONE_TEST_FRAMES, 1, TONE_TEST_RATE, TONE_TEST_FREQ), 80.0);
+}
+
+- (void)testToneGenSilenceKeepsPhase
+{
+    ToneGen played, muted;
+    int16_t a[2 * 300], b[2 * 300];
+    
+    tone_gen_init(&played, TONE_TEST_FREQ, TONE_TEST_RATE, 1000.0f);
+    tone_gen_init(&muted, TONE_TEST_FREQ, TONE_TEST_RATE, 1000.0f);
+    
+    // A muted command channel picks up where the tone would have been
+    tone_gen_render_s16(&played, a + 1, 300, 2);
+    tone_gen_render_silent(&muted, b + 1, 300, 2);
+    for (int k = 0; k < 300; k++) {
+        XCTAssertEqual(b[2 * k + 1], 0);
+    }
+    
+    tone_gen_render_s16(&played, a, 300, 2);
+    tone_gen_render_s16(&muted, b, 300, 2);
+    for (int k = 0; k < 300; k++) {
+        XCTAssertEqual(a[2 * k], b[2 * k]);
+    }
+}
+
+- (void)testSensorDecoderFollowsLevelAndClock
+{
+    static SensorDecoder dec;
+    SignalGenPacket truth[DECODE_TEST_PACKETS];
+    SignalGenConfig config;
+    double clockOffsets[] = { 0, -0.1, 0.1 };
+    double amplitudes[] = { 300, 3000, 30000 };
+    int16_t *signal;
+    
+    // Quiet or loud, slow or fast sensor clock, every packet must come through
+    for (int c = 0; c < 3; c++) {
+        for (int a = 0; a < 3; a++) {
+            signal_gen_default(&config);
+            config.amplitude = amplitudes[a];
+            config.noise = DECODE_TEST_NOISE;
+            config.clockOffset = clockOffsets[c];
+            config.seed = 3 * c + a + 1;
+            long long n = signal_gen_render(&config, DECODE_TEST_PACKETS, &signal, truth);
+            XCTAssertGreaterThan(n, 0);
+            
+            sensor_decoder_init(&dec);
+            for (long long k = 0; k < n; k += 256) {
+                sensor_decoder_process(&dec, signal + k, n - k < 256 ? (int)(n - k) : 256, 1);
+            }
+            free(signal);
+            
+            XCTAssertEqual(sensor_decoder_reading_count(&dec), DECODE_TEST_PACKETS, @"clock %+.2f amplitude %.0f", clockOffsets[c], amplitudes[a]);
+            XCTAssertEqual(dec.badPackets, 0, @"clock %+.2f amplitude %.0f", clockOffsets[c], amplitudes[a]);
+            for (int p = 0; p < sensor_decoder_reading_count(&dec); p++) {
+                XCTAssertEqual(fixed_q16_to_float(dec.readings.humidity[p]), truth[p].humidity);
+                XCTAssertEqual(fixed_q16_to_float(dec.readings.temperature[p]), truth[p].temperature);
+            }
+        }
+    }
+}
+
+- (void)testSensorDecoderCopiesReadingsUntilReused
+{
+    static SensorDecoder dec;
+    SignalGenPacket truth[DECODE_TEST_PACKETS];
+    SignalGenConfig config;
+    SensorReading reading;
+    int16_t *signal;
+    
+    signal_gen_default(&config);
+    config.noise = DECODE_TEST_NOISE;
+    long long n = signal_gen_render(&config, DECODE_TEST_PACKETS, &signal, truth);
+    XCTAssertGreaterThan(n, 0);
+    
+    sensor_decoder_init(&dec);
+    sensor_decoder_process(&dec, signal, (int)n, 1);
+    free(signal);
+    
+    XCTAssertEqual(sensor_decoder_reading_count(&dec), DECODE_TEST_PACKETS);
+    for (int p = 0; p < DECODE_TEST_PACKETS; p++) {
+        XCTAssertTrue(sensor_decoder_copy_reading(&dec, p, &reading));
+        XCTAssertEqual(reading.humidity, dec.readings.humidity[p]);
+        XCTAssertEqual(fixed_q16_to_float(reading.temperature), truth[p].temperature);
+        XCTAssertEqual(reading.sample, dec.readings.sample[p]);
+    }
+    XCTAssertFalse(sensor_decoder_copy_reading(&dec, DECODE_TEST_PACKETS, &reading));
+    
+    // Once the count reaches a slot's next reading, the slot may be half written
+    dec.numReadings = SENSOR_MAX_READINGS + 1;
+    XCTAssertFalse(sensor_decoder_copy_reading(&dec, 0, &reading));
+    XCTAssertTrue(sensor_decoder_copy_reading(&dec, 2, &reading));
+}
+
+- (void)testSensorIORenderDecodesAndReplacesInput
+{
+    static SensorIO io;
+    SignalGenPacket truth[DECODE_TEST_PACKETS];
+    SignalGenConfig config;
+    int16_t frames[2 * 256];
+    int16_t *signal;
+    BOOL replaced = YES;
+    
+    signal_gen_default(&config);
+    config.noise = DECODE_TEST_NOISE;
+    long long n = signal_gen_render(&config, DECODE_TEST_PACKETS, &signal, truth);
+    XCTAssertGreaterThan(n, 0);
+    
+    // Callback sized stereo buffers with the mic on the left, as RemoteIO hands them over
+    XCTAssertTrue(sensor_io_init(&io, 0));
+    sensor_io_reset(&io, config.sampleRate);
+    for (long long k = 0; k + 256 <= n; k += 256) {
+        IoStatsCycle cycle = { 0 };
+        for (int f = 0; f < 256; f++) {
+            frames[2 * f] = signal[k + f];
+            frames[2 * f + 1] = signal[k + f];
+        }
+        sensor_io_render(&io, frames, 256, 2, &cycle);
+        
+        // Power tone is off, so nothing of the mic may be left on the left channel
+        for (int f = 0; f < 256; f++) {
+            if (frames[2 * f] != 0) replaced = NO;
+        }
+    }
+    free(signal);
+    
+    XCTAssertTrue(replaced);
+    XCTAssertEqual(sensor_decoder_reading_count(&io.decoder), DECODE_TEST_PACKETS);
+    for (int p = 0; p < sensor_decoder_reading_count(&io.decoder); p++) {
+        XCTAssertEqual(fixed_q16_to_float(io.decoder.readings.humidity[p]), truth[p].humidity);
+    }
+    sensor_io_free(&io);
+}
+
+- (void)testReadingStatsRejectsSpikesAndFollowsSteps
+{
+    static ReadingStats stats;
+    ReadingStatsCounters counters;
+    double sum = 0, squares = 0;
+    int accepted = 0;
+    
+    // Humidity wanders +-1 %RH around 40 with a spike every 100 readings, in Q16.16 like the decoder's
+    reading_stats_init(&stats);
+    for (int k = 0; k < 1000; k++) {
+        int32_t humidity = k % 100 == 50 ? 95 * FIXED_Q16_ONE : 40 * FIXED_Q16_ONE + ((k * 37) % 21 - 10) * FIXED_Q16_ONE / 10;
+        if (reading_stats_add(&stats, humidity, 20 * FIXED_Q16_ONE)) {
+            double h = (double)humidity / FIXED_Q16_ONE;
+            sum += h;
+            squares += h * h;
+            accepted++;
+        }
+    }
+    
+    reading_stats_snapshot(&stats, &counters);
+    double mean = sum / accepted;
+    XCTAssertEqual(counters.rejected, 10ull);
+    XCTAssertEqual(counters.count, (uint64_t)accepted);
+    XCTAssertEqualWithAccuracy(reading_stats_mean(&counters, READING_HUMIDITY), mean, 1e-9);
+    XCTAssertEqualWithAccuracy(reading_stats_variance(&counters, READING_HUMIDITY), (squares - accepted * mean * mean) / (accepted - 1), 1e-3);
+    XCTAssertEqual(counters.quantity[READING_HUMIDITY].max, 41 * FIXED_Q16_ONE);
+    XCTAssertEqualWithAccuracy(reading_stats_quantile(&counters, READING_HUMIDITY, 0.5), 40.0f, 0.1f);
+    XCTAssertEqualWithAccuracy(reading_stats_mean(&counters, READING_TEMPERATURE), 20.0, 1e-9);
+    XCTAssertEqualWithAccuracy(reading_stats_variance(&counters, READING_TEMPERATURE), 0.0, 1e-9);
+    
+    // A real step is only doubted until most of the window has moved
+    for (int k = 0; k < READING_STATS_WINDOW; k++) reading_stats_add(&stats, 60 * FIXED_Q16_ONE, 20 * FIXED_Q16_ONE);
+    XCTAssertTrue(reading_stats_add(&stats, 60 * FIXED_Q16_ONE, 20 * FIXED_Q16_ONE));
+    reading_stats_snapshot(&stats, &counters);
+    XCTAssertLessThanOrEqual(counters.rejected, 10ull + READING_STATS_WINDOW / 2 + 1);
+}
+
+- (void)testLinkRateAnnouncementsAndBackOff
+{
+    LinkCommand command;
+    LinkListener listener;
+    LinkRate link;
+    ToneGen tone;
+    int16_t buffer[256];
+    
+    // Each rate message is heard as its rate, then the request tone after it,
+    // and a NAK as its sequence and frame without changing the rate
+    link_command_init(&command, 44100);
+    link_listener_init(&listener, 44100, 4000);
+    tone_gen_init(&tone, 20000, 44100, 32767.0f / 2);
+    for (int m = 0; m <= LINK_RATES; m++) {
+        int message = m < LINK_RATES ? LINK_MSG_RATE(m) : LINK_MSG_NAK_OF(0x2b, 5);
+        int heard = -1;
+        XCTAssertTrue(link_command_send(&command, message));
+        while (link_command_active(&command)) {
+            uint32_t sent = link_command_render(&command, &tone, buffer, 256, 1);
+            tone_gen_render_s16(&tone, buffer + sent, 256 - sent, 1);
+            int fed = link_listener_feed(&listener, buffer, 256, 1);
+            if (fed >= 0) heard = fed;
+        }
+        for (int k = 0; k < 10; k++) {
+            tone_gen_render_s16(&tone, buffer, 256, 1);
+            link_listener_feed(&listener, buffer, 256, 1);
+        }
+        XCTAssertEqual(heard, message);
+        XCTAssertTrue(listener.requested);
+    }
+    XCTAssertEqual(LINK_NAK_SEQUENCE(LINK_MSG_NAK_OF(0x2b, 5)), 0xb);
+    XCTAssertEqual(LINK_NAK_FRAME(LINK_MSG_NAK_OF(0x2b, 5)), 5);
+    XCTAssertEqual(listener.rate, LINK_RATES - 1);
+    
+    // Steps up after a good run, backs off on bad check sums and holds the failed rate
+    link_rate_init(&link, 44100);
+    for (int k = 0; k < LINK_UP_PACKETS - 1; k++) XCTAssertFalse(link_rate_update(&link, 1, 0, 256));
+    XCTAssertTrue(link_rate_update(&link, 1, 0, 256));
+    XCTAssertEqual(link.rate, 1);
+    for (int k = 0; k < LINK_MAX_BAD; k++) XCTAssertFalse(link_rate_update(&link, 0, 1, 256));
+    XCTAssertTrue(link_rate_update(&link, 0, 1, 256));
+    XCTAssertEqual(link.rate, 0);
+    for (int k = 0; k < LINK_HOLD_PACKETS - 1; k++) link_rate_update(&link, 1, 0, 256);
+    XCTAssertEqual(link.rate, 0);
+    XCTAssertTrue(link_rate_update(&link, 1, 0, 256));
+    XCTAssertEqual(link.rate, 1);
+    XCTAssertEqual(link.holdLength[1], 2 * LINK_HOLD_PACKETS);
+    
+    // and falls back when a raised rate decodes nothing
+    XCTAssertTrue(link_rate_update(&link, 0, 0, (uint32_t)(LINK_SILENT_SECONDS * 44100) + 1));
+    XCTAssertEqual(link.rate, 0);
+}
+
+- (void)testSensorDecoderSplitsFramedBursts
+{
+    static SensorDecoder dec;
+    SignalGenPacket truth[DECODE_TEST_PACKETS];
+    SignalGenConfig config;
+    int16_t *signal;
+    
+    // Four sensors to a burst, each reading comes out with its sensor's ID
+    signal_gen_default(&config);
+    config.noise = DECODE_TEST_NOISE;
+    config.framedSensors = 4;
+    long long n = signal_gen_render(&config, DECODE_TEST_PACKETS, &signal, truth);
+    XCTAssertGreaterThan(n, 0);
+    
+    sensor_decoder_init(&dec);
+    for (long long k = 0; k < n; k += 256) {
+        sensor_decoder_process(&dec, signal + k, n - k < 256 ? (int)(n - k) : 256, 1);
+    }
+    free(signal);
+    
+    XCTAssertEqual(sensor_decoder_reading_count(&dec), DECODE_TEST_PACKETS);
+    XCTAssertEqual(dec.badPackets, 0);
+    for (int p = 0; p < sensor_decoder_reading_count(&dec); p++) {
+        XCTAssertEqual(fixed_q16_to_float(dec.readings.humidity[p]), truth[p].humidity);
+        XCTAssertEqual(fixed_q16_to_float(dec.readings.temperature[p]), truth[p].temperature);
+        XCTAssertEqual(dec.readings.sensor[p], p % 4);
+    }
+    
+    // A 0 and a 1 flipped together get past the ChipCap2 check sum, not the CRC
+    uint8_t packet[CHIPCAP_PACKET_BYTES] = { 0, 0x12, 0x34, 0x56, 0x78 };
+    uint8_t burst[32];
+    SensorFrame frame;
+    int offset = SENSOR_FRAME_HEADER;
+    packet[0] = (uint8_t)chipcap_checksum(packet, CHIPCAP_PACKET_BYTES);
+    int numBytes = sensor_frame_begin(burst, (int)sizeof(burst), 7, false);
+    numBytes = sensor_frame_append(burst, numBytes, (int)sizeof(burst), SENSOR_FRAME_CHIPCAP2, 1, packet + 1, 4);
+    XCTAssertEqual(sensor_frame_parse(burst, numBytes, &offset, &frame), SENSOR_FRAME_GOOD);
+    packet[1] ^= 0x02;
+    packet[2] ^= 0x01;
+    burst[SENSOR_FRAME_HEADER + 2] ^= 0x02;
+    burst[SENSOR_FRAME_HEADER + 3] ^= 0x01;
+    offset = SENSOR_FRAME_HEADER;
+    XCTAssertTrue(chipcap_valid(packet, CHIPCAP_PACKET_BYTES));
+    XCTAssertEqual(sensor_frame_parse(burst, numBytes, &offset, &frame), SENSOR_FRAME_BAD);
+}
+
+- (void)testSensorDecoderNaksFailedFrames
+{
+    static SensorDecoder dec;
+    SignalGenConfig config;
+    uint8_t burst[64], payload[CHIPCAP_PACKET_BYTES - 1] = { 0x12, 0x34, 0x56, 0x78 };
+    int16_t *signal;
+    long long start;
+    
+    // Frame 2 of 4 fails its CRC, the frames after it still decode
+    int numBytes = sensor_frame_begin(burst, (int)sizeof(burst), 0x2b, false);
+    for (int f = 0; f < 4; f++) {
+        numBytes = sensor_frame_append(burst, numBytes, (int)sizeof(burst), SENSOR_FRAME_CHIPCAP2, f, payload, 4);
+    }
+    burst[SENSOR_FRAME_HEADER + 2 * (SENSOR_FRAME_OVERHEAD + 4) + 3] ^= 0x10;
+    
+    signal_gen_default(&config);
+    config.noise = DECODE_TEST_NOISE;
+    long long n = signal_gen_render_bytes(&config, burst, numBytes, &signal, &start);
+    XCTAssertGreaterThan(n, 0);
+    
+    sensor_decoder_init(&dec);
+    for (long long k = 0; k < n; k += 256) {
+        sensor_decoder_process(&dec, signal + k, n - k < 256 ? (int)(n - k) : 256, 1);
+    }
+    free(signal);
+    
+    XCTAssertEqual(sensor_decoder_reading_count(&dec), 3);
+    XCTAssertEqual(dec.readings.sensor[2], 3);
+    XCTAssertEqual(dec.numNaks, 1);
+    XCTAssertEqual(dec.naks[0].sequence, 0x2b);
+    XCTAssertEqual(dec.naks[0].frame, 2);
+    XCTAssertEqual(dec.nextSequence, 0x2c);
+}
+
+- (void)testCodedFramesCorrectOneWrongByte
+{
+    static SensorDecoder dec;
+    SignalGenConfig config;
+    uint8_t burst[64], sent[64], payload[CHIPCAP_PACKET_BYTES - 1] = { 0x12, 0x34, 0x56, 0x78 };
+    SensorFrame frame;
+    int16_t *signal;
+    long long start;
+    int offset;
+    
+    int numBytes = sensor_frame_begin(sent, (int)sizeof(sent), 0x2b, true);
+    for (int f = 0; f < 4; f++) {
+        numBytes = sensor_frame_append(sent, numBytes, (int)sizeof(sent), SENSOR_FRAME_CHIPCAP2, f, payload, 4);
+    }
+    XCTAssertEqual(numBytes, SENSOR_FRAME_HEADER + 4 * (4 + SENSOR_FRAME_CODED_OVERHEAD));
+    
+    // A wrong payload, length or sequence byte is put right in place
+    int wrong[] = { SENSOR_FRAME_HEADER + 3, SENSOR_FRAME_HEADER + 1, SENSOR_FRAME_HEADER - 1 };
+    for (int w = 0; w < 3; w++) {
+        memcpy(burst, sent, numBytes);
+        burst[wrong[w]] ^= 0xa5;
+        offset = SENSOR_FRAME_HEADER;
+        XCTAssertEqual(sensor_frame_parse(burst, numBytes, &offset, &frame), SENSOR_FRAME_GOOD);
+        XCTAssertEqual(frame.corrected, 1);
+        XCTAssertEqual(frame.sequence, 0x2b);
+        XCTAssertEqual(memcmp(frame.payload, payload, 4), 0);
+        XCTAssertEqual(memcmp(burst, sent, numBytes), 0);
+    }
+    
+    // Two wrong bytes are too many, the next frame is still found
+    memcpy(burst, sent, numBytes);
+    burst[SENSOR_FRAME_HEADER + 2] ^= 0x01;
+    burst[SENSOR_FRAME_HEADER + 4] ^= 0x80;
+    offset = SENSOR_FRAME_HEADER;
+    XCTAssertEqual(sensor_frame_parse(burst, numBytes, &offset, &frame), SENSOR_FRAME_BAD);
+    XCTAssertEqual(sensor_frame_parse(burst, numBytes, &offset, &frame), SENSOR_FRAME_GOOD);
+    XCTAssertEqual(frame.id, 1);
+    
+    // Through the decoder, with a bit of the sync word and one of a frame wrong
+    memcpy(burst, sent, numBytes);
+    burst[0] ^= 0x10;
+    burst[SENSOR_FRAME_HEADER + 2 * (4 + SENSOR_FRAME_CODED_OVERHEAD) + 4] ^= 0x04;
+    signal_gen_default(&config);
+    config.noise = DECODE_TEST_NOISE;
+    long long n = signal_gen_render_bytes(&config, burst, numBytes, &signal, &start);
+    XCTAssertGreaterThan(n, 0);
+    
+    sensor_decoder_init(&dec);
+    for (long long k = 0; k < n; k += 256) {
+        sensor_decoder_process(&dec, signal + k, n - k < 256 ? (int)(n - k) : 256, 1);
+    }
+    free(signal);
+    
+    XCTAssertEqual(sensor_decoder_reading_count(&dec), 4);
+    XCTAssertEqual(dec.correctedPackets, 1);
+    XCTAssertEqual(dec.badPackets, 0);
+    XCTAssertEqual(dec.numNaks, 0);
+}
+
+- (void)testTraceLogDropsWhenFullAndWriterKeepsOrder
+{
+    TraceLog trace;
+    TraceWriter writer;
+    TraceHeader header;
+    TraceRecord record;
+    uint8_t bytes[CHIPCAP_PACKET_BYTES] = { 0x21, 0x3a, 0x55, 0x66, 0x10 };
+    
+    XCTAssertTrue(trace_log_init(&trace, 6, TRACE_DEFAULT_MASK));
+    XCTAssertEqual(trace.capacity, 8u);
+    
+    // Half periods are off by default and cost nothing, a full ring counts what it drops
+    XCTAssertTrue(trace_log_write(&trace, TRACE_HALF, 0, 0, 0, NULL, 0));
+    for (int k = 0; k < 10; k++) {
+        XCTAssertEqual(trace_log_write(&trace, TRACE_PACKET, k, 1, 0x21, bytes, sizeof(bytes)), k < 8);
+    }
+    XCTAssertEqual(trace.dropped, 2u);
+    XCTAssertEqual(trace_log_read(&trace, &record, 1), 1u);
+    XCTAssertEqual(record.type, TRACE_PACKET);
+    XCTAssertEqual(memcmp(record.data, bytes, sizeof(bytes)), 0);
+    XCTAssertEqual(record.data[sizeof(bytes)], 0);
+    trace_log_free(&trace);
+    
+    // A decode traced to a file while the writer drains it
+    XCTAssertTrue(trace_log_init(&trace, 64, TRACE_DEFAULT_MASK));
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"test" TRACE_EXTENSION];
+    XCTAssertTrue(trace_writer_start(&writer, &trace, [path fileSystemRepresentation], 44100));
+    
+    SignalGenConfig config;
+    SignalGenPacket truth[3];
+    SensorDecoder dec;
+    int16_t *signal;
+    signal_gen_default(&config);
+    long long n = signal_gen_render(&config, 3, &signal, truth);
+    XCTAssertGreaterThan(n, 0);
+    
+    sensor_decoder_init(&dec);
+    sensor_decoder_set_trace(&dec, &trace);
+    for (long long k = 0; k < n; k += 256) {
+        sensor_decoder_process(&dec, signal + k, n - k < 256 ? (int)(n - k) : 256, 1);
+    }
+    free(signal);
+    XCTAssertTrue(trace_writer_stop(&writer));
+    XCTAssertEqual(writer.written, 9u);
+    
+    FILE *file = fopen([path fileSystemRepresentation], "rb");
+    XCTAssertTrue(file != NULL && trace_read_header(file, &header));
+    XCTAssertEqual(header.sampleRate, 44100u);
+    XCTAssertEqual(header.dropped, 0u);
+    
+    static const TraceType expected[] = { TRACE_START, TRACE_END, TRACE_PACKET };
+    uint64_t lastSample = 0;
+    for (int k = 0; k < 9; k++) {
+        XCTAssertEqual(fread(&record, sizeof(record), 1, file), 1u);
+        XCTAssertEqual(record.type, expected[k % 3]);
+        XCTAssertGreaterThanOrEqual(record.sample, lastSample);
+        lastSample = record.sample;
+        if (record.type == TRACE_PACKET) {
+            XCTAssertEqual(record.arg, 1);
+            XCTAssertEqual(memcmp(record.data, truth[k / 3].bytes, CHIPCAP_PACKET_BYTES), 0);
+        }
+    }
+    XCTAssertEqual(fread(&record, sizeof(record), 1, file), 0u);
+    fclose(file);
+    trace_log_free(&trace);
+}
+
+- (void)testFixedPointMatchesDivisionAndFloat
+{
+    // Reciprocals against /, at the edges of each divisor's quotients and the top of the range
+    uint32_t seed = 1;
+    for (int32_t d = 1; d <= 1024; d++) {
+        FixedRecip recip = fixed_recip(d);
+        int32_t edges[] = { 0, 1, d - 1, d, d + 1, 32768 * d - 1, 32768 * d, INT32_MAX - 1, INT32_MAX };
+        for (int k = 0; k < 9; k++) {
+            XCTAssertEqual(fixed_div(edges[k], recip), edges[k] / d);
+        }
+        for (int k = 0; k < 1000; k++) {
+            seed = seed * 1103515245u + 12345u;
+            int32_t n = (int32_t)(seed & INT32_MAX);
+            XCTAssertEqual(fixed_div(n, recip), n / d);
+        }
+    }
+    XCTAssertEqual(fixed_div(INT32_MAX, fixed_recip(INT32_MAX)), 1);
+    
+    // Windows of -32768, the largest sums window_avg_s16 sees
+    int16_t loud[1024];
+    int32_t avgs[1024];
+    for (int k = 0; k < 1024; k++) loud[k] = -32768;
+    for (int window = 1; window <= 64; window++) {
+        int n = window_avg_s16(loud, 1024, window, avgs);
+        for (int w = 0; w < n; w++) XCTAssertEqual(avgs[w], 32768);
+    }
+    
+    // Every ChipCap2 reading, against the data sheet formulas in double
+    uint8_t bytes[CHIPCAP_PACKET_BYTES] = { 0 };
+    for (int raw = 0; raw < 65536; raw++) {
+        float humidity, temperature;
+        int32_t humidityQ, temperatureQ;
+        
+        bytes[1] = bytes[3] = (uint8_t)(raw >> 8);
+        bytes[2] = bytes[4] = (uint8_t)raw;
+        chipcap_convert(bytes, &humidity, &temperature);
+        chipcap_convert_q16(bytes, &humidityQ, &temperatureQ);
+        
+        float expectedHumidity = (((bytes[1] >> 2)*256 + bytes[2])/16384.0) * 100;
+        float expectedTemperature = ((bytes[3]*64 + (bytes[4] >> 2))/16384.0) * 165 - 40;
+        XCTAssertEqual(humidity, expectedHumidity);
+        XCTAssertEqual(temperature, expectedTemperature);
+        XCTAssertEqual(humidityQ, (int32_t)(expectedHumidity * FIXED_Q16_ONE));
+        XCTAssertEqual(temperatureQ, (int32_t)(expectedTemperature * FIXED_Q16_ONE));
+    }
+}
+
+- (void)testSensorIODecodesOtherSampleRates
+{
+    static SensorIO io;
+    static Resampler rs;
+    SignalGenPacket truth[DECODE_TEST_PACKETS];
+    SignalGenConfig config;
+    int16_t frames[2 * 256];
+    int16_t *signal;
+    const uint32_t rates[] = { 48000, 96000, 32000 };
+    
+    // DC comes through exactly once the delay line has filled
+    int16_t level[256], out[RESAMPLER_MAX_RATIO * 256];
+    int used;
+    for (int k = 0; k < 256; k++) level[k] = 1000;
+    XCTAssertTrue(resampler_init(&rs, 48000, MAN_LINE_SAMPLE_RATE));
+    int numOut = resampler_process(&rs, level, 256, 1, out, RESAMPLER_MAX_RATIO * 256, &used);
+    XCTAssertEqual(used, 256);
+    XCTAssertEqual(numOut, 256 * 147 / 160 + 1);
+    for (int k = RESAMPLER_TAPS; k < numOut; k++) XCTAssertEqual(out[k], 1000);
+    XCTAssertFalse(resampler_init(&rs, 4000, MAN_LINE_SAMPLE_RATE));
+    
+    XCTAssertTrue(sensor_io_init(&io, 0));
+    for (int r = 0; r < 3; r++) {
+        signal_gen_default(&config);
+        config.noise = DECODE_TEST_NOISE;
+        config.gapSamples = config.gapSamples * rates[r] / MAN_LINE_SAMPLE_RATE;
+        config.gapJitter = config.gapJitter * rates[r] / MAN_LINE_SAMPLE_RATE;
+        config.sampleRate = rates[r];
+        long long n = signal_gen_render(&config, DECODE_TEST_PACKETS, &signal, truth);
+        
+        sensor_io_reset(&io, rates[r]);
+        for (long long k = 0; k + 256 <= n; k += 256) {
+            IoStatsCycle cycle = { 0 };
+            for (int f = 0; f < 256; f++) {
+                frames[2 * f] = signal[k + f];
+                frames[2 * f + 1] = 0;
+            }
+            sensor_io_render(&io, frames, 256, 2, &cycle);
+        }
+        free(signal);
+        
+        XCTAssertEqual(sensor_decoder_reading_count(&io.decoder), DECODE_TEST_PACKETS, @"at %u Hz", rates[r]);
+        for (int p = 0; p < sensor_decoder_reading_count(&io.decoder); p++) {
+            XCTAssertEqual(fixed_q16_to_float(io.decoder.readings.humidity[p]), truth[p].humidity);
+        }
+    }
+    sensor_io_free(&io);
+}
+
+- (void)testSensorIORetriesKeepReadingTimes
+{
+    static SensorIO io;
+    SignalGenPacket truth[DECODE_TEST_PACKETS];
+    SignalGenConfig config;
+    int16_t frames[2 * 256];
+    int16_t *signal;
+    const uint32_t rate = 48000;
+    int retries = 0, p = 1;
+    long long k;
+    
+    signal_gen_default(&config);
+    config.noise = DECODE_TEST_NOISE;
+    config.gapSamples = config.gapSamples * rate / MAN_LINE_SAMPLE_RATE;
+    config.gapJitter = config.gapJitter * rate / MAN_LINE_SAMPLE_RATE;
+    config.sampleRate = rate;
+    long long n = signal_gen_render(&config, DECODE_TEST_PACKETS, &signal, truth);
+    
+    // Every other gap loses a buffer to a retry, as after a bad check sum
+    XCTAssertTrue(sensor_io_init(&io, 0));
+    sensor_io_reset(&io, rate);
+    for (k = 0; k + 256 <= n; k += 256) {
+        IoStatsCycle cycle = { 0 };
+        for (int f = 0; f < 256; f++) {
+            frames[2 * f] = signal[k + f];
+            frames[2 * f + 1] = 0;
+        }
+        if (p < DECODE_TEST_PACKETS && k > truth[p - 1].endSample + 1024 && k + 256 < truth[p].startSample) {
+            io.waitACycle = true;
+            retries++;
+            p += 2;
+        }
+        sensor_io_render(&io, frames, 256, 2, &cycle);
+    }
+    free(signal);
+    
+    // Skipped buffers are still counted, so each reading is as far past its packet as the first
+    XCTAssertEqual(retries, DECODE_TEST_PACKETS / 2);
+    XCTAssertEqualWithAccuracy((double)io.decoder.sampleCount, (double)k * MAN_LINE_SAMPLE_RATE / rate, 1.0);
+    XCTAssertEqual(sensor_decoder_reading_count(&io.decoder), DECODE_TEST_PACKETS);
+    long long latency = io.decoder.readings.sample[0] - truth[0].endSample * MAN_LINE_SAMPLE_RATE / rate;
+    for (p = 1; p < sensor_decoder_reading_count(&io.decoder); p++) {
+        long long late = io.decoder.readings.sample[p] - truth[p].endSample * MAN_LINE_SAMPLE_RATE / rate;
+        XCTAssertEqualWithAccuracy((double)late, (double)latency, HALF_PERIOD_TC / 8, @"packet %d", p);
+    }
+    sensor_io_free(&io);
+}
+
+- (void)testCaptureCodecRoundTripsAndFindsDamage
+{
+    SignalGenPacket truth[DECODE_TEST_PACKETS];
+    SignalGenConfig config;
+    CaptureHeader header;
+    CaptureCodecWriter writer;
+    CaptureCodecReader reader;
+    int16_t *signal;
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"test" CAPTURE_CODEC_EXTENSION];
+    
+    signal_gen_default(&config);
+    config.noise = DECODE_TEST_NOISE;
+    long long n = signal_gen_render(&config, DECODE_TEST_PACKETS, &signal, truth);
+    XCTAssertGreaterThan(n, 2 * CAPTURE_CODEC_BLOCK_FRAMES);
+    
+    // Two channels, the second the first inverted, written in pieces that straddle blocks
+    int16_t *frames = malloc(2 * n * sizeof(int16_t));
+    for (long long k = 0; k < n; k++) {
+        frames[2 * k] = signal[k];
+        frames[2 * k + 1] = (int16_t)-signal[k];
+    }
+    capture_header_init(&header, MAN_LINE_SAMPLE_RATE, 2, "test");
+    XCTAssertTrue(capture_codec_writer_open(&writer, [path fileSystemRepresentation], &header));
+    for (long long k = 0; k < n; k += 1000) {
+        XCTAssertTrue(capture_codec_writer_write(&writer, frames + 2 * k, n - k < 1000 ? (uint32_t)(n - k) : 1000));
+        
+        // Until it is closed, a capture holds its whole blocks
+        if (k == 4000) {
+            fflush(writer.file);
+            XCTAssertTrue(capture_codec_reader_open(&reader, [path fileSystemRepresentation]));
+            XCTAssertEqual(reader.numBlocks, 1u);
+            XCTAssertEqual(reader.header.numFrames, (uint64_t)CAPTURE_CODEC_BLOCK_FRAMES);
+            capture_codec_reader_close(&reader);
+        }
+    }
+    XCTAssertTrue(capture_codec_writer_close(&writer));
+    
+    XCTAssertTrue(capture_codec_reader_open(&reader, [path fileSystemRepresentation]));
+    XCTAssertEqual(reader.header.numFrames, (uint64_t)n);
+    XCTAssertEqual(reader.header.channels, 2u);
+    XCTAssertLessThan(reader.mapBytes, (size_t)n * 4 / 2);
+    int16_t *decoded = malloc(2 * CAPTURE_CODEC_BLOCK_FRAMES * sizeof(int16_t));
+    for (uint32_t block = 0; block < reader.numBlocks; block++) {
+        uint64_t first = capture_codec_block_start(&reader, block);
+        int numFrames = capture_codec_decode_block(&reader, block, decoded);
+        XCTAssertEqual(numFrames, n - first < CAPTURE_CODEC_BLOCK_FRAMES ? (int)(n - first) : CAPTURE_CODEC_BLOCK_FRAMES);
+        XCTAssertEqual(memcmp(decoded, frames + 2 * first, 2 * numFrames * sizeof(int16_t)), 0, @"block %u", block);
+    }
+    capture_codec_reader_close(&reader);
+    
+    // One wrong payload byte fails that block's check sum and no other
+    FILE *file = fopen([path fileSystemRepresentation], "r+b");
+    XCTAssertTrue(file != NULL);
+    XCTAssertTrue(capture_codec_reader_open(&reader, [path fileSystemRepresentation]));
+    long damaged = (long)reader.offsets[1] + CAPTURE_CODEC_BLOCK_BYTES + 100;
+    capture_codec_reader_close(&reader);
+    fseek(file, damaged, SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, damaged, SEEK_SET);
+    fputc(byte ^ 0x10, file);
+    fclose(file);
+    
+    XCTAssertTrue(capture_codec_reader_open(&reader, [path fileSystemRepresentation]));
+    XCTAssertGreaterThan(capture_codec_decode_block(&reader, 0, decoded), 0);
+    XCTAssertEqual(capture_codec_decode_block(&reader, 1, decoded), -1);
+    XCTAssertGreaterThan(capture_codec_decode_block(&reader, 2, decoded), 0);
+    capture_codec_reader_close(&reader);
+    
+    free(decoded);
+    free(frames);
+    free(signal);
+}
+
+- (void)testReadingStoreRollsUpAndSurvivesReopen
+{
+    ReadingStore store;
+    ReadingBucket buckets[8], summary;
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"test" READING_STORE_EXTENSION];
+    const int64_t t0 = 1700002800000LL;     // On the hour
+    
+    // Four readings a second for 150 s, humidity counting up and temperature down
+    unlink([path fileSystemRepresentation]);
+    XCTAssertTrue(reading_store_open(&store, [path fileSystemRepresentation]));
+    for (int i = 0; i < 600; i++) {
+        XCTAssertTrue(reading_store_add(&store, t0 + 250 * i, i << 16, -(i << 16)));
+    }
+    
+    XCTAssertEqual(reading_store_query(&store, READING_STORE_SECOND, t0, t0 + 1000, buckets, 8), 1);
+    XCTAssertEqual(buckets[0].count, 4u);
+    XCTAssertEqual(buckets[0].min[READING_HUMIDITY], 0);
+    XCTAssertEqual(buckets[0].max[READING_HUMIDITY], 3 << 16);
+    XCTAssertEqual(buckets[0].min[READING_TEMPERATURE], -(3 << 16));
+    XCTAssertEqual(buckets[0].sum[READING_HUMIDITY], 6LL << 16);
+    
+    // The last minute is still filling and is included
+    XCTAssertEqual(reading_store_query(&store, READING_STORE_MINUTE, t0, t0 + 3600000, buckets, 8), 3);
+    XCTAssertEqual(buckets[0].count, 240u);
+    XCTAssertEqual(buckets[2].count, 120u);
+    XCTAssertEqual(buckets[2].timeMs, t0 + 120000);
+    XCTAssertEqual(buckets[2].max[READING_HUMIDITY], 599 << 16);
+    XCTAssertEqual(reading_store_query(&store, READING_STORE_RAW, t0 + 1000, t0 + 2000, buckets, 8), 4);
+    XCTAssertEqual(buckets[3].timeMs, t0 + 1750);
+    
+    XCTAssertEqual(reading_store_level_for(&store, t0, t0 + 150000, 1000), READING_STORE_RAW);
+    XCTAssertEqual(reading_store_level_for(&store, t0, t0 + 150000, 200), READING_STORE_SECOND);
+    XCTAssertEqual(reading_store_level_for(&store, t0, t0 + 150000, 3), READING_STORE_MINUTE);
+    
+    // Ragged ends come from the finer levels, exactly
+    XCTAssertTrue(reading_store_summary(&store, t0 + 500, t0 + 125000, &summary));
+    XCTAssertEqual(summary.count, 498u);
+    XCTAssertEqual(summary.min[READING_HUMIDITY], 2 << 16);
+    XCTAssertEqual(summary.max[READING_HUMIDITY], 499 << 16);
+    XCTAssertEqual(summary.sum[READING_HUMIDITY], (long long)(2 + 499) * 498 / 2 << 16);
+    
+    // A clock that steps back is held at the newest reading
+    XCTAssertTrue(reading_store_add(&store, t0 - 5000, 1 << 16, 1 << 16));
+    XCTAssertEqual(store.lastMs, t0 + 250 * 599);
+    XCTAssertTrue(reading_store_close(&store));
+    
+    // A record cut short by a crash is dropped and appending carries on after the last whole one
+    FILE *file = fopen([path fileSystemRepresentation], "ab");
+    fwrite("GSFRtor", 1, 7, file);
+    fclose(file);
+    XCTAssertTrue(reading_store_open(&store, [path fileSystemRepresentation]));
+    XCTAssertEqual(store.total, 601ull);
+    XCTAssertTrue(reading_store_summary(&store, t0, t0 + 150000, &summary));
+    XCTAssertEqual(summary.count, 601u);
+    XCTAssertTrue(reading_store_add(&store, t0 + 150000, 0, 0));
+    XCTAssertTrue(reading_store_close(&store));
+    XCTAssertTrue(reading_store_open(&store, [path fileSystemRepresentation]));
+    XCTAssertEqual(store.total, 602ull);
+    XCTAssertTrue(reading_store_close(&store));
+    unlink([path fileSystemRepresentation]);
+    
+    // Once raw readings are forgotten, a range starting among them is only known to the second
+    XCTAssertTrue(reading_store_init(&store));
+    for (int i = 0; i < READING_STORE_RAW_CAPACITY + 1000; i++) {
+        reading_store_add(&store, t0 + i, i, i);
+    }
+    XCTAssertGreaterThan(store.level[READING_STORE_RAW].lostBeforeMs, t0 + 999);
+    XCTAssertTrue(reading_store_summary(&store, t0, t0 + 5000, &summary));
+    XCTAssertEqual(summary.count, 5000u);
+    XCTAssertFalse(reading_store_summary(&store, t0 + 10, t0 + 5000, &summary));
+    XCTAssertEqual(summary.count, 5000u);
+    XCTAssertEqual(summary.min[READING_HUMIDITY], 0);
+    reading_store_free(&store);
+}
+
+- (void)testCubicBezierSolvesFlatAndSteepCurves
+{
+    static const double curves[][4] = { { 0.25, 0.1, 0.25, 1.0 }, { 0.42, 0.0, 0.58, 1.0 }, { 0.0, 0.8, 1.0, 0.2 } };
+    CubicBezier curve;
+    
+    for (int c = 0; c < 3; c++) {
+        cubic_bezier_init(&curve, curves[c][0], curves[c][1], curves[c][2], curves[c][3]);
+        for (int k = 0; k <= 1000; k++) {
+            double x = k / 1000.0;
+            double t = cubic_bezier_solve(&curve, x);
+            XCTAssertEqualWithAccuracy(cubic_bezier_x(&curve, t), x, 1e-9, @"curve %d at %.3f", c, x);
+        }
+        
+        // Ends are exact, and x outside [0, 1] is held there
+        XCTAssertEqual(cubic_bezier_value(&curve, 0), 0.0);
+        XCTAssertEqual(cubic_bezier_value(&curve, 1), 1.0);
+        XCTAssertEqual(cubic_bezier_value(&curve, -0.5), 0.0);
+        XCTAssertEqual(cubic_bezier_value(&curve, 1.5), 1.0);
+    }
+}
+
 - (void)testExample
 {
     XCTFail(@"No implementation for \"%s\"", __PRETTY_FUNCTION__);
@@ -8,6 +8,9 @@
 
 #import "RBBCubicBezier.h"
 
+// Defined by the app in GSFEasing.m, patched in by the app's Podfile
+extern RBBEasingFunction GSFCubicBezier(CGFloat x1, CGFloat y1, CGFloat x2, CGFloat y2);
+
 #define A(a1, a2) (1.0 - 3.0 * a2 + 3.0 * a1)
 #define B(a1, a2) (3.0 * a2 - 6.0 * a1)
 #define C(a1)     (3.0 * a1)
@@ -47,11 +50,6 @@ CGFloat RBBCubicBezierBinarySubdivide(CGFloat x, CGFloat x1, CGFloat x2) {
 }
 
 extern RBBEasingFunction RBBCubicBezier(CGFloat x1, CGFloat y1, CGFloat x2, CGFloat y2) {
-    if (x1 == y1 && x2 == y2) return RBBEasingFunctionLinear;
-
-    return ^(CGFloat x) {
-        CGFloat t = RBBCubicBezierBinarySubdivide(x, x1, x2);
-
-        return RBBCubicBezierCalculate(t, y1, y2);
-    };
+    // Solved from a sample table with Newton-Raphson instead of bisecting every value
+    return GSFCubicBezier(x1, y1, x2, y2);
 }
\ No newline at end of file